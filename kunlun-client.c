@@ -5,11 +5,14 @@
  * 轻量级 Linux 系统监控工具，周期性采集服务器性能指标并通过 HTTP POST 上报。
  * 支持采集：系统运行时间、负载、CPU、内存、磁盘、网络等核心指标。
  *
- * 编译命令：gcc -O2 -Wall -static -o kunlun kunlun-client.c
+ * 编译命令：gcc -O2 -Wall -static -pthread -o kunlun kunlun-client.c
  * 运行方式：./kunlun -u https://example.com/api/report
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -22,9 +25,40 @@
 #include <getopt.h>
 #include <netdb.h>
 #include <sys/statvfs.h>
-#include <mntent.h>
-#include <string.h>
+#include <sys/sysmacros.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <errno.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <math.h>
+#include <strings.h>
+#include <fnmatch.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/netlink.h>
+#include <linux/sock_diag.h>
+#include <linux/inet_diag.h>
+#include <linux/rtnetlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+#include <linux/if_link.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <sys/syscall.h>
+#include <sys/inotify.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
+#include <stdatomic.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
 
 /* ============================================================================
  * 数据结构定义
@@ -77,17 +111,47 @@ typedef struct
     double mem_buff_cache_mib;  /**< 缓冲区/缓存内存 */
 } MemInfo;
 
+/** TCP 状态个数（内核状态值 TCP_ESTABLISHED=1 到 TCP_CLOSING=11） */
+#define TCP_STATE_COUNT 11
+
 /**
  * @brief 网络连接和流量信息
  */
 typedef struct
 {
-    int tcp_connections;                        /**< TCP 连接数 */
-    int udp_connections;                        /**< UDP 连接数 */
-    unsigned long default_interface_net_tx_bytes;   /**< 默认网口发送字节数 */
-    unsigned long default_interface_net_rx_bytes;   /**< 默认网口接收字节数 */
+    int tcp_connections;                        /**< TCP 连接数（IPv4 + IPv6） */
+    int udp_connections;                        /**< UDP 连接数（IPv4 + IPv6） */
+    int tcp_states[TCP_STATE_COUNT];            /**< 各状态 TCP 连接数（下标为内核状态值减 1） */
+    unsigned long long default_interface_net_tx_bytes;  /**< 物理网卡发送字节数 */
+    unsigned long long default_interface_net_rx_bytes;  /**< 物理网卡接收字节数 */
 } NetInfo;
 
+#define NETIF_MAX       32      /**< 最多上报的网络接口数 */
+#define NETIF_FIELDS    16      /**< 每个接口的计数器数（同 /proc/net/dev） */
+
+/**
+ * @brief 一个网络接口的计数器
+ *
+ * 顺序同 /proc/net/dev：rx bytes packets errs drop fifo frame compressed multicast，
+ * tx bytes packets errs drop fifo colls carrier compressed。
+ */
+typedef struct
+{
+    char name[IF_NAMESIZE];                     /**< 接口名 */
+    unsigned long long v[NETIF_FIELDS];         /**< 计数器 */
+} NetIfCounters;
+
+/**
+ * @brief 全部选中网络接口的计数器
+ *
+ * 写入队列、批次和本地缓存时只保存前 count 项（见 sample_pack）。
+ */
+typedef struct
+{
+    uint16_t count;                             /**< 接口数 */
+    NetIfCounters iface[NETIF_MAX];             /**< 各接口计数器（按 ifindex 升序） */
+} NetIfStats;
+
 /**
  * @brief 磁盘 I/O 统计信息
  */
@@ -106,6 +170,230 @@ typedef struct
     unsigned long long weighted_io_time;    /**< 加权 I/O 时间（毫秒） */
 } DiskStats;
 
+#define DISK_MAX        32      /**< 最多上报的块设备数 */
+#define DISK_FIELDS     17      /**< /proc/diskstats 每行最多的计数器数（5.5+ 含 discard 和 flush） */
+#define DISK_NAME_MAX   32      /**< 设备名最大长度（含结尾 '\0'，同内核 DISK_NAME_LEN） */
+
+/**
+ * @brief 一个块设备的 I/O 计数器
+ */
+typedef struct
+{
+    char name[DISK_NAME_MAX];                   /**< 设备名 */
+    unsigned long long v[DISK_FIELDS];          /**< 计数器，顺序同 /proc/diskstats 第 4 列起 */
+} BlockDev;
+
+/**
+ * @brief 全部选中块设备的 I/O 计数器
+ *
+ * 写入队列、批次和本地缓存时只保存前 count 项（见 sample_pack）。
+ */
+typedef struct
+{
+    uint16_t count;                             /**< 设备数 */
+    uint16_t fields;                            /**< 每个设备的有效计数器数（11、15 或 17，取决于内核版本） */
+    BlockDev dev[DISK_MAX];                     /**< 各设备计数器 */
+} BlockDevStats;
+
+#define FS_MAX          32      /**< 最多上报的文件系统数 */
+#define FS_PATH_MAX     128     /**< 挂载点最大长度（含结尾 '\0'），更长的挂载点不统计 */
+#define FS_TYPE_MAX     16      /**< 文件系统类型最大长度（含结尾 '\0'） */
+
+#define FS_FLAG_TIMEOUT 1       /**< statvfs 超时（或上一次超时的调用仍未返回），数值为 0 */
+#define FS_FLAG_ERROR   2       /**< statvfs 失败，数值为 0 */
+#define FS_FLAG_RDONLY  4       /**< 只读挂载 */
+
+/**
+ * @brief 一个文件系统的容量和 inode 使用情况
+ */
+typedef struct
+{
+    char mount_point[FS_PATH_MAX];      /**< 挂载点 */
+    char fstype[FS_TYPE_MAX];           /**< 文件系统类型 */
+    uint32_t flags;                     /**< FS_FLAG_* */
+    unsigned long long total_kb;        /**< 总容量（KB） */
+    unsigned long long free_kb;         /**< 空闲容量（KB，含保留块） */
+    unsigned long long avail_kb;        /**< 非特权用户可用容量（KB） */
+    unsigned long long inodes_total;    /**< inode 总数 */
+    unsigned long long inodes_free;     /**< 空闲 inode 数 */
+} FsUsage;
+
+/**
+ * @brief 全部真实文件系统的使用情况
+ *
+ * 写入队列、批次和本地缓存时只保存前 count 项（见 sample_pack）。
+ */
+typedef struct
+{
+    uint16_t count;                     /**< 文件系统数 */
+    FsUsage fs[FS_MAX];                 /**< 各文件系统 */
+} FsStats;
+
+#define PROC_TOP_MAX    20      /**< 每个维度最多上报的进程数 */
+
+/**
+ * @brief 进程排行的维度
+ */
+typedef enum
+{
+    PROC_TOP_CPU,           /**< CPU 占比 */
+    PROC_TOP_RSS,           /**< 常驻内存 */
+    PROC_TOP_IO,            /**< 磁盘读写字节数 */
+    PROC_TOP_DIMS
+} ProcTopDim;
+
+/**
+ * @brief 进程排行中的一个进程
+ */
+typedef struct
+{
+    int32_t pid;                        /**< 进程号 */
+    char comm[16];                      /**< 进程名（/proc/<pid>/stat 第 2 列） */
+    float cpu_pct;                      /**< 两次采集之间的 CPU 占比（单核为 100%） */
+    unsigned long long rss_kb;          /**< 常驻内存（KB） */
+    unsigned long long read_bytes;      /**< 两次采集之间从存储读取的字节数 */
+    unsigned long long write_bytes;     /**< 两次采集之间写往存储的字节数 */
+} ProcTopEntry;
+
+/**
+ * @brief 各维度资源占用最多的进程
+ *
+ * 写入队列、批次和本地缓存时每个维度只保存前 count 项（见 sample_pack）。
+ */
+typedef struct
+{
+    uint32_t interval_ms;                           /**< 两次遍历之间的间隔（毫秒），0 表示没有排行 */
+    uint32_t processes;                             /**< 本次遍历的进程数 */
+    uint16_t count[PROC_TOP_DIMS];                  /**< 各维度的进程数 */
+    ProcTopEntry top[PROC_TOP_DIMS][PROC_TOP_MAX];  /**< 各维度按降序排列的进程 */
+} ProcTopStats;
+
+/**
+ * @brief 进程事件速率（proc connector）
+ */
+typedef struct
+{
+    uint32_t interval_ms;   /**< 统计区间（毫秒），0 表示没有数据 */
+    uint32_t flags;         /**< PROC_EVENTS_FLAG_* */
+    float forks_ps;         /**< 每秒创建的进程数（不含线程） */
+    float execs_ps;         /**< 每秒 exec 次数 */
+    float exits_ps;         /**< 每秒退出的进程数（不含线程） */
+} ProcEventStats;
+
+/**
+ * @brief PSI 资源
+ */
+enum
+{
+    PSI_CPU,
+    PSI_MEMORY,
+    PSI_IO,
+    PSI_RESOURCES
+};
+
+/**
+ * @brief PSI 文件中的一行（some 或 full）
+ */
+typedef struct
+{
+    float avg10;                        /**< 10 秒平均阻塞占比（%） */
+    float avg60;                        /**< 60 秒平均阻塞占比（%） */
+    unsigned long long total_us;        /**< 累计阻塞时长（微秒） */
+} PsiLine;
+
+/**
+ * @brief 系统级压力阻塞信息
+ */
+typedef struct
+{
+    uint32_t present;                   /**< 位掩码：成功读取的资源 */
+    uint32_t fired;                     /**< 位掩码：上一次采集以来触发过的触发器，位号为 资源 * 2 + (full ? 1 : 0) */
+    uint32_t flags;                     /**< PSI_FLAG_* */
+    PsiLine some[PSI_RESOURCES];        /**< 各资源的 some 行 */
+    PsiLine full[PSI_RESOURCES];        /**< 各资源的 full 行 */
+} PsiStats;
+
+#define PSI_FLAG_OOB    1       /**< 带外样本：由 PSI 触发器触发，不在周期边界上 */
+
+#define CGROUP_TOP_MAX  10      /**< 每个维度最多上报的 cgroup 数 */
+#define CGROUP_PATH_MAX 256     /**< cgroup 路径最大长度（含结尾 '\0'），更深的 cgroup 不统计 */
+
+/**
+ * @brief cgroup 排行的维度
+ */
+typedef enum
+{
+    CGROUP_TOP_CPU,         /**< CPU 使用 */
+    CGROUP_TOP_MEM,         /**< 内存使用（memory.current） */
+    CGROUP_TOP_DIMS
+} CgroupTopDim;
+
+/**
+ * @brief cgroup 排行中的一个 cgroup
+ */
+typedef struct
+{
+    char path[CGROUP_PATH_MAX];         /**< 相对 cgroup 根的路径 */
+    float cpu_pct;                      /**< 两次采集之间的 CPU 使用（单核为 100%） */
+    float throttled_pct;                /**< 被限流的调度周期占比（nr_throttled / nr_periods） */
+    unsigned long long throttled_usec;  /**< 两次采集之间被限流的时长（微秒） */
+    unsigned long long mem_kb;          /**< 当前内存使用（KB） */
+    unsigned long long mem_max_kb;      /**< 内存上限（KB），0 表示不限制 */
+    uint32_t oom_kills;                 /**< 两次采集之间 OOM kill 的次数 */
+    float psi_some[PSI_RESOURCES];      /**< 各资源 *.pressure 的 some avg10（%），未启用 --psi 时为 0 */
+    unsigned long long read_bytes;      /**< 两次采集之间读取的字节数 */
+    unsigned long long write_bytes;     /**< 两次采集之间写入的字节数 */
+} CgroupEntry;
+
+/**
+ * @brief 各维度资源占用最多的 cgroup
+ *
+ * 写入队列、批次和本地缓存时每个维度只保存前 count 项（见 sample_pack）。
+ */
+typedef struct
+{
+    uint32_t interval_ms;                               /**< 两次采集之间的间隔（毫秒），0 表示没有排行 */
+    uint32_t cgroups;                                   /**< 跟踪的 cgroup 数 */
+    uint16_t count[CGROUP_TOP_DIMS];                    /**< 各维度的 cgroup 数 */
+    CgroupEntry top[CGROUP_TOP_DIMS][CGROUP_TOP_MAX];   /**< 各维度按降序排列的 cgroup */
+} CgroupStats;
+
+/**
+ * @brief 主循环调度统计
+ */
+typedef struct
+{
+    uint32_t missed_ticks;  /**< 上一个样本以来错过的周期数（采集或上报超过 10 秒） */
+    int32_t lag_ms;         /**< 本次周期边界被处理时相对边界的延迟（毫秒） */
+    uint32_t busy_ms;       /**< 上一轮采集和上报的耗时（毫秒） */
+} LoopStats;
+
+/**
+ * @brief 采集与上报之间的队列统计
+ */
+typedef struct
+{
+    uint32_t depth;             /**< 入队本样本之前队列中的样本数 */
+    uint32_t capacity;          /**< 队列容量 */
+    uint32_t drops;             /**< 上一个样本以来因队列满丢弃的样本数 */
+    uint32_t sent;              /**< 上一个样本以来成功上报的样本数 */
+    uint32_t latency_avg_ms;    /**< 这些样本从入队到上报完成的平均耗时（毫秒） */
+    uint32_t latency_max_ms;    /**< 这些样本从入队到上报完成的最大耗时（毫秒） */
+} QueueStats;
+
+/**
+ * @brief 上报重试状态
+ */
+typedef struct
+{
+    uint8_t state;              /**< 重试状态（RetryState） */
+    uint32_t failures;          /**< 连续失败次数 */
+    uint32_t retry_in_ms;       /**< 距离允许下一次上报的时间（毫秒），0 表示可立即上报 */
+    uint32_t skipped;           /**< 上一个样本以来因退避或熔断未尝试、直接写入本地缓存的样本数 */
+    uint32_t trips;             /**< 上一个样本以来熔断次数 */
+    int32_t last_status;        /**< 最近一次失败的 HTTP 状态码，0 表示网络错误或没有失败 */
+} UploadStats;
+
 /**
  * @brief 系统基本信息
  */
@@ -118,81 +406,122 @@ typedef struct
     char hostname[256];                 /**< 主机名 */
 } SystemInfo;
 
-/* ============================================================================
- * 磁盘统计函数
- * ============================================================================ */
+#define SUB_GAUGE_COUNT     8   /**< 高频采样汇总的瞬时值字段数 */
+#define SUB_RATE_COUNT      9   /**< 高频采样汇总的计数器字段数 */
 
 /**
- * @brief 获取根目录挂载分区的磁盘 I/O 统计信息
- *
- * 通过解析 /proc/mounts 找到根目录对应的设备，再从 /proc/diskstats 读取该设备的统计信息。
- *
- * @param stats 输出参数，存储磁盘统计信息
- * @return 成功返回 0，失败返回 -1
+ * @brief 瞬时值统计量下标
  */
-int get_root_diskstats(DiskStats *stats) {
-    if (!stats) return -1;
-
-    memset(stats, 0, sizeof(DiskStats));
-
-    /* 从 /proc/mounts 获取根目录挂载的设备名 */
-    FILE *mounts_file = setmntent("/proc/mounts", "r");
-    if (!mounts_file) {
-        perror("setmntent");
-        return -1;
-    }
-
-    char root_device[256] = "";
-    struct mntent *mount_entry;
-
-    while ((mount_entry = getmntent(mounts_file)) != NULL) {
-        if (strcmp(mount_entry->mnt_dir, "/") == 0) {
-            strncpy(root_device, mount_entry->mnt_fsname, sizeof(root_device));
-            root_device[sizeof(root_device) - 1] = '\0';
-            break;
-        }
-    }
-    endmntent(mounts_file);
+enum
+{
+    SUB_MIN,
+    SUB_MAX,
+    SUB_MEAN,
+    SUB_LAST,
+    SUB_STAT_COUNT
+};
 
-    if (strlen(root_device) == 0) {
-        fprintf(stderr, "Could not find root device in /proc/mounts\n");
-        return -1;
-    }
+/**
+ * @brief 一个上报周期内高频采样的汇总
+ */
+typedef struct
+{
+    int count;                                      /**< 采样点数，0 表示未启用 */
+    double cost_us;                                 /**< 每个中间采样点的平均耗时（微秒） */
+    double stats[SUB_GAUGE_COUNT][SUB_STAT_COUNT];  /**< 各瞬时值的 min/max/mean/last */
+    double rate_max[SUB_RATE_COUNT];                /**< 各计数器相邻采样点间的最大每秒速率 */
+} SubStats;
 
-    /* 移除 /dev/ 前缀，/proc/diskstats 中不包含此前缀 */
-    if (strncmp(root_device, "/dev/", 5) == 0) {
-        memmove(root_device, root_device + 5, strlen(root_device) - 4);
-    }
+#define RATE_FLAG_CPU_RESET     0x01    /**< CPU 计数器重置，CPU 占比无效 */
+#define RATE_FLAG_DISK_RESET    0x02    /**< 磁盘计数器重置，磁盘速率无效 */
+#define RATE_FLAG_NET_RESET     0x04    /**< 网卡计数器重置，重置方向的流量速率无效 */
+#define RATE_FLAG_WRAP          0x08    /**< 检测到 32 位计数器回绕并已修正 */
 
-    /* 从 /proc/diskstats 读取设备统计信息 */
-    FILE *diskstats_file = fopen("/proc/diskstats", "r");
-    if (!diskstats_file) {
-        perror("/proc/diskstats");
-        return -1;
-    }
+/**
+ * @brief 相对上一次采集的速率和利用率
+ */
+typedef struct
+{
+    uint64_t interval_ms;       /**< 与上一次采集的实际间隔（单调时钟），0 表示没有基准 */
+    int flags;                  /**< RATE_FLAG_* */
+    double cpu_busy_pct;        /**< 非空闲（不含 iowait）占比 */
+    double cpu_user_pct;        /**< 用户态占比 */
+    double cpu_system_pct;      /**< 内核态占比 */
+    double cpu_nice_pct;        /**< 低优先级用户态占比 */
+    double cpu_idle_pct;        /**< 空闲占比 */
+    double cpu_iowait_pct;      /**< I/O 等待占比 */
+    double cpu_irq_pct;         /**< 硬件中断占比 */
+    double cpu_softirq_pct;     /**< 软件中断占比 */
+    double cpu_steal_pct;       /**< 虚拟化偷取占比 */
+    double disk_reads_ps;       /**< 每秒完成的读操作数 */
+    double disk_writes_ps;      /**< 每秒完成的写操作数 */
+    double disk_read_kbps;      /**< 每秒读取 KiB */
+    double disk_write_kbps;     /**< 每秒写入 KiB */
+    double disk_r_await_ms;     /**< 读操作平均耗时 */
+    double disk_w_await_ms;     /**< 写操作平均耗时 */
+    double disk_await_ms;       /**< 读写操作平均耗时 */
+    double disk_util_pct;       /**< 设备忙碌时间占比 */
+    double disk_avg_queue;      /**< 平均队列深度 */
+    double net_rx_bps;          /**< 每秒接收字节数 */
+    double net_tx_bps;          /**< 每秒发送字节数 */
+} Rates;
 
-    char line[1024];
+#define PERCPU_MAX          512     /**< 每 CPU 统计支持的核心数上限 */
+#define PERCPU_HIST_BUCKETS 10      /**< 核心占比分布直方图的桶数（每桶 10%） */
 
-    while (fgets(line, sizeof(line), diskstats_file)) {
-        int major, minor;
-        char name[256];
+/**
+ * @brief 一个核心相对上一次采集的占比
+ */
+typedef struct
+{
+    uint16_t id;            /**< CPU 编号 */
+    uint16_t busy;          /**< 非空闲占比（0.1%） */
+    uint16_t softirq;       /**< 软中断占比（0.1%） */
+} PerCpuEntry;
 
-        int fields_read;
-        fields_read = sscanf(line, "%d %d %255s %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu",
-                   &major, &minor, name,
-                   &stats->reads_completed, &stats->read_merges, &stats->read_sectors, &stats->reading_ms,
-                   &stats->writes_completed, &stats->write_merges, &stats->write_sectors, &stats->writing_ms,
-                   &stats->ios_in_progress, &stats->iotime_ms, &stats->weighted_io_time);
-        if (fields_read >= 11 && strcmp(name, root_device) == 0) {
-            fclose(diskstats_file);
-            return 0;
-        }
-    }
+/**
+ * @brief 每个核心相对上一次采集的占比
+ *
+ * 按 PERCPU_MAX 定长；写入队列、批次和本地缓存时只保存前 count 项（见 sample_pack）。
+ */
+typedef struct
+{
+    uint16_t count;                         /**< 核心数，0 表示没有数据 */
+    uint16_t hist[PERCPU_HIST_BUCKETS];     /**< 非空闲占比落在各 10% 区间的核心数 */
+    PerCpuEntry cpu[PERCPU_MAX];            /**< 各核心占比 */
+} PerCpuStats;
 
-    fclose(diskstats_file);
-    fprintf(stderr, "Could not find diskstats for root device: %s\n", root_device);
-    return -1;
-}
+/**
+ * @brief 一次采集的全部指标
+ *
+ * 定长、不含指针，按各可选块的容量上限分配，只用作采集和格式化时的工作结构；
+ * 写入上报队列、批次和本地缓存时编码为只含实际条目的紧凑记录（见 sample_pack），之后还原并重新格式化上报。
+ */
+typedef struct
+{
+    int64_t timestamp;      /**< 采集时间戳（Unix 时间戳） */
+    uint64_t mono_ns;       /**< 采集时间（单调时钟），用于计算速率 */
+    Uptime uptime;          /**< 运行时间 */
+    LoadAvg loadavg;        /**< 负载信息 */
+    CpuInfo cpuinfo;        /**< CPU 信息 */
+    MemInfo meminfo;        /**< 内存信息 */
+    NetInfo netinfo;        /**< 网络信息 */
+    NetIfStats interfaces;  /**< 选中网络接口的计数器 */
+    DiskStats diskstats;    /**< 磁盘统计 */
+    BlockDevStats disks;    /**< 选中的全部块设备 */
+    FsStats filesystems;    /**< 全部真实文件系统的容量 */
+    ProcTopStats top;       /**< 资源占用最多的进程 */
+    ProcEventStats proc_events; /**< 进程创建、exec、退出速率 */
+    CgroupStats cgroups;    /**< 资源占用最多的 cgroup */
+    PsiStats psi;           /**< 压力阻塞信息 */
+    LoopStats loop;         /**< 主循环调度统计 */
+    QueueStats queue;       /**< 上报队列统计 */
+    UploadStats upload;     /**< 上报重试状态 */
+    SystemInfo sysinfo;     /**< 系统信息 */
+    SubStats hf;            /**< 高频采样汇总 */
+    Rates rates;            /**< 相对上一次采集的速率 */
+    PerCpuStats percpu;     /**< 每 CPU 占比 */
+} Sample;
 
 /* ============================================================================
  * 工具函数
@@ -215,568 +544,11065 @@ static FILE *safe_fopen(const char *filename, const char *mode)
     return fp;
 }
 
-/* ============================================================================
- * 系统信息读取函数
- * ============================================================================ */
+/**
+ * @brief 获取单调时钟时间（纳秒）
+ *
+ * 使用 CLOCK_MONOTONIC，不受系统时间调整（NTP 校时、手动修改）影响，适合计算时间间隔。
+ *
+ * @return 单调时钟纳秒数
+ */
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
 
 /**
- * @brief 从 /proc/uptime 读取系统运行时间
+ * @brief 获取单调时钟时间（毫秒）
  *
- * @param uptime 输出参数，存储运行时间信息
- * @return 成功返回 0，失败返回 -1
+ * @return 单调时钟毫秒数
  */
-int read_uptime(Uptime *uptime)
+static uint64_t monotonic_ms(void)
 {
-    FILE *fp = safe_fopen("/proc/uptime", "r");
-    if (!fp)
-        return -1;
+    return monotonic_ns() / 1000000ULL;
+}
+
+/**
+ * @brief 名字过滤规则的匹配结果
+ */
+typedef enum
+{
+    NAME_FILTER_EXCLUDED = -1,  /**< 命中排除项 */
+    NAME_FILTER_NONE = 0,       /**< 没有命中任何项 */
+    NAME_FILTER_WILDCARD = 1,   /**< 只命中含通配符的项 */
+    NAME_FILTER_EXPLICIT = 2    /**< 命中直接写出的名字 */
+} NameFilterMatch;
 
-    if (fscanf(fp, "%lf %lf", &uptime->uptime_s, &uptime->idle_s) != 2)
+/**
+ * @brief 按逗号分隔的通配符列表匹配名字
+ *
+ * "all" 等同 "*"，"!" 开头表示排除，排除项优先。调用者据此决定只被通配符选中的名字
+ * 是否还要套用默认排除（如 loop 设备、回环接口）。
+ *
+ * @param filter 过滤规则
+ * @param name 名字
+ * @return 匹配结果
+ */
+static NameFilterMatch name_filter_match(const char *filter, const char *name)
+{
+    NameFilterMatch match = NAME_FILTER_NONE;
+    while (*filter)
     {
-        fprintf(stderr, "Invalid /proc/uptime format\n");
-        fclose(fp);
-        return -1;
+        size_t len = strcspn(filter, ",");
+        int exclude = (*filter == '!');
+        char pattern[64];
+        if (len - exclude < sizeof(pattern))
+        {
+            memcpy(pattern, filter + exclude, len - exclude);
+            pattern[len - exclude] = '\0';
+            if (strcmp(pattern, "all") == 0)
+            {
+                strcpy(pattern, "*");
+            }
+            if (fnmatch(pattern, name, 0) == 0)
+            {
+                if (exclude)
+                {
+                    return NAME_FILTER_EXCLUDED;
+                }
+                if (strpbrk(pattern, "*?[") == NULL)
+                {
+                    match = NAME_FILTER_EXPLICIT;
+                }
+                else if (match == NAME_FILTER_NONE)
+                {
+                    match = NAME_FILTER_WILDCARD;
+                }
+            }
+        }
+        filter += len;
+        if (*filter == ',')
+        {
+            filter++;
+        }
     }
-    fclose(fp);
-    return 0;
+    return match;
 }
 
+/* ============================================================================
+ * 采集数据源注册表
+ * ============================================================================ */
+
+#define PROC_SOURCE_INIT_SIZE   4096                /**< 数据源缓冲区初始大小 */
+#define PROC_SOURCE_MAX_SIZE    (16 * 1024 * 1024)  /**< 数据源缓冲区大小上限 */
+
 /**
- * @brief 从 /proc/loadavg 读取系统负载和任务信息
+ * @brief 持久打开的 procfs/sysfs 数据源
  *
- * @param loadavg 输出参数，存储负载信息
- * @return 成功返回 0，失败返回 -1
+ * 文件只打开一次，每次采集用 pread 从偏移 0 重新读取到预分配缓冲区，
+ * 避免每个周期的 open/close 系统调用和 stdio 缓冲区分配。
  */
-int read_loadavg(LoadAvg *loadavg)
+typedef struct
 {
-    FILE *fp = safe_fopen("/proc/loadavg", "r");
-    if (!fp)
-        return -1;
+    const char *path;           /**< 文件路径 */
+    int fd;                     /**< 文件描述符，-1 表示未打开 */
+    char *buf;                  /**< 读取缓冲区（内容以 '\0' 结尾） */
+    size_t cap;                 /**< 缓冲区容量 */
+    size_t len;                 /**< 最近一次读取的字节数 */
+    unsigned long reads;        /**< 成功读取次数 */
+    unsigned long reopens;      /**< 重新打开次数 */
+    unsigned long errors;       /**< 读取失败次数 */
+    uint64_t read_ns_total;     /**< 读取累计耗时（纳秒） */
+    uint64_t read_ns_max;       /**< 单次读取最大耗时（纳秒） */
+} ProcSource;
+
+/**
+ * @brief 数据源编号
+ */
+enum
+{
+    SRC_UPTIME,
+    SRC_LOADAVG,
+    SRC_STAT,
+    SRC_MEMINFO,
+    SRC_DISKSTATS,
+    SRC_NET_DEV,
+    SRC_MOUNTINFO,
+    SRC_PSI_CPU,
+    SRC_PSI_MEMORY,
+    SRC_PSI_IO,
+    SRC_COUNT
+};
 
-    if (fscanf(fp, "%lf %lf %lf %d/%d",
-               &loadavg->load_1min, &loadavg->load_5min, &loadavg->load_15min,
-               &loadavg->running_tasks, &loadavg->total_tasks) != 5)
+static ProcSource proc_sources[SRC_COUNT] = {
+    [SRC_UPTIME] = {.path = "/proc/uptime", .fd = -1},
+    [SRC_LOADAVG] = {.path = "/proc/loadavg", .fd = -1},
+    [SRC_STAT] = {.path = "/proc/stat", .fd = -1},
+    [SRC_MEMINFO] = {.path = "/proc/meminfo", .fd = -1},
+    [SRC_DISKSTATS] = {.path = "/proc/diskstats", .fd = -1},
+    [SRC_NET_DEV] = {.path = "/proc/net/dev", .fd = -1},
+    [SRC_MOUNTINFO] = {.path = "/proc/self/mountinfo", .fd = -1},
+    [SRC_PSI_CPU] = {.path = "/proc/pressure/cpu", .fd = -1},
+    [SRC_PSI_MEMORY] = {.path = "/proc/pressure/memory", .fd = -1},
+    [SRC_PSI_IO] = {.path = "/proc/pressure/io", .fd = -1},
+};
+
+/**
+ * @brief 打开数据源文件
+ *
+ * @param src 数据源
+ * @return 成功返回 0，失败返回 -1
+ */
+static int proc_source_open(ProcSource *src)
+{
+    src->fd = open(src->path, O_RDONLY | O_CLOEXEC);
+    if (src->fd < 0)
     {
-        fprintf(stderr, "Invalid /proc/loadavg format\n");
-        fclose(fp);
+        perror(src->path);
         return -1;
     }
-    fclose(fp);
     return 0;
 }
 
 /**
- * @brief 从 /proc/stat 读取 CPU 时间统计
+ * @brief 关闭数据源文件
  *
- * @param cpuinfo 输出参数，存储 CPU 信息
- * @return 成功返回 0，失败返回 -1
+ * @param src 数据源
  */
-int read_cpu_info(CpuInfo *cpuinfo)
+static void proc_source_close(ProcSource *src)
 {
-    FILE *fp = safe_fopen("/proc/stat", "r");
-    if (!fp)
-        return -1;
-
-    char cpu_label[4];
-    if (fscanf(fp, "%3s %llu %llu %llu %llu %llu %llu %llu %llu",
-               cpu_label, &cpuinfo->cpu_user, &cpuinfo->cpu_nice, &cpuinfo->cpu_system,
-               &cpuinfo->cpu_idle, &cpuinfo->cpu_iowait, &cpuinfo->cpu_irq,
-               &cpuinfo->cpu_softirq, &cpuinfo->cpu_steal) != 9 ||
-        strcmp(cpu_label, "cpu") != 0)
+    if (src->fd >= 0)
     {
-        fprintf(stderr, "Invalid /proc/stat format\n");
-        fclose(fp);
-        return -1;
+        close(src->fd);
+        src->fd = -1;
     }
-    fclose(fp);
-    return 0;
 }
 
 /**
- * @brief 从 /proc/meminfo 读取内存信息
+ * @brief 用 pread 从头读取整个文件到缓冲区，缓冲区不足时自动扩容
  *
- * @param meminfo 输出参数，存储内存信息（单位：MiB）
- * @return 成功返回 0，失败返回 -1
+ * @param src 数据源
+ * @return 成功返回 0，失败返回 -1（errno 保留 pread 的错误码）
  */
-int read_mem_info(MemInfo *meminfo)
+static int proc_source_pread(ProcSource *src)
 {
-    FILE *fp = safe_fopen("/proc/meminfo", "r");
-    if (!fp)
-        return -1;
-
-    char key[32];
-    unsigned long long value;
-    meminfo->mem_total_mib = 0;
-    meminfo->mem_free_mib = 0;
-    meminfo->mem_buff_cache_mib = 0;
-
-    while (fscanf(fp, "%31s %llu kB", key, &value) == 2)
+    size_t len = 0;
+    for (;;)
     {
-        if (strcmp(key, "MemTotal:") == 0)
-        {
-            meminfo->mem_total_mib = value / 1024.0;
-        }
-        else if (strcmp(key, "MemFree:") == 0)
-        {
-            meminfo->mem_free_mib = value / 1024.0;
-        }
-        else if (strcmp(key, "Buffers:") == 0 || strcmp(key, "Cached:") == 0)
+        if (len + 1 >= src->cap)
         {
-            meminfo->mem_buff_cache_mib += value / 1024.0;
+            size_t cap = src->cap ? src->cap * 2 : PROC_SOURCE_INIT_SIZE;
+            char *buf;
+            if (cap > PROC_SOURCE_MAX_SIZE || (buf = realloc(src->buf, cap)) == NULL)
+            {
+                errno = ENOMEM;
+                return -1;
+            }
+            src->buf = buf;
+            src->cap = cap;
         }
-    }
-    fclose(fp);
-
-    meminfo->mem_used_mib = meminfo->mem_total_mib - meminfo->mem_free_mib;
-    return 0;
-}
-
-/**
- * @brief 从 /proc/net/tcp 和 /proc/net/udp 读取连接数
- *
- * @param netinfo 输出参数，存储网络连接信息
- * @return 成功返回 0
- */
-int read_net_info(NetInfo *netinfo)
-{
-    netinfo->tcp_connections = 0;
-    netinfo->udp_connections = 0;
 
-    const char *files[] = {"/proc/net/tcp", "/proc/net/udp", NULL};
-    int *counts[] = {&netinfo->tcp_connections, &netinfo->udp_connections, NULL};
-
-    for (int i = 0; files[i] != NULL; i++)
-    {
-        FILE *fp = safe_fopen(files[i], "r");
-        if (fp)
+        ssize_t n = pread(src->fd, src->buf + len, src->cap - 1 - len, len);
+        if (n < 0)
         {
-            char line[256];
-            /* 跳过标题行 */
-            if (fgets(line, sizeof(line), fp) == NULL)
+            if (errno == EINTR)
             {
-                fprintf(stderr, "Error reading header line from %s\n", files[i]);
-                fclose(fp);
                 continue;
             }
-
-            /* 统计包含 ':' 的行数（即连接条目） */
-            while (fgets(line, sizeof(line), fp))
-            {
-                if (strchr(line, ':') != NULL)
-                {
-                    (*counts[i])++;
-                }
-            }
-            fclose(fp);
+            return -1;
         }
-        else
+        if (n == 0)
         {
-            fprintf(stderr, "Failed to open %s\n", files[i]);
+            break;
         }
+        len += n;
     }
+    src->buf[len] = '\0';
+    src->len = len;
     return 0;
 }
 
 /**
- * @brief 获取机器唯一标识
+ * @brief 读取数据源当前内容
  *
- * 依次尝试从 /etc/machine-id 和 /var/lib/dbus/machine-id 读取。
+ * 文件句柄失效（ESTALE/ENOENT/ENODEV/EBADF，例如设备被移除后重新出现）时透明地重新打开一次。
  *
- * @param buffer 输出缓冲区
- * @param buffer_size 缓冲区大小
- * @return 成功返回 0，失败返回 -1（buffer 中存储 "unknown"）
+ * @param id 数据源编号（SRC_*）
+ * @param len 输出参数，内容长度（可为 NULL）
+ * @return 成功返回以 '\0' 结尾的可写缓冲区（下次读取前有效），失败返回 NULL
  */
-int get_machine_id(char *buffer, size_t buffer_size)
+static char *proc_source_read(int id, size_t *len)
 {
-    const char *paths[] = {"/etc/machine-id", "/var/lib/dbus/machine-id", NULL};
-    for (int i = 0; paths[i] != NULL; i++)
+    ProcSource *src = &proc_sources[id];
+    uint64_t start = monotonic_ns();
+
+    if (src->fd < 0 && proc_source_open(src) != 0)
     {
-        FILE *fp = safe_fopen(paths[i], "r");
-        if (fp)
+        src->errors++;
+        return NULL;
+    }
+
+    int ret = proc_source_pread(src);
+    if (ret != 0 && (errno == ESTALE || errno == ENOENT || errno == ENODEV || errno == EBADF))
+    {
+        proc_source_close(src);
+        src->reopens++;
+        if (proc_source_open(src) == 0)
         {
-            if (fgets(buffer, buffer_size, fp))
-            {
-                fclose(fp);
-                buffer[strcspn(buffer, "\n")] = 0;
-                return 0;
-            }
-            fclose(fp);
+            ret = proc_source_pread(src);
         }
     }
-    strncpy(buffer, "unknown", buffer_size);
-    buffer[buffer_size - 1] = '\0';
-    return -1;
+    if (ret != 0)
+    {
+        perror(src->path);
+        proc_source_close(src);
+        src->errors++;
+        return NULL;
+    }
+
+    uint64_t elapsed = monotonic_ns() - start;
+    src->reads++;
+    src->read_ns_total += elapsed;
+    if (elapsed > src->read_ns_max)
+    {
+        src->read_ns_max = elapsed;
+    }
+    if (len)
+    {
+        *len = src->len;
+    }
+    return src->buf;
 }
 
 /**
- * @brief 获取主机名
+ * @brief 输出各数据源的读取开销统计
  *
- * @param buffer 输出缓冲区
- * @param buffer_size 缓冲区大小
- * @return 成功返回 0，失败返回 -1（buffer 中存储 "unknown"）
+ * @param out 输出流
  */
-int get_hostname(char *buffer, size_t buffer_size)
+void proc_sources_report(FILE *out)
 {
-    if (gethostname(buffer, buffer_size) != 0)
+    fprintf(out, "%-18s %10s %10s %10s %8s %8s %8s\n",
+            "source", "reads", "avg_us", "max_us", "bytes", "reopens", "errors");
+    for (int i = 0; i < SRC_COUNT; i++)
     {
-        strncpy(buffer, "unknown", buffer_size);
-        buffer[buffer_size - 1] = '\0';
-        return -1;
+        const ProcSource *src = &proc_sources[i];
+        double avg_us = src->reads ? src->read_ns_total / 1000.0 / src->reads : 0;
+        fprintf(out, "%-18s %10lu %10.1f %10.1f %8zu %8lu %8lu\n",
+                src->path, src->reads, avg_us, src->read_ns_max / 1000.0,
+                src->len, src->reopens, src->errors);
     }
-    return 0;
 }
 
 /* ============================================================================
- * 网络流量采集函数
+ * /proc 文本解析
+ *
+ * 针对 /proc 文件格式的轻量解析函数：不分配内存、不依赖 locale、不解释格式串。
+ * 所有函数以只读方式在整文件缓冲区上前进，遇到 '\n' 或 '\0' 自然停止，
+ * 因此可以单次遍历整个文件而不需要先拆分行。
  * ============================================================================ */
 
 /**
- * @brief 去除字符串前导空白字符
- *
- * @param str 待处理的字符串（原地修改）
+ * @brief 按预计算哈希匹配的键
+ */
+typedef struct
+{
+    const char *key;    /**< 键名（不含分隔符） */
+    uint32_t hash;      /**< 键名哈希，由 kp_keys_init() 计算 */
+} KpKey;
+
+/**
+ * @brief 跳过空格和制表符（不跨行）
  */
-void trim_leading_whitespace(char *str)
+static inline const char *kp_skip_ws(const char *p)
 {
-    char *start = str;
-    while (*start && (*start == ' ' || *start == '\t' || *start == '\n' || *start == '\r'))
+    while (*p == ' ' || *p == '\t')
     {
-        start++;
+        p++;
     }
-    memmove(str, start, strlen(start) + 1);
+    return p;
 }
 
 /**
- * @brief 判断网口是否为物理网卡
- *
- * 通过两个条件判断：
- * 1. 存在 /sys/class/net/<iface>/device 目录（指向 PCI 或 USB 等物理设备）
- * 2. 接口类型为 1（ARPHRD_ETHER，即以太网）
+ * @brief 跳到下一行行首
  *
- * @param iface 网口名称
- * @return 是物理网卡返回 1，否则返回 0
+ * @return 下一行行首；已到缓冲区末尾时返回指向 '\0' 的指针
  */
-static int is_physical_interface(const char *iface)
+static inline const char *kp_next_line(const char *p)
 {
-    if (!iface || *iface == '\0')
-    {
-        return 0;
-    }
-
-    char path[256];
-    struct stat st;
-    FILE *fp;
-    int type;
+    const char *nl = strchr(p, '\n');
+    return nl ? nl + 1 : p + strlen(p);
+}
 
-    /* 检查 device 目录是否存在 */
-    snprintf(path, sizeof(path), "/sys/class/net/%s/device", iface);
-    if (stat(path, &st) != 0)
+/**
+ * @brief 解析无符号十进制整数（跳过前导空白）
+ *
+ * @param p 输入位置
+ * @param out 输出参数，解析结果
+ * @return 数字之后的位置，没有数字时返回 NULL
+ */
+static inline const char *kp_parse_u64(const char *p, unsigned long long *out)
+{
+    p = kp_skip_ws(p);
+    if ((unsigned)(*p - '0') > 9)
     {
-        return 0;
+        return NULL;
     }
-
-    /* 检查 type 文件内容是否为 1（ARPHRD_ETHER） */
-    snprintf(path, sizeof(path), "/sys/class/net/%s/type", iface);
-    fp = fopen(path, "r");
-    if (!fp)
+    unsigned long long v = 0;
+    unsigned d;
+    while ((d = (unsigned)(*p - '0')) <= 9)
     {
-        return 0;
+        v = v * 10 + d;
+        p++;
     }
+    *out = v;
+    return p;
+}
 
-    if (fscanf(fp, "%d", &type) != 1)
+/**
+ * @brief 连续解析多个无符号整数，直到行尾或非数字
+ *
+ * @param p 输入位置
+ * @param out 输出数组
+ * @param max 最多解析个数
+ * @return 实际解析个数
+ */
+static int kp_parse_u64_list(const char *p, unsigned long long *out, int max)
+{
+    int n = 0;
+    while (n < max && (p = kp_parse_u64(p, &out[n])) != NULL)
     {
-        fclose(fp);
-        return 0;
+        n++;
     }
-    fclose(fp);
-
-    return (type == 1);
+    return n;
 }
 
 /**
- * @brief 获取所有物理网卡的流量统计
- *
- * 遍历 /sys/class/net 目录，识别物理网卡，然后从 /proc/net/dev 读取流量并累加。
- * 物理网卡判断标准：存在 device 目录且类型为以太网（type=1）。
+ * @brief 解析 /proc 中的定点小数（如 "12345.67"），跳过前导空白
  *
- * @param rx_bytes 输出参数，接收字节数（累加）
- * @param tx_bytes 输出参数，发送字节数（累加）
- * @return 成功返回 0，失败返回 -1
+ * @param p 输入位置
+ * @param out 输出参数，解析结果
+ * @return 数字之后的位置，没有数字时返回 NULL
  */
-int get_default_interface_traffic(unsigned long *rx_bytes, unsigned long *tx_bytes)
+static const char *kp_parse_fixed(const char *p, double *out)
 {
-    *rx_bytes = 0;
-    *tx_bytes = 0;
-
-    /* 打开 /sys/class/net 目录 */
-    DIR *dir = opendir("/sys/class/net");
-    if (!dir)
+    unsigned long long ip;
+    p = kp_parse_u64(p, &ip);
+    if (!p)
     {
-        perror("Failed to open /sys/class/net");
-        return -1;
+        return NULL;
     }
-
-    /* 收集所有物理网卡名称 */
-    char phys_ifaces[64][32];
-    int phys_count = 0;
-    struct dirent *entry;
-
-    while ((entry = readdir(dir)) != NULL && phys_count < 64)
+    double v = (double)ip;
+    if (*p == '.')
     {
-        if (entry->d_name[0] == '.')
-        {
-            continue;
-        }
-
-        if (is_physical_interface(entry->d_name))
+        double scale = 0.1;
+        unsigned d;
+        for (p++; (d = (unsigned)(*p - '0')) <= 9; p++)
         {
-            strncpy(phys_ifaces[phys_count], entry->d_name, 31);
-            phys_ifaces[phys_count][31] = '\0';
-            phys_count++;
+            v += d * scale;
+            scale *= 0.1;
         }
     }
-    closedir(dir);
+    *out = v;
+    return p;
+}
 
-    if (phys_count == 0)
+/**
+ * @brief 取出一个以空白结束的词（跳过前导空白）
+ *
+ * @param p 输入位置
+ * @param tok 输出参数，词首
+ * @param len 输出参数，词长度
+ * @return 词之后的位置，没有词时返回 NULL
+ */
+static inline const char *kp_token(const char *p, const char **tok, size_t *len)
+{
+    p = kp_skip_ws(p);
+    const char *start = p;
+    while (*p && *p != ' ' && *p != '\t' && *p != '\n')
     {
-        fprintf(stderr, "No physical network interface found\n");
-        return -1;
+        p++;
     }
-
-    /* 从 /proc/net/dev 读取流量数据 */
-    FILE *fp = fopen("/proc/net/dev", "r");
-    if (!fp)
+    if (p == start)
     {
-        perror("Failed to open /proc/net/dev");
-        return -1;
+        return NULL;
     }
+    *tok = start;
+    *len = p - start;
+    return p;
+}
 
-    char line[256];
-    /* 跳过前两行标题 */
-    fgets(line, sizeof(line), fp);
-    fgets(line, sizeof(line), fp);
-
-    while (fgets(line, sizeof(line), fp))
+/**
+ * @brief 计算键名哈希（FNV-1a）
+ */
+static inline uint32_t kp_hash(const char *s, size_t len)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++)
     {
-        char name[32];
-        unsigned long rx, tx;
-
-        /* /proc/net/dev 格式：接口名: rx_bytes rx_packets ... tx_bytes ... */
-        if (sscanf(line, "%31[^:]: %lu %*lu %*lu %*lu %*lu %*lu %*lu %*lu %lu",
-                   name, &rx, &tx) == 3)
-        {
-            trim_leading_whitespace(name);
-
-            /* 检查是否为物理网卡 */
-            for (int i = 0; i < phys_count; i++)
-            {
-                if (strcmp(name, phys_ifaces[i]) == 0)
-                {
-                    *rx_bytes += rx;
-                    *tx_bytes += tx;
-                    break;
-                }
-            }
-        }
+        h = (h ^ (unsigned char)s[i]) * 16777619u;
     }
-
-    fclose(fp);
-    return 0;
+    return h;
 }
 
-/* ============================================================================
- * 磁盘空间函数
- * ============================================================================ */
-
 /**
- * @brief 获取指定路径的磁盘空间信息
+ * @brief 预计算键表中各键的哈希
  *
- * @param path 路径（为空或 NULL 时默认为 "/"）
- * @param total_size_kb 输出参数，总容量（KB）
- * @param available_size_kb 输出参数，可用容量（KB）
- * @return 成功返回 0，失败返回 -1
+ * @param keys 键表
+ * @param count 键个数
  */
-int get_disk_space_kb(const char *path, unsigned long long *total_size_kb, unsigned long long *available_size_kb)
+static void kp_keys_init(KpKey *keys, int count)
 {
-    const char *effective_path = (path && *path) ? path : "/";
-    struct statvfs vfs;
-
-    if (statvfs(effective_path, &vfs) == -1)
-    {
-        perror("statvfs");
-        return -1;
-    }
-
-    if (total_size_kb)
-    {
-        *total_size_kb = (vfs.f_blocks * vfs.f_frsize) / 1024;
-    }
-    if (available_size_kb)
+    for (int i = 0; i < count; i++)
     {
-        *available_size_kb = (vfs.f_bavail * vfs.f_frsize) / 1024;
+        keys[i].hash = kp_hash(keys[i].key, strlen(keys[i].key));
     }
-
-    return 0;
 }
 
-/* ============================================================================
- * HTTP 上报函数
- * ============================================================================ */
-
 /**
- * @brief 使用 curl 发送 POST 请求
+ * @brief 在键表中查找键
  *
- * @param url 目标 URL
- * @param data POST 数据（已格式化为 key=value 形式）
- * @return 成功返回 0，失败返回 -1
+ * @param keys 键表
+ * @param count 键个数
+ * @param key 待查找的键
+ * @param len 键长度
+ * @return 命中返回下标，否则返回 -1
  */
-int send_post_request(const char *url, const char *data)
+static inline int kp_key_lookup(const KpKey *keys, int count, const char *key, size_t len)
 {
-    char command[4096];
-    int ret = snprintf(command, sizeof(command), "curl -s -X POST -d '%s' '%s'", data, url);
-    if (ret < 0 || ret >= sizeof(command))
+    uint32_t h = kp_hash(key, len);
+    for (int i = 0; i < count; i++)
     {
-        fprintf(stderr, "Error: Command too long or encoding error\n");
-        return -1;
+        if (keys[i].hash == h && strncmp(keys[i].key, key, len) == 0 && keys[i].key[len] == '\0')
+        {
+            return i;
+        }
     }
-    return system(command);
+    return -1;
 }
 
 /* ============================================================================
- * 指标采集与格式化
+ * 每 CPU 统计
  * ============================================================================ */
 
+#define PERCPU_MODES        8       /**< /proc/stat 每行读取的时间项数 */
+#define PERCPU_DEFAULT_TOP  8       /**< top 模式默认上报的核心数 */
+#define PERCPU_BLOCK        8       /**< 差值计算每组处理的核心数（PERCPU_MAX 的约数） */
+
 /**
- * @brief 采集所有系统指标
+ * @brief 每 CPU 统计的上报方式
+ */
+typedef enum
+{
+    PERCPU_OFF,     /**< 不采集 */
+    PERCPU_FULL,    /**< 上报全部核心 */
+    PERCPU_TOP      /**< 上报最忙的若干核心和分布直方图 */
+} PerCpuMode;
+
+/**
+ * @brief 每 CPU 计数器表（结构数组布局）
  *
- * @param uptime 输出参数，运行时间
- * @param loadavg 输出参数，负载信息
- * @param cpuinfo 输出参数，CPU 信息
- * @param meminfo 输出参数，内存信息
- * @param netinfo 输出参数，网络信息
- * @param sysinfo 输出参数，系统信息
- * @param diskstats 输出参数，磁盘统计
+ * 每种时间项各占一段连续数组，两组交替保存本次和上一次的值，差值计算按核心顺序遍历连续内存，便于编译器向量化。
+ * 只保存低 32 位：按 2^32 取模的差值在间隔小于 2^31 个 jiffies（100 Hz 下约 248 天）时是精确的，
+ * 且 32 位整数到浮点的转换在基线 x86-64 上就有 SIMD 指令。
  */
-void collect_metrics(Uptime *uptime, LoadAvg *loadavg, CpuInfo *cpuinfo, MemInfo *meminfo, NetInfo *netinfo, SystemInfo *sysinfo, DiskStats *diskstats)
+static struct
 {
-    if (read_uptime(uptime) != 0)
-    {
-        fprintf(stderr, "Failed to read uptime\n");
-    }
+    PerCpuMode mode;                                        /**< 上报方式 */
+    int top;                                                /**< top 模式上报的核心数 */
+    int cur;                                                /**< 本次数据所在的组 */
+    int count[2];                                           /**< 各组的核心数 */
+    uint16_t id[2][PERCPU_MAX];                             /**< 各组的 CPU 编号 */
+    uint32_t ticks[2][PERCPU_MODES][PERCPU_MAX];            /**< 各组各时间项累计值的低 32 位（顺序同 /proc/stat） */
+    float busy[PERCPU_MAX];                                 /**< 差值计算结果：非空闲占比 */
+    float softirq[PERCPU_MAX];                              /**< 差值计算结果：软中断占比 */
+} percpu = {.top = PERCPU_DEFAULT_TOP};
+
+/**
+ * @brief 解析 /proc/stat 的 cpuN 行，返回在线 CPU 数；启用每 CPU 统计时同时写入计数器表
+ *
+ * @param buf /proc/stat 内容
+ * @param store 非 0 时写入计数器表的新一组
+ * @return 在线 CPU 数
+ */
+static int percpu_parse(const char *buf, int store)
+{
+    int bank = percpu.cur ^ 1;
+    int count = 0;
+    for (const char *p = kp_next_line(buf); strncmp(p, "cpu", 3) == 0 && isdigit((unsigned char)p[3]); p = kp_next_line(p))
+    {
+        if (store && count < PERCPU_MAX)
+        {
+            unsigned long long id, v[PERCPU_MODES] = {0};
+            const char *q = kp_parse_u64(p + 3, &id);
+            if (q && kp_parse_u64_list(q, v, PERCPU_MODES) >= 4)
+            {
+                percpu.id[bank][count] = (uint16_t)id;
+                for (int k = 0; k < PERCPU_MODES; k++)
+                {
+                    percpu.ticks[bank][k][count] = (uint32_t)v[k];
+                }
+            }
+        }
+        count++;
+    }
+    if (store)
+    {
+        percpu.count[bank] = count < PERCPU_MAX ? count : PERCPU_MAX;
+        percpu.cur = bank;
+    }
+    return count;
+}
+
+/**
+ * @brief 每 CPU 差值计算
+ *
+ * 按 PERCPU_BLOCK 个核心一组处理，内层循环次数固定且没有分支（钳位和除零保护都是 select），
+ * -O2 默认的向量化代价模型下即可生成 SIMD 代码（SSE2 每次处理 4 个核心）。
+ * n 向上取整到 PERCPU_BLOCK，多出的位置计算结果无意义、由调用者忽略。单项回退（iowait 等）按 0 计。
+ *
+ * @param n 核心数
+ * @param cur 本次各时间项数组
+ * @param prev 上一次各时间项数组
+ * @param busy 输出参数，非空闲（不含 idle、iowait）占比
+ * @param softirq 输出参数，软中断占比
+ */
+static void percpu_delta_kernel(int n, const uint32_t (*restrict cur)[PERCPU_MAX],
+                                const uint32_t (*restrict prev)[PERCPU_MAX],
+                                float *restrict busy, float *restrict softirq)
+{
+    for (int base = 0; base < n; base += PERCPU_BLOCK)
+    {
+        for (int j = 0; j < PERCPU_BLOCK; j++)
+        {
+            int i = base + j;
+            int32_t d0 = (int32_t)(cur[0][i] - prev[0][i]);
+            int32_t d1 = (int32_t)(cur[1][i] - prev[1][i]);
+            int32_t d2 = (int32_t)(cur[2][i] - prev[2][i]);
+            int32_t d3 = (int32_t)(cur[3][i] - prev[3][i]);
+            int32_t d4 = (int32_t)(cur[4][i] - prev[4][i]);
+            int32_t d5 = (int32_t)(cur[5][i] - prev[5][i]);
+            int32_t d6 = (int32_t)(cur[6][i] - prev[6][i]);
+            int32_t d7 = (int32_t)(cur[7][i] - prev[7][i]);
+            d0 = d0 > 0 ? d0 : 0;
+            d1 = d1 > 0 ? d1 : 0;
+            d2 = d2 > 0 ? d2 : 0;
+            d3 = d3 > 0 ? d3 : 0;
+            d4 = d4 > 0 ? d4 : 0;
+            d5 = d5 > 0 ? d5 : 0;
+            d6 = d6 > 0 ? d6 : 0;
+            d7 = d7 > 0 ? d7 : 0;
+            int32_t total = d0 + d1 + d2 + d3 + d4 + d5 + d6 + d7;
+            /* 总和为 0 时分子也为 0，除以 1 即得 0 */
+            float scale = 100.0f / (float)(total | (total == 0));
+            busy[i] = (float)(total - d3 - d4) * scale;
+            softirq[i] = (float)d6 * scale;
+        }
+    }
+}
+
+/**
+ * @brief 计算本次与上一次之间每个核心的占比，写入上报结构
+ *
+ * 核心集合变化（CPU 热插拔）或没有上一次数据时不输出（stats->count 为 0）。
+ *
+ * @param stats 输出参数
+ */
+void percpu_compute(PerCpuStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    int cur = percpu.cur;
+    int prev = cur ^ 1;
+    int n = percpu.count[cur];
+    if (percpu.mode == PERCPU_OFF || n == 0 || percpu.count[prev] != n ||
+        memcmp(percpu.id[cur], percpu.id[prev], (size_t)n * sizeof(uint16_t)) != 0)
+    {
+        return;
+    }
+
+    percpu_delta_kernel(n, (const uint32_t (*)[PERCPU_MAX])percpu.ticks[cur],
+                        (const uint32_t (*)[PERCPU_MAX])percpu.ticks[prev], percpu.busy, percpu.softirq);
+
+    stats->count = (uint16_t)n;
+    for (int i = 0; i < n; i++)
+    {
+        PerCpuEntry *e = &stats->cpu[i];
+        e->id = percpu.id[cur][i];
+        e->busy = (uint16_t)(percpu.busy[i] * 10 + 0.5f);
+        e->softirq = (uint16_t)(percpu.softirq[i] * 10 + 0.5f);
+        int bucket = e->busy / 100;
+        stats->hist[bucket < PERCPU_HIST_BUCKETS ? bucket : PERCPU_HIST_BUCKETS - 1]++;
+    }
+}
+
+/**
+ * @brief 选出最忙的 k 个核心（按非空闲占比降序）
+ *
+ * @param stats 每 CPU 统计
+ * @param k 最多选出的核心数
+ * @param out 输出参数，核心在 stats 中的下标
+ * @return 选出的核心数
+ */
+static int percpu_top(const PerCpuStats *stats, int k, int *out)
+{
+    int n = 0;
+    for (int i = 0; i < stats->count; i++)
+    {
+        if (n < k)
+        {
+            n++;
+        }
+        else if (stats->cpu[i].busy <= stats->cpu[out[k - 1]].busy)
+        {
+            continue;
+        }
+        int j = n - 1;
+        for (; j > 0 && stats->cpu[out[j - 1]].busy < stats->cpu[i].busy; j--)
+        {
+            out[j] = out[j - 1];
+        }
+        out[j] = i;
+    }
+    return n;
+}
+
+/* ============================================================================
+ * 系统信息读取函数
+ * ============================================================================ */
+
+/**
+ * @brief 从 /proc/uptime 读取系统运行时间
+ *
+ * @param uptime 输出参数，存储运行时间信息
+ * @return 成功返回 0，失败返回 -1
+ */
+int read_uptime(Uptime *uptime)
+{
+    const char *p = proc_source_read(SRC_UPTIME, NULL);
+    if (!p)
+        return -1;
+
+    if ((p = kp_parse_fixed(p, &uptime->uptime_s)) == NULL ||
+        kp_parse_fixed(p, &uptime->idle_s) == NULL)
+    {
+        fprintf(stderr, "Invalid /proc/uptime format\n");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 从 /proc/loadavg 读取系统负载和任务信息
+ *
+ * @param loadavg 输出参数，存储负载信息
+ * @return 成功返回 0，失败返回 -1
+ */
+int read_loadavg(LoadAvg *loadavg)
+{
+    const char *p = proc_source_read(SRC_LOADAVG, NULL);
+    if (!p)
+        return -1;
+
+    unsigned long long running, total;
+    if ((p = kp_parse_fixed(p, &loadavg->load_1min)) == NULL ||
+        (p = kp_parse_fixed(p, &loadavg->load_5min)) == NULL ||
+        (p = kp_parse_fixed(p, &loadavg->load_15min)) == NULL ||
+        (p = kp_parse_u64(p, &running)) == NULL || *p++ != '/' ||
+        kp_parse_u64(p, &total) == NULL)
+    {
+        fprintf(stderr, "Invalid /proc/loadavg format\n");
+        return -1;
+    }
+    loadavg->running_tasks = (int)running;
+    loadavg->total_tasks = (int)total;
+    return 0;
+}
+
+/**
+ * @brief 解析 /proc/stat 首行的汇总 CPU 时间
+ *
+ * @param buf /proc/stat 内容
+ * @param cpuinfo 输出参数，存储 CPU 信息
+ * @return 成功返回 0，格式错误返回 -1
+ */
+static int parse_cpu_info(const char *buf, CpuInfo *cpuinfo)
+{
+    unsigned long long v[8];
+    if (strncmp(buf, "cpu ", 4) != 0 || kp_parse_u64_list(buf + 4, v, 8) != 8)
+    {
+        return -1;
+    }
+    cpuinfo->cpu_user = v[0];
+    cpuinfo->cpu_nice = v[1];
+    cpuinfo->cpu_system = v[2];
+    cpuinfo->cpu_idle = v[3];
+    cpuinfo->cpu_iowait = v[4];
+    cpuinfo->cpu_irq = v[5];
+    cpuinfo->cpu_softirq = v[6];
+    cpuinfo->cpu_steal = v[7];
+    return 0;
+}
+
+/**
+ * @brief 从 /proc/stat 读取 CPU 时间统计和在线 CPU 数
+ *
+ * @param cpuinfo 输出参数，存储 CPU 信息
+ * @param num_cpus 输出参数，在线 CPU 数（可为 NULL）
+ * @param per_cpu 非 0 且启用每 CPU 统计时，同一遍解析中写入每 CPU 计数器表
+ * @return 成功返回 0，失败返回 -1
+ */
+int read_cpu_info(CpuInfo *cpuinfo, int *num_cpus, int per_cpu)
+{
+    const char *buf = proc_source_read(SRC_STAT, NULL);
+    if (!buf)
+        return -1;
+
+    if (parse_cpu_info(buf, cpuinfo) != 0)
+    {
+        fprintf(stderr, "Invalid /proc/stat format\n");
+        return -1;
+    }
+    int store = per_cpu && percpu.mode != PERCPU_OFF;
+    if (num_cpus || store)
+    {
+        int count = percpu_parse(buf, store);
+        if (num_cpus)
+        {
+            *num_cpus = count;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief /proc/meminfo 中关心的键
+ */
+enum
+{
+    MEMINFO_MEM_TOTAL,
+    MEMINFO_MEM_FREE,
+    MEMINFO_BUFFERS,
+    MEMINFO_CACHED,
+    MEMINFO_KEY_COUNT
+};
+
+static KpKey meminfo_keys[MEMINFO_KEY_COUNT] = {
+    [MEMINFO_MEM_TOTAL] = {"MemTotal"},
+    [MEMINFO_MEM_FREE] = {"MemFree"},
+    [MEMINFO_BUFFERS] = {"Buffers"},
+    [MEMINFO_CACHED] = {"Cached"},
+};
+
+/**
+ * @brief 单次遍历解析 /proc/meminfo 内容
+ *
+ * @param buf /proc/meminfo 内容
+ * @param meminfo 输出参数，存储内存信息（单位：MiB）
+ * @return 成功返回 0
+ */
+static int parse_mem_info(const char *buf, MemInfo *meminfo)
+{
+    if (meminfo_keys[0].hash == 0)
+    {
+        kp_keys_init(meminfo_keys, MEMINFO_KEY_COUNT);
+    }
+
+    unsigned long long kb[MEMINFO_KEY_COUNT] = {0};
+    int found = 0;
+    for (const char *p = buf; *p && found < MEMINFO_KEY_COUNT; p = kp_next_line(p))
+    {
+        const char *colon = strchr(p, ':');
+        if (!colon)
+        {
+            break;
+        }
+        int idx = kp_key_lookup(meminfo_keys, MEMINFO_KEY_COUNT, p, colon - p);
+        if (idx >= 0 && kp_parse_u64(colon + 1, &kb[idx]))
+        {
+            found++;
+        }
+    }
+
+    meminfo->mem_total_mib = kb[MEMINFO_MEM_TOTAL] / 1024.0;
+    meminfo->mem_free_mib = kb[MEMINFO_MEM_FREE] / 1024.0;
+    meminfo->mem_buff_cache_mib = (kb[MEMINFO_BUFFERS] + kb[MEMINFO_CACHED]) / 1024.0;
+    meminfo->mem_used_mib = meminfo->mem_total_mib - meminfo->mem_free_mib;
+    return 0;
+}
+
+/**
+ * @brief 从 /proc/meminfo 读取内存信息
+ *
+ * @param meminfo 输出参数，存储内存信息（单位：MiB）
+ * @return 成功返回 0，失败返回 -1
+ */
+int read_mem_info(MemInfo *meminfo)
+{
+    const char *buf = proc_source_read(SRC_MEMINFO, NULL);
+    if (!buf)
+        return -1;
+
+    return parse_mem_info(buf, meminfo);
+}
+
+/**
+ * @brief 获取机器唯一标识
+ *
+ * 依次尝试从 /etc/machine-id 和 /var/lib/dbus/machine-id 读取。
+ *
+ * @param buffer 输出缓冲区
+ * @param buffer_size 缓冲区大小
+ * @return 成功返回 0，失败返回 -1（buffer 中存储 "unknown"）
+ */
+int get_machine_id(char *buffer, size_t buffer_size)
+{
+    const char *paths[] = {"/etc/machine-id", "/var/lib/dbus/machine-id", NULL};
+    for (int i = 0; paths[i] != NULL; i++)
+    {
+        FILE *fp = safe_fopen(paths[i], "r");
+        if (fp)
+        {
+            if (fgets(buffer, buffer_size, fp))
+            {
+                fclose(fp);
+                buffer[strcspn(buffer, "\n")] = 0;
+                return 0;
+            }
+            fclose(fp);
+        }
+    }
+    strncpy(buffer, "unknown", buffer_size);
+    buffer[buffer_size - 1] = '\0';
+    return -1;
+}
+
+/**
+ * @brief 获取主机名
+ *
+ * @param buffer 输出缓冲区
+ * @param buffer_size 缓冲区大小
+ * @return 成功返回 0，失败返回 -1（buffer 中存储 "unknown"）
+ */
+int get_hostname(char *buffer, size_t buffer_size)
+{
+    if (gethostname(buffer, buffer_size) != 0)
+    {
+        strncpy(buffer, "unknown", buffer_size);
+        buffer[buffer_size - 1] = '\0';
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 检查主机名是否变化
+ *
+ * 持久打开 /proc/sys/kernel/hostname，sethostname() 会以 POLLPRI 唤醒该文件的等待者，
+ * 因此无需每个周期调用 gethostname()。无法打开时每次都视为已变化。
+ *
+ * @return 变化（或无法判断）返回 1，否则返回 0
+ */
+static int hostname_changed(void)
+{
+    static int fd = -1;
+    static int first = 1;
+
+    if (fd < 0)
+    {
+        fd = open("/proc/sys/kernel/hostname", O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            return 1;
+        }
+    }
+
+    struct pollfd pfd = {.fd = fd, .events = POLLPRI};
+    int changed = poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLPRI | POLLERR));
+    if (first)
+    {
+        first = 0;
+        return 1;
+    }
+    return changed;
+}
+
+/* ============================================================================
+ * 连接数统计
+ * ============================================================================ */
+
+#define SOCK_DIAG_BUF_SIZE      (64 * 1024)     /**< netlink 接收缓冲区大小 */
+#define PROC_NET_BUF_SIZE       (256 * 1024)    /**< 回退路径读取 /proc/net 套接字列表的缓冲区大小 */
+#define TCP_STATES_ALL          0xffeu          /**< 全部 TCP 状态（1..11）的位掩码 */
+
+/** TCP 状态名，下标为内核状态值减 1（与 tcp_states[] 下标一致） */
+static const char *const tcp_state_names[TCP_STATE_COUNT] = {
+    "established", "syn_sent", "syn_recv", "fin_wait1", "fin_wait2", "time_wait",
+    "close", "close_wait", "last_ack", "listen", "closing",
+};
+
+/**
+ * @brief /proc/net 下的套接字列表文件（netlink 不可用时的回退数据源）
+ */
+typedef struct
+{
+    const char *path;       /**< 文件路径 */
+    int addr_hex_len;       /**< 地址十六进制长度：IPv4 为 8，IPv6 为 32 */
+    int fd;                 /**< 持久打开的文件描述符，-1 表示未打开 */
+} ProcNetFile;
+
+/**
+ * @brief 连接数统计状态
+ */
+static struct
+{
+    int fd;                             /**< NETLINK_SOCK_DIAG 套接字，-1 表示未打开 */
+    int unavailable;                    /**< netlink 不可用，始终走回退路径 */
+    uint32_t seq;                       /**< netlink 请求序号 */
+    uint32_t tcp_state_mask;            /**< 统计的 TCP 状态位掩码（由内核过滤） */
+    char *buf;                          /**< 接收/读取缓冲区 */
+    ProcNetFile tcp_files[2];           /**< /proc/net/tcp、tcp6 */
+    ProcNetFile udp_files[2];           /**< /proc/net/udp、udp6 */
+} sock_stats = {
+    .fd = -1,
+    .tcp_state_mask = TCP_STATES_ALL,
+    .tcp_files = {{"/proc/net/tcp", 8, -1}, {"/proc/net/tcp6", 32, -1}},
+    .udp_files = {{"/proc/net/udp", 8, -1}, {"/proc/net/udp6", 32, -1}},
+};
+
+/**
+ * @brief 解析 TCP 状态列表（如 "established,time_wait"，"all" 表示全部）
+ *
+ * @param list 逗号分隔的状态名
+ * @param mask 输出参数，状态位掩码（第 n 位对应内核状态值 n）
+ * @return 成功返回 0，含未知状态名返回 -1
+ */
+int parse_tcp_state_mask(const char *list, uint32_t *mask)
+{
+    *mask = 0;
+    while (*list)
+    {
+        size_t len = strcspn(list, ",");
+        if (len == 3 && strncmp(list, "all", 3) == 0)
+        {
+            *mask |= TCP_STATES_ALL;
+        }
+        else
+        {
+            int i;
+            for (i = 0; i < TCP_STATE_COUNT; i++)
+            {
+                if (strlen(tcp_state_names[i]) == len && strncmp(list, tcp_state_names[i], len) == 0)
+                {
+                    *mask |= 1u << (i + 1);
+                    break;
+                }
+            }
+            if (i == TCP_STATE_COUNT)
+            {
+                return -1;
+            }
+        }
+        list += len;
+        if (*list == ',')
+        {
+            list++;
+        }
+    }
+    return *mask ? 0 : -1;
+}
+
+/**
+ * @brief 设置需要统计的 TCP 状态
+ *
+ * @param mask 状态位掩码（第 n 位对应内核状态值 n）
+ */
+void set_tcp_state_mask(uint32_t mask)
+{
+    sock_stats.tcp_state_mask = mask;
+}
+
+/**
+ * @brief 通过 NETLINK_SOCK_DIAG 转储并统计一个地址族/协议的套接字
+ *
+ * 只接收二进制的 inet_diag_msg，内核无需把每个套接字格式化为文本；
+ * 状态过滤由内核根据 idiag_states 完成。
+ *
+ * @param family AF_INET 或 AF_INET6
+ * @param protocol IPPROTO_TCP 或 IPPROTO_UDP
+ * @param states 状态位掩码
+ * @param total 输出参数，累加套接字总数
+ * @param by_state 输出参数，累加各状态计数（可为 NULL）
+ * @return 成功返回 0，失败返回 -1（errno 为内核返回的错误码）
+ */
+static int sock_diag_count(int family, int protocol, uint32_t states, int *total, int *by_state)
+{
+    struct
+    {
+        struct nlmsghdr nlh;
+        struct inet_diag_req_v2 req;
+    } request;
+    memset(&request, 0, sizeof(request));
+    request.nlh.nlmsg_len = sizeof(request);
+    request.nlh.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+    request.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    request.nlh.nlmsg_seq = ++sock_stats.seq;
+    request.req.sdiag_family = family;
+    request.req.sdiag_protocol = protocol;
+    request.req.idiag_states = states;
+
+    struct sockaddr_nl kernel = {.nl_family = AF_NETLINK};
+    if (sendto(sock_stats.fd, &request, sizeof(request), 0, (struct sockaddr *)&kernel, sizeof(kernel)) < 0)
+    {
+        return -1;
+    }
+
+    for (;;)
+    {
+        ssize_t n = recv(sock_stats.fd, sock_stats.buf, SOCK_DIAG_BUF_SIZE, 0);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+
+        int len = (int)n;
+        for (struct nlmsghdr *nlh = (struct nlmsghdr *)sock_stats.buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len))
+        {
+            if (nlh->nlmsg_seq != request.nlh.nlmsg_seq)
+            {
+                continue;
+            }
+            if (nlh->nlmsg_type == NLMSG_DONE)
+            {
+                return 0;
+            }
+            if (nlh->nlmsg_type == NLMSG_ERROR)
+            {
+                struct nlmsgerr *err = NLMSG_DATA(nlh);
+                errno = err->error ? -err->error : EIO;
+                return -1;
+            }
+            if (nlh->nlmsg_type == SOCK_DIAG_BY_FAMILY)
+            {
+                const struct inet_diag_msg *msg = NLMSG_DATA(nlh);
+                (*total)++;
+                if (by_state && msg->idiag_state >= 1 && msg->idiag_state <= TCP_STATE_COUNT)
+                {
+                    by_state[msg->idiag_state - 1]++;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief 统计一个地址族/协议的套接字（netlink），失败时不修改输出
+ *
+ * @return 成功返回 0，转储失败返回 -1
+ */
+static int sock_diag_count_family(int family, int protocol, uint32_t states, int *total, int *by_state)
+{
+    int count = 0, count_states[TCP_STATE_COUNT] = {0};
+    if (sock_diag_count(family, protocol, states, &count, by_state ? count_states : NULL) != 0)
+    {
+        return -1;
+    }
+    *total += count;
+    if (by_state)
+    {
+        for (int i = 0; i < TCP_STATE_COUNT; i++)
+        {
+            by_state[i] += count_states[i];
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief 以大缓冲区顺序读取 /proc/net/{tcp,udp}[6]，用 memchr 按行计数
+ *
+ * 状态列在首个 ':' 之后的固定偏移处（地址和端口均为定宽十六进制），
+ * 因此无需逐字段解析即可按状态过滤和分类。
+ *
+ * @param file 数据源
+ * @param states 状态位掩码
+ * @param total 输出参数，累加套接字总数
+ * @param by_state 输出参数，累加各状态计数（可为 NULL）
+ * @return 成功返回 0，失败返回 -1
+ */
+static int proc_net_count(ProcNetFile *file, uint32_t states, int *total, int *by_state)
+{
+    if (file->fd < 0)
+    {
+        file->fd = open(file->path, O_RDONLY | O_CLOEXEC);
+        if (file->fd < 0)
+        {
+            /* 未启用 IPv6 时 tcp6/udp6 不存在，不视为错误 */
+            return errno == ENOENT ? 0 : -1;
+        }
+    }
+
+    char *buf = sock_stats.buf;
+    size_t have = 0;
+    off_t offset = 0;
+    int header = 1;
+    /* "sl: " 之后依次为 " 本地地址:端口 远端地址:端口 状态" */
+    const size_t state_off = 2 * (file->addr_hex_len + 6) + 2;
+
+    for (;;)
+    {
+        ssize_t n = pread(file->fd, buf + have, PROC_NET_BUF_SIZE - have, offset);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            close(file->fd);
+            file->fd = -1;
+            return -1;
+        }
+        if (n == 0)
+        {
+            return 0;
+        }
+        offset += n;
+        have += n;
+
+        char *p = buf, *end = buf + have, *nl;
+        while ((nl = memchr(p, '\n', end - p)) != NULL)
+        {
+            if (header)
+            {
+                header = 0;
+            }
+            else
+            {
+                const char *colon = memchr(p, ':', nl - p);
+                if (colon && (size_t)(nl - colon) > state_off + 2)
+                {
+                    const char *st = colon + state_off;
+                    unsigned state = (isdigit((unsigned char)st[0]) ? st[0] - '0' : (st[0] | 0x20) - 'a' + 10) * 16 +
+                                     (isdigit((unsigned char)st[1]) ? st[1] - '0' : (st[1] | 0x20) - 'a' + 10);
+                    if (state < 32 && (states & (1u << state)))
+                    {
+                        (*total)++;
+                        if (by_state && state >= 1 && state <= TCP_STATE_COUNT)
+                        {
+                            by_state[state - 1]++;
+                        }
+                    }
+                }
+            }
+            p = nl + 1;
+        }
+
+        /* 保留不完整的行到缓冲区开头；单行超过缓冲区时丢弃 */
+        have = end - p;
+        if (have == PROC_NET_BUF_SIZE)
+        {
+            have = 0;
+        }
+        memmove(buf, p, have);
+    }
+}
+
+/**
+ * @brief 统计 TCP/UDP 连接数及各 TCP 状态计数（IPv4 + IPv6）
+ *
+ * 优先使用 NETLINK_SOCK_DIAG；netlink 不可用（或未加载对应协议、地址族的 diag 模块）时
+ * 按地址族分别回退为读取 /proc/net/{tcp,tcp6,udp,udp6}。内核未启用 IPv6 时 tcp6/udp6 不存在，只统计 IPv4。
+ *
+ * @param netinfo 输出参数，存储网络连接信息
+ * @return 成功返回 0，任一协议统计失败返回 -1
+ */
+int read_net_info(NetInfo *netinfo)
+{
+    netinfo->tcp_connections = 0;
+    netinfo->udp_connections = 0;
+    memset(netinfo->tcp_states, 0, sizeof(netinfo->tcp_states));
+
+    if (!sock_stats.buf)
+    {
+        sock_stats.buf = malloc(PROC_NET_BUF_SIZE > SOCK_DIAG_BUF_SIZE ? PROC_NET_BUF_SIZE : SOCK_DIAG_BUF_SIZE);
+        if (!sock_stats.buf)
+        {
+            perror("malloc");
+            return -1;
+        }
+    }
+
+    if (sock_stats.fd < 0 && !sock_stats.unavailable)
+    {
+        sock_stats.fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+        if (sock_stats.fd < 0)
+        {
+            perror("NETLINK_SOCK_DIAG unavailable, falling back to /proc/net");
+            sock_stats.unavailable = 1;
+        }
+    }
+
+    const struct
+    {
+        int protocol;
+        uint32_t states;
+        int *total;
+        int *by_state;
+        ProcNetFile *files;
+    } protocols[] = {
+        {IPPROTO_TCP, sock_stats.tcp_state_mask, &netinfo->tcp_connections, netinfo->tcp_states, sock_stats.tcp_files},
+        {IPPROTO_UDP, TCP_STATES_ALL, &netinfo->udp_connections, NULL, sock_stats.udp_files},
+    };
+    int ret = 0;
+
+    for (size_t i = 0; i < sizeof(protocols) / sizeof(protocols[0]); i++)
+    {
+        for (int f = 0; f < 2; f++)
+        {
+            if (sock_stats.fd >= 0 && sock_diag_count_family(f ? AF_INET6 : AF_INET, protocols[i].protocol,
+                                                             protocols[i].states, protocols[i].total,
+                                                             protocols[i].by_state) == 0)
+            {
+                continue;
+            }
+            if (proc_net_count(&protocols[i].files[f], protocols[i].states, protocols[i].total, protocols[i].by_state) != 0)
+            {
+                perror(protocols[i].files[f].path);
+                ret = -1;
+            }
+        }
+    }
+    return ret;
+}
+
+/* ============================================================================
+ * 网络接口表（rtnetlink）
+ * ============================================================================ */
+
+#define RTNL_BUF_SIZE   (32 * 1024)     /**< rtnetlink 接收缓冲区大小 */
+
+/**
+ * @brief 网络接口表项
+ */
+typedef struct
+{
+    int ifindex;                        /**< 接口索引 */
+    char name[IF_NAMESIZE];             /**< 接口名 */
+    int physical;                       /**< 是否为物理网卡（加入表时判定一次） */
+    int selected;                       /**< 是否按 --interfaces 上报（加入表或改名时判定） */
+    int seen;                           /**< 全量同步时是否出现在转储中 */
+    struct rtnl_link_stats64 stats;     /**< 最近一次转储的 64 位计数器 */
+} NetIface;
+
+/**
+ * @brief 网络接口表
+ *
+ * 接口集合由 RTM_NEWLINK/RTM_DELLINK 事件增量维护，物理网卡判定只在接口首次出现时做一次；
+ * 计数器每个周期通过一次 RTM_GETLINK 转储获取。事件丢失（ENOBUFS）时下次转储做全量同步。
+ */
+static struct
+{
+    int query_fd;           /**< 用于转储的 NETLINK_ROUTE 套接字 */
+    int event_fd;           /**< 订阅 RTMGRP_LINK 的事件套接字 */
+    int unavailable;        /**< rtnetlink 不可用，回退到 /sys + /proc/net/dev */
+    int resync;             /**< 下次转储需要全量同步 */
+    uint32_t seq;           /**< 请求序号 */
+    char *buf;              /**< 接收缓冲区 */
+    NetIface *ifaces;       /**< 按 ifindex 升序排列的接口表 */
+    int count;              /**< 接口个数 */
+    int cap;                /**< 接口表容量 */
+    char filter[256];       /**< 接口过滤规则（--interfaces），空串表示不上报每接口计数器 */
+} link_table = {.query_fd = -1, .event_fd = -1, .resync = 1};
+
+/**
+ * @brief 打开 rtnetlink 套接字
+ *
+ * @param groups 订阅的多播组（0 表示不订阅）
+ * @return 成功返回套接字，失败返回 -1
+ */
+static int rtnl_open(uint32_t groups)
+{
+    int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | (groups ? SOCK_NONBLOCK : 0), NETLINK_ROUTE);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    struct sockaddr_nl local = {.nl_family = AF_NETLINK, .nl_groups = groups};
+    if (bind(fd, (struct sockaddr *)&local, sizeof(local)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief 在接口表中二分查找
+ *
+ * @param ifindex 接口索引
+ * @param pos 输出参数，未找到时为插入位置
+ * @return 找到返回表项，否则返回 NULL
+ */
+static NetIface *link_table_find(int ifindex, int *pos)
+{
+    int lo = 0, hi = link_table.count;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (link_table.ifaces[mid].ifindex < ifindex)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (pos)
+    {
+        *pos = lo;
+    }
+    return (lo < link_table.count && link_table.ifaces[lo].ifindex == ifindex) ? &link_table.ifaces[lo] : NULL;
+}
+
+/**
+ * @brief 判断新出现的接口是否为物理网卡
+ *
+ * 判定标准与原实现一致：类型为以太网（ARPHRD_ETHER）且存在 /sys/class/net/<iface>/device。
+ */
+static int link_is_physical(const char *name, unsigned short type)
+{
+    if (type != ARPHRD_ETHER)
+    {
+        return 0;
+    }
+    char path[64];
+    struct stat st;
+    snprintf(path, sizeof(path), "/sys/class/net/%s/device", name);
+    return stat(path, &st) == 0;
+}
+
+/**
+ * @brief 设置网络接口过滤规则
+ *
+ * @param filter 逗号分隔的通配符列表，"all" 等同 "*"，"!" 开头表示排除
+ * @return 成功返回 0，规则过长或为空返回 -1
+ */
+int set_interface_filter(const char *filter)
+{
+    if (!*filter || strlen(filter) >= sizeof(link_table.filter))
+    {
+        return -1;
+    }
+    strcpy(link_table.filter, filter);
+    return 0;
+}
+
+/**
+ * @brief 按过滤规则判断接口是否上报
+ *
+ * 直接写出的接口名总是选中；通配符不选中回环接口和 veth（容器网络对的一端）。
+ */
+static int link_selected(const char *name)
+{
+    if (!link_table.filter[0])
+    {
+        return 0;
+    }
+    NameFilterMatch match = name_filter_match(link_table.filter, name);
+    return match == NAME_FILTER_EXPLICIT ||
+           (match == NAME_FILTER_WILDCARD && strcmp(name, "lo") != 0 && strncmp(name, "veth", 4) != 0);
+}
+
+/**
+ * @brief 插入或更新接口表项
+ *
+ * 已知接口只更新名字（重命名）并重新判定是否上报，不再重复判定物理网卡。
+ *
+ * @return 成功返回表项，内存不足返回 NULL
+ */
+static NetIface *link_table_upsert(int ifindex, const char *name, unsigned short type)
+{
+    int pos;
+    NetIface *iface = link_table_find(ifindex, &pos);
+    if (iface)
+    {
+        if (strcmp(iface->name, name) != 0)
+        {
+            snprintf(iface->name, sizeof(iface->name), "%s", name);
+            iface->selected = link_selected(iface->name);
+        }
+        return iface;
+    }
+
+    if (link_table.count == link_table.cap)
+    {
+        int cap = link_table.cap ? link_table.cap * 2 : 16;
+        NetIface *ifaces = realloc(link_table.ifaces, cap * sizeof(NetIface));
+        if (!ifaces)
+        {
+            return NULL;
+        }
+        link_table.ifaces = ifaces;
+        link_table.cap = cap;
+    }
+    memmove(&link_table.ifaces[pos + 1], &link_table.ifaces[pos], (link_table.count - pos) * sizeof(NetIface));
+    link_table.count++;
+
+    iface = &link_table.ifaces[pos];
+    memset(iface, 0, sizeof(*iface));
+    iface->ifindex = ifindex;
+    snprintf(iface->name, sizeof(iface->name), "%s", name);
+    iface->physical = link_is_physical(name, type);
+    iface->selected = link_selected(iface->name);
+    return iface;
+}
+
+/**
+ * @brief 删除接口表项
+ */
+static void link_table_remove(int ifindex)
+{
+    int pos;
+    if (link_table_find(ifindex, &pos))
+    {
+        link_table.count--;
+        memmove(&link_table.ifaces[pos], &link_table.ifaces[pos + 1], (link_table.count - pos) * sizeof(NetIface));
+    }
+}
+
+/**
+ * @brief 处理一条 RTM_NEWLINK/RTM_DELLINK 消息
+ *
+ * @param nlh netlink 消息
+ * @param sync 是否为全量同步转储（标记出现过的接口）
+ */
+static void link_table_apply(const struct nlmsghdr *nlh, int sync)
+{
+    const struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+    if (nlh->nlmsg_type == RTM_DELLINK)
+    {
+        link_table_remove(ifi->ifi_index);
+        return;
+    }
+
+    const char *name = NULL;
+    const struct rtattr *stats64 = NULL;
+    int len = IFLA_PAYLOAD(nlh);
+    for (const struct rtattr *rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len))
+    {
+        if (rta->rta_type == IFLA_IFNAME)
+        {
+            name = RTA_DATA(rta);
+        }
+        else if (rta->rta_type == IFLA_STATS64)
+        {
+            stats64 = rta;
+        }
+    }
+    if (!name)
+    {
+        return;
+    }
+
+    NetIface *iface = link_table_upsert(ifi->ifi_index, name, ifi->ifi_type);
+    if (!iface)
+    {
+        return;
+    }
+    if (sync)
+    {
+        iface->seen = 1;
+    }
+    if (stats64 && RTA_PAYLOAD(stats64) >= sizeof(struct rtnl_link_stats64))
+    {
+        /* 属性负载只保证 4 字节对齐 */
+        memcpy(&iface->stats, RTA_DATA(stats64), sizeof(struct rtnl_link_stats64));
+    }
+}
+
+/**
+ * @brief 处理积压的链路事件（非阻塞）
+ */
+static void link_events_drain(void)
+{
+    for (;;)
+    {
+        ssize_t n = recv(link_table.event_fd, link_table.buf, RTNL_BUF_SIZE, MSG_DONTWAIT);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == ENOBUFS)
+            {
+                /* 事件队列溢出，部分事件已丢失 */
+                link_table.resync = 1;
+                continue;
+            }
+            return;
+        }
+
+        int len = (int)n;
+        for (struct nlmsghdr *nlh = (struct nlmsghdr *)link_table.buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len))
+        {
+            if (nlh->nlmsg_type == RTM_NEWLINK || nlh->nlmsg_type == RTM_DELLINK)
+            {
+                link_table_apply(nlh, 0);
+            }
+        }
+    }
+}
+
+/**
+ * @brief 一次 RTM_GETLINK 转储，刷新所有接口的 64 位计数器
+ *
+ * 需要全量同步时，转储中未出现的接口将从表中删除。
+ *
+ * @return 成功返回 0，失败返回 -1
+ */
+static int link_table_dump(void)
+{
+    struct
+    {
+        struct nlmsghdr nlh;
+        struct ifinfomsg ifi;
+    } request;
+    memset(&request, 0, sizeof(request));
+    request.nlh.nlmsg_len = sizeof(request);
+    request.nlh.nlmsg_type = RTM_GETLINK;
+    request.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    request.nlh.nlmsg_seq = ++link_table.seq;
+    request.ifi.ifi_family = AF_UNSPEC;
+
+    int sync = link_table.resync;
+    if (sync)
+    {
+        for (int i = 0; i < link_table.count; i++)
+        {
+            link_table.ifaces[i].seen = 0;
+        }
+    }
+
+    struct sockaddr_nl kernel = {.nl_family = AF_NETLINK};
+    if (sendto(link_table.query_fd, &request, sizeof(request), 0, (struct sockaddr *)&kernel, sizeof(kernel)) < 0)
+    {
+        return -1;
+    }
+
+    for (;;)
+    {
+        ssize_t n = recv(link_table.query_fd, link_table.buf, RTNL_BUF_SIZE, 0);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+
+        int len = (int)n;
+        for (struct nlmsghdr *nlh = (struct nlmsghdr *)link_table.buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len))
+        {
+            if (nlh->nlmsg_seq != request.nlh.nlmsg_seq)
+            {
+                continue;
+            }
+            if (nlh->nlmsg_type == NLMSG_ERROR)
+            {
+                return -1;
+            }
+            if (nlh->nlmsg_type == NLMSG_DONE)
+            {
+                if (sync)
+                {
+                    for (int i = link_table.count - 1; i >= 0; i--)
+                    {
+                        if (!link_table.ifaces[i].seen)
+                        {
+                            link_table_remove(link_table.ifaces[i].ifindex);
+                        }
+                    }
+                    link_table.resync = 0;
+                }
+                return 0;
+            }
+            if (nlh->nlmsg_type == RTM_NEWLINK)
+            {
+                link_table_apply(nlh, sync);
+            }
+        }
+    }
+}
+
+/**
+ * @brief 通过 rtnetlink 刷新接口表
+ *
+ * @return 成功返回 0；rtnetlink 不可用或转储失败返回 -1
+ */
+static int link_table_refresh(void)
+{
+    if (link_table.unavailable)
+    {
+        return -1;
+    }
+    if (link_table.query_fd < 0)
+    {
+        link_table.buf = malloc(RTNL_BUF_SIZE);
+        link_table.query_fd = rtnl_open(0);
+        link_table.event_fd = rtnl_open(RTMGRP_LINK);
+        if (!link_table.buf || link_table.query_fd < 0 || link_table.event_fd < 0)
+        {
+            perror("rtnetlink unavailable, falling back to /proc/net/dev");
+            link_table.unavailable = 1;
+            return -1;
+        }
+    }
+
+    link_events_drain();
+    if (link_table_dump() != 0)
+    {
+        perror("RTM_GETLINK");
+        link_table.resync = 1;
+        return -1;
+    }
+    return 0;
+}
+
+/* ============================================================================
+ * 网络流量采集函数
+ * ============================================================================ */
+
+/**
+ * @brief 判断网口是否为物理网卡
+ *
+ * 通过两个条件判断：
+ * 1. 存在 /sys/class/net/<iface>/device 目录（指向 PCI 或 USB 等物理设备）
+ * 2. 接口类型为 1（ARPHRD_ETHER，即以太网）
+ *
+ * @param iface 网口名称
+ * @return 是物理网卡返回 1，否则返回 0
+ */
+static int is_physical_interface(const char *iface)
+{
+    if (!iface || *iface == '\0')
+    {
+        return 0;
+    }
+
+    char path[256];
+    struct stat st;
+    FILE *fp;
+    int type;
+
+    /* 检查 device 目录是否存在 */
+    snprintf(path, sizeof(path), "/sys/class/net/%s/device", iface);
+    if (stat(path, &st) != 0)
+    {
+        return 0;
+    }
+
+    /* 检查 type 文件内容是否为 1（ARPHRD_ETHER） */
+    snprintf(path, sizeof(path), "/sys/class/net/%s/type", iface);
+    fp = fopen(path, "r");
+    if (!fp)
+    {
+        return 0;
+    }
+
+    if (fscanf(fp, "%d", &type) != 1)
+    {
+        fclose(fp);
+        return 0;
+    }
+    fclose(fp);
+
+    return (type == 1);
+}
+
+/**
+ * @brief 通过 /sys/class/net 和 /proc/net/dev 获取物理网卡流量（rtnetlink 不可用时的回退路径）
+ *
+ * 遍历 /sys/class/net 目录，识别物理网卡，然后从 /proc/net/dev 读取流量并累加。
+ * 物理网卡判断标准：存在 device 目录且类型为以太网（type=1）。
+ *
+ * @param rx_bytes 输出参数，接收字节数（累加）
+ * @param tx_bytes 输出参数，发送字节数（累加）
+ * @return 成功返回 0，失败返回 -1
+ */
+static int get_physical_traffic_procfs(unsigned long long *rx_bytes, unsigned long long *tx_bytes)
+{
+    *rx_bytes = 0;
+    *tx_bytes = 0;
+
+    /* 打开 /sys/class/net 目录 */
+    DIR *dir = opendir("/sys/class/net");
+    if (!dir)
+    {
+        perror("Failed to open /sys/class/net");
+        return -1;
+    }
+
+    /* 收集所有物理网卡名称 */
+    char phys_ifaces[64][32];
+    int phys_count = 0;
+    struct dirent *entry;
+
+    while ((entry = readdir(dir)) != NULL && phys_count < 64)
+    {
+        if (entry->d_name[0] == '.')
+        {
+            continue;
+        }
+
+        if (is_physical_interface(entry->d_name))
+        {
+            strncpy(phys_ifaces[phys_count], entry->d_name, 31);
+            phys_ifaces[phys_count][31] = '\0';
+            phys_count++;
+        }
+    }
+    closedir(dir);
+
+    if (phys_count == 0)
+    {
+        fprintf(stderr, "No physical network interface found\n");
+        return -1;
+    }
+
+    /* 从 /proc/net/dev 读取流量数据 */
+    char *buf = proc_source_read(SRC_NET_DEV, NULL);
+    if (!buf)
+    {
+        return -1;
+    }
+
+    /* 跳过前两行标题 */
+    const char *p = kp_next_line(kp_next_line(buf));
+
+    for (; *p; p = kp_next_line(p))
+    {
+        /* /proc/net/dev 格式：接口名: rx_bytes rx_packets ... tx_bytes ... */
+        const char *name = kp_skip_ws(p);
+        const char *colon = strchr(name, ':');
+        unsigned long long v[9];
+        if (!colon || kp_parse_u64_list(colon + 1, v, 9) != 9)
+        {
+            continue;
+        }
+        size_t name_len = colon - name;
+
+        /* 检查是否为物理网卡 */
+        for (int i = 0; i < phys_count; i++)
+        {
+            if (strncmp(name, phys_ifaces[i], name_len) == 0 && phys_ifaces[i][name_len] == '\0')
+            {
+                *rx_bytes += v[0];
+                *tx_bytes += v[8];
+                break;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 获取所有物理网卡的流量统计
+ *
+ * 优先使用 rtnetlink 维护的接口表和 64 位计数器（32 位平台上也不会回绕）；
+ * rtnetlink 不可用时回退到 /sys/class/net + /proc/net/dev。
+ *
+ * @param rx_bytes 输出参数，接收字节数（累加）
+ * @param tx_bytes 输出参数，发送字节数（累加）
+ * @return 成功返回 0，失败返回 -1
+ */
+int get_default_interface_traffic(unsigned long long *rx_bytes, unsigned long long *tx_bytes)
+{
+    if (link_table_refresh() != 0)
+    {
+        return get_physical_traffic_procfs(rx_bytes, tx_bytes);
+    }
+
+    *rx_bytes = 0;
+    *tx_bytes = 0;
+    int phys_count = 0;
+    for (int i = 0; i < link_table.count; i++)
+    {
+        const NetIface *iface = &link_table.ifaces[i];
+        if (iface->physical)
+        {
+            *rx_bytes += iface->stats.rx_bytes;
+            *tx_bytes += iface->stats.tx_bytes;
+            phys_count++;
+        }
+    }
+
+    if (phys_count == 0)
+    {
+        fprintf(stderr, "No physical network interface found\n");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 把 rtnetlink 的 64 位计数器换算为 /proc/net/dev 的 16 列
+ *
+ * 合并规则与内核 dev_seq_printf_stats() 一致。
+ *
+ * @param st rtnetlink 计数器
+ * @param v 输出参数，NETIF_FIELDS 个计数器
+ */
+static void link_stats_to_procfs(const struct rtnl_link_stats64 *st, unsigned long long *v)
+{
+    v[0] = st->rx_bytes;
+    v[1] = st->rx_packets;
+    v[2] = st->rx_errors;
+    v[3] = st->rx_dropped + st->rx_missed_errors;
+    v[4] = st->rx_fifo_errors;
+    v[5] = st->rx_length_errors + st->rx_over_errors + st->rx_crc_errors + st->rx_frame_errors;
+    v[6] = st->rx_compressed;
+    v[7] = st->multicast;
+    v[8] = st->tx_bytes;
+    v[9] = st->tx_packets;
+    v[10] = st->tx_errors;
+    v[11] = st->tx_dropped;
+    v[12] = st->tx_fifo_errors;
+    v[13] = st->collisions;
+    v[14] = st->tx_carrier_errors + st->tx_aborted_errors + st->tx_window_errors + st->tx_heartbeat_errors;
+    v[15] = st->tx_compressed;
+}
+
+/**
+ * @brief 获取按 --interfaces 选中的每个网络接口的计数器
+ *
+ * 使用 get_default_interface_traffic() 本周期刷新过的接口表，不再单独转储；
+ * rtnetlink 不可用时解析 /proc/net/dev。
+ *
+ * @param stats 输出参数
+ * @return 成功返回 0，失败返回 -1
+ */
+int get_interface_stats(NetIfStats *stats)
+{
+    stats->count = 0;
+    if (!link_table.unavailable && link_table.query_fd >= 0)
+    {
+        for (int i = 0; i < link_table.count && stats->count < NETIF_MAX; i++)
+        {
+            const NetIface *iface = &link_table.ifaces[i];
+            if (iface->selected)
+            {
+                NetIfCounters *out = &stats->iface[stats->count++];
+                memcpy(out->name, iface->name, sizeof(out->name));
+                link_stats_to_procfs(&iface->stats, out->v);
+            }
+        }
+        return 0;
+    }
+
+    char *buf = proc_source_read(SRC_NET_DEV, NULL);
+    if (!buf)
+    {
+        return -1;
+    }
+    for (const char *p = kp_next_line(kp_next_line(buf)); *p && stats->count < NETIF_MAX; p = kp_next_line(p))
+    {
+        const char *name = kp_skip_ws(p);
+        const char *colon = strchr(name, ':');
+        NetIfCounters *out = &stats->iface[stats->count];
+        if (!colon || (size_t)(colon - name) >= sizeof(out->name) ||
+            kp_parse_u64_list(colon + 1, out->v, NETIF_FIELDS) != NETIF_FIELDS)
+        {
+            continue;
+        }
+        memcpy(out->name, name, colon - name);
+        out->name[colon - name] = '\0';
+        if (link_selected(out->name))
+        {
+            stats->count++;
+        }
+    }
+    return 0;
+}
+
+/* ============================================================================
+ * 挂载表
+ * ============================================================================ */
+
+/**
+ * @brief /proc/self/mountinfo 中的一行（指针指向数据源缓冲区，不以 '\0' 结尾）
+ */
+typedef struct
+{
+    unsigned int major;         /**< 文件系统所在设备的主设备号 */
+    unsigned int minor;         /**< 文件系统所在设备的次设备号 */
+    const char *mount_point;    /**< 挂载点（空格等字符为八进制转义） */
+    size_t mount_point_len;     /**< 挂载点长度 */
+    const char *fstype;         /**< 文件系统类型 */
+    size_t fstype_len;          /**< 文件系统类型长度 */
+    const char *source;         /**< 挂载源 */
+    size_t source_len;          /**< 挂载源长度 */
+} MountEntry;
+
+/**
+ * @brief 获取挂载表代数
+ *
+ * 持久打开 /proc/self/mountinfo，以 POLLPRI 检测挂载表变化（不读取内容）。
+ * 每次检测到变化代数加 1，调用者保存上次看到的代数即可判断是否需要重新解析。
+ * 无法打开 mountinfo 时每次调用都视为已变化。
+ *
+ * @return 当前挂载表代数
+ */
+static unsigned long mount_table_generation(void)
+{
+    static unsigned long generation = 1;
+    ProcSource *src = &proc_sources[SRC_MOUNTINFO];
+
+    if (src->fd < 0 && proc_source_open(src) != 0)
+    {
+        return ++generation;
+    }
+
+    struct pollfd pfd = {.fd = src->fd, .events = POLLPRI};
+    if (poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLPRI | POLLERR)))
+    {
+        generation++;
+    }
+    return generation;
+}
+
+/**
+ * @brief 解析 mountinfo 的一行
+ *
+ * 格式：id parent major:minor root mount_point options [optional...] - fstype source super_options
+ *
+ * @param p 行首
+ * @param entry 输出参数，解析结果
+ * @return 成功返回 0，格式错误返回 -1
+ */
+static int mountinfo_parse_line(const char *p, MountEntry *entry)
+{
+    const char *end = strchr(p, '\n');
+    if (!end)
+    {
+        end = p + strlen(p);
+    }
+
+    unsigned long long id, parent, major, minor;
+    const char *root;
+    size_t root_len;
+    if ((p = kp_parse_u64(p, &id)) == NULL ||
+        (p = kp_parse_u64(p, &parent)) == NULL ||
+        (p = kp_parse_u64(p, &major)) == NULL || *p++ != ':' ||
+        (p = kp_parse_u64(p, &minor)) == NULL ||
+        (p = kp_token(p, &root, &root_len)) == NULL ||
+        (p = kp_token(p, &entry->mount_point, &entry->mount_point_len)) == NULL)
+    {
+        return -1;
+    }
+
+    const char *sep = memmem(p, end - p, " - ", 3);
+    if (!sep ||
+        (p = kp_token(sep + 3, &entry->fstype, &entry->fstype_len)) == NULL ||
+        kp_token(p, &entry->source, &entry->source_len) == NULL)
+    {
+        return -1;
+    }
+    entry->major = (unsigned int)major;
+    entry->minor = (unsigned int)minor;
+    return 0;
+}
+
+/**
+ * @brief 通过块设备名查询设备号（/sys/class/block/<name>/dev）
+ *
+ * @return 成功返回 0，失败返回 -1
+ */
+static int block_device_number(const char *name, size_t name_len, unsigned int *major, unsigned int *minor)
+{
+    char path[128], buf[32];
+    if (name_len > 64)
+    {
+        return -1;
+    }
+    snprintf(path, sizeof(path), "/sys/class/block/%.*s/dev", (int)name_len, name);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0)
+    {
+        return -1;
+    }
+    buf[n] = '\0';
+
+    unsigned long long maj, min;
+    const char *p = kp_parse_u64(buf, &maj);
+    if (!p || *p != ':' || !kp_parse_u64(p + 1, &min))
+    {
+        return -1;
+    }
+    *major = (unsigned int)maj;
+    *minor = (unsigned int)min;
+    return 0;
+}
+
+/* ============================================================================
+ * 磁盘统计函数
+ * ============================================================================ */
+
+/**
+ * @brief 单次遍历 /proc/diskstats 内容，按设备号查找设备的统计信息
+ *
+ * @param buf /proc/diskstats 内容
+ * @param dev_major 主设备号
+ * @param dev_minor 次设备号
+ * @param stats 输出参数，存储磁盘统计信息
+ * @return 找到返回 0，否则返回 -1
+ */
+static int parse_diskstats_device(const char *buf, unsigned int dev_major, unsigned int dev_minor, DiskStats *stats)
+{
+    for (const char *p = buf; *p; p = kp_next_line(p))
+    {
+        unsigned long long major, minor, v[11] = {0};
+        const char *name;
+        size_t name_len;
+
+        /* 格式：major minor name reads_completed read_merges ... weighted_io_time */
+        if ((p = kp_parse_u64(p, &major)) == NULL ||
+            (p = kp_parse_u64(p, &minor)) == NULL ||
+            (p = kp_token(p, &name, &name_len)) == NULL)
+        {
+            return -1;
+        }
+        if (major != dev_major || minor != dev_minor)
+        {
+            continue;
+        }
+        if (kp_parse_u64_list(p, v, 11) < 8)
+        {
+            return -1;
+        }
+        stats->reads_completed = v[0];
+        stats->read_merges = v[1];
+        stats->read_sectors = v[2];
+        stats->reading_ms = v[3];
+        stats->writes_completed = v[4];
+        stats->write_merges = v[5];
+        stats->write_sectors = v[6];
+        stats->writing_ms = v[7];
+        stats->ios_in_progress = v[8];
+        stats->iotime_ms = v[9];
+        stats->weighted_io_time = v[10];
+        return 0;
+    }
+    return -1;
+}
+
+/**
+ * @brief 确定根文件系统所在块设备的设备号
+ *
+ * 优先使用 stat("/") 的 st_dev，天然处理 /dev/mapper、by-uuid、root=/dev/root 等名字间接；
+ * btrfs、overlay 等文件系统的 st_dev 是匿名设备（主设备号 0），此时退回到 mountinfo 中
+ * 根挂载点的挂载源，再通过 stat() 或 /sys/class/block 换算设备号。
+ *
+ * @param major 输出参数，主设备号
+ * @param minor 输出参数，次设备号
+ * @return 成功返回 0，失败返回 -1
+ */
+static int resolve_root_device(unsigned int *major, unsigned int *minor)
+{
+    struct stat st;
+    if (stat("/", &st) == 0 && major(st.st_dev) != 0)
+    {
+        *major = major(st.st_dev);
+        *minor = minor(st.st_dev);
+        return 0;
+    }
+
+    const char *buf = proc_source_read(SRC_MOUNTINFO, NULL);
+    if (!buf)
+    {
+        return -1;
+    }
+
+    /* 同一挂载点可能叠加多次挂载，最后一条才是可见的 */
+    MountEntry root;
+    int found = 0;
+    for (const char *p = buf; *p; p = kp_next_line(p))
+    {
+        MountEntry entry;
+        if (mountinfo_parse_line(p, &entry) == 0 && entry.mount_point_len == 1 && entry.mount_point[0] == '/')
+        {
+            root = entry;
+            found = 1;
+        }
+    }
+    if (!found)
+    {
+        fprintf(stderr, "Could not find root mount in /proc/self/mountinfo\n");
+        return -1;
+    }
+    if (root.major != 0)
+    {
+        *major = root.major;
+        *minor = root.minor;
+        return 0;
+    }
+
+    char source[256];
+    if (root.source_len >= sizeof(source))
+    {
+        return -1;
+    }
+    memcpy(source, root.source, root.source_len);
+    source[root.source_len] = '\0';
+    if (stat(source, &st) == 0 && S_ISBLK(st.st_mode))
+    {
+        *major = major(st.st_rdev);
+        *minor = minor(st.st_rdev);
+        return 0;
+    }
+
+    const char *name = strrchr(source, '/');
+    name = name ? name + 1 : source;
+    if (block_device_number(name, strlen(name), major, minor) == 0)
+    {
+        return 0;
+    }
+    fprintf(stderr, "Could not resolve root device: %s\n", source);
+    return -1;
+}
+
+/**
+ * @brief /proc/diskstats 行索引的一项
+ */
+typedef struct
+{
+    unsigned int major;     /**< 主设备号 */
+    unsigned int minor;     /**< 次设备号 */
+    int slot;               /**< 在上报表中的位置，-1 表示未选中 */
+    int root;               /**< 是否为根设备 */
+} DiskLine;
+
+/**
+ * @brief /proc/diskstats 设备索引
+ *
+ * 按行记录每个设备的设备号及其用途（根设备、上报表位置）。每次采集只核对各行的设备号，
+ * 与索引一致时直接按位置取用，不再比较设备名或查询 sysfs；设备增减（行数或某行设备号变化）
+ * 或根设备变化时才重建索引。
+ */
+static struct
+{
+    char filter[256];                   /**< 设备过滤规则（--disks），空串表示不上报全部设备 */
+    DiskLine *lines;                    /**< 各行的索引项 */
+    int line_count;                     /**< 索引覆盖的行数 */
+    int line_cap;                       /**< lines 的容量 */
+    int built;                          /**< 索引是否有效 */
+    unsigned int root_major;            /**< 建索引时的根设备主设备号 */
+    unsigned int root_minor;            /**< 建索引时的根设备次设备号 */
+    int dev_count;                      /**< 上报表中的设备数 */
+    char name[DISK_MAX][DISK_NAME_MAX]; /**< 上报表中各设备的名字 */
+    unsigned long rebuilds;             /**< 重建次数 */
+    const char *sysfs_root;             /**< 查询分区用的 sysfs 根目录，NULL 表示 /sys（自检时替换） */
+} disk_index;
+
+/**
+ * @brief 设置块设备过滤规则
+ *
+ * @param filter 逗号分隔的通配符列表，"all" 等同 "*"，"!" 开头表示排除
+ * @return 成功返回 0，规则过长或为空返回 -1
+ */
+int set_disk_filter(const char *filter)
+{
+    if (!*filter || strlen(filter) >= sizeof(disk_index.filter))
+    {
+        return -1;
+    }
+    strcpy(disk_index.filter, filter);
+    disk_index.built = 0;
+    return 0;
+}
+
+/**
+ * @brief 是否启用了全部块设备上报
+ */
+static int disk_filter_enabled(void)
+{
+    return disk_index.filter[0] != '\0';
+}
+
+/**
+ * @brief 判断设备是否是分区（/sys/dev/block/<major>:<minor>/partition 存在）
+ */
+static int block_device_is_partition(unsigned int major, unsigned int minor)
+{
+    char path[256];
+    snprintf(path, sizeof(path), "%s/dev/block/%u:%u/partition",
+             disk_index.sysfs_root ? disk_index.sysfs_root : "/sys", major, minor);
+    return access(path, F_OK) == 0;
+}
+
+/**
+ * @brief 按过滤规则判断设备是否上报
+ *
+ * 规则依次匹配：命中排除项立即排除；命中不含通配符的项（直接写出的设备名）则选中；
+ * 命中含通配符的项时，loop、ram、zram 设备和分区默认不选中。
+ *
+ * @param name 设备名
+ * @param major 主设备号
+ * @param minor 次设备号
+ * @return 选中返回 1，否则返回 0
+ */
+static int disk_selected(const char *name, unsigned int major, unsigned int minor)
+{
+    NameFilterMatch match = name_filter_match(disk_index.filter, name);
+    if (match == NAME_FILTER_EXPLICIT)
+    {
+        return 1;
+    }
+    if (match != NAME_FILTER_WILDCARD || strncmp(name, "loop", 4) == 0 || strncmp(name, "ram", 3) == 0 ||
+        strncmp(name, "zram", 4) == 0)
+    {
+        return 0;
+    }
+    return !block_device_is_partition(major, minor);
+}
+
+/**
+ * @brief 重建 /proc/diskstats 设备索引
+ *
+ * @param buf /proc/diskstats 内容
+ * @param root_major 根设备主设备号
+ * @param root_minor 根设备次设备号
+ * @return 成功返回 0，内容格式错误或内存不足返回 -1
+ */
+static int disk_index_rebuild(const char *buf, unsigned int root_major, unsigned int root_minor)
+{
+    disk_index.built = 0;
+    disk_index.line_count = 0;
+    disk_index.dev_count = 0;
+    disk_index.rebuilds++;
+    for (const char *p = buf; *p; p = kp_next_line(p))
+    {
+        unsigned long long major, minor;
+        const char *name;
+        size_t name_len;
+        if ((p = kp_parse_u64(p, &major)) == NULL ||
+            (p = kp_parse_u64(p, &minor)) == NULL ||
+            (p = kp_token(p, &name, &name_len)) == NULL)
+        {
+            return -1;
+        }
+        if (disk_index.line_count == disk_index.line_cap)
+        {
+            int cap = disk_index.line_cap ? disk_index.line_cap * 2 : 64;
+            DiskLine *lines = realloc(disk_index.lines, (size_t)cap * sizeof(DiskLine));
+            if (!lines)
+            {
+                return -1;
+            }
+            disk_index.lines = lines;
+            disk_index.line_cap = cap;
+        }
+
+        DiskLine *line = &disk_index.lines[disk_index.line_count++];
+        line->major = (unsigned int)major;
+        line->minor = (unsigned int)minor;
+        line->root = (line->major == root_major && line->minor == root_minor);
+        line->slot = -1;
+
+        char dev[DISK_NAME_MAX];
+        if (disk_filter_enabled() && disk_index.dev_count < DISK_MAX && name_len < sizeof(dev))
+        {
+            memcpy(dev, name, name_len);
+            dev[name_len] = '\0';
+            if (disk_selected(dev, line->major, line->minor))
+            {
+                line->slot = disk_index.dev_count;
+                memcpy(disk_index.name[disk_index.dev_count++], dev, sizeof(dev));
+            }
+        }
+    }
+    disk_index.root_major = root_major;
+    disk_index.root_minor = root_minor;
+    disk_index.built = 1;
+    return 0;
+}
+
+/**
+ * @brief 用 /proc/diskstats 一行的计数器填充根设备统计
+ */
+static void diskstats_fill(DiskStats *stats, const unsigned long long *v)
+{
+    stats->reads_completed = v[0];
+    stats->read_merges = v[1];
+    stats->read_sectors = v[2];
+    stats->reading_ms = v[3];
+    stats->writes_completed = v[4];
+    stats->write_merges = v[5];
+    stats->write_sectors = v[6];
+    stats->writing_ms = v[7];
+    stats->ios_in_progress = v[8];
+    stats->iotime_ms = v[9];
+    stats->weighted_io_time = v[10];
+}
+
+/**
+ * @brief 单次遍历 /proc/diskstats，按索引取出根设备和选中设备的计数器
+ *
+ * 逐行核对设备号与索引是否一致，不一致（设备增减）时重建索引并重新遍历一次。
+ *
+ * @param buf /proc/diskstats 内容
+ * @param root_major 根设备主设备号
+ * @param root_minor 根设备次设备号
+ * @param root 输出参数，根设备统计，NULL 表示不需要
+ * @param devs 输出参数，选中设备的计数器，NULL 表示不需要
+ * @return 成功返回 0；格式错误或需要根设备而未找到时返回 -1
+ */
+static int diskstats_scan(const char *buf, unsigned int root_major, unsigned int root_minor,
+                          DiskStats *root, BlockDevStats *devs)
+{
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        if ((attempt > 0 || !disk_index.built || disk_index.root_major != root_major ||
+             disk_index.root_minor != root_minor) &&
+            disk_index_rebuild(buf, root_major, root_minor) != 0)
+        {
+            return -1;
+        }
+
+        int found = 0, fields = 0, i = 0, stale = 0;
+        for (const char *p = buf; *p; p = kp_next_line(p), i++)
+        {
+            unsigned long long major, minor, v[DISK_FIELDS] = {0};
+            const char *name;
+            size_t name_len;
+            if ((p = kp_parse_u64(p, &major)) == NULL ||
+                (p = kp_parse_u64(p, &minor)) == NULL)
+            {
+                return -1;
+            }
+            if (i >= disk_index.line_count || disk_index.lines[i].major != major || disk_index.lines[i].minor != minor)
+            {
+                stale = 1;
+                break;
+            }
+            const DiskLine *line = &disk_index.lines[i];
+            if (!(line->root && root) && !(line->slot >= 0 && devs))
+            {
+                continue;
+            }
+            int n;
+            if ((p = kp_token(p, &name, &name_len)) == NULL || (n = kp_parse_u64_list(p, v, DISK_FIELDS)) < 8)
+            {
+                return -1;
+            }
+            if (line->root && root)
+            {
+                diskstats_fill(root, v);
+                found = 1;
+            }
+            if (line->slot >= 0 && devs)
+            {
+                BlockDev *dev = &devs->dev[line->slot];
+                memcpy(dev->name, disk_index.name[line->slot], DISK_NAME_MAX);
+                memcpy(dev->v, v, sizeof(dev->v));
+                fields = n;
+            }
+        }
+        if (stale || i != disk_index.line_count)
+        {
+            continue;
+        }
+        if (devs)
+        {
+            devs->count = (uint16_t)disk_index.dev_count;
+            devs->fields = (uint16_t)fields;
+        }
+        return (root && !found) ? -1 : 0;
+    }
+    return -1;
+}
+
+/**
+ * @brief 获取根目录挂载分区和按 --disks 选中的全部块设备的磁盘 I/O 统计信息
+ *
+ * 根设备号只在启动时和挂载表变化后解析；两者在同一次 /proc/diskstats 遍历中取出。
+ *
+ * @param stats 输出参数，存储根分区磁盘统计信息
+ * @param devs 输出参数，选中设备的计数器，NULL 表示不需要
+ * @return 成功返回 0，失败返回 -1
+ */
+int get_diskstats(DiskStats *stats, BlockDevStats *devs) {
+    static unsigned long resolved_generation;
+    static int resolved;
+    static unsigned int root_major, root_minor;
+
+    if (!stats) return -1;
+
+    memset(stats, 0, sizeof(DiskStats));
+    if (devs) {
+        devs->count = 0;
+        devs->fields = 0;
+    }
+
+    unsigned long generation = mount_table_generation();
+    if (generation != resolved_generation) {
+        resolved = (resolve_root_device(&root_major, &root_minor) == 0);
+        resolved_generation = generation;
+    }
+    if (!resolved && !devs) {
+        return -1;
+    }
+
+    /* 从 /proc/diskstats 读取设备统计信息 */
+    const char *buf = proc_source_read(SRC_DISKSTATS, NULL);
+    if (!buf) {
+        return -1;
+    }
+
+    if (diskstats_scan(buf, root_major, root_minor, resolved ? stats : NULL, devs) != 0 || !resolved) {
+        fprintf(stderr, "Could not find diskstats for root device: %u:%u\n", root_major, root_minor);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 获取根目录挂载分区的磁盘 I/O 统计信息
+ *
+ * @param stats 输出参数，存储磁盘统计信息
+ * @return 成功返回 0，失败返回 -1
+ */
+int get_root_diskstats(DiskStats *stats) {
+    return get_diskstats(stats, NULL);
+}
+
+/* ============================================================================
+ * 磁盘空间函数
+ * ============================================================================ */
+
+/**
+ * @brief 获取指定路径的磁盘空间信息
+ *
+ * @param path 路径（为空或 NULL 时默认为 "/"）
+ * @param total_size_kb 输出参数，总容量（KB）
+ * @param available_size_kb 输出参数，可用容量（KB）
+ * @return 成功返回 0，失败返回 -1
+ */
+int get_disk_space_kb(const char *path, unsigned long long *total_size_kb, unsigned long long *available_size_kb)
+{
+    const char *effective_path = (path && *path) ? path : "/";
+    struct statvfs vfs;
+
+    if (statvfs(effective_path, &vfs) == -1)
+    {
+        perror("statvfs");
+        return -1;
+    }
+
+    if (total_size_kb)
+    {
+        *total_size_kb = (vfs.f_blocks * vfs.f_frsize) / 1024;
+    }
+    if (available_size_kb)
+    {
+        *available_size_kb = (vfs.f_bavail * vfs.f_frsize) / 1024;
+    }
+
+    return 0;
+}
+
+/* ============================================================================
+ * 文件系统容量
+ *
+ * 文件系统列表从 mountinfo 解析并缓存，只在挂载表变化时刷新。statvfs 交给工作线程执行，
+ * 主线程最多等待 --statvfs-timeout 毫秒：失去响应的 NFS/CIFS 挂载会让 statvfs 无限期阻塞
+ * （不可中断睡眠，信号也无法打断），超时后放弃该线程并另起一个，
+ * 被放弃的线程返回前不再统计同一挂载点，避免线程随周期累积。
+ * ============================================================================ */
+
+#define FS_DEFAULT_TIMEOUT_MS   1000        /**< statvfs 默认超时（毫秒） */
+#define FS_WORKER_STACK         (64 * 1024) /**< 工作线程栈大小 */
+
+/**
+ * @brief 不统计的伪文件系统和内存文件系统类型
+ */
+static const char *const fs_pseudo_types[] = {
+    "autofs", "binfmt_misc", "bpf", "cgroup", "cgroup2", "configfs", "debugfs", "devpts",
+    "devtmpfs", "efivarfs", "fusectl", "fuse.lxcfs", "fuse.gvfsd-fuse", "hugetlbfs", "mqueue",
+    "nsfs", "overlay", "proc", "pstore", "ramfs", "rpc_pipefs", "securityfs", "selinuxfs",
+    "squashfs", "sysfs", "tmpfs", "tracefs", "nfsd",
+};
+
+/**
+ * @brief statvfs 工作线程
+ *
+ * 主线程与工作线程通过同一个互斥锁和条件变量交接请求：主线程写入 path 并置 pending，
+ * 工作线程完成后置 done。主线程超时放弃时置 abandoned，工作线程完成当前调用后退出，
+ * 由主线程在之后的周期中看到 done 后释放。
+ */
+typedef struct
+{
+    pthread_mutex_t lock;       /**< 保护以下字段 */
+    pthread_cond_t cond;        /**< 请求和完成通知 */
+    int pending;                /**< 有待执行的请求 */
+    int done;                   /**< 请求已完成 */
+    int abandoned;              /**< 主线程已放弃等待 */
+    char path[FS_PATH_MAX];     /**< 请求的挂载点 */
+    struct statvfs vfs;         /**< 结果 */
+    int err;                    /**< 0 或 errno */
+} FsWorker;
+
+/**
+ * @brief 文件系统列表缓存和工作线程
+ */
+static struct
+{
+    int enabled;                                /**< 是否上报全部文件系统 */
+    int timeout_ms;                             /**< statvfs 超时（毫秒） */
+    unsigned long generation;                   /**< 列表对应的挂载表代数，0 表示未解析 */
+    int count;                                  /**< 文件系统数 */
+    char path[FS_MAX][FS_PATH_MAX];             /**< 挂载点（已反转义） */
+    char fstype[FS_MAX][FS_TYPE_MAX];           /**< 文件系统类型 */
+    int rdonly[FS_MAX];                         /**< 是否只读挂载 */
+    FsWorker *worker;                           /**< 空闲的工作线程，NULL 表示尚未创建 */
+    FsWorker *abandoned[FS_MAX];                /**< 超时后仍阻塞在 statvfs 中的工作线程 */
+    int abandoned_count;                        /**< abandoned 中的线程数 */
+} fs_table = {.timeout_ms = FS_DEFAULT_TIMEOUT_MS};
+
+/**
+ * @brief 还原 mountinfo 中的八进制转义（\040 等）
+ *
+ * @param in 转义后的字符串（不以 '\0' 结尾）
+ * @param len 长度
+ * @param out 输出缓冲区
+ * @param out_size 输出缓冲区大小
+ * @return 成功返回 0，输出缓冲区不足返回 -1
+ */
+static int mountinfo_unescape(const char *in, size_t len, char *out, size_t out_size)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        if (n + 1 >= out_size)
+        {
+            return -1;
+        }
+        if (in[i] == '\\' && i + 3 < len &&
+            (unsigned)(in[i + 1] - '0') < 4 && (unsigned)(in[i + 2] - '0') < 8 && (unsigned)(in[i + 3] - '0') < 8)
+        {
+            out[n++] = (char)(((in[i + 1] - '0') << 6) | ((in[i + 2] - '0') << 3) | (in[i + 3] - '0'));
+            i += 3;
+        }
+        else
+        {
+            out[n++] = in[i];
+        }
+    }
+    out[n] = '\0';
+    return 0;
+}
+
+/**
+ * @brief 判断文件系统类型是否为伪文件系统
+ */
+static int fs_is_pseudo(const char *fstype, size_t len)
+{
+    for (size_t i = 0; i < sizeof(fs_pseudo_types) / sizeof(fs_pseudo_types[0]); i++)
+    {
+        if (strlen(fs_pseudo_types[i]) == len && memcmp(fs_pseudo_types[i], fstype, len) == 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief 从 mountinfo 重建文件系统列表
+ *
+ * 跳过伪文件系统；同一设备号的多次挂载（bind mount、btrfs 子卷以外的重复挂载）只保留第一个挂载点。
+ *
+ * @return 成功返回 0，读取 mountinfo 失败返回 -1
+ */
+static int fs_table_refresh(void)
+{
+    const char *buf = proc_source_read(SRC_MOUNTINFO, NULL);
+    if (!buf)
+    {
+        return -1;
+    }
+
+    unsigned int devs[FS_MAX][2];
+    fs_table.count = 0;
+    for (const char *p = buf; *p && fs_table.count < FS_MAX; p = kp_next_line(p))
+    {
+        MountEntry entry;
+        if (mountinfo_parse_line(p, &entry) != 0 || entry.fstype_len >= FS_TYPE_MAX ||
+            fs_is_pseudo(entry.fstype, entry.fstype_len))
+        {
+            continue;
+        }
+        int dup = 0;
+        for (int i = 0; i < fs_table.count && !dup; i++)
+        {
+            dup = (devs[i][0] == entry.major && devs[i][1] == entry.minor);
+        }
+        int n = fs_table.count;
+        if (dup || mountinfo_unescape(entry.mount_point, entry.mount_point_len, fs_table.path[n], FS_PATH_MAX) != 0)
+        {
+            continue;
+        }
+        memcpy(fs_table.fstype[n], entry.fstype, entry.fstype_len);
+        fs_table.fstype[n][entry.fstype_len] = '\0';
+
+        /* 挂载选项是挂载点之后的第一个词 */
+        const char *opts = entry.mount_point + entry.mount_point_len;
+        size_t opts_len;
+        fs_table.rdonly[n] = (kp_token(opts, &opts, &opts_len) != NULL && opts_len >= 2 &&
+                              strncmp(opts, "ro", 2) == 0 && (opts_len == 2 || opts[2] == ','));
+        devs[n][0] = entry.major;
+        devs[n][1] = entry.minor;
+        fs_table.count++;
+    }
+    return 0;
+}
+
+/**
+ * @brief 工作线程主函数：循环等待请求并执行 statvfs
+ */
+static void *fs_worker_main(void *arg)
+{
+    FsWorker *w = arg;
+    pthread_mutex_lock(&w->lock);
+    for (;;)
+    {
+        while (!w->pending)
+        {
+            pthread_cond_wait(&w->cond, &w->lock);
+        }
+        char path[FS_PATH_MAX];
+        memcpy(path, w->path, sizeof(path));
+        pthread_mutex_unlock(&w->lock);
+
+        struct statvfs vfs;
+        int err = statvfs(path, &vfs) == 0 ? 0 : errno;
+
+        pthread_mutex_lock(&w->lock);
+        w->vfs = vfs;
+        w->err = err;
+        w->pending = 0;
+        w->done = 1;
+        if (w->abandoned)
+        {
+            break;
+        }
+        pthread_cond_broadcast(&w->cond);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+/**
+ * @brief 创建工作线程（分离、小栈、屏蔽全部信号）
+ *
+ * @return 成功返回工作线程，失败返回 NULL
+ */
+static FsWorker *fs_worker_start(void)
+{
+    FsWorker *w = calloc(1, sizeof(FsWorker));
+    if (!w)
+    {
+        return NULL;
+    }
+    pthread_condattr_t cattr;
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, &cattr);
+    pthread_condattr_destroy(&cattr);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_attr_setstacksize(&attr, FS_WORKER_STACK);
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    pthread_t tid;
+    int ret = pthread_create(&tid, &attr, fs_worker_main, w);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    pthread_attr_destroy(&attr);
+    if (ret != 0)
+    {
+        fprintf(stderr, "pthread_create: %s\n", strerror(ret));
+        pthread_cond_destroy(&w->cond);
+        pthread_mutex_destroy(&w->lock);
+        free(w);
+        return NULL;
+    }
+    return w;
+}
+
+/**
+ * @brief 释放已经返回的被放弃线程；返回仍阻塞在指定挂载点上的线程是否存在
+ *
+ * @param path 挂载点，NULL 表示只做清理
+ * @return 有线程仍阻塞在 path 上返回 1，否则返回 0
+ */
+static int fs_reap_abandoned(const char *path)
+{
+    int stuck = 0;
+    for (int i = 0; i < fs_table.abandoned_count;)
+    {
+        FsWorker *w = fs_table.abandoned[i];
+        pthread_mutex_lock(&w->lock);
+        int done = w->done;
+        int same = path && strcmp(w->path, path) == 0;
+        pthread_mutex_unlock(&w->lock);
+        if (done)
+        {
+            pthread_cond_destroy(&w->cond);
+            pthread_mutex_destroy(&w->lock);
+            free(w);
+            fs_table.abandoned[i] = fs_table.abandoned[--fs_table.abandoned_count];
+            continue;
+        }
+        stuck |= same;
+        i++;
+    }
+    return stuck;
+}
+
+/**
+ * @brief 带超时的 statvfs
+ *
+ * @param path 挂载点
+ * @param vfs 输出参数，结果
+ * @return 成功返回 0；失败返回 errno，超时（或上一次超时的调用仍未返回）返回 ETIMEDOUT
+ */
+static int fs_statvfs_timed(const char *path, struct statvfs *vfs)
+{
+    if (fs_reap_abandoned(path) || fs_table.abandoned_count >= FS_MAX)
+    {
+        return ETIMEDOUT;
+    }
+    if (!fs_table.worker && (fs_table.worker = fs_worker_start()) == NULL)
+    {
+        return EAGAIN;
+    }
+
+    FsWorker *w = fs_table.worker;
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += fs_table.timeout_ms / 1000;
+    deadline.tv_nsec += (long)(fs_table.timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&w->lock);
+    snprintf(w->path, sizeof(w->path), "%s", path);
+    w->done = 0;
+    w->pending = 1;
+    pthread_cond_broadcast(&w->cond);
+    int ret = 0;
+    while (!w->done && ret != ETIMEDOUT)
+    {
+        ret = pthread_cond_timedwait(&w->cond, &w->lock, &deadline);
+    }
+    if (w->done)
+    {
+        *vfs = w->vfs;
+        ret = w->err;
+        pthread_mutex_unlock(&w->lock);
+        return ret;
+    }
+    w->abandoned = 1;
+    pthread_mutex_unlock(&w->lock);
+
+    fprintf(stderr, "statvfs(%s) timed out after %d ms\n", path, fs_table.timeout_ms);
+    fs_table.abandoned[fs_table.abandoned_count++] = w;
+    fs_table.worker = NULL;
+    return ETIMEDOUT;
+}
+
+/**
+ * @brief 获取全部真实文件系统的容量和 inode 使用情况
+ *
+ * @param stats 输出参数
+ * @return 成功返回 0，读取挂载表失败返回 -1
+ */
+int get_filesystems(FsStats *stats)
+{
+    stats->count = 0;
+    unsigned long generation = mount_table_generation();
+    if (generation != fs_table.generation)
+    {
+        if (fs_table_refresh() != 0)
+        {
+            return -1;
+        }
+        fs_table.generation = generation;
+    }
+
+    for (int i = 0; i < fs_table.count; i++)
+    {
+        FsUsage *fs = &stats->fs[stats->count++];
+        memset(fs, 0, sizeof(*fs));
+        memcpy(fs->mount_point, fs_table.path[i], FS_PATH_MAX);
+        memcpy(fs->fstype, fs_table.fstype[i], FS_TYPE_MAX);
+        fs->flags = fs_table.rdonly[i] ? FS_FLAG_RDONLY : 0;
+
+        struct statvfs vfs;
+        int err = fs_statvfs_timed(fs_table.path[i], &vfs);
+        if (err != 0)
+        {
+            fs->flags |= (err == ETIMEDOUT) ? FS_FLAG_TIMEOUT : FS_FLAG_ERROR;
+            continue;
+        }
+        fs->total_kb = (unsigned long long)vfs.f_blocks * vfs.f_frsize / 1024;
+        fs->free_kb = (unsigned long long)vfs.f_bfree * vfs.f_frsize / 1024;
+        fs->avail_kb = (unsigned long long)vfs.f_bavail * vfs.f_frsize / 1024;
+        fs->inodes_total = vfs.f_files;
+        fs->inodes_free = vfs.f_ffree;
+    }
+    return 0;
+}
+
+/* ============================================================================
+ * 进程排行
+ *
+ * 持有 /proc 的目录 fd，每个周期 lseek 回开头后用 getdents64 批量读取目录项，
+ * 每个进程用 openat 相对该 fd 打开 stat 和 io，读入复用的缓冲区。
+ * 进程表以 pid 为键（开放寻址），保存上一次的 CPU 时间和 I/O 计数以计算差值，
+ * 按启动时间识别 pid 复用；各维度的前 N 名用大小为 N 的最小堆选出。
+ * ============================================================================ */
+
+#define PROC_DENTS_BUF      (64 * 1024)     /**< getdents64 缓冲区大小 */
+#define PROC_FILE_BUF       1024            /**< stat、io 读取缓冲区大小 */
+
+/**
+ * @brief getdents64 返回的目录项（内核 struct linux_dirent64）
+ */
+struct linux_dirent64
+{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+/**
+ * @brief 进程表项
+ */
+typedef struct
+{
+    int32_t pid;                        /**< 进程号，0 表示空槽 */
+    uint32_t gen;                       /**< 最近一次出现在遍历中的代数 */
+    unsigned long long start_time;      /**< 启动时间（jiffies），用于识别 pid 复用 */
+    unsigned long long cpu_ticks;       /**< utime + stime */
+    unsigned long long read_bytes;      /**< 累计 read_bytes */
+    unsigned long long write_bytes;     /**< 累计 write_bytes */
+    int valid;                          /**< 以上计数器是否已读取（事件新加入的进程为 0） */
+    int stat_fd;                        /**< 缓存的 <pid>/stat fd，-1 表示每次 openat */
+} ProcEntry;
+
+/**
+ * @brief 进程采集器状态
+ */
+static struct
+{
+    int top_n;                          /**< 每个维度上报的进程数，0 表示关闭 */
+    int dir_fd;                         /**< /proc 目录 fd */
+    char *dents;                        /**< getdents64 缓冲区 */
+    ProcEntry *table;                   /**< 进程表（开放寻址，容量为 2 的幂） */
+    uint32_t cap;                       /**< 进程表容量 */
+    uint32_t count;                     /**< 进程表中的进程数 */
+    uint32_t gen;                       /**< 当前遍历代数 */
+    uint64_t last_ns;                   /**< 上一次遍历的时间（单调时钟） */
+    long page_kb;                       /**< 页大小（KB） */
+    long clk_tck;                       /**< 每秒 jiffies 数 */
+    int tracked;                        /**< 进程表由 proc connector 事件维护，无需遍历目录 */
+    uint32_t fd_budget;                 /**< 最多缓存的 stat fd 数，0 表示不缓存 */
+    uint32_t cached_fds;                /**< 当前缓存的 stat fd 数 */
+} proc_top = {.dir_fd = -1};
+
+/**
+ * @brief 进程排行的候选项（堆元素）
+ */
+typedef struct
+{
+    double key;                         /**< 排序键 */
+    ProcTopEntry entry;                 /**< 上报内容 */
+} ProcTopCandidate;
+
+/**
+ * @brief 大小为 cap 的最小堆：未满时插入，已满时只替换堆顶（当前第 N 名）
+ *
+ * @param heap 堆数组
+ * @param n 输入输出参数，堆中的元素数
+ * @param cap 堆容量
+ * @param item 候选项
+ */
+static void proc_heap_offer(ProcTopCandidate *heap, int *n, int cap, const ProcTopCandidate *item)
+{
+    int i;
+    if (*n < cap)
+    {
+        /* 上浮 */
+        for (i = (*n)++; i > 0 && heap[(i - 1) / 2].key > item->key; i = (i - 1) / 2)
+        {
+            heap[i] = heap[(i - 1) / 2];
+        }
+        heap[i] = *item;
+        return;
+    }
+    if (item->key <= heap[0].key)
+    {
+        return;
+    }
+    /* 替换堆顶后下沉 */
+    for (i = 0;;)
+    {
+        int child = 2 * i + 1;
+        if (child >= *n)
+        {
+            break;
+        }
+        if (child + 1 < *n && heap[child + 1].key < heap[child].key)
+        {
+            child++;
+        }
+        if (heap[child].key >= item->key)
+        {
+            break;
+        }
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = *item;
+}
+
+/**
+ * @brief 把最小堆中的元素按降序写入上报结构
+ */
+static int proc_heap_drain(ProcTopCandidate *heap, int n, ProcTopEntry *out)
+{
+    int count = n;
+    while (n > 0)
+    {
+        out[n - 1] = heap[0].entry;
+        ProcTopCandidate last = heap[--n];
+        int i = 0;
+        for (;;)
+        {
+            int child = 2 * i + 1;
+            if (child >= n)
+            {
+                break;
+            }
+            if (child + 1 < n && heap[child + 1].key < heap[child].key)
+            {
+                child++;
+            }
+            if (heap[child].key >= last.key)
+            {
+                break;
+            }
+            heap[i] = heap[child];
+            i = child;
+        }
+        if (n > 0)
+        {
+            heap[i] = last;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief 在进程表中查找 pid，不存在时返回应插入的空槽
+ */
+static ProcEntry *proc_table_slot(int32_t pid)
+{
+    uint32_t mask = proc_top.cap - 1;
+    for (uint32_t i = ((uint32_t)pid * 2654435761u) & mask;; i = (i + 1) & mask)
+    {
+        if (proc_top.table[i].pid == pid || proc_top.table[i].pid == 0)
+        {
+            return &proc_top.table[i];
+        }
+    }
+}
+
+/**
+ * @brief 扩容进程表（装载因子超过 1/2 时调用）
+ *
+ * @return 成功返回 0，内存不足返回 -1
+ */
+static int proc_table_grow(void)
+{
+    uint32_t old_cap = proc_top.cap;
+    ProcEntry *old = proc_top.table;
+    uint32_t cap = old_cap ? old_cap * 2 : 1024;
+    ProcEntry *table = calloc(cap, sizeof(ProcEntry));
+    if (!table)
+    {
+        return -1;
+    }
+    proc_top.table = table;
+    proc_top.cap = cap;
+    for (uint32_t i = 0; i < old_cap; i++)
+    {
+        if (old[i].pid)
+        {
+            *proc_table_slot(old[i].pid) = old[i];
+        }
+    }
+    free(old);
+    return 0;
+}
+
+/**
+ * @brief 删除表项（线性探测的后移删除），同时关闭缓存的 fd
+ *
+ * 后续同一探测链上的表项前移填补空槽，因此调用者遍历时删除后应重新检查同一个槽。
+ *
+ * @param e 表项
+ */
+static void proc_table_delete(ProcEntry *e)
+{
+    uint32_t mask = proc_top.cap - 1;
+    uint32_t hole = (uint32_t)(e - proc_top.table);
+    if (e->stat_fd >= 0)
+    {
+        close(e->stat_fd);
+        proc_top.cached_fds--;
+    }
+    for (uint32_t j = (hole + 1) & mask; proc_top.table[j].pid; j = (j + 1) & mask)
+    {
+        uint32_t home = ((uint32_t)proc_top.table[j].pid * 2654435761u) & mask;
+        if (((j - home) & mask) >= ((j - hole) & mask))
+        {
+            proc_top.table[hole] = proc_top.table[j];
+            hole = j;
+        }
+    }
+    proc_top.table[hole].pid = 0;
+    proc_top.count--;
+}
+
+/**
+ * @brief 插入进程（已存在时返回原表项），必要时扩容
+ *
+ * @return 成功返回表项，内存不足返回 NULL
+ */
+static ProcEntry *proc_table_insert(int32_t pid)
+{
+    if (proc_top.count * 2 >= proc_top.cap && proc_table_grow() != 0)
+    {
+        return NULL;
+    }
+    ProcEntry *e = proc_table_slot(pid);
+    if (!e->pid)
+    {
+        memset(e, 0, sizeof(*e));
+        e->pid = pid;
+        e->stat_fd = -1;
+        proc_top.count++;
+    }
+    return e;
+}
+
+/**
+ * @brief 删除本次遍历中没有出现的进程
+ */
+static void proc_table_sweep(void)
+{
+    for (uint32_t i = 0; i < proc_top.cap;)
+    {
+        ProcEntry *e = &proc_top.table[i];
+        if (!e->pid || e->gen == proc_top.gen)
+        {
+            i++;
+            continue;
+        }
+        proc_table_delete(e);
+    }
+}
+
+/**
+ * @brief 相对 /proc 目录 fd 读取 <pid>/<name> 到缓冲区
+ *
+ * @return 读取的字节数，失败（进程已退出、无权限）返回 -1
+ */
+static ssize_t proc_read_pid_file(const char *pid, const char *name, char *buf, size_t size)
+{
+    char path[32];
+    snprintf(path, sizeof(path), "%s/%s", pid, name);
+    int fd = openat(proc_top.dir_fd, path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    ssize_t n = read(fd, buf, size - 1);
+    close(fd);
+    if (n < 0)
+    {
+        return -1;
+    }
+    buf[n] = '\0';
+    return n;
+}
+
+/**
+ * @brief 解析 /proc/<pid>/stat
+ *
+ * 进程名可能含空格和括号，取最后一个 ')' 之后的字段：state 为第 1 个，utime、stime 为第 12、13 个，
+ * starttime 为第 20 个，rss（页）为第 22 个。
+ *
+ * @return 成功返回 0，格式错误返回 -1
+ */
+static int proc_parse_stat(const char *buf, char *comm, unsigned long long *cpu_ticks,
+                           unsigned long long *start_time, unsigned long long *rss_pages)
+{
+    const char *open = strchr(buf, '(');
+    const char *close = strrchr(buf, ')');
+    if (!open || !close || close < open)
+    {
+        return -1;
+    }
+    size_t len = close - open - 1;
+    if (len > 15)
+    {
+        len = 15;
+    }
+    memcpy(comm, open + 1, len);
+    comm[len] = '\0';
+
+    const char *p = close + 1;
+    const char *tok;
+    size_t tok_len;
+    if ((p = kp_token(p, &tok, &tok_len)) == NULL)
+    {
+        return -1;
+    }
+    unsigned long long v[21];
+    /* state 之后的第 2 至 22 个字段都是整数（tty_nr、nice 等可能为负，只跳过） */
+    for (int i = 0; i < 21; i++)
+    {
+        if ((p = kp_token(p, &tok, &tok_len)) == NULL)
+        {
+            return -1;
+        }
+        v[i] = 0;
+        kp_parse_u64(tok, &v[i]);
+    }
+    *cpu_ticks = v[10] + v[11];
+    *start_time = v[18];
+    *rss_pages = v[20];
+    return 0;
+}
+
+/**
+ * @brief 解析 /proc/<pid>/io 中的 read_bytes 和 write_bytes
+ */
+static void proc_parse_io(const char *buf, unsigned long long *read_bytes, unsigned long long *write_bytes)
+{
+    for (const char *p = buf; *p; p = kp_next_line(p))
+    {
+        if (strncmp(p, "read_bytes:", 11) == 0)
+        {
+            kp_parse_u64(p + 11, read_bytes);
+        }
+        else if (strncmp(p, "write_bytes:", 12) == 0)
+        {
+            kp_parse_u64(p + 12, write_bytes);
+        }
+    }
+}
+
+/**
+ * @brief 读取一个进程的 stat：优先 pread 缓存的 fd，否则 openat（启用缓存时保留新打开的 fd）
+ *
+ * 缓存的 fd 绑定到打开时的进程，进程退出后读取失败（ESRCH）；此时重新 openat，
+ * 以便 pid 已被新进程复用时读到新进程。
+ *
+ * @return 读取的字节数，进程已退出返回 -1
+ */
+static ssize_t proc_read_stat(ProcEntry *e, const char *pid, char *buf, size_t size)
+{
+    if (e->stat_fd >= 0)
+    {
+        ssize_t n = pread(e->stat_fd, buf, size - 1, 0);
+        if (n > 0)
+        {
+            buf[n] = '\0';
+            return n;
+        }
+        close(e->stat_fd);
+        e->stat_fd = -1;
+        proc_top.cached_fds--;
+    }
+
+    char path[32];
+    snprintf(path, sizeof(path), "%s/stat", pid);
+    int fd = openat(proc_top.dir_fd, path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    ssize_t n = pread(fd, buf, size - 1, 0);
+    if (n > 0 && proc_top.cached_fds < proc_top.fd_budget)
+    {
+        e->stat_fd = fd;
+        proc_top.cached_fds++;
+    }
+    else
+    {
+        close(fd);
+    }
+    if (n <= 0)
+    {
+        return -1;
+    }
+    buf[n] = '\0';
+    return n;
+}
+
+/**
+ * @brief 遍历中的共享状态
+ */
+typedef struct
+{
+    int ranked;                                         /**< 是否输出排行（已有上一次遍历） */
+    double interval_s;                                  /**< 与上一次遍历的间隔（秒） */
+    ProcTopCandidate heaps[PROC_TOP_DIMS][PROC_TOP_MAX];/**< 各维度的最小堆 */
+    int heap_n[PROC_TOP_DIMS];                          /**< 各堆的元素数 */
+} ProcWalk;
+
+/**
+ * @brief 读取一个进程，更新表项并参与排行
+ *
+ * io 每次都读：utime/stime 以时钟节拍（通常 10 毫秒）计，等待 I/O 为主的进程在一个周期内
+ * CPU 时间可能完全不变，却仍有大量读写。
+ *
+ * @return 成功返回 0，进程已退出返回 -1（表项的 gen 不更新，由 proc_table_sweep 删除）
+ */
+static int proc_visit(ProcEntry *e, ProcWalk *walk, ProcTopStats *stats)
+{
+    char pid[16], buf[PROC_FILE_BUF];
+    ProcTopCandidate c;
+    unsigned long long cpu_ticks, start_time, rss_pages;
+    memset(&c, 0, sizeof(c));
+    snprintf(pid, sizeof(pid), "%d", e->pid);
+    if (proc_read_stat(e, pid, buf, sizeof(buf)) < 0 ||
+        proc_parse_stat(buf, c.entry.comm, &cpu_ticks, &start_time, &rss_pages) != 0)
+    {
+        return -1;
+    }
+
+    int known = e->valid && e->start_time == start_time;
+    unsigned long long read_bytes = known ? e->read_bytes : 0, write_bytes = known ? e->write_bytes : 0;
+    if (proc_read_pid_file(pid, "io", buf, sizeof(buf)) > 0)
+    {
+        proc_parse_io(buf, &read_bytes, &write_bytes);
+    }
+
+    c.entry.pid = e->pid;
+    c.entry.rss_kb = rss_pages * proc_top.page_kb;
+    if (known)
+    {
+        c.entry.cpu_pct = (float)((double)(cpu_ticks - e->cpu_ticks) * 100.0 / proc_top.clk_tck / walk->interval_s);
+        c.entry.read_bytes = read_bytes >= e->read_bytes ? read_bytes - e->read_bytes : 0;
+        c.entry.write_bytes = write_bytes >= e->write_bytes ? write_bytes - e->write_bytes : 0;
+    }
+    e->gen = proc_top.gen;
+    e->valid = 1;
+    e->start_time = start_time;
+    e->cpu_ticks = cpu_ticks;
+    e->read_bytes = read_bytes;
+    e->write_bytes = write_bytes;
+    stats->processes++;
+
+    if (!walk->ranked || proc_top.top_n <= 0)
+    {
+        return 0;
+    }
+    /* 新进程没有基线，只参与内存排行 */
+    c.key = (double)c.entry.rss_kb;
+    proc_heap_offer(walk->heaps[PROC_TOP_RSS], &walk->heap_n[PROC_TOP_RSS], proc_top.top_n, &c);
+    if (known && c.entry.cpu_pct > 0)
+    {
+        c.key = c.entry.cpu_pct;
+        proc_heap_offer(walk->heaps[PROC_TOP_CPU], &walk->heap_n[PROC_TOP_CPU], proc_top.top_n, &c);
+    }
+    if (known && c.entry.read_bytes + c.entry.write_bytes > 0)
+    {
+        c.key = (double)(c.entry.read_bytes + c.entry.write_bytes);
+        proc_heap_offer(walk->heaps[PROC_TOP_IO], &walk->heap_n[PROC_TOP_IO], proc_top.top_n, &c);
+    }
+    return 0;
+}
+
+/**
+ * @brief 用 getdents64 遍历 /proc 目录，进程表与目录内容同步
+ *
+ * @return 成功返回 0，失败返回 -1
+ */
+static int proc_walk_dir(ProcWalk *walk, ProcTopStats *stats)
+{
+    if (lseek(proc_top.dir_fd, 0, SEEK_SET) != 0)
+    {
+        perror("lseek /proc");
+        return -1;
+    }
+    long n;
+    while ((n = syscall(SYS_getdents64, proc_top.dir_fd, proc_top.dents, PROC_DENTS_BUF)) > 0)
+    {
+        for (long off = 0; off < n;)
+        {
+            const struct linux_dirent64 *d = (const struct linux_dirent64 *)(proc_top.dents + off);
+            off += d->d_reclen;
+            unsigned long long pid;
+            const char *end = kp_parse_u64(d->d_name, &pid);
+            if (!end || *end != '\0' || pid == 0 || pid > INT32_MAX)
+            {
+                continue;
+            }
+            ProcEntry *e = proc_table_insert((int32_t)pid);
+            if (!e)
+            {
+                return -1;
+            }
+            proc_visit(e, walk, stats);
+        }
+    }
+    if (n < 0)
+    {
+        perror("getdents64 /proc");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 计算各进程相对上一次遍历的差值并选出各维度的前 N 名
+ *
+ * 进程表由 proc connector 事件维护时直接读取表中的进程（pread 缓存的 fd），
+ * 否则用 getdents64 遍历 /proc。首次遍历只建立基线，不输出排行。
+ *
+ * @param stats 输出参数
+ * @return 成功返回 0，失败返回 -1
+ */
+int get_top_processes(ProcTopStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    if (proc_top.dir_fd < 0)
+    {
+        proc_top.dir_fd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        proc_top.dents = malloc(PROC_DENTS_BUF);
+        proc_top.page_kb = sysconf(_SC_PAGESIZE) / 1024;
+        proc_top.clk_tck = sysconf(_SC_CLK_TCK);
+        if (proc_top.dir_fd < 0 || !proc_top.dents || proc_table_grow() != 0)
+        {
+            perror("/proc");
+            return -1;
+        }
+    }
+
+    static ProcWalk walk;
+    uint64_t now = monotonic_ns();
+    memset(walk.heap_n, 0, sizeof(walk.heap_n));
+    walk.interval_s = proc_top.last_ns ? (double)(now - proc_top.last_ns) / 1e9 : 0;
+    walk.ranked = walk.interval_s > 0;
+    proc_top.last_ns = now;
+    proc_top.gen++;
+
+    if (proc_top.tracked)
+    {
+        for (uint32_t i = 0; i < proc_top.cap; i++)
+        {
+            if (proc_top.table[i].pid)
+            {
+                proc_visit(&proc_top.table[i], &walk, stats);
+            }
+        }
+    }
+    else if (proc_walk_dir(&walk, stats) != 0)
+    {
+        return -1;
+    }
+    proc_table_sweep();
+
+    if (walk.ranked)
+    {
+        stats->interval_ms = (uint32_t)(walk.interval_s * 1000 + 0.5);
+        for (int dim = 0; dim < PROC_TOP_DIMS; dim++)
+        {
+            stats->count[dim] = (uint16_t)proc_heap_drain(walk.heaps[dim], walk.heap_n[dim], stats->top[dim]);
+        }
+    }
+    return 0;
+}
+
+/* ============================================================================
+ * 进程事件（proc connector）
+ *
+ * 订阅内核 proc connector 的 fork/exec/exit 事件，统计进程创建、exec 和退出速率；
+ * 启用进程排行时同时按事件增删进程表（进程表项缓存 stat fd），进程排行不再遍历 /proc。
+ * 事件丢失（ENOBUFS）时下一次进程排行重新遍历一次 /proc 校正进程表。
+ * ============================================================================ */
+
+#define PROC_EVENTS_BUF         (64 * 1024)         /**< 事件接收缓冲区大小 */
+#define PROC_EVENTS_RCVBUF      (8 * 1024 * 1024)   /**< 套接字接收缓冲区大小 */
+#define PROC_EVENTS_FD_RESERVE  256                 /**< 缓存 fd 时为其他用途保留的 fd 数 */
+
+#define PROC_EVENTS_FLAG_LOST   1       /**< 本周期有事件丢失，速率偏低 */
+
+/**
+ * @brief 进程事件采集器状态
+ */
+static struct
+{
+    int enabled;                /**< 是否启用 */
+    int fd;                     /**< NETLINK_CONNECTOR 套接字，-1 表示未打开 */
+    char *buf;                  /**< 接收缓冲区 */
+    uint64_t forks;             /**< 本周期的进程创建数（不含线程） */
+    uint64_t execs;             /**< 本周期的 exec 数 */
+    uint64_t exits;             /**< 本周期的进程退出数（不含线程） */
+    int lost;                   /**< 本周期是否丢失过事件 */
+    uint64_t last_ns;           /**< 上一次输出的时间（单调时钟） */
+} proc_events = {.fd = -1};
+
+/**
+ * @brief 打开 proc connector 套接字并订阅事件
+ *
+ * 需要 CAP_NET_ADMIN。启用进程排行时把 RLIMIT_NOFILE 软限制提高到硬限制，用于缓存每个进程的 stat fd。
+ *
+ * @return 成功返回 0，失败返回 -1
+ */
+static int proc_events_open(void)
+{
+    int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+    if (fd < 0)
+    {
+        perror("NETLINK_CONNECTOR");
+        return -1;
+    }
+    int rcvbuf = PROC_EVENTS_RCVBUF;
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) != 0)
+    {
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+    struct sockaddr_nl local = {.nl_family = AF_NETLINK, .nl_groups = CN_IDX_PROC};
+    if (bind(fd, (struct sockaddr *)&local, sizeof(local)) != 0)
+    {
+        perror("bind CN_IDX_PROC");
+        close(fd);
+        return -1;
+    }
+
+    struct
+    {
+        struct nlmsghdr nlh;
+        struct cn_msg cn;
+        enum proc_cn_mcast_op op;
+    } __attribute__((packed)) request;
+    memset(&request, 0, sizeof(request));
+    request.nlh.nlmsg_len = sizeof(request);
+    request.nlh.nlmsg_type = NLMSG_DONE;
+    request.cn.id.idx = CN_IDX_PROC;
+    request.cn.id.val = CN_VAL_PROC;
+    request.cn.len = sizeof(request.op);
+    request.op = PROC_CN_MCAST_LISTEN;
+    if (send(fd, &request, sizeof(request), 0) < 0)
+    {
+        perror("PROC_CN_MCAST_LISTEN");
+        close(fd);
+        return -1;
+    }
+
+    if (proc_top.top_n > 0)
+    {
+        struct rlimit rl;
+        if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max)
+        {
+            rl.rlim_cur = rl.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &rl);
+        }
+        if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur > 2 * PROC_EVENTS_FD_RESERVE)
+        {
+            rlim_t budget = rl.rlim_cur - PROC_EVENTS_FD_RESERVE;
+            proc_top.fd_budget = budget > UINT32_MAX ? UINT32_MAX : (uint32_t)budget;
+        }
+    }
+    proc_events.fd = fd;
+    return 0;
+}
+
+/**
+ * @brief 处理积压的进程事件（非阻塞）
+ */
+void proc_events_drain(void)
+{
+    if (proc_events.fd < 0)
+    {
+        return;
+    }
+    for (;;)
+    {
+        ssize_t n = recv(proc_events.fd, proc_events.buf, PROC_EVENTS_BUF, 0);
+        if (n < 0)
+        {
+            if (errno == ENOBUFS)
+            {
+                /* 事件丢失：进程表可能漏掉了增删，下次进程排行重新遍历 /proc */
+                proc_events.lost = 1;
+                proc_top.tracked = 0;
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                perror("recv proc events");
+            }
+            return;
+        }
+
+        int len = (int)n;
+        for (struct nlmsghdr *nlh = (struct nlmsghdr *)proc_events.buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len))
+        {
+            const struct cn_msg *cn = NLMSG_DATA(nlh);
+            if (cn->id.idx != CN_IDX_PROC || cn->len < sizeof(struct proc_event) - sizeof(((struct proc_event *)0)->event_data))
+            {
+                continue;
+            }
+            const struct proc_event *ev = (const struct proc_event *)cn->data;
+            switch (ev->what)
+            {
+            case PROC_EVENT_FORK:
+                if (ev->event_data.fork.child_pid == ev->event_data.fork.child_tgid)
+                {
+                    proc_events.forks++;
+                    if (proc_top.tracked && !proc_table_insert(ev->event_data.fork.child_tgid))
+                    {
+                        proc_top.tracked = 0;
+                    }
+                }
+                break;
+            case PROC_EVENT_EXEC:
+                proc_events.execs++;
+                break;
+            case PROC_EVENT_EXIT:
+                if (ev->event_data.exit.process_pid == ev->event_data.exit.process_tgid)
+                {
+                    proc_events.exits++;
+                    if (proc_top.tracked)
+                    {
+                        ProcEntry *e = proc_table_slot(ev->event_data.exit.process_tgid);
+                        if (e->pid)
+                        {
+                            proc_table_delete(e);
+                        }
+                    }
+                }
+                break;
+            default:
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * @brief 输出本周期的进程事件速率
+ *
+ * 首次调用时订阅事件，之后每次调用先处理积压的事件，再按与上一次调用的间隔计算速率。
+ *
+ * @param stats 输出参数
+ * @return 成功返回 0，订阅失败返回 -1
+ */
+int get_proc_events(ProcEventStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    if (proc_events.fd < 0)
+    {
+        if (!proc_events.buf && (proc_events.buf = malloc(PROC_EVENTS_BUF)) == NULL)
+        {
+            return -1;
+        }
+        if (proc_events_open() != 0)
+        {
+            proc_events.enabled = 0;
+            return -1;
+        }
+        proc_events.last_ns = monotonic_ns();
+        return 0;
+    }
+
+    proc_events_drain();
+    uint64_t now = monotonic_ns();
+    double interval_s = (double)(now - proc_events.last_ns) / 1e9;
+    stats->interval_ms = (uint32_t)(interval_s * 1000 + 0.5);
+    stats->flags = proc_events.lost ? PROC_EVENTS_FLAG_LOST : 0;
+    stats->forks_ps = (float)(proc_events.forks / interval_s);
+    stats->execs_ps = (float)(proc_events.execs / interval_s);
+    stats->exits_ps = (float)(proc_events.exits / interval_s);
+    proc_events.last_ns = now;
+    proc_events.forks = proc_events.execs = proc_events.exits = 0;
+    proc_events.lost = 0;
+    return 0;
+}
+
+/**
+ * @brief 在进程排行之后调用：本次遍历过 /proc 时，进程表已与目录同步，此后改由事件维护
+ */
+static void proc_events_sync_table(void)
+{
+    if (proc_events.fd >= 0 && proc_top.top_n > 0 && proc_top.dir_fd >= 0)
+    {
+        proc_top.tracked = 1;
+    }
+}
+
+/* ============================================================================
+ * 压力阻塞信息（PSI）
+ *
+ * 读取 /proc/pressure/{cpu,memory,io} 的 some/full 两行。可选注册内核 PSI 触发器：
+ * 触发器 fd 在事件循环中等待，触发时立即采集并上报一个带外样本。
+ * ============================================================================ */
+
+#define PSI_TRIGGER_MAX     8           /**< 最多注册的触发器数 */
+#define PSI_TRIGGER_SPEC    48          /**< 触发器写入内容的最大长度 */
+
+static const char *const psi_resource_names[PSI_RESOURCES] = {"cpu", "memory", "io"};
+
+/**
+ * @brief 一个 PSI 触发器
+ */
+typedef struct
+{
+    int resource;                       /**< PSI_CPU 等 */
+    int full;                           /**< 1 为 full，0 为 some */
+    char spec[PSI_TRIGGER_SPEC];        /**< 写入压力文件的内容，如 "some 150000 1000000" */
+    int fd;                             /**< 触发器 fd，-1 表示未注册 */
+} PsiTrigger;
+
+/**
+ * @brief PSI 采集器状态
+ */
+static struct
+{
+    int enabled;                        /**< 是否采集 PSI */
+    int unavailable;                    /**< 位掩码：读取失败（内核未启用 PSI）的资源 */
+    PsiTrigger triggers[PSI_TRIGGER_MAX];   /**< 触发器 */
+    int trigger_count;                  /**< 触发器数 */
+    uint32_t fired;                     /**< 上一次采集以来触发过的 (资源, some/full) 位掩码 */
+} psi;
+
+/**
+ * @brief 解析 PSI 文件内容
+ *
+ * 格式：some avg10=0.00 avg60=0.00 avg300=0.00 total=0，full 行相同（旧内核的 cpu 文件没有 full 行）。
+ *
+ * @param buf 文件内容
+ * @param some 输出参数，some 行
+ * @param full 输出参数，full 行（缺失时清零）
+ * @return 至少解析出 some 行返回 0，否则返回 -1
+ */
+static int psi_parse(const char *buf, PsiLine *some, PsiLine *full)
+{
+    int found = 0;
+    memset(some, 0, sizeof(*some));
+    memset(full, 0, sizeof(*full));
+    for (const char *p = buf; *p; p = kp_next_line(p))
+    {
+        PsiLine *line = strncmp(p, "some ", 5) == 0 ? some : strncmp(p, "full ", 5) == 0 ? full : NULL;
+        const char *a10 = line ? strstr(p, "avg10=") : NULL;
+        const char *a60 = line ? strstr(p, "avg60=") : NULL;
+        const char *total = line ? strstr(p, "total=") : NULL;
+        double v10, v60;
+        if (!a10 || !a60 || !total || !kp_parse_fixed(a10 + 6, &v10) || !kp_parse_fixed(a60 + 6, &v60) ||
+            !kp_parse_u64(total + 6, &line->total_us))
+        {
+            continue;
+        }
+        line->avg10 = (float)v10;
+        line->avg60 = (float)v60;
+        found |= (line == some);
+    }
+    return found ? 0 : -1;
+}
+
+/**
+ * @brief 解析 --psi-trigger 参数：resource:some|full:stall_us:window_us
+ *
+ * @return 成功返回 0，格式错误或触发器过多返回 -1
+ */
+static int psi_add_trigger(const char *arg)
+{
+    char resource[16], kind[8];
+    unsigned long stall_us, window_us;
+    if (psi.trigger_count >= PSI_TRIGGER_MAX ||
+        sscanf(arg, "%15[a-z]:%7[a-z]:%lu:%lu", resource, kind, &stall_us, &window_us) != 4 ||
+        (strcmp(kind, "some") != 0 && strcmp(kind, "full") != 0) || stall_us == 0 || stall_us > window_us)
+    {
+        return -1;
+    }
+    PsiTrigger *t = &psi.triggers[psi.trigger_count];
+    t->resource = -1;
+    for (int r = 0; r < PSI_RESOURCES; r++)
+    {
+        if (strcmp(resource, psi_resource_names[r]) == 0)
+        {
+            t->resource = r;
+        }
+    }
+    if (t->resource < 0)
+    {
+        return -1;
+    }
+    t->full = kind[0] == 'f';
+    t->fd = -1;
+    snprintf(t->spec, sizeof(t->spec), "%s %lu %lu", kind, stall_us, window_us);
+    psi.trigger_count++;
+    psi.enabled = 1;
+    return 0;
+}
+
+/**
+ * @brief 注册全部触发器
+ *
+ * 每个触发器单独打开压力文件，写入 "some|full <stall_us> <window_us>"（含结尾 '\0'），之后以 POLLPRI 轮询。
+ * 窗口须在 500 ms 到 10 s 之间；非 root 用户只能使用 2 s 整数倍的窗口。注册失败的触发器输出错误后忽略。
+ */
+static void psi_register_triggers(void)
+{
+    for (int i = 0; i < psi.trigger_count; i++)
+    {
+        PsiTrigger *t = &psi.triggers[i];
+        char path[32];
+        snprintf(path, sizeof(path), "/proc/pressure/%s", psi_resource_names[t->resource]);
+        t->fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        if (t->fd < 0 || write(t->fd, t->spec, strlen(t->spec) + 1) < 0)
+        {
+            fprintf(stderr, "PSI trigger %s \"%s\": %s\n", path, t->spec, strerror(errno));
+            if (t->fd >= 0)
+            {
+                close(t->fd);
+            }
+            t->fd = -1;
+        }
+    }
+}
+
+/**
+ * @brief 读取系统级 PSI，并带出上一次采集以来触发过的触发器
+ *
+ * @param stats 输出参数
+ * @return 成功返回 0，全部资源都不可用返回 -1
+ */
+int get_psi_stats(PsiStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    for (int r = 0; r < PSI_RESOURCES; r++)
+    {
+        if (psi.unavailable & (1u << r))
+        {
+            continue;
+        }
+        const char *buf = proc_source_read(SRC_PSI_CPU + r, NULL);
+        if (!buf || psi_parse(buf, &stats->some[r], &stats->full[r]) != 0)
+        {
+            /* 内核未启用 PSI（CONFIG_PSI=n 或 psi=0）时不再重试 */
+            psi.unavailable |= 1u << r;
+            continue;
+        }
+        stats->present |= 1u << r;
+    }
+    stats->fired = psi.fired;
+    psi.fired = 0;
+    return stats->present ? 0 : -1;
+}
+
+/**
+ * @brief 处理触发器 fd 上的 epoll 事件
+ *
+ * @param i 触发器下标
+ * @param revents epoll 事件
+ * @return 触发器触发返回 1，否则返回 0（压力文件出错时注销该触发器）
+ */
+static int psi_trigger_ready(int i, uint32_t revents)
+{
+    PsiTrigger *t = &psi.triggers[i];
+    if (t->fd < 0)
+    {
+        return 0;
+    }
+    if (revents & EPOLLERR)
+    {
+        close(t->fd);   /* 关闭即从 epoll 中移除 */
+        t->fd = -1;
+        return 0;
+    }
+    psi.fired |= 1u << (t->resource * 2 + t->full);
+    return 1;
+}
+
+/* ============================================================================
+ * cgroup 资源
+ *
+ * 遍历 cgroup v2 层级到指定深度，每个 cgroup 持有目录 fd，相对它读取 cpu.stat、memory.current、
+ * memory.max、memory.events 和 io.stat；cgroup 的创建和删除由 inotify 通知，不必每个周期重新遍历。
+ * 按 CPU 和内存两个维度各上报前 K 个 cgroup。
+ * ============================================================================ */
+
+#define CGROUP_DEPTH_MAX    8           /**< --cgroups 允许的最大深度 */
+#define CGROUP_FILE_BUF     4096        /**< 单个 cgroup 文件的读取缓冲区大小 */
+#define CGROUP_EVENTS_BUF   16384       /**< inotify 事件读取缓冲区大小 */
+
+/**
+ * @brief 一个被跟踪的 cgroup
+ */
+typedef struct
+{
+    int dir_fd;                         /**< 目录 fd，-1 表示空闲槽 */
+    int wd;                             /**< inotify 监视描述符，-1 表示未监视（已到最大深度） */
+    int parent;                         /**< 父节点下标，根为 -1 */
+    int depth;                          /**< 深度，根为 0 */
+    int valid;                          /**< 以下累计值是否已读取 */
+    char path[CGROUP_PATH_MAX];         /**< 相对 cgroup 根的路径，根为空串 */
+    unsigned long long usage_usec;      /**< cpu.stat usage_usec */
+    unsigned long long nr_periods;      /**< cpu.stat nr_periods */
+    unsigned long long nr_throttled;    /**< cpu.stat nr_throttled */
+    unsigned long long throttled_usec;  /**< cpu.stat throttled_usec */
+    unsigned long long oom_kill;        /**< memory.events oom_kill */
+    unsigned long long read_bytes;      /**< io.stat 各设备 rbytes 之和 */
+    unsigned long long write_bytes;     /**< io.stat 各设备 wbytes 之和 */
+} CgroupNode;
+
+/**
+ * @brief cgroup 采集器状态
+ */
+static struct
+{
+    int max_depth;                      /**< 遍历深度，0 表示关闭 */
+    int top_k;                          /**< 每个维度上报的 cgroup 数 */
+    char root[FS_PATH_MAX];             /**< cgroup v2 挂载点 */
+    int inotify_fd;                     /**< inotify fd，-1 表示未初始化 */
+    int need_rescan;                    /**< inotify 队列溢出或根目录失效，需要重建 */
+    CgroupNode *nodes;                  /**< 节点数组，下标 0 为根 */
+    int cap;                            /**< 节点数组容量 */
+    int count;                          /**< 节点数组已使用的长度（含空闲槽） */
+    uint64_t last_ns;                   /**< 上一次采集的时间（单调时钟） */
+} cgroups = {.top_k = 5, .inotify_fd = -1};
+
+/**
+ * @brief 从 mountinfo 查找 cgroup v2 挂载点（纯 v2 系统为 /sys/fs/cgroup，混合模式通常为 /sys/fs/cgroup/unified）
+ *
+ * @return 找到返回 0，否则返回 -1
+ */
+static int cgroup_find_root(char *out, size_t size)
+{
+    const char *buf = proc_source_read(SRC_MOUNTINFO, NULL);
+    for (const char *p = buf; p && *p; p = kp_next_line(p))
+    {
+        MountEntry entry;
+        if (mountinfo_parse_line(p, &entry) == 0 && entry.fstype_len == 7 && memcmp(entry.fstype, "cgroup2", 7) == 0 &&
+            mountinfo_unescape(entry.mount_point, entry.mount_point_len, out, size) == 0)
+        {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief 相对目录 fd 读取一个 cgroup 文件
+ *
+ * @return 读取的字节数，文件不存在（控制器未启用）或 cgroup 已删除时返回 -1
+ */
+static ssize_t cgroup_read_file(int dir_fd, const char *name, char *buf, size_t size)
+{
+    int fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    ssize_t n = read(fd, buf, size - 1);
+    close(fd);
+    if (n < 0)
+    {
+        return -1;
+    }
+    buf[n] = '\0';
+    return n;
+}
+
+/**
+ * @brief 在 "键 值" 格式的文件内容中查找一个键（cpu.stat、memory.events）
+ *
+ * @return 找到返回 0，否则返回 -1（*out 不变）
+ */
+static int cgroup_keyed_value(const char *buf, const char *key, unsigned long long *out)
+{
+    size_t len = strlen(key);
+    for (const char *p = buf; *p; p = kp_next_line(p))
+    {
+        if (strncmp(p, key, len) == 0 && p[len] == ' ')
+        {
+            return kp_parse_u64(p + len, out) ? 0 : -1;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief 汇总 io.stat 中各设备的 rbytes 和 wbytes
+ *
+ * 每行格式：major:minor rbytes=N wbytes=N rios=N wios=N dbytes=N dios=N
+ */
+static void cgroup_parse_io(const char *buf, unsigned long long *read_bytes, unsigned long long *write_bytes)
+{
+    *read_bytes = *write_bytes = 0;
+    for (const char *p = buf; *p; p = kp_next_line(p))
+    {
+        const char *end = strchr(p, '\n');
+        const char *r = memmem(p, end ? (size_t)(end - p) : strlen(p), " rbytes=", 8);
+        const char *w = memmem(p, end ? (size_t)(end - p) : strlen(p), " wbytes=", 8);
+        unsigned long long v;
+        if (r && kp_parse_u64(r + 8, &v))
+        {
+            *read_bytes += v;
+        }
+        if (w && kp_parse_u64(w + 8, &v))
+        {
+            *write_bytes += v;
+        }
+    }
+}
+
+/**
+ * @brief 查找父节点下指定名字的子节点
+ *
+ * @return 节点下标，不存在返回 -1
+ */
+static int cgroup_find_child(int parent, const char *name)
+{
+    const char *base = cgroups.nodes[parent].path;
+    size_t base_len = strlen(base);
+    for (int i = 1; i < cgroups.count; i++)
+    {
+        const CgroupNode *n = &cgroups.nodes[i];
+        if (n->dir_fd >= 0 && n->parent == parent &&
+            strcmp(n->path + base_len + (base_len ? 1 : 0), name) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief 按 inotify 监视描述符查找节点
+ *
+ * @return 节点下标，不存在返回 -1
+ */
+static int cgroup_find_wd(int wd)
+{
+    for (int i = 0; i < cgroups.count; i++)
+    {
+        if (cgroups.nodes[i].dir_fd >= 0 && cgroups.nodes[i].wd == wd)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void cgroup_scan_children(int idx);
+
+/**
+ * @brief 加入一个 cgroup：打开目录 fd，未到最大深度时加 inotify 监视并加入已有的子 cgroup
+ *
+ * 先加监视再遍历子目录，遍历期间新建的子 cgroup 不会漏掉（重复的创建事件由 cgroup_find_child 去重）。
+ *
+ * @param parent 父节点下标，加入根时为 -1
+ * @param name 目录名（加入根时忽略）
+ * @return 节点下标，失败返回 -1
+ */
+static int cgroup_add(int parent, const char *name)
+{
+    char path[CGROUP_PATH_MAX];
+    int fd;
+    if (parent < 0)
+    {
+        path[0] = '\0';
+        fd = open(cgroups.root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    }
+    else
+    {
+        const char *base = cgroups.nodes[parent].path;
+        if (cgroup_find_child(parent, name) >= 0 ||
+            snprintf(path, sizeof(path), "%s%s%s", base, *base ? "/" : "", name) >= (int)sizeof(path))
+        {
+            return -1;
+        }
+        fd = openat(cgroups.nodes[parent].dir_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    }
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    int idx = 0;
+    while (idx < cgroups.count && cgroups.nodes[idx].dir_fd >= 0)
+    {
+        idx++;
+    }
+    if (idx == cgroups.cap)
+    {
+        int cap = cgroups.cap ? cgroups.cap * 2 : 64;
+        CgroupNode *nodes = realloc(cgroups.nodes, cap * sizeof(CgroupNode));
+        if (!nodes)
+        {
+            close(fd);
+            return -1;
+        }
+        cgroups.nodes = nodes;
+        cgroups.cap = cap;
+    }
+    if (idx == cgroups.count)
+    {
+        cgroups.count++;
+    }
+
+    CgroupNode *n = &cgroups.nodes[idx];
+    memset(n, 0, sizeof(*n));
+    n->dir_fd = fd;
+    n->wd = -1;
+    n->parent = parent;
+    n->depth = parent < 0 ? 0 : cgroups.nodes[parent].depth + 1;
+    memcpy(n->path, path, sizeof(path));
+    if (n->depth < cgroups.max_depth)
+    {
+        char full[FS_PATH_MAX + CGROUP_PATH_MAX + 1];
+        snprintf(full, sizeof(full), "%s/%s", cgroups.root, path);
+        n->wd = inotify_add_watch(cgroups.inotify_fd, full,
+                                  IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR);
+        cgroup_scan_children(idx);
+    }
+    return idx;
+}
+
+/**
+ * @brief 加入一个节点下已有的全部子 cgroup
+ */
+static void cgroup_scan_children(int idx)
+{
+    int fd = openat(cgroups.nodes[idx].dir_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *dir = fd >= 0 ? fdopendir(fd) : NULL;
+    if (!dir)
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return;
+    }
+    struct dirent *d;
+    while ((d = readdir(dir)) != NULL)
+    {
+        if (d->d_type == DT_DIR && d->d_name[0] != '.')
+        {
+            /* cgroup_add 可能扩容节点数组，不能持有节点指针 */
+            cgroup_add(idx, d->d_name);
+        }
+    }
+    closedir(dir);
+}
+
+/**
+ * @brief 删除一个节点及其全部后代
+ */
+static void cgroup_remove(int idx)
+{
+    for (int i = 1; i < cgroups.count; i++)
+    {
+        if (cgroups.nodes[i].dir_fd >= 0 && cgroups.nodes[i].parent == idx)
+        {
+            cgroup_remove(i);
+        }
+    }
+    CgroupNode *n = &cgroups.nodes[idx];
+    if (n->wd >= 0)
+    {
+        inotify_rm_watch(cgroups.inotify_fd, n->wd);
+    }
+    close(n->dir_fd);
+    n->dir_fd = -1;
+    while (cgroups.count > 0 && cgroups.nodes[cgroups.count - 1].dir_fd < 0)
+    {
+        cgroups.count--;
+    }
+}
+
+/**
+ * @brief 丢弃全部节点，重新遍历层级
+ *
+ * @return 成功返回 0，失败返回 -1
+ */
+static int cgroup_rescan(void)
+{
+    if (cgroups.count > 0)
+    {
+        cgroup_remove(0);
+    }
+    if (cgroups.inotify_fd >= 0)
+    {
+        close(cgroups.inotify_fd);
+    }
+    cgroups.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (cgroups.inotify_fd < 0)
+    {
+        perror("inotify_init1");
+        return -1;
+    }
+    cgroups.need_rescan = 0;
+    if (cgroup_add(-1, NULL) != 0)
+    {
+        fprintf(stderr, "Failed to open cgroup root %s\n", cgroups.root);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 处理积压的 inotify 事件，增删节点
+ */
+static void cgroup_drain_events(void)
+{
+    static char buf[CGROUP_EVENTS_BUF] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n;
+    while ((n = read(cgroups.inotify_fd, buf, sizeof(buf))) > 0)
+    {
+        for (char *p = buf; p < buf + n; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len)
+        {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            if (ev->mask & IN_Q_OVERFLOW)
+            {
+                cgroups.need_rescan = 1;
+                continue;
+            }
+            int parent = cgroup_find_wd(ev->wd);
+            if (parent < 0)
+            {
+                continue;
+            }
+            if (ev->mask & IN_IGNORED)
+            {
+                /* 监视的目录已删除：根目录失效时重建，其他节点等待父目录的删除事件 */
+                cgroups.nodes[parent].wd = -1;
+                cgroups.need_rescan |= (parent == 0);
+            }
+            else if ((ev->mask & IN_ISDIR) && (ev->mask & (IN_CREATE | IN_MOVED_TO)))
+            {
+                cgroup_add(parent, ev->name);
+            }
+            else if ((ev->mask & IN_ISDIR) && (ev->mask & (IN_DELETE | IN_MOVED_FROM)))
+            {
+                int child = cgroup_find_child(parent, ev->name);
+                if (child > 0)
+                {
+                    cgroup_remove(child);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief 读取一个节点的计数器，计算与上一次的差值
+ *
+ * @param n 节点
+ * @param interval_s 与上一次采集的间隔（秒），0 表示只建立基线
+ * @param out 输出参数
+ * @return 有差值返回 0，新节点或读取失败返回 -1
+ */
+static int cgroup_collect_node(CgroupNode *n, double interval_s, CgroupEntry *out)
+{
+    char buf[CGROUP_FILE_BUF];
+    unsigned long long usage = 0, periods = 0, throttled = 0, throttled_usec = 0, oom_kill = 0;
+    unsigned long long mem = 0, mem_max = 0, read_bytes = 0, write_bytes = 0;
+    if (cgroup_read_file(n->dir_fd, "cpu.stat", buf, sizeof(buf)) < 0)
+    {
+        return -1;
+    }
+    cgroup_keyed_value(buf, "usage_usec", &usage);
+    cgroup_keyed_value(buf, "nr_periods", &periods);
+    cgroup_keyed_value(buf, "nr_throttled", &throttled);
+    cgroup_keyed_value(buf, "throttled_usec", &throttled_usec);
+    if (cgroup_read_file(n->dir_fd, "memory.current", buf, sizeof(buf)) > 0)
+    {
+        kp_parse_u64(buf, &mem);
+    }
+    if (cgroup_read_file(n->dir_fd, "memory.max", buf, sizeof(buf)) > 0)
+    {
+        kp_parse_u64(buf, &mem_max);    /* "max" 解析失败，保持 0 表示不限制 */
+    }
+    if (cgroup_read_file(n->dir_fd, "memory.events", buf, sizeof(buf)) > 0)
+    {
+        cgroup_keyed_value(buf, "oom_kill", &oom_kill);
+    }
+    if (cgroup_read_file(n->dir_fd, "io.stat", buf, sizeof(buf)) > 0)
+    {
+        cgroup_parse_io(buf, &read_bytes, &write_bytes);
+    }
+
+    int ranked = n->valid && interval_s > 0;
+    if (ranked && psi.enabled)
+    {
+        static const char *const files[PSI_RESOURCES] = {"cpu.pressure", "memory.pressure", "io.pressure"};
+        for (int r = 0; r < PSI_RESOURCES; r++)
+        {
+            PsiLine some, full;
+            out->psi_some[r] = cgroup_read_file(n->dir_fd, files[r], buf, sizeof(buf)) > 0 &&
+                               psi_parse(buf, &some, &full) == 0 ? some.avg10 : 0;
+        }
+    }
+    if (ranked)
+    {
+        memcpy(out->path, n->path, CGROUP_PATH_MAX);
+        out->cpu_pct = (float)((double)(usage >= n->usage_usec ? usage - n->usage_usec : 0) / 1e4 / interval_s);
+        unsigned long long dp = periods >= n->nr_periods ? periods - n->nr_periods : 0;
+        unsigned long long dt = throttled >= n->nr_throttled ? throttled - n->nr_throttled : 0;
+        out->throttled_pct = dp ? (float)((double)dt * 100.0 / dp) : 0;
+        out->throttled_usec = throttled_usec >= n->throttled_usec ? throttled_usec - n->throttled_usec : 0;
+        out->mem_kb = mem / 1024;
+        out->mem_max_kb = mem_max / 1024;
+        out->oom_kills = (uint32_t)(oom_kill >= n->oom_kill ? oom_kill - n->oom_kill : 0);
+        out->read_bytes = read_bytes >= n->read_bytes ? read_bytes - n->read_bytes : 0;
+        out->write_bytes = write_bytes >= n->write_bytes ? write_bytes - n->write_bytes : 0;
+    }
+    n->valid = 1;
+    n->usage_usec = usage;
+    n->nr_periods = periods;
+    n->nr_throttled = throttled;
+    n->throttled_usec = throttled_usec;
+    n->oom_kill = oom_kill;
+    n->read_bytes = read_bytes;
+    n->write_bytes = write_bytes;
+    return ranked ? 0 : -1;
+}
+
+/**
+ * @brief 把候选项插入按键降序排列、长度至多 k 的数组（k 很小，直接插入）
+ *
+ * @param list 数组
+ * @param keys 与数组对应的键
+ * @param n 输入输出参数，数组长度
+ * @param k 数组容量
+ * @param key 候选项的键
+ * @param item 候选项
+ */
+static void cgroup_top_offer(CgroupEntry *list, double *keys, uint16_t *n, int k, double key, const CgroupEntry *item)
+{
+    if (*n == k && key <= keys[k - 1])
+    {
+        return;
+    }
+    int i = *n < k ? (*n)++ : k - 1;
+    for (; i > 0 && keys[i - 1] < key; i--)
+    {
+        list[i] = list[i - 1];
+        keys[i] = keys[i - 1];
+    }
+    list[i] = *item;
+    keys[i] = key;
+}
+
+/**
+ * @brief 采集全部被跟踪的 cgroup，选出 CPU 和内存两个维度的前 K 个
+ *
+ * 首次调用时查找 cgroup v2 挂载点并遍历层级，之后只处理 inotify 事件。首次采集只建立基线。
+ * cpu.stat、io.stat 等计数器包含后代 cgroup，父子 cgroup 可能同时上榜。
+ *
+ * @param stats 输出参数
+ * @return 成功返回 0，失败返回 -1
+ */
+int get_cgroup_stats(CgroupStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    if (!cgroups.root[0] && cgroup_find_root(cgroups.root, sizeof(cgroups.root)) != 0)
+    {
+        fprintf(stderr, "No cgroup v2 hierarchy mounted\n");
+        cgroups.max_depth = 0;
+        return -1;
+    }
+    if (cgroups.inotify_fd < 0 || cgroups.need_rescan)
+    {
+        if (cgroup_rescan() != 0)
+        {
+            return -1;
+        }
+    }
+    cgroup_drain_events();
+
+    uint64_t now = monotonic_ns();
+    double interval_s = cgroups.last_ns ? (double)(now - cgroups.last_ns) / 1e9 : 0;
+    cgroups.last_ns = now;
+
+    static CgroupEntry entry;
+    double keys[CGROUP_TOP_DIMS][CGROUP_TOP_MAX];
+    for (int i = 1; i < cgroups.count; i++)
+    {
+        CgroupNode *n = &cgroups.nodes[i];
+        if (n->dir_fd < 0)
+        {
+            continue;
+        }
+        stats->cgroups++;
+        if (cgroup_collect_node(n, interval_s, &entry) != 0)
+        {
+            continue;
+        }
+        if (entry.cpu_pct > 0)
+        {
+            cgroup_top_offer(stats->top[CGROUP_TOP_CPU], keys[CGROUP_TOP_CPU], &stats->count[CGROUP_TOP_CPU],
+                             cgroups.top_k, entry.cpu_pct, &entry);
+        }
+        if (entry.mem_kb > 0)
+        {
+            cgroup_top_offer(stats->top[CGROUP_TOP_MEM], keys[CGROUP_TOP_MEM], &stats->count[CGROUP_TOP_MEM],
+                             cgroups.top_k, (double)entry.mem_kb, &entry);
+        }
+    }
+    if (interval_s > 0)
+    {
+        stats->interval_ms = (uint32_t)(interval_s * 1000 + 0.5);
+    }
+    return 0;
+}
+
+/* ============================================================================
+ * HTTP 上报函数
+ * ============================================================================ */
+
+#define HTTP_DNS_TTL_S          300     /**< DNS 解析结果缓存时间（秒） */
+#define HTTP_DNS_STALE_S        30      /**< 重新解析失败时继续沿用旧结果的时间（秒） */
+#define HTTP_TIMEOUT_MS         10000   /**< 单次请求（连接 + 发送 + 接收）总超时（毫秒） */
+#define HTTP_MAX_ADDRS          4       /**< 缓存的解析地址数量上限 */
+#define HTTP_RECV_BUF_SIZE      4096    /**< 响应接收缓冲区大小（响应头必须能装下） */
+#define HTTP_BODY_KEEP_SIZE     256     /**< 保留的响应正文字节数 */
+#define HTTP_CONTENT_TYPE_FORM  "application/x-www-form-urlencoded" /**< 单个样本、注册帧 */
+#define HTTP_CONTENT_TYPE_BATCH "application/x-kunlun-batch"        /**< 多个样本，每行一个 */
+
+/**
+ * @brief 上报地址解析结果
+ */
+typedef struct
+{
+    char host[256];         /**< 主机名或 IP（IPv6 不含方括号） */
+    char port[8];           /**< 端口 */
+    char path[1024];        /**< 请求路径（含查询串） */
+    char authority[272];    /**< Host 请求头内容 */
+} HttpUrl;
+
+/**
+ * @brief HTTP 响应摘要
+ */
+typedef struct
+{
+    int status;                         /**< 状态码，未收到任何响应时为 0 */
+    int keep_alive;                     /**< 响应后连接是否可复用 */
+    int retry_after_s;                  /**< Retry-After 头（秒），没有则为 -1 */
+    char body[HTTP_BODY_KEEP_SIZE];     /**< 响应正文前若干字节（以 '\0' 结尾） */
+    size_t body_len;                    /**< body 中的有效字节数 */
+} HttpResponse;
+
+/**
+ * @brief 持久化 HTTP 客户端
+ *
+ * 保持与上报服务器的长连接，并缓存 DNS 解析结果，避免每次上报都重新解析和握手。
+ * 仅原生支持 http://，其余协议（如 https://）回退到 curl。
+ */
+typedef struct
+{
+    char url[256];                                  /**< 原始上报地址 */
+    int native;                                     /**< 1 表示原生处理，0 表示回退 curl */
+    HttpUrl target;                                 /**< 解析后的地址 */
+    int fd;                                         /**< 当前连接，-1 表示未连接 */
+    struct sockaddr_storage addrs[HTTP_MAX_ADDRS];  /**< 缓存的解析地址 */
+    socklen_t addr_lens[HTTP_MAX_ADDRS];            /**< 各地址长度 */
+    int addr_count;                                 /**< 缓存的地址个数 */
+    uint64_t addr_expire_ms;                        /**< 解析结果过期时间（单调时钟） */
+    unsigned long requests;                         /**< 成功完成的请求数 */
+    unsigned long connects;                         /**< 建立连接次数 */
+} HttpClient;
+
+/**
+ * @brief 分块传输编码（chunked）解码状态
+ */
+typedef struct
+{
+    enum
+    {
+        CHUNK_SIZE,         /**< 读取块大小（十六进制） */
+        CHUNK_EXT,          /**< 跳过块扩展直到行尾 */
+        CHUNK_DATA,         /**< 读取块数据 */
+        CHUNK_DATA_END,     /**< 块数据后的 CRLF */
+        CHUNK_TRAILER,      /**< 末尾的 trailer 头 */
+        CHUNK_DONE          /**< 解码完成 */
+    } state;
+    uint64_t size;          /**< 当前块剩余字节数 */
+    int digits;             /**< 已读取的块大小位数 */
+    size_t line_len;        /**< trailer 当前行长度 */
+} HttpChunkDecoder;
+
+/**
+ * @brief 解析 http:// 上报地址
+ *
+ * @param url 上报地址
+ * @param out 输出参数，解析结果
+ * @return 成功返回 0；非 http:// 或带用户信息等需要 curl 处理的地址返回 1；格式错误返回 -1
+ */
+static int http_parse_url(const char *url, HttpUrl *out)
+{
+    memset(out, 0, sizeof(*out));
+    if (strncasecmp(url, "http://", 7) != 0)
+    {
+        return 1;
+    }
+
+    const char *p = url + 7;
+    size_t auth_len = strcspn(p, "/?#");
+    if (auth_len == 0 || auth_len >= sizeof(out->authority))
+    {
+        return -1;
+    }
+    memcpy(out->authority, p, auth_len);
+    if (strchr(out->authority, '@'))
+    {
+        return 1;
+    }
+
+    /* 拆分主机和端口，支持 [IPv6]:port 形式 */
+    const char *host = out->authority;
+    const char *port = NULL;
+    size_t host_len;
+    if (host[0] == '[')
+    {
+        const char *close = strchr(host, ']');
+        if (!close)
+        {
+            return -1;
+        }
+        host++;
+        host_len = close - host;
+        if (close[1] == ':')
+        {
+            port = close + 2;
+        }
+        else if (close[1] != '\0')
+        {
+            return -1;
+        }
+    }
+    else
+    {
+        const char *colon = strchr(host, ':');
+        host_len = colon ? (size_t)(colon - host) : strlen(host);
+        port = colon ? colon + 1 : NULL;
+    }
+    if (host_len == 0 || host_len >= sizeof(out->host))
+    {
+        return -1;
+    }
+    memcpy(out->host, host, host_len);
+
+    if (!port || *port == '\0')
+    {
+        port = "80";
+    }
+    if (strlen(port) >= sizeof(out->port) || strspn(port, "0123456789") != strlen(port))
+    {
+        return -1;
+    }
+    strcpy(out->port, port);
+
+    /* 路径：去掉片段，缺省为 "/" */
+    const char *path = p + auth_len;
+    size_t path_len = strcspn(path, "#");
+    if (path_len + 2 > sizeof(out->path))
+    {
+        return -1;
+    }
+    if (path_len == 0 || path[0] != '/')
+    {
+        out->path[0] = '/';
+        memcpy(out->path + 1, path, path_len);
+    }
+    else
+    {
+        memcpy(out->path, path, path_len);
+    }
+    return 0;
+}
+
+/**
+ * @brief 初始化 HTTP 客户端
+ *
+ * @param client 客户端
+ * @param url 上报地址
+ * @return 成功返回 0，地址格式错误返回 -1
+ */
+int http_client_init(HttpClient *client, const char *url)
+{
+    memset(client, 0, sizeof(*client));
+    client->fd = -1;
+    strncpy(client->url, url, sizeof(client->url) - 1);
+
+    int ret = http_parse_url(url, &client->target);
+    if (ret < 0)
+    {
+        fprintf(stderr, "Invalid url: %s\n", url);
+        return -1;
+    }
+    client->native = (ret == 0);
+    return 0;
+}
+
+/**
+ * @brief 关闭当前连接（保留 DNS 缓存）
+ *
+ * @param client 客户端
+ */
+static void http_close(HttpClient *client)
+{
+    if (client->fd >= 0)
+    {
+        close(client->fd);
+        client->fd = -1;
+    }
+}
+
+/**
+ * @brief 等待套接字就绪，直到截止时间
+ *
+ * @param fd 套接字
+ * @param events 等待的事件（POLLIN / POLLOUT）
+ * @param deadline_ms 截止时间（单调时钟毫秒）
+ * @return 就绪返回 1，超时返回 0，出错返回 -1
+ */
+static int http_wait(int fd, short events, uint64_t deadline_ms)
+{
+    for (;;)
+    {
+        uint64_t now = monotonic_ms();
+        if (now >= deadline_ms)
+        {
+            return 0;
+        }
+        struct pollfd pfd = {.fd = fd, .events = events};
+        int ret = poll(&pfd, 1, (int)(deadline_ms - now));
+        if (ret < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        return ret < 0 ? -1 : (ret > 0);
+    }
+}
+
+/**
+ * @brief 把一个文本形式的 IPv4/IPv6 地址加入客户端的地址缓存
+ *
+ * @return 是合法的数字地址返回 1（缓存已满时不加入），否则返回 0
+ */
+static int http_add_numeric_addr(HttpClient *client, const char *text, uint16_t port)
+{
+    struct sockaddr_in v4 = {.sin_family = AF_INET, .sin_port = htons(port)};
+    struct sockaddr_in6 v6 = {.sin6_family = AF_INET6, .sin6_port = htons(port)};
+    const void *addr;
+    socklen_t len;
+    if (inet_pton(AF_INET, text, &v4.sin_addr) == 1)
+    {
+        addr = &v4;
+        len = sizeof(v4);
+    }
+    else if (inet_pton(AF_INET6, text, &v6.sin6_addr) == 1)
+    {
+        addr = &v6;
+        len = sizeof(v6);
+    }
+    else
+    {
+        return 0;
+    }
+    if (client->addr_count < HTTP_MAX_ADDRS)
+    {
+        memcpy(&client->addrs[client->addr_count], addr, len);
+        client->addr_lens[client->addr_count] = len;
+        client->addr_count++;
+    }
+    return 1;
+}
+
+/**
+ * @brief 不经过 NSS 解析上报主机：数字地址直接使用，否则查找 /etc/hosts
+ *
+ * 静态链接的 glibc 中 getaddrinfo 要在运行时加载与编译时同版本的 NSS 模块，版本不一致的主机上可能
+ * 解析失败；这两种情况不需要 DNS，因此先自行处理，只有都不命中时才调用 getaddrinfo。
+ *
+ * @return 命中返回 1（地址已写入缓存），未命中返回 0
+ */
+static int http_resolve_local(HttpClient *client)
+{
+    uint16_t port = (uint16_t)atoi(client->target.port);
+    int saved = client->addr_count;
+    client->addr_count = 0;
+    if (http_add_numeric_addr(client, client->target.host, port))
+    {
+        return 1;
+    }
+
+    FILE *fp = fopen("/etc/hosts", "re");
+    if (fp)
+    {
+        char line[512];
+        while (fgets(line, sizeof(line), fp) && client->addr_count < HTTP_MAX_ADDRS)
+        {
+            line[strcspn(line, "#\n")] = '\0';
+            char *save = NULL;
+            char *addr = strtok_r(line, " \t", &save);
+            for (char *name = addr ? strtok_r(NULL, " \t", &save) : NULL; name; name = strtok_r(NULL, " \t", &save))
+            {
+                if (strcasecmp(name, client->target.host) == 0)
+                {
+                    http_add_numeric_addr(client, addr, port);
+                    break;
+                }
+            }
+        }
+        fclose(fp);
+    }
+    if (client->addr_count > 0)
+    {
+        return 1;
+    }
+    client->addr_count = saved;
+    return 0;
+}
+
+/**
+ * @brief 解析上报主机地址并缓存
+ *
+ * 数字地址和 /etc/hosts 中的主机名自行解析（见 http_resolve_local），其余交给 getaddrinfo。
+ * 解析失败时若已有旧结果，则继续沿用一小段时间，避免 DNS 抖动导致上报中断。
+ *
+ * @param client 客户端
+ * @return 成功（含沿用旧结果）返回 0，失败返回 -1
+ */
+static int http_resolve(HttpClient *client)
+{
+    if (http_resolve_local(client))
+    {
+        client->addr_expire_ms = monotonic_ms() + HTTP_DNS_TTL_S * 1000ULL;
+        return 0;
+    }
+
+    struct addrinfo hints, *res, *ai;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_ADDRCONFIG;
+
+    int ret = getaddrinfo(client->target.host, client->target.port, &hints, &res);
+    if (ret != 0)
+    {
+        fprintf(stderr, "getaddrinfo %s: %s\n", client->target.host, gai_strerror(ret));
+        if (client->addr_count > 0)
+        {
+            client->addr_expire_ms = monotonic_ms() + HTTP_DNS_STALE_S * 1000ULL;
+            return 0;
+        }
+        return -1;
+    }
+
+    client->addr_count = 0;
+    for (ai = res; ai && client->addr_count < HTTP_MAX_ADDRS; ai = ai->ai_next)
+    {
+        if (ai->ai_addrlen > sizeof(struct sockaddr_storage))
+        {
+            continue;
+        }
+        memcpy(&client->addrs[client->addr_count], ai->ai_addr, ai->ai_addrlen);
+        client->addr_lens[client->addr_count] = ai->ai_addrlen;
+        client->addr_count++;
+    }
+    freeaddrinfo(res);
+
+    client->addr_expire_ms = monotonic_ms() + HTTP_DNS_TTL_S * 1000ULL;
+    return client->addr_count > 0 ? 0 : -1;
+}
+
+/**
+ * @brief 以非阻塞方式连接指定地址
+ *
+ * @param addr 目标地址
+ * @param addr_len 地址长度
+ * @param deadline_ms 截止时间（单调时钟毫秒）
+ * @return 成功返回已连接的非阻塞套接字，失败返回 -1
+ */
+static int http_connect_addr(const struct sockaddr *addr, socklen_t addr_len, uint64_t deadline_ms)
+{
+    int fd = socket(addr->sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    if (connect(fd, addr, addr_len) != 0)
+    {
+        if (errno != EINPROGRESS || http_wait(fd, POLLOUT, deadline_ms) <= 0)
+        {
+            close(fd);
+            return -1;
+        }
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0)
+        {
+            close(fd);
+            return -1;
+        }
+    }
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+/**
+ * @brief 检查空闲长连接是否仍然可用
+ *
+ * 空闲连接上不应有可读数据；可读意味着服务器已关闭连接（EOF）或发送了意外数据。
+ *
+ * @param fd 套接字
+ * @return 可用返回 1，否则返回 0
+ */
+static int http_conn_alive(int fd)
+{
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    if (poll(&pfd, 1, 0) == 0)
+    {
+        return 1;
+    }
+    char c;
+    ssize_t n = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+/**
+ * @brief 确保客户端持有可用连接，必要时重新解析并建立连接
+ *
+ * @param client 客户端
+ * @param deadline_ms 截止时间（单调时钟毫秒）
+ * @param reused 输出参数，复用已有连接时为 1
+ * @return 成功返回 0，失败返回 -1
+ */
+static int http_ensure_connected(HttpClient *client, uint64_t deadline_ms, int *reused)
+{
+    *reused = 0;
+    if (client->fd >= 0)
+    {
+        if (http_conn_alive(client->fd))
+        {
+            *reused = 1;
+            return 0;
+        }
+        http_close(client);
+    }
+
+    if (client->addr_count == 0 || monotonic_ms() >= client->addr_expire_ms)
+    {
+        if (http_resolve(client) != 0)
+        {
+            return -1;
+        }
+    }
+
+    for (int i = 0; i < client->addr_count; i++)
+    {
+        int fd = http_connect_addr((struct sockaddr *)&client->addrs[i], client->addr_lens[i], deadline_ms);
+        if (fd >= 0)
+        {
+            client->fd = fd;
+            client->connects++;
+            return 0;
+        }
+    }
+
+    /* 所有地址均连接失败，下次强制重新解析 */
+    client->addr_expire_ms = 0;
+    fprintf(stderr, "Failed to connect to %s:%s\n", client->target.host, client->target.port);
+    return -1;
+}
+
+/**
+ * @brief 发送全部数据，处理部分写入
+ *
+ * @param fd 非阻塞套接字
+ * @param buf 数据
+ * @param len 数据长度
+ * @param flags send() 额外标志（如 MSG_MORE）
+ * @param deadline_ms 截止时间（单调时钟毫秒）
+ * @return 成功返回 0，失败或超时返回 -1
+ */
+static int http_send_all(int fd, const char *buf, size_t len, int flags, uint64_t deadline_ms)
+{
+    while (len > 0)
+    {
+        ssize_t n = send(fd, buf, len, flags | MSG_NOSIGNAL);
+        if (n > 0)
+        {
+            buf += n;
+            len -= n;
+        }
+        else if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            if (http_wait(fd, POLLOUT, deadline_ms) <= 0)
+            {
+                return -1;
+            }
+        }
+        else
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief 在截止时间前接收数据
+ *
+ * @return 接收到的字节数，对端关闭返回 0，出错或超时返回 -1
+ */
+static ssize_t http_recv(int fd, char *buf, size_t len, uint64_t deadline_ms)
+{
+    for (;;)
+    {
+        ssize_t n = recv(fd, buf, len, 0);
+        if (n >= 0)
+        {
+            return n;
+        }
+        if (errno == EINTR)
+        {
+            continue;
+        }
+        if ((errno != EAGAIN && errno != EWOULDBLOCK) || http_wait(fd, POLLIN, deadline_ms) <= 0)
+        {
+            return -1;
+        }
+    }
+}
+
+/**
+ * @brief 保存响应正文的前若干字节
+ */
+static void http_body_append(HttpResponse *resp, const char *data, size_t len)
+{
+    size_t room = sizeof(resp->body) - 1 - resp->body_len;
+    if (len > room)
+    {
+        len = room;
+    }
+    memcpy(resp->body + resp->body_len, data, len);
+    resp->body_len += len;
+    resp->body[resp->body_len] = '\0';
+}
+
+/**
+ * @brief 向 chunked 解码器输入数据
+ *
+ * @param dec 解码器
+ * @param data 输入数据
+ * @param len 输入长度
+ * @param resp 响应（保存正文）
+ * @return 成功返回 0（解码完成时 dec->state 为 CHUNK_DONE），格式错误返回 -1
+ */
+static int http_chunk_feed(HttpChunkDecoder *dec, const char *data, size_t len, HttpResponse *resp)
+{
+    size_t i = 0;
+    while (i < len && dec->state != CHUNK_DONE)
+    {
+        char ch = data[i];
+        switch (dec->state)
+        {
+        case CHUNK_SIZE:
+        case CHUNK_EXT:
+            if (ch == '\n')
+            {
+                if (dec->digits == 0)
+                {
+                    return -1;
+                }
+                dec->state = dec->size ? CHUNK_DATA : CHUNK_TRAILER;
+                dec->line_len = 0;
+            }
+            else if (dec->state == CHUNK_SIZE && isxdigit((unsigned char)ch))
+            {
+                if (++dec->digits > 15)
+                {
+                    return -1;
+                }
+                dec->size = dec->size * 16 + (ch <= '9' ? ch - '0' : (ch | 0x20) - 'a' + 10);
+            }
+            else if (ch != '\r')
+            {
+                dec->state = CHUNK_EXT;
+            }
+            i++;
+            break;
+        case CHUNK_DATA:
+        {
+            size_t take = len - i;
+            if (take > dec->size)
+            {
+                take = dec->size;
+            }
+            http_body_append(resp, data + i, take);
+            dec->size -= take;
+            i += take;
+            if (dec->size == 0)
+            {
+                dec->state = CHUNK_DATA_END;
+            }
+            break;
+        }
+        case CHUNK_DATA_END:
+            if (ch == '\n')
+            {
+                dec->state = CHUNK_SIZE;
+                dec->digits = 0;
+            }
+            else if (ch != '\r')
+            {
+                return -1;
+            }
+            i++;
+            break;
+        case CHUNK_TRAILER:
+            if (ch == '\n')
+            {
+                if (dec->line_len == 0)
+                {
+                    dec->state = CHUNK_DONE;
+                }
+                dec->line_len = 0;
+            }
+            else if (ch != '\r')
+            {
+                dec->line_len++;
+            }
+            i++;
+            break;
+        case CHUNK_DONE:
+            break;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief 解析响应头
+ *
+ * @param hdr 响应头（以 '\0' 结尾，不含末尾空行）
+ * @param resp 输出参数，状态码、Retry-After 和连接复用标志
+ * @param content_length 输出参数，Content-Length，没有则为 -1
+ * @param chunked 输出参数，是否为分块传输
+ * @return 成功返回 0，格式错误返回 -1
+ */
+static int http_parse_headers(char *hdr, HttpResponse *resp, long long *content_length, int *chunked)
+{
+    /* 状态行为 "HTTP/1.x <状态码>"，经 curl 转发的 HTTP/2、HTTP/3 响应为 "HTTP/2 <状态码>" */
+    const char *space = strchr(hdr, ' ');
+    if (strncmp(hdr, "HTTP/", 5) != 0 || !space || sscanf(space, "%d", &resp->status) != 1)
+    {
+        return -1;
+    }
+    resp->keep_alive = strncmp(hdr, "HTTP/1.0", 8) != 0;
+    resp->retry_after_s = -1;
+    *content_length = -1;
+    *chunked = 0;
+
+    char *save = NULL;
+    strtok_r(hdr, "\r\n", &save);
+    for (char *line = strtok_r(NULL, "\r\n", &save); line; line = strtok_r(NULL, "\r\n", &save))
+    {
+        char *value = strchr(line, ':');
+        if (!value)
+        {
+            continue;
+        }
+        *value++ = '\0';
+        value += strspn(value, " \t");
+
+        if (strcasecmp(line, "Content-Length") == 0)
+        {
+            *content_length = strtoll(value, NULL, 10);
+        }
+        else if (strcasecmp(line, "Transfer-Encoding") == 0)
+        {
+            *chunked = (strcasestr(value, "chunked") != NULL);
+        }
+        else if (strcasecmp(line, "Connection") == 0)
+        {
+            if (strcasestr(value, "close"))
+            {
+                resp->keep_alive = 0;
+            }
+            else if (strcasestr(value, "keep-alive"))
+            {
+                resp->keep_alive = 1;
+            }
+        }
+        else if (strcasecmp(line, "Retry-After") == 0 && isdigit((unsigned char)*value))
+        {
+            resp->retry_after_s = atoi(value);
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief 读取并解析一个完整的 HTTP 响应
+ *
+ * 支持 Content-Length、chunked 以及以关闭连接结束的正文。响应正文只保留前若干字节。
+ *
+ * @param fd 非阻塞套接字
+ * @param resp 输出参数，响应摘要
+ * @param deadline_ms 截止时间（单调时钟毫秒）
+ * @return 成功返回 0，失败返回 -1（未收到任何响应时 resp->status 为 0）
+ */
+static int http_read_response(int fd, HttpResponse *resp, uint64_t deadline_ms)
+{
+    char buf[HTTP_RECV_BUF_SIZE];
+    size_t len = 0;
+    char *hdr_end;
+    long long content_length;
+    int chunked;
+
+    /* 读取响应头，跳过 1xx 中间响应 */
+    for (;;)
+    {
+        while ((hdr_end = memmem(buf, len, "\r\n\r\n", 4)) == NULL)
+        {
+            if (len >= sizeof(buf) - 1)
+            {
+                return -1;
+            }
+            ssize_t n = http_recv(fd, buf + len, sizeof(buf) - 1 - len, deadline_ms);
+            if (n <= 0)
+            {
+                return -1;
+            }
+            len += n;
+        }
+        *hdr_end = '\0';
+        if (http_parse_headers(buf, resp, &content_length, &chunked) != 0)
+        {
+            resp->status = 0;
+            return -1;
+        }
+        size_t consumed = (hdr_end + 4) - buf;
+        len -= consumed;
+        memmove(buf, buf + consumed, len);
+        if (resp->status >= 200)
+        {
+            break;
+        }
+    }
+
+    /* 204/304 没有正文 */
+    if (resp->status == 204 || resp->status == 304)
+    {
+        return 0;
+    }
+
+    if (chunked)
+    {
+        HttpChunkDecoder dec = {.state = CHUNK_SIZE};
+        for (;;)
+        {
+            if (http_chunk_feed(&dec, buf, len, resp) != 0)
+            {
+                return -1;
+            }
+            if (dec.state == CHUNK_DONE)
+            {
+                return 0;
+            }
+            ssize_t n = http_recv(fd, buf, sizeof(buf), deadline_ms);
+            if (n <= 0)
+            {
+                return -1;
+            }
+            len = n;
+        }
+    }
+
+    if (content_length >= 0)
+    {
+        unsigned long long remaining = content_length;
+        for (;;)
+        {
+            size_t take = len < remaining ? len : remaining;
+            http_body_append(resp, buf, take);
+            remaining -= take;
+            if (remaining == 0)
+            {
+                return 0;
+            }
+            ssize_t n = http_recv(fd, buf, sizeof(buf), deadline_ms);
+            if (n <= 0)
+            {
+                return -1;
+            }
+            len = n;
+        }
+    }
+
+    /* 既无长度也非分块：正文持续到连接关闭 */
+    resp->keep_alive = 0;
+    for (;;)
+    {
+        http_body_append(resp, buf, len);
+        ssize_t n = http_recv(fd, buf, sizeof(buf), deadline_ms);
+        if (n < 0)
+        {
+            return -1;
+        }
+        if (n == 0)
+        {
+            return 0;
+        }
+        len = n;
+    }
+}
+
+/**
+ * @brief 使用 curl 发送 POST 请求
+ *
+ * 仅用于原生客户端无法处理的协议（如 https://）。请求体经管道写入 curl 的标准输入，不受命令行长度限制；
+ * 响应头（-D -）经另一个管道读回，解析出状态码和 Retry-After，与原生客户端一样交给重试策略。
+ * 总耗时受 --max-time 限制，与原生客户端的 HTTP_TIMEOUT_MS 相同。
+ * 主线程屏蔽了 SIGINT/SIGTERM/SIGHUP（由 signalfd 接收），而信号屏蔽字会经 fork/exec 继承，
+ * 因此用 posix_spawn 启动 curl 并清空其屏蔽字，使卡住的上报仍能被 systemctl stop 或 Ctrl-C 终止。
+ * 本进程忽略 SIGPIPE，curl 提前退出时写管道得到 EPIPE，按上报失败处理；curl 自身恢复默认处理。
+ *
+ * @param url 目标 URL
+ * @param content_type 请求体类型
+ * @param content_encoding 请求体压缩方式，NULL 表示未压缩
+ * @param data POST 数据
+ * @param len 数据长度
+ * @param resp 输出参数，状态码和 Retry-After（未收到响应时状态码为 0）
+ * @return 成功返回 0，失败返回 curl 的退出状态（无法启动或被信号终止时为 -1）
+ */
+static int send_post_request_curl(const char *url, const char *content_type, const char *content_encoding,
+                                  const char *data, size_t len, HttpResponse *resp)
+{
+    char type_header[256], encoding_header[128], max_time[16];
+    snprintf(type_header, sizeof(type_header), "Content-Type: %s", content_type);
+    snprintf(encoding_header, sizeof(encoding_header), "Content-Encoding: %s", content_encoding ? content_encoding : "");
+    snprintf(max_time, sizeof(max_time), "%d", HTTP_TIMEOUT_MS / 1000);
+    char *argv[20];
+    int argc = 0;
+    argv[argc++] = "curl";
+    argv[argc++] = "-s";
+    argv[argc++] = "--max-time";
+    argv[argc++] = max_time;
+    argv[argc++] = "-o";
+    argv[argc++] = "/dev/null";
+    argv[argc++] = "-D";
+    argv[argc++] = "-";
+    argv[argc++] = "-X";
+    argv[argc++] = "POST";
+    argv[argc++] = "-H";
+    argv[argc++] = type_header;
+    if (content_encoding)
+    {
+        argv[argc++] = "-H";
+        argv[argc++] = encoding_header;
+    }
+    argv[argc++] = "--data-binary";
+    argv[argc++] = "@-";
+    argv[argc++] = (char *)url;
+    argv[argc] = NULL;
+
+    int in[2], out[2];
+    if (pipe2(in, O_CLOEXEC) != 0)
+    {
+        perror("pipe2");
+        return -1;
+    }
+    if (pipe2(out, O_CLOEXEC) != 0)
+    {
+        perror("pipe2");
+        close(in[0]);
+        close(in[1]);
+        return -1;
+    }
+    sigset_t none, defaults;
+    sigemptyset(&none);
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGPIPE);
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigmask(&attr, &none);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, in[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, out[1], STDOUT_FILENO);
+
+    pid_t pid;
+    int err = posix_spawnp(&pid, "curl", &actions, &attr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    close(in[0]);
+    close(out[1]);
+    if (err != 0)
+    {
+        fprintf(stderr, "posix_spawn curl: %s\n", strerror(err));
+        close(in[1]);
+        close(out[0]);
+        return -1;
+    }
+
+    size_t written = 0;
+    while (written < len)
+    {
+        ssize_t n = write(in[1], data + written, len - written);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            break;
+        }
+        written += (size_t)n;
+    }
+    close(in[1]);
+
+    /* 响应头很小，curl 发完请求体后才输出，读到 EOF 即可；超出缓冲区的部分丢弃 */
+    char hdr[HTTP_RECV_BUF_SIZE];
+    size_t hdr_len = 0;
+    for (;;)
+    {
+        char discard[512];
+        char *dst = hdr_len < sizeof(hdr) - 1 ? hdr + hdr_len : discard;
+        size_t room = hdr_len < sizeof(hdr) - 1 ? sizeof(hdr) - 1 - hdr_len : sizeof(discard);
+        ssize_t n = read(out[0], dst, room);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            break;
+        }
+        if (dst == hdr + hdr_len)
+        {
+            hdr_len += (size_t)n;
+        }
+    }
+    close(out[0]);
+    hdr[hdr_len] = '\0';
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0)
+    {
+        if (errno != EINTR)
+        {
+            perror("waitpid curl");
+            return -1;
+        }
+    }
+    int ret = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    if (written != len && ret == 0)
+    {
+        ret = -1;
+    }
+
+    /* 可能有多个响应头块（如 100 Continue），取最后一个 */
+    char *block = hdr, *next;
+    while ((next = strstr(block, "\r\n\r\nHTTP/")) != NULL)
+    {
+        block = next + 4;
+    }
+    char *end = strstr(block, "\r\n\r\n");
+    if (end)
+    {
+        *end = '\0';
+    }
+    long long content_length;
+    int chunked;
+    if (http_parse_headers(block, resp, &content_length, &chunked) != 0)
+    {
+        resp->status = 0;
+        resp->retry_after_s = -1;
+    }
+    resp->keep_alive = 0;
+    return ret;
+}
+
+/**
+ * @brief 发送 POST 请求
+ *
+ * http:// 地址使用内置客户端：长连接复用、DNS 缓存、非阻塞收发。
+ * 复用的连接若在收到响应前失效（服务器已关闭空闲连接），自动换新连接重试一次。
+ * 其他协议回退到 curl。
+ *
+ * @param client 客户端
+ * @param content_type 请求体类型
+ * @param content_encoding 请求体压缩方式（Content-Encoding），NULL 表示未压缩
+ * @param data POST 数据
+ * @param data_len 数据长度
+ * @param resp 输出参数，响应摘要（可为 NULL）
+ * @return 服务器返回 2xx 时返回 0，否则返回 -1
+ */
+int send_post_request(HttpClient *client, const char *content_type, const char *content_encoding,
+                      const char *data, size_t data_len, HttpResponse *resp)
+{
+    HttpResponse local;
+    if (!resp)
+    {
+        resp = &local;
+    }
+
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        memset(resp, 0, sizeof(*resp));
+        resp->retry_after_s = -1;
+
+        if (!client->native)
+        {
+            int ret = send_post_request_curl(client->url, content_type, content_encoding, data, data_len, resp);
+            if (ret != 0)
+            {
+                fprintf(stderr, "curl returned %d\n", ret);
+                return -1;
+            }
+            if (resp->status < 200 || resp->status >= 300)
+            {
+                fprintf(stderr, "Server returned HTTP %d\n", resp->status);
+                return -1;
+            }
+            client->requests++;
+            return 0;
+        }
+
+        uint64_t deadline_ms = monotonic_ms() + HTTP_TIMEOUT_MS;
+        int reused;
+        if (http_ensure_connected(client, deadline_ms, &reused) != 0)
+        {
+            return -1;
+        }
+
+        char header[1536];
+        int header_len = snprintf(header, sizeof(header),
+                                  "POST %s HTTP/1.1\r\n"
+                                  "Host: %s\r\n"
+                                  "User-Agent: kunlun\r\n"
+                                  "Content-Type: %s\r\n"
+                                  "%s%s%s"
+                                  "Content-Length: %zu\r\n"
+                                  "Connection: keep-alive\r\n"
+                                  "\r\n",
+                                  client->target.path, client->target.authority, content_type,
+                                  content_encoding ? "Content-Encoding: " : "",
+                                  content_encoding ? content_encoding : "",
+                                  content_encoding ? "\r\n" : "", data_len);
+        if (header_len < 0 || header_len >= (int)sizeof(header))
+        {
+            fprintf(stderr, "Error: Request header too long\n");
+            return -1;
+        }
+
+        if (http_send_all(client->fd, header, header_len, MSG_MORE, deadline_ms) == 0 &&
+            http_send_all(client->fd, data, data_len, 0, deadline_ms) == 0 &&
+            http_read_response(client->fd, resp, deadline_ms) == 0)
+        {
+            client->requests++;
+            if (!resp->keep_alive)
+            {
+                http_close(client);
+            }
+            if (resp->status < 200 || resp->status >= 300)
+            {
+                fprintf(stderr, "Server returned HTTP %d\n", resp->status);
+                return -1;
+            }
+            return 0;
+        }
+
+        http_close(client);
+        if (!reused || resp->status != 0)
+        {
+            break;
+        }
+    }
+
+    fprintf(stderr, "HTTP request to %s failed\n", client->url);
+    return -1;
+}
+
+/* ============================================================================
+ * 上报会话
+ * ============================================================================ */
+
+#define SESSION_UNSUPPORTED_RETRY_S     3600    /**< 服务端不支持会话时重新尝试注册的间隔（秒） */
+#define SESSION_HANDLE_UNKNOWN_STATUS   409     /**< 服务端不认识句柄时返回的状态码 */
+
+/**
+ * @brief 上报会话
+ *
+ * 会话模式下，静态身份（machine_id、hostname、cpu_num_cores）只在注册时发送一次，
+ * 服务端返回一个数字句柄；之后的上报只携带句柄和动态指标。
+ */
+typedef struct
+{
+    int enabled;                /**< 是否启用会话模式 */
+    unsigned long handle;       /**< 服务端分配的主机句柄，0 表示未注册 */
+    char hostname[256];         /**< 注册时的主机名 */
+    int cpu_num_cores;          /**< 注册时的 CPU 核心数 */
+    uint64_t next_attempt_ms;   /**< 下次允许尝试注册的时间（单调时钟） */
+    int have_live;              /**< live 是否有效 */
+    SystemInfo live;            /**< 最近一个实时样本的主机身份，注册只用它，不用补发的旧样本 */
+} Session;
+
+/**
+ * @brief 对表单字段值做 URL 编码
+ *
+ * @param in 原始字符串
+ * @param out 输出缓冲区
+ * @param out_size 输出缓冲区大小（不足时截断）
+ */
+static void url_encode(const char *in, char *out, size_t out_size)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    size_t len = 0;
+    for (; *in && len + 4 <= out_size; in++)
+    {
+        unsigned char c = (unsigned char)*in;
+        if (isalnum(c) || c == '-' || c == '.' || c == '_' || c == '~')
+        {
+            out[len++] = c;
+        }
+        else
+        {
+            out[len++] = '%';
+            out[len++] = hex[c >> 4];
+            out[len++] = hex[c & 15];
+        }
+    }
+    out[len] = '\0';
+}
+
+/**
+ * @brief 发送注册帧并解析服务端返回的句柄
+ *
+ * 注册帧：register=1&machine_id=<id>&hostname=<name>&cpu_num_cores=<n>
+ * 响应正文：handle=<数字> 或单独的数字。2xx 但没有句柄表示服务端不支持会话，
+ * 此时继续发送完整上报，并在 SESSION_UNSUPPORTED_RETRY_S 秒后再尝试。
+ *
+ * @return 注册成功返回 0，否则返回 -1
+ */
+static int session_register(HttpClient *client, Session *session, const SystemInfo *sysinfo)
+{
+    /* curl 回退不读取响应正文，拿不到句柄，不必发送注册请求 */
+    if (!client->native)
+    {
+        session->next_attempt_ms = monotonic_ms() + SESSION_UNSUPPORTED_RETRY_S * 1000ULL;
+        return -1;
+    }
+
+    char hostname[sizeof(sysinfo->hostname) * 3];
+    char body[1024];
+    url_encode(sysinfo->hostname, hostname, sizeof(hostname));
+    snprintf(body, sizeof(body), "register=1&machine_id=%s&hostname=%s&cpu_num_cores=%d",
+             sysinfo->machine_id, hostname, sysinfo->cpu_num_cores);
+
+    HttpResponse resp;
+    if (send_post_request(client, HTTP_CONTENT_TYPE_FORM, NULL, body, strlen(body), &resp) != 0)
+    {
+        fprintf(stderr, "Session registration failed\n");
+        return -1;
+    }
+
+    const char *p = resp.body + strspn(resp.body, " \t\r\n");
+    if (strncmp(p, "handle=", 7) == 0)
+    {
+        p += 7;
+    }
+    unsigned long long handle;
+    if (!kp_parse_u64(p, &handle) || handle == 0)
+    {
+        fprintf(stderr, "Server did not return a session handle, sending full reports\n");
+        session->next_attempt_ms = monotonic_ms() + SESSION_UNSUPPORTED_RETRY_S * 1000ULL;
+        return -1;
+    }
+
+    session->handle = (unsigned long)handle;
+    snprintf(session->hostname, sizeof(session->hostname), "%s", sysinfo->hostname);
+    session->cpu_num_cores = sysinfo->cpu_num_cores;
+    return 0;
+}
+
+/**
+ * @brief 获取本次上报使用的会话句柄
+ *
+ * 未注册、或主机名/核心数与注册时不同，则（重新）注册。
+ *
+ * @param client HTTP 客户端
+ * @param session 会话
+ * @param sysinfo 当前主机身份
+ * @return 有效句柄；0 表示本次上报需要携带完整身份
+ */
+unsigned long session_handle(HttpClient *client, Session *session, const SystemInfo *sysinfo)
+{
+    if (!session->enabled)
+    {
+        return 0;
+    }
+    if (session->handle &&
+        (strcmp(session->hostname, sysinfo->hostname) != 0 || session->cpu_num_cores != sysinfo->cpu_num_cores))
+    {
+        session->handle = 0;
+        session->next_attempt_ms = 0;
+    }
+    if (!session->handle && monotonic_ms() >= session->next_attempt_ms)
+    {
+        session_register(client, session, sysinfo);
+    }
+    return session->handle;
+}
+
+/**
+ * @brief 根据上报响应更新会话：服务端不认识句柄（409）时下次重新注册
+ *
+ * @param session 会话
+ * @param resp 上报响应
+ */
+void session_check_response(Session *session, const HttpResponse *resp)
+{
+    if (session->handle && resp->status == SESSION_HANDLE_UNKNOWN_STATUS)
+    {
+        session->handle = 0;
+        session->next_attempt_ms = 0;
+    }
+}
+
+/* ============================================================================
+ * 上报重试策略
+ *
+ * 上报失败后按指数退避等待，等待时间在 [0, 上限] 内均匀取值（full jitter），避免大量主机在上报端
+ * 恢复时同时重试。连续失败达到阈值后熔断：不再上报，样本直接写入本地缓存，退避到期后只发送一个
+ * 样本作为探测，成功才恢复正常上报（积压样本随后按补发限速上报）。429/503 带 Retry-After 时至少
+ * 等待该时长。状态只由上报线程修改，主线程通过原子变量读取统计。
+ * ============================================================================ */
+
+#define RETRY_BASE_MS           10000   /**< 第一次失败后的退避上限（毫秒） */
+#define RETRY_MAX_MS            300000  /**< 退避上限的最大值（毫秒） */
+#define RETRY_AFTER_MAX_S       3600    /**< Retry-After 的最大采信值（秒） */
+#define BREAKER_THRESHOLD       5       /**< 连续失败多少次后熔断 */
+
+/**
+ * @brief 重试状态
+ */
+typedef enum
+{
+    RETRY_OK = 0,           /**< 正常上报 */
+    RETRY_BACKOFF,          /**< 上报失败，退避中 */
+    RETRY_OPEN,             /**< 已熔断，等待探测 */
+    RETRY_PROBE,            /**< 熔断后的探测：只发送一个样本 */
+} RetryState;
+
+/** 状态名，顺序与 RetryState 相同 */
+static const char *const retry_state_names[] = {"ok", "backoff", "open", "probe"};
+
+/**
+ * @brief 上报重试策略状态
+ */
+static struct
+{
+    atomic_int state;                   /**< 当前状态（RetryState） */
+    atomic_uint failures;               /**< 连续失败次数 */
+    atomic_ullong next_attempt_ns;      /**< 允许下一次上报的时间（单调时钟），0 表示不限 */
+    atomic_int last_status;             /**< 最近一次失败的 HTTP 状态码 */
+    atomic_uint skipped;                /**< 上一个样本以来未尝试上报的样本数 */
+    atomic_uint trips;                  /**< 上一个样本以来熔断次数 */
+    uint64_t rng;                       /**< 抖动用伪随机数状态（xorshift64，仅上报线程访问） */
+} retry_policy;
+
+/**
+ * @brief 第 failures 次连续失败后的退避上限：RETRY_BASE_MS 逐次翻倍，不超过 RETRY_MAX_MS
+ */
+static uint32_t retry_backoff_cap_ms(uint32_t failures)
+{
+    uint64_t cap = RETRY_BASE_MS;
+    for (uint32_t i = 1; i < failures && cap < RETRY_MAX_MS; i++)
+    {
+        cap <<= 1;
+    }
+    return cap < RETRY_MAX_MS ? (uint32_t)cap : RETRY_MAX_MS;
+}
+
+/**
+ * @brief 抖动用随机数，首次调用时用启动时刻和进程号播种
+ */
+static uint64_t retry_rand(void)
+{
+    uint64_t x = retry_policy.rng;
+    if (x == 0)
+    {
+        x = monotonic_ns() ^ ((uint64_t)getpid() << 32) ^ 0x9e3779b97f4a7c15ULL;
+    }
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return retry_policy.rng = x;
+}
+
+/**
+ * @brief 第 failures 次连续失败后的等待时间
+ *
+ * 退避中在 [0, 上限] 内均匀取值；熔断后取 [上限/2, 上限]，保证探测之间有间隔。
+ *
+ * @param failures 连续失败次数
+ * @param open 是否已熔断
+ * @return 等待时间（毫秒）
+ */
+static uint64_t retry_delay_ms(uint32_t failures, int open)
+{
+    uint32_t cap = retry_backoff_cap_ms(failures);
+    return open ? cap / 2 + retry_rand() % (cap / 2 + 1) : retry_rand() % ((uint64_t)cap + 1);
+}
+
+/**
+ * @brief 判断现在能否上报，熔断的等待到期时转入探测
+ *
+ * @param now_ns 当前时间（单调时钟）
+ * @return RETRY_OK 正常上报；RETRY_PROBE 只发送一个样本探测；其他值表示本次不上报
+ */
+RetryState retry_allow(uint64_t now_ns)
+{
+    RetryState state = atomic_load(&retry_policy.state);
+    if (state == RETRY_OK || now_ns < atomic_load(&retry_policy.next_attempt_ns))
+    {
+        return state == RETRY_OK ? RETRY_OK : RETRY_BACKOFF;
+    }
+    if (state == RETRY_OPEN || state == RETRY_PROBE)
+    {
+        atomic_store(&retry_policy.state, RETRY_PROBE);
+        return RETRY_PROBE;
+    }
+    return RETRY_OK;
+}
+
+/**
+ * @brief 记录一次上报结果并计算下一次允许上报的时间
+ *
+ * 等待时间见 retry_delay_ms；429/503 带 Retry-After 时取两者中较大的一个。
+ *
+ * @param ok 上报是否送达（含服务端明确拒绝、无需重试的情况）
+ * @param resp 上报响应
+ * @param now_ns 当前时间（单调时钟）
+ */
+void retry_record(int ok, const HttpResponse *resp, uint64_t now_ns)
+{
+    RetryState state = atomic_load(&retry_policy.state);
+    if (ok)
+    {
+        if (state == RETRY_PROBE)
+        {
+            fprintf(stderr, "Upload endpoint recovered after %u failures, circuit closed\n",
+                    atomic_load(&retry_policy.failures));
+        }
+        atomic_store(&retry_policy.failures, 0);
+        atomic_store(&retry_policy.next_attempt_ns, 0);
+        atomic_store(&retry_policy.last_status, 0);
+        atomic_store(&retry_policy.state, RETRY_OK);
+        return;
+    }
+
+    uint32_t failures = atomic_fetch_add(&retry_policy.failures, 1) + 1;
+    uint64_t delay_ms;
+    if (state == RETRY_PROBE || failures >= BREAKER_THRESHOLD)
+    {
+        delay_ms = retry_delay_ms(failures, 1);
+        if (state != RETRY_PROBE && state != RETRY_OPEN)
+        {
+            atomic_fetch_add(&retry_policy.trips, 1);
+            fprintf(stderr, "Circuit breaker open after %u consecutive upload failures\n", failures);
+        }
+        state = RETRY_OPEN;
+    }
+    else
+    {
+        delay_ms = retry_delay_ms(failures, 0);
+        state = RETRY_BACKOFF;
+    }
+    if ((resp->status == 429 || resp->status == 503) && resp->retry_after_s >= 0)
+    {
+        uint64_t after_ms = (uint64_t)(resp->retry_after_s < RETRY_AFTER_MAX_S ? resp->retry_after_s
+                                                                                : RETRY_AFTER_MAX_S) * 1000;
+        delay_ms = after_ms > delay_ms ? after_ms : delay_ms;
+    }
+    atomic_store(&retry_policy.last_status, resp->status);
+    atomic_store(&retry_policy.next_attempt_ns, now_ns + delay_ms * 1000000);
+    atomic_store(&retry_policy.state, state);
+    fprintf(stderr, "Next upload attempt in %llu ms (%s, %u consecutive failures)\n",
+            (unsigned long long)delay_ms, retry_state_names[state], failures);
+}
+
+/**
+ * @brief 主线程：取出重试状态，并清零上一个样本以来的计数
+ *
+ * @param stats 输出参数
+ */
+void retry_take_stats(UploadStats *stats)
+{
+    uint64_t next = atomic_load(&retry_policy.next_attempt_ns), now = monotonic_ns();
+    stats->state = (uint8_t)atomic_load(&retry_policy.state);
+    stats->failures = atomic_load(&retry_policy.failures);
+    stats->retry_in_ms = next > now ? (uint32_t)((next - now) / 1000000) : 0;
+    stats->last_status = atomic_load(&retry_policy.last_status);
+    stats->skipped = atomic_exchange(&retry_policy.skipped, 0);
+    stats->trips = atomic_exchange(&retry_policy.trips, 0);
+}
+
+/* ============================================================================
+ * 高频采样
+ * ============================================================================ */
+
+#define SUB_MAX_HZ          20      /**< 采样频率上限 */
+#define SUB_WINDOW_MAX      (10 * SUB_MAX_HZ + 1)   /**< 窗口容量：一个上报周期的采样点加上周期末的完整采集 */
+
+/** 瞬时值字段名，顺序与 hf_stats 相同 */
+static const char *const sub_gauge_names[SUB_GAUGE_COUNT] = {
+    "cpu_busy_pct", "cpu_iowait_pct", "cpu_steal_pct", "load_1min",
+    "running_tasks", "mem_used_mib", "mem_free_mib", "disk_ios_in_progress",
+};
+
+/** 计数器字段名，顺序与 hf_rate_max 相同 */
+static const char *const sub_rate_names[SUB_RATE_COUNT] = {
+    "cpu_user", "cpu_system", "cpu_iowait", "cpu_steal",
+    "disk_reads", "disk_writes", "disk_read_sectors", "disk_write_sectors", "disk_iotime_ms",
+};
+
+/**
+ * @brief 一个采样点
+ */
+typedef struct
+{
+    uint64_t t_ns;          /**< 采样时间（单调时钟） */
+    LoadAvg loadavg;        /**< 负载 */
+    CpuInfo cpuinfo;        /**< CPU 累计时间 */
+    MemInfo meminfo;        /**< 内存 */
+    DiskStats diskstats;    /**< 根分区磁盘统计 */
+} SubPoint;
+
+/**
+ * @brief 高频采样器：在两次上报之间以固定频率采集开销低的数据源，上报时汇总
+ */
+static struct
+{
+    int hz;                             /**< 采样频率，0 表示关闭 */
+    int have_base;                      /**< base 是否有效 */
+    SubPoint base;                      /**< 上一窗口的最后一个点，作为本窗口第一个区间的起点 */
+    SubPoint points[SUB_WINDOW_MAX];    /**< 本窗口的采样点 */
+    int count;                          /**< 本窗口的采样点数 */
+    uint64_t cost_ns;                   /**< 本窗口采样耗时合计 */
+} sub_sampler;
+
+/**
+ * @brief 从 /proc 读取一个采样点
+ */
+static void sub_point_read(SubPoint *point)
+{
+    int num_cpus;
+    point->t_ns = monotonic_ns();
+    read_loadavg(&point->loadavg);
+    read_cpu_info(&point->cpuinfo, &num_cpus, 0);
+    read_mem_info(&point->meminfo);
+    get_root_diskstats(&point->diskstats);
+}
+
+/**
+ * @brief 追加采样点（窗口已满时覆盖最后一个点）
+ */
+static void sub_push(const SubPoint *point)
+{
+    int slot = sub_sampler.count < SUB_WINDOW_MAX ? sub_sampler.count++ : SUB_WINDOW_MAX - 1;
+    sub_sampler.points[slot] = *point;
+}
+
+/**
+ * @brief 采集一个中间采样点
+ */
+void sub_sample(void)
+{
+    SubPoint point;
+    sub_point_read(&point);
+    sub_push(&point);
+    sub_sampler.cost_ns += monotonic_ns() - point.t_ns;
+}
+
+/**
+ * @brief 计数器差值，计数器变小（重置或回绕）时返回 -1
+ */
+static inline double sub_counter_delta(unsigned long long cur, unsigned long long prev)
+{
+    return cur >= prev ? (double)(cur - prev) : -1;
+}
+
+/**
+ * @brief 计算一个采样点的瞬时值，CPU 占比取自与前一个点之间的区间
+ *
+ * @param prev 前一个点，NULL 表示没有（CPU 占比记为无效）
+ * @param point 当前点
+ * @param gauges 输出参数，瞬时值；无法计算的记为 NAN
+ */
+static void sub_gauges(const SubPoint *prev, const SubPoint *point, double *gauges)
+{
+    gauges[0] = gauges[1] = gauges[2] = NAN;
+    if (prev)
+    {
+        const CpuInfo *a = &prev->cpuinfo;
+        const CpuInfo *b = &point->cpuinfo;
+        unsigned long long total_a = a->cpu_user + a->cpu_system + a->cpu_nice + a->cpu_idle + a->cpu_iowait +
+                                     a->cpu_irq + a->cpu_softirq + a->cpu_steal;
+        unsigned long long total_b = b->cpu_user + b->cpu_system + b->cpu_nice + b->cpu_idle + b->cpu_iowait +
+                                     b->cpu_irq + b->cpu_softirq + b->cpu_steal;
+        double total = sub_counter_delta(total_b, total_a);
+        double idle = sub_counter_delta(b->cpu_idle, a->cpu_idle);
+        double iowait = sub_counter_delta(b->cpu_iowait, a->cpu_iowait);
+        double steal = sub_counter_delta(b->cpu_steal, a->cpu_steal);
+        if (total > 0 && idle >= 0 && iowait >= 0 && steal >= 0)
+        {
+            gauges[0] = 100.0 * (total - idle - iowait) / total;
+            gauges[1] = 100.0 * iowait / total;
+            gauges[2] = 100.0 * steal / total;
+        }
+    }
+    gauges[3] = point->loadavg.load_1min;
+    gauges[4] = point->loadavg.running_tasks;
+    gauges[5] = point->meminfo.mem_used_mib;
+    gauges[6] = point->meminfo.mem_free_mib;
+    gauges[7] = (double)point->diskstats.ios_in_progress;
+}
+
+/**
+ * @brief 计算两个采样点之间各计数器的每秒速率
+ *
+ * @param rates 输出参数；计数器变小的记为 NAN
+ */
+static void sub_rates(const SubPoint *prev, const SubPoint *point, double *rates)
+{
+    const unsigned long long cur[SUB_RATE_COUNT] = {
+        point->cpuinfo.cpu_user, point->cpuinfo.cpu_system, point->cpuinfo.cpu_iowait, point->cpuinfo.cpu_steal,
+        point->diskstats.reads_completed, point->diskstats.writes_completed,
+        point->diskstats.read_sectors, point->diskstats.write_sectors, point->diskstats.iotime_ms,
+    };
+    const unsigned long long old[SUB_RATE_COUNT] = {
+        prev->cpuinfo.cpu_user, prev->cpuinfo.cpu_system, prev->cpuinfo.cpu_iowait, prev->cpuinfo.cpu_steal,
+        prev->diskstats.reads_completed, prev->diskstats.writes_completed,
+        prev->diskstats.read_sectors, prev->diskstats.write_sectors, prev->diskstats.iotime_ms,
+    };
+    double seconds = (double)(point->t_ns - prev->t_ns) / 1e9;
+    for (int i = 0; i < SUB_RATE_COUNT; i++)
+    {
+        double delta = sub_counter_delta(cur[i], old[i]);
+        rates[i] = delta >= 0 && seconds > 0 ? delta / seconds : NAN;
+    }
+}
+
+/**
+ * @brief 以本周期完整采集的结果作为窗口最后一个点，汇总窗口并开始下一个窗口
+ *
+ * @param sample 本周期的完整采集结果，汇总结果写入 sample->hf
+ */
+void sub_finish(Sample *sample)
+{
+    SubStats *hf = &sample->hf;
+    memset(hf, 0, sizeof(*hf));
+    if (sub_sampler.hz <= 0)
+    {
+        return;
+    }
+
+    SubPoint last = {.t_ns = monotonic_ns(), .loadavg = sample->loadavg, .cpuinfo = sample->cpuinfo,
+                     .meminfo = sample->meminfo, .diskstats = sample->diskstats};
+    sub_push(&last);
+
+    int counted[SUB_GAUGE_COUNT] = {0};
+    for (int r = 0; r < SUB_RATE_COUNT; r++)
+    {
+        hf->rate_max[r] = NAN;
+    }
+    for (int i = 0; i < sub_sampler.count; i++)
+    {
+        const SubPoint *point = &sub_sampler.points[i];
+        const SubPoint *prev = i > 0 ? &sub_sampler.points[i - 1] : sub_sampler.have_base ? &sub_sampler.base : NULL;
+        double gauges[SUB_GAUGE_COUNT];
+        sub_gauges(prev, point, gauges);
+        for (int g = 0; g < SUB_GAUGE_COUNT; g++)
+        {
+            double v = gauges[g];
+            if (isnan(v))
+            {
+                continue;
+            }
+            double *st = hf->stats[g];
+            if (counted[g]++ == 0)
+            {
+                st[SUB_MIN] = st[SUB_MAX] = v;
+            }
+            st[SUB_MIN] = v < st[SUB_MIN] ? v : st[SUB_MIN];
+            st[SUB_MAX] = v > st[SUB_MAX] ? v : st[SUB_MAX];
+            st[SUB_MEAN] += v;
+            st[SUB_LAST] = v;
+        }
+        if (prev)
+        {
+            double rates[SUB_RATE_COUNT];
+            sub_rates(prev, point, rates);
+            for (int r = 0; r < SUB_RATE_COUNT; r++)
+            {
+                if (!isnan(rates[r]) && (isnan(hf->rate_max[r]) || rates[r] > hf->rate_max[r]))
+                {
+                    hf->rate_max[r] = rates[r];
+                }
+            }
+        }
+    }
+    for (int g = 0; g < SUB_GAUGE_COUNT; g++)
+    {
+        hf->stats[g][SUB_MEAN] = counted[g] ? hf->stats[g][SUB_MEAN] / counted[g] : 0;
+    }
+    for (int r = 0; r < SUB_RATE_COUNT; r++)
+    {
+        hf->rate_max[r] = isnan(hf->rate_max[r]) ? 0 : hf->rate_max[r];
+    }
+    hf->count = sub_sampler.count;
+    hf->cost_us = sub_sampler.count > 1 ? (double)sub_sampler.cost_ns / 1000 / (sub_sampler.count - 1) : 0;
+
+    sub_sampler.base = last;
+    sub_sampler.have_base = 1;
+    sub_sampler.count = 0;
+    sub_sampler.cost_ns = 0;
+}
+
+/**
+ * @brief 输出高频采样汇总（-v 时使用）
+ */
+void sub_report(FILE *out, const SubStats *hf)
+{
+    if (hf->count == 0)
+    {
+        return;
+    }
+    fprintf(out, "%-22s %10s %10s %10s %10s   (%d points, %.1f us/point, %.3f%% CPU at %d Hz)\n",
+            "subsample", "min", "max", "mean", "last", hf->count, hf->cost_us,
+            hf->cost_us * sub_sampler.hz / 1e4, sub_sampler.hz);
+    for (int g = 0; g < SUB_GAUGE_COUNT; g++)
+    {
+        fprintf(out, "%-22s %10.2f %10.2f %10.2f %10.2f\n", sub_gauge_names[g],
+                hf->stats[g][SUB_MIN], hf->stats[g][SUB_MAX], hf->stats[g][SUB_MEAN], hf->stats[g][SUB_LAST]);
+    }
+    for (int r = 0; r < SUB_RATE_COUNT; r++)
+    {
+        fprintf(out, "%-22s max %.2f/s\n", sub_rate_names[r], hf->rate_max[r]);
+    }
+}
+
+/* ============================================================================
+ * 事件循环
+ *
+ * 单线程 epoll 循环：周期边界由对齐到实时时钟整 10 秒的周期 timerfd 驱动（TFD_TIMER_ABSTIME），
+ * 高频采样点由第二个 timerfd 驱动；SIGINT/SIGTERM/SIGHUP 经 signalfd 进入循环，
+ * proc connector 套接字和 PSI 触发器 fd 也在同一个 epoll 中等待。
+ * 周期 timerfd 的到期次数即错过的周期数，采集或上报超过 10 秒时据此上报，而不是悄悄拉长周期。
+ * ============================================================================ */
+
+#define LOOP_INTERVAL_S     10          /**< 上报周期（秒），对齐到实时时钟的整数倍 */
+#define LOOP_MAX_EVENTS     16          /**< 单次 epoll_wait 处理的最大事件数 */
+
+/**
+ * @brief event_loop_wait() 的返回值
+ */
+enum
+{
+    LOOP_TICK,              /**< 到达周期边界 */
+    LOOP_PSI,               /**< PSI 触发器触发，应立即采集带外样本 */
+    LOOP_RELOAD,            /**< 收到 SIGHUP */
+    LOOP_STOP               /**< 收到 SIGINT/SIGTERM，应上报剩余样本后退出 */
+};
+
+/**
+ * @brief epoll 事件的来源（epoll_event.data.u64）；PSI 触发器为 LOOP_SRC_PSI + 触发器下标
+ */
+enum
+{
+    LOOP_SRC_TICK,
+    LOOP_SRC_SUB,
+    LOOP_SRC_SIGNAL,
+    LOOP_SRC_PROC_EVENTS,
+    LOOP_SRC_PSI
+};
+
+/**
+ * @brief 事件循环状态
+ */
+static struct
+{
+    int epfd;                   /**< epoll fd */
+    int tick_fd;                /**< 周期边界 timerfd */
+    int sub_fd;                 /**< 高频采样 timerfd，-1 表示未启用 */
+    int sig_fd;                 /**< signalfd */
+    int proc_events_fd;         /**< 已加入 epoll 的 proc connector 套接字，-1 表示没有 */
+    uint32_t missed;            /**< 上一个样本以来错过的周期数 */
+    time_t boundary;            /**< 最近一次处理的周期边界（实时时钟，秒） */
+    uint64_t boundary_mono_ns;  /**< 该边界对应的单调时钟时间 */
+    int32_t lag_ms;             /**< 最近一次周期边界被处理时相对边界的延迟（毫秒） */
+} event_loop = {.epfd = -1, .tick_fd = -1, .sub_fd = -1, .sig_fd = -1, .proc_events_fd = -1};
+
+/**
+ * @brief 把 fd 加入 epoll
+ *
+ * @return 成功返回 0，失败返回 -1
+ */
+static int loop_watch(int fd, uint32_t events, uint64_t src)
+{
+    struct epoll_event ev = {.events = events, .data.u64 = src};
+    if (epoll_ctl(event_loop.epfd, EPOLL_CTL_ADD, fd, &ev) != 0)
+    {
+        perror("epoll_ctl");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 把周期 timerfd 设置到下一个整 10 秒边界
+ *
+ * TFD_TIMER_CANCEL_ON_SET：实时时钟被设置（NTP 步进、手动改时间）时读取返回 ECANCELED，届时重新对齐。
+ *
+ * @return 成功返回 0，失败返回 -1
+ */
+static int loop_arm_tick(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    struct itimerspec its = {
+        .it_interval = {.tv_sec = LOOP_INTERVAL_S},
+        .it_value = {.tv_sec = now.tv_sec - now.tv_sec % LOOP_INTERVAL_S + LOOP_INTERVAL_S},
+    };
+    if (timerfd_settime(event_loop.tick_fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &its, NULL) != 0)
+    {
+        perror("timerfd_settime");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 把高频采样 timerfd 设置为对齐到实时时钟整数倍周期的周期定时器
+ *
+ * @return 成功返回 0，失败返回 -1
+ */
+static int loop_arm_sub(void)
+{
+    long period_ns = 1000000000L / sub_sampler.hz;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    struct itimerspec its = {
+        .it_interval = {.tv_sec = 0, .tv_nsec = period_ns},
+        .it_value = {.tv_sec = now.tv_sec, .tv_nsec = (now.tv_nsec / period_ns + 1) * period_ns},
+    };
+    if (sub_sampler.hz == 1)
+    {
+        its.it_interval = (struct timespec){.tv_sec = 1};
+    }
+    if (its.it_value.tv_nsec >= 1000000000L)
+    {
+        its.it_value.tv_sec++;
+        its.it_value.tv_nsec = 0;
+    }
+    if (timerfd_settime(event_loop.sub_fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &its, NULL) != 0)
+    {
+        perror("timerfd_settime");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 创建 epoll、timerfd 和 signalfd，注册 PSI 触发器
+ *
+ * 必须在创建任何线程之前调用：屏蔽的信号掩码由之后创建的线程继承，信号只经 signalfd 送达。
+ *
+ * @return 成功返回 0，失败返回 -1
+ */
+int event_loop_init(void)
+{
+    /* curl 提前退出时写管道返回 EPIPE（按上报失败处理），而不是以 SIGPIPE 终止进程 */
+    signal(SIGPIPE, SIG_IGN);
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGHUP);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) != 0)
+    {
+        perror("sigprocmask");
+        return -1;
+    }
+
+    event_loop.epfd = epoll_create1(EPOLL_CLOEXEC);
+    event_loop.tick_fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+    event_loop.sig_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (event_loop.epfd < 0 || event_loop.tick_fd < 0 || event_loop.sig_fd < 0)
+    {
+        perror("event loop");
+        return -1;
+    }
+    if (loop_arm_tick() != 0 ||
+        loop_watch(event_loop.tick_fd, EPOLLIN, LOOP_SRC_TICK) != 0 ||
+        loop_watch(event_loop.sig_fd, EPOLLIN, LOOP_SRC_SIGNAL) != 0)
+    {
+        return -1;
+    }
+    if (sub_sampler.hz > 0)
+    {
+        event_loop.sub_fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (event_loop.sub_fd < 0 || loop_arm_sub() != 0 ||
+            loop_watch(event_loop.sub_fd, EPOLLIN, LOOP_SRC_SUB) != 0)
+        {
+            return -1;
+        }
+    }
+
+    psi_register_triggers();
+    for (int i = 0; i < psi.trigger_count; i++)
+    {
+        if (psi.triggers[i].fd >= 0)
+        {
+            loop_watch(psi.triggers[i].fd, EPOLLPRI, LOOP_SRC_PSI + i);
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief 读取 timerfd 的到期次数；实时时钟被设置时重新对齐
+ *
+ * @return 到期次数，没有到期或时钟被设置时返回 0
+ */
+static uint64_t loop_read_timer(int fd, int (*rearm)(void))
+{
+    uint64_t expirations = 0;
+    if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+    {
+        if (errno == ECANCELED)
+        {
+            fprintf(stderr, "Realtime clock was set, realigning timers\n");
+            rearm();
+        }
+        return 0;
+    }
+    return expirations;
+}
+
+/**
+ * @brief 判断当前时刻是否在周期边界前后半个高频采样周期内（该点留给完整采集）
+ */
+static int loop_near_boundary(long period_ns)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    long long ns = (long long)(now.tv_sec % LOOP_INTERVAL_S) * 1000000000LL + now.tv_nsec;
+    return ns < period_ns / 2 || ns > LOOP_INTERVAL_S * 1000000000LL - period_ns / 2;
+}
+
+/**
+ * @brief 等待下一个需要主循环处理的事件
+ *
+ * 期间处理高频采样点和进程事件。处理周期边界时记录延迟和错过的周期数（由 loop_take_stats 取出）。
+ *
+ * @return LOOP_TICK、LOOP_PSI、LOOP_RELOAD 或 LOOP_STOP
+ */
+int event_loop_wait(void)
+{
+    /* proc connector 在首次采集时才订阅 */
+    if (proc_events.fd >= 0 && event_loop.proc_events_fd != proc_events.fd &&
+        loop_watch(proc_events.fd, EPOLLIN, LOOP_SRC_PROC_EVENTS) == 0)
+    {
+        event_loop.proc_events_fd = proc_events.fd;
+    }
+
+    for (;;)
+    {
+        struct epoll_event events[LOOP_MAX_EVENTS];
+        int n = epoll_wait(event_loop.epfd, events, LOOP_MAX_EVENTS, -1);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("epoll_wait");
+            return LOOP_STOP;
+        }
+
+        int result = -1;
+        for (int i = 0; i < n; i++)
+        {
+            uint64_t src = events[i].data.u64;
+            if (src == LOOP_SRC_TICK)
+            {
+                uint64_t expirations = loop_read_timer(event_loop.tick_fd, loop_arm_tick);
+                if (expirations > 0)
+                {
+                    struct timespec now;
+                    clock_gettime(CLOCK_REALTIME, &now);
+                    uint64_t lag_ns = (uint64_t)(now.tv_sec % LOOP_INTERVAL_S) * 1000000000ULL + now.tv_nsec;
+                    event_loop.missed += (uint32_t)(expirations - 1);
+                    event_loop.lag_ms = (int32_t)(lag_ns / 1000000);
+                    event_loop.boundary = now.tv_sec - now.tv_sec % LOOP_INTERVAL_S;
+                    event_loop.boundary_mono_ns = monotonic_ns() - lag_ns;
+                    result = LOOP_TICK;
+                }
+            }
+            else if (src == LOOP_SRC_SUB)
+            {
+                long period_ns = 1000000000L / sub_sampler.hz;
+                if (loop_read_timer(event_loop.sub_fd, loop_arm_sub) > 0 && !loop_near_boundary(period_ns))
+                {
+                    sub_sample();
+                }
+            }
+            else if (src == LOOP_SRC_SIGNAL)
+            {
+                struct signalfd_siginfo si;
+                while (read(event_loop.sig_fd, &si, sizeof(si)) == sizeof(si))
+                {
+                    int r = si.ssi_signo == SIGHUP ? LOOP_RELOAD : LOOP_STOP;
+                    result = result > r ? result : r;
+                }
+            }
+            else if (src == LOOP_SRC_PROC_EVENTS)
+            {
+                proc_events_drain();
+            }
+            else if (psi_trigger_ready((int)(src - LOOP_SRC_PSI), events[i].events))
+            {
+                result = result > LOOP_PSI ? result : LOOP_PSI;
+            }
+        }
+        if (result >= 0)
+        {
+            return result;
+        }
+    }
+}
+
+/**
+ * @brief 处理 SIGHUP：关闭缓存的数据源 fd，下次使用时重新打开
+ *
+ * 进程表下次重新遍历 /proc，cgroup 层级下次重新遍历；用于在挂载或容器大范围变化后不重启即可重建缓存状态。
+ * 上报连接和 DNS 缓存由上报线程重建（uploader_reload）。
+ */
+void event_loop_reload(void)
+{
+    fprintf(stderr, "SIGHUP: reopening data sources and connections\n");
+    for (int i = 0; i < SRC_COUNT; i++)
+    {
+        proc_source_close(&proc_sources[i]);
+    }
+    proc_top.tracked = 0;
+    cgroups.need_rescan = 1;
+}
+
+/**
+ * @brief 取出并清零上一个样本以来的调度统计
+ *
+ * @param stats 输出参数
+ * @param busy_ms 上一轮从处理周期边界到采集、上报完成的耗时（毫秒）
+ */
+void loop_take_stats(LoopStats *stats, uint32_t busy_ms)
+{
+    stats->missed_ticks = event_loop.missed;
+    stats->lag_ms = event_loop.lag_ms;
+    stats->busy_ms = busy_ms;
+    event_loop.missed = 0;
+}
+
+/* ============================================================================
+ * 速率计算
+ * ============================================================================ */
+
+/** 32 位计数器回绕后的最大可信增量：超过则视为重置 */
+#define RATE_WRAP32_MAX_DELTA   0x80000000ULL
+
+/**
+ * @brief 速率计算器：保存上一次采集的计数器，按单调时钟的实际间隔计算速率
+ */
+static struct
+{
+    int have_prev;          /**< prev 是否有效 */
+    uint64_t mono_ns;       /**< 上一次采集的时间（单调时钟） */
+    CpuInfo cpu;            /**< 上一次的 CPU 累计时间 */
+    DiskStats disk;         /**< 上一次的根分区磁盘统计 */
+    unsigned long long rx;  /**< 上一次的接收字节数 */
+    unsigned long long tx;  /**< 上一次的发送字节数 */
+} rate_state;
+
+/**
+ * @brief 计算计数器增量，识别 32 位回绕和重置
+ *
+ * 计数器变小时：两个值都在 32 位范围内且按回绕计算的增量合理，视为 32 位回绕；否则视为重置。
+ *
+ * @param cur 当前值
+ * @param prev 上一次的值
+ * @param flags 输入输出参数，回绕时置 RATE_FLAG_WRAP，重置时置 reset_flag
+ * @param reset_flag 重置时设置的标志
+ * @return 增量，重置时返回 0
+ */
+static unsigned long long rate_delta(unsigned long long cur, unsigned long long prev, int *flags, int reset_flag)
+{
+    if (cur >= prev)
+    {
+        return cur - prev;
+    }
+    if (prev <= UINT32_MAX && cur <= UINT32_MAX)
+    {
+        unsigned long long wrapped = cur + 0x100000000ULL - prev;
+        if (wrapped < RATE_WRAP32_MAX_DELTA)
+        {
+            *flags |= RATE_FLAG_WRAP;
+            return wrapped;
+        }
+    }
+    *flags |= reset_flag;
+    return 0;
+}
+
+/**
+ * @brief 计算本次采集相对上一次采集的速率和利用率，写入 sample->rates
+ *
+ * 第一次采集没有基准，sample->rates.interval_ms 为 0。
+ * 某一组计数器重置（如根分区设备变化、网卡重建、CPU 计数器整体变小）时该组速率记为 0 并置相应标志。
+ *
+ * @param sample 本次采集结果，sample->mono_ns 为采集时间
+ */
+void compute_rates(Sample *sample)
+{
+    Rates *r = &sample->rates;
+    memset(r, 0, sizeof(*r));
+
+    if (rate_state.have_prev && sample->mono_ns > rate_state.mono_ns)
+    {
+        double seconds = (double)(sample->mono_ns - rate_state.mono_ns) / 1e9;
+        r->interval_ms = (sample->mono_ns - rate_state.mono_ns) / 1000000;
+
+        /* CPU：/proc/stat 的 iowait 等单项可能小幅回退，单项回退按 0 计；总和回退视为重置 */
+        const CpuInfo *c = &sample->cpuinfo;
+        const CpuInfo *p = &rate_state.cpu;
+        const unsigned long long cur[8] = {c->cpu_user, c->cpu_system, c->cpu_nice, c->cpu_idle,
+                                           c->cpu_iowait, c->cpu_irq, c->cpu_softirq, c->cpu_steal};
+        const unsigned long long old[8] = {p->cpu_user, p->cpu_system, p->cpu_nice, p->cpu_idle,
+                                           p->cpu_iowait, p->cpu_irq, p->cpu_softirq, p->cpu_steal};
+        unsigned long long delta[8], total = 0, total_cur = 0, total_old = 0;
+        for (int i = 0; i < 8; i++)
+        {
+            delta[i] = cur[i] >= old[i] ? cur[i] - old[i] : 0;
+            total += delta[i];
+            total_cur += cur[i];
+            total_old += old[i];
+        }
+        if (total_cur < total_old)
+        {
+            r->flags |= RATE_FLAG_CPU_RESET;
+        }
+        else if (total > 0)
+        {
+            double *pct[8] = {&r->cpu_user_pct, &r->cpu_system_pct, &r->cpu_nice_pct, &r->cpu_idle_pct,
+                              &r->cpu_iowait_pct, &r->cpu_irq_pct, &r->cpu_softirq_pct, &r->cpu_steal_pct};
+            for (int i = 0; i < 8; i++)
+            {
+                *pct[i] = 100.0 * (double)delta[i] / (double)total;
+            }
+            r->cpu_busy_pct = 100.0 - r->cpu_idle_pct - r->cpu_iowait_pct;
+        }
+
+        /* 磁盘：与 iostat 相同的定义 */
+        const DiskStats *d = &sample->diskstats;
+        const DiskStats *q = &rate_state.disk;
+        int disk_flags = 0;
+        unsigned long long reads = rate_delta(d->reads_completed, q->reads_completed, &disk_flags, RATE_FLAG_DISK_RESET);
+        unsigned long long writes = rate_delta(d->writes_completed, q->writes_completed, &disk_flags, RATE_FLAG_DISK_RESET);
+        unsigned long long rsect = rate_delta(d->read_sectors, q->read_sectors, &disk_flags, RATE_FLAG_DISK_RESET);
+        unsigned long long wsect = rate_delta(d->write_sectors, q->write_sectors, &disk_flags, RATE_FLAG_DISK_RESET);
+        unsigned long long rms = rate_delta(d->reading_ms, q->reading_ms, &disk_flags, RATE_FLAG_DISK_RESET);
+        unsigned long long wms = rate_delta(d->writing_ms, q->writing_ms, &disk_flags, RATE_FLAG_DISK_RESET);
+        unsigned long long io_ms = rate_delta(d->iotime_ms, q->iotime_ms, &disk_flags, RATE_FLAG_DISK_RESET);
+        unsigned long long wio_ms = rate_delta(d->weighted_io_time, q->weighted_io_time, &disk_flags, RATE_FLAG_DISK_RESET);
+        if (!(disk_flags & RATE_FLAG_DISK_RESET))
+        {
+            r->disk_reads_ps = (double)reads / seconds;
+            r->disk_writes_ps = (double)writes / seconds;
+            r->disk_read_kbps = (double)rsect * 512 / 1024 / seconds;
+            r->disk_write_kbps = (double)wsect * 512 / 1024 / seconds;
+            r->disk_r_await_ms = reads ? (double)rms / (double)reads : 0;
+            r->disk_w_await_ms = writes ? (double)wms / (double)writes : 0;
+            r->disk_await_ms = reads + writes ? (double)(rms + wms) / (double)(reads + writes) : 0;
+            r->disk_util_pct = (double)io_ms / (seconds * 10);
+            r->disk_util_pct = r->disk_util_pct > 100 ? 100 : r->disk_util_pct;
+            r->disk_avg_queue = (double)wio_ms / (seconds * 1000);
+        }
+        r->flags |= disk_flags;
+
+        /* 网络：收发方向分别判断，一个方向重置不影响另一个方向 */
+        r->net_rx_bps = (double)rate_delta(sample->netinfo.default_interface_net_rx_bytes, rate_state.rx,
+                                           &r->flags, RATE_FLAG_NET_RESET) / seconds;
+        r->net_tx_bps = (double)rate_delta(sample->netinfo.default_interface_net_tx_bytes, rate_state.tx,
+                                           &r->flags, RATE_FLAG_NET_RESET) / seconds;
+    }
+
+    rate_state.have_prev = 1;
+    rate_state.mono_ns = sample->mono_ns;
+    rate_state.cpu = sample->cpuinfo;
+    rate_state.disk = sample->diskstats;
+    rate_state.rx = sample->netinfo.default_interface_net_rx_bytes;
+    rate_state.tx = sample->netinfo.default_interface_net_tx_bytes;
+}
+
+/* ============================================================================
+ * 指标采集与格式化
+ * ============================================================================ */
+
+/**
+ * @brief 采集所有系统指标
+ *
+ * machine_id 只在启动时读取一次；主机名仅在内核通知变化时重新读取；
+ * CPU 核心数取自本次读取的 /proc/stat。
+ *
+ * @param sample 输出参数，采集结果（timestamp 由调用者设置；sysinfo 中的静态身份跨周期保留）
+ */
+void collect_metrics(Sample *sample)
+{
+    Uptime *uptime = &sample->uptime;
+    LoadAvg *loadavg = &sample->loadavg;
+    CpuInfo *cpuinfo = &sample->cpuinfo;
+    MemInfo *meminfo = &sample->meminfo;
+    NetInfo *netinfo = &sample->netinfo;
+    SystemInfo *sysinfo = &sample->sysinfo;
+    DiskStats *diskstats = &sample->diskstats;
+
+    if (read_uptime(uptime) != 0)
+    {
+        fprintf(stderr, "Failed to read uptime\n");
+    }
     if (read_loadavg(loadavg) != 0)
     {
-        fprintf(stderr, "Failed to read loadavg\n");
+        fprintf(stderr, "Failed to read loadavg\n");
+    }
+    if (read_cpu_info(cpuinfo, &sysinfo->cpu_num_cores, 1) != 0)
+    {
+        fprintf(stderr, "Failed to read cpu info\n");
+    }
+    if (read_mem_info(meminfo) != 0)
+    {
+        fprintf(stderr, "Failed to read mem info\n");
+    }
+    if (read_net_info(netinfo) != 0)
+    {
+        fprintf(stderr, "Failed to read net info\n");
+    }
+    if (hostname_changed() && get_hostname(sysinfo->hostname, sizeof(sysinfo->hostname)) != 0)
+    {
+        fprintf(stderr, "Failed to get hostname\n");
+    }
+    if (get_diskstats(diskstats, disk_filter_enabled() ? &sample->disks : NULL) != 0){
+        fprintf(stderr, "Failed to get diskstats\n");
+    }
+
+    if (get_disk_space_kb("/", &sysinfo->root_disk_total_kb, &sysinfo->root_disk_avail_kb) != 0)
+    {
+        fprintf(stderr, "Failed to get disk space\n");
+    }
+    if (fs_table.enabled && get_filesystems(&sample->filesystems) != 0)
+    {
+        fprintf(stderr, "Failed to get filesystems\n");
+    }
+    if (proc_events.enabled && get_proc_events(&sample->proc_events) != 0)
+    {
+        fprintf(stderr, "Failed to get process events\n");
+    }
+    if (proc_top.top_n > 0)
+    {
+        if (get_top_processes(&sample->top) != 0)
+        {
+            fprintf(stderr, "Failed to get top processes\n");
+        }
+        proc_events_sync_table();
+    }
+    if (psi.enabled && get_psi_stats(&sample->psi) != 0)
+    {
+        fprintf(stderr, "Failed to read pressure stall information\n");
+        psi.enabled = 0;
+    }
+    if (cgroups.max_depth > 0 && get_cgroup_stats(&sample->cgroups) != 0)
+    {
+        fprintf(stderr, "Failed to get cgroup stats\n");
+    }
+    if (get_default_interface_traffic(&netinfo->default_interface_net_rx_bytes, &netinfo->default_interface_net_tx_bytes) != 0)
+    {
+        fprintf(stderr, "Failed to get net traffic\n");
+    }
+    if (link_table.filter[0] && get_interface_stats(&sample->interfaces) != 0)
+    {
+        fprintf(stderr, "Failed to get interface stats\n");
+    }
+}
+
+#define KV_BUFFER_SIZE  65536   /**< 单个样本格式化结果的缓冲区大小（每 CPU 全量上报和 cgroup 排行时最长） */
+
+/**
+ * @brief 编码扩展字段中的名字（挂载点、进程名、cgroup 路径）
+ *
+ * 空白、反斜杠和分隔符 ','、':' 按 mountinfo 的规则转义为 \ooo，再做 URL 编码。
+ *
+ * @param in 原始名字
+ * @param out 输出缓冲区（长度至少为 strlen(in) * 12 + 1 才不会截断）
+ * @param out_size 输出缓冲区大小
+ */
+static void kv_encode_name(const char *in, char *out, size_t out_size)
+{
+    char escaped[CGROUP_PATH_MAX * 4];
+    size_t n = 0;
+    for (; *in && n + 5 <= sizeof(escaped); in++)
+    {
+        if (strchr(" \t\n\\,:", *in))
+        {
+            n += sprintf(escaped + n, "\\%03o", (unsigned char)*in);
+        }
+        else
+        {
+            escaped[n++] = *in;
+        }
+    }
+    escaped[n] = '\0';
+    url_encode(escaped, out, out_size);
+}
+
+/**
+ * @brief 将指标转换为 values=v1,v2,v3,... 格式的字符串
+ *
+ * 输出字段顺序（共 35 个字段）：
+ * timestamp, uptime_s, load_1min, load_5min, load_15min, running_tasks, total_tasks,
+ * cpu_user, cpu_system, cpu_nice, cpu_idle, cpu_iowait, cpu_irq, cpu_softirq, cpu_steal,
+ * mem_total_mib, mem_free_mib, mem_used_mib, mem_buff_cache_mib,
+ * tcp_connections, udp_connections, net_rx_bytes, net_tx_bytes, cpu_num_cores,
+ * root_disk_total_kb, root_disk_avail_kb,
+ * disk_reads_completed, disk_writes_completed, disk_reading_ms, disk_writing_ms,
+ * disk_iotime_ms, disk_ios_in_progress, disk_weighted_io_time,
+ * machine_id, hostname
+ *
+ * 之后追加扩展字段 &tcp_states=c1,c2,...（各 TCP 状态连接数，顺序见 tcp_state_names）。
+ *
+ * 会话模式（handle 非 0）下以 handle=<句柄>& 开头，并省略末尾的 machine_id 和 hostname。
+ *
+ * @param sample 采集结果
+ * @param handle 会话句柄，0 表示携带完整身份
+ * @return 成功返回格式化字符串（需调用者 free），失败返回 NULL
+ */
+char *metrics_to_kv(const Sample *sample, unsigned long handle) {
+    const Uptime *uptime = &sample->uptime;
+    const LoadAvg *loadavg = &sample->loadavg;
+    const CpuInfo *cpuinfo = &sample->cpuinfo;
+    const MemInfo *meminfo = &sample->meminfo;
+    const NetInfo *netinfo = &sample->netinfo;
+    const SystemInfo *sysinfo = &sample->sysinfo;
+    const DiskStats *diskstats = &sample->diskstats;
+
+    char *kv_string = malloc(KV_BUFFER_SIZE);
+    if (!kv_string) {
+        perror("malloc");
+        return NULL;
+    }
+
+    char values_buffer[KV_BUFFER_SIZE];
+    int values_len = 0;
+
+    values_len += snprintf(values_buffer + values_len, sizeof(values_buffer) - values_len,
+                           "%ld,%ld,%.2lf,%.2lf,%.2lf,%d,%d,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%.2lf,%.2lf,%.2lf,%.2lf,%d,%d,%llu,%llu,%d,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu",
+                           (long)sample->timestamp, (long)uptime->uptime_s,
+                           loadavg->load_1min, loadavg->load_5min, loadavg->load_15min,
+                           loadavg->running_tasks, loadavg->total_tasks,
+                           cpuinfo->cpu_user, cpuinfo->cpu_system, cpuinfo->cpu_nice,
+                           cpuinfo->cpu_idle, cpuinfo->cpu_iowait, cpuinfo->cpu_irq,
+                           cpuinfo->cpu_softirq, cpuinfo->cpu_steal,
+                           meminfo->mem_total_mib, meminfo->mem_free_mib, meminfo->mem_used_mib,
+                           meminfo->mem_buff_cache_mib,
+                           netinfo->tcp_connections, netinfo->udp_connections,
+                           netinfo->default_interface_net_rx_bytes, netinfo->default_interface_net_tx_bytes,
+                           sysinfo->cpu_num_cores,
+                           sysinfo->root_disk_total_kb, sysinfo->root_disk_avail_kb,
+                           diskstats->reads_completed, diskstats->writes_completed, diskstats->reading_ms, diskstats->writing_ms,
+                           diskstats->iotime_ms, diskstats->ios_in_progress, diskstats->weighted_io_time);
+    if (!handle && values_len >= 0 && values_len < (int)sizeof(values_buffer)) {
+        values_len += snprintf(values_buffer + values_len, sizeof(values_buffer) - values_len,
+                               ",%s,%s", sysinfo->machine_id, sysinfo->hostname);
+    }
+
+    if (values_len < 0 || values_len >= (int)sizeof(values_buffer)) {
+        fprintf(stderr, "Error: Values string too long\n");
+        free(kv_string);
+        return NULL;
+    }
+
+    int kv_len = handle ? snprintf(kv_string, KV_BUFFER_SIZE, "handle=%lu&values=%s", handle, values_buffer)
+                        : snprintf(kv_string, KV_BUFFER_SIZE, "values=%s", values_buffer);
+
+    /* 扩展字段：各 TCP 状态连接数，顺序见 tcp_state_names */
+    if (kv_len >= 0 && kv_len < KV_BUFFER_SIZE) {
+        kv_len += snprintf(kv_string + kv_len, KV_BUFFER_SIZE - kv_len, "&tcp_states=");
+        for (int i = 0; i < TCP_STATE_COUNT && kv_len < KV_BUFFER_SIZE; i++) {
+            kv_len += snprintf(kv_string + kv_len, KV_BUFFER_SIZE - kv_len, i ? ",%d" : "%d", netinfo->tcp_states[i]);
+        }
+    }
+
+    /* 扩展字段：速率 */
+    const Rates *rates = &sample->rates;
+    if (rates->interval_ms > 0 && kv_len >= 0 && kv_len < KV_BUFFER_SIZE) {
+        kv_len += snprintf(kv_string + kv_len, KV_BUFFER_SIZE - kv_len, "&rates=%llu,%d",
+                           (unsigned long long)rates->interval_ms, rates->flags);
+        const double rate_values[] = {
+            rates->cpu_busy_pct, rates->cpu_user_pct, rates->cpu_system_pct, rates->cpu_nice_pct,
+            rates->cpu_idle_pct, rates->cpu_iowait_pct, rates->cpu_irq_pct, rates->cpu_softirq_pct,
+            rates->cpu_steal_pct, rates->disk_reads_ps, rates->disk_writes_ps, rates->disk_read_kbps,
+            rates->disk_write_kbps, rates->disk_r_await_ms, rates->disk_w_await_ms, rates->disk_await_ms,
+            rates->disk_util_pct, rates->disk_avg_queue, rates->net_rx_bps, rates->net_tx_bps,
+        };
+        for (size_t i = 0; i < sizeof(rate_values) / sizeof(rate_values[0]) && kv_len < KV_BUFFER_SIZE; i++) {
+            kv_len += snprintf(kv_string + kv_len, KV_BUFFER_SIZE - kv_len, ",%.2lf", rate_values[i]);
+        }
+    }
+
+    /* 扩展字段：每 CPU 占比 */
+    const PerCpuStats *pc = &sample->percpu;
+    if (pc->count > 0 && kv_len >= 0 && kv_len < KV_BUFFER_SIZE) {
+        int order[PERCPU_MAX];
+        int n = pc->count;
+        if (percpu.mode == PERCPU_TOP) {
+            n = percpu_top(pc, percpu.top, order);
+        } else {
+            for (int i = 0; i < n; i++) {
+                order[i] = i;
+            }
+        }
+        kv_len += snprintf(kv_string + kv_len, KV_BUFFER_SIZE - kv_len, "&%s=", percpu.mode == PERCPU_TOP ? "percpu_top" : "percpu");
+        for (int i = 0; i < n && kv_len < KV_BUFFER_SIZE; i++) {
+            const PerCpuEntry *e = &pc->cpu[order[i]];
+            kv_len += snprintf(kv_string + kv_len, KV_BUFFER_SIZE - kv_len, i ? ",%u:%u.%u" : "%u:%u.%u",
+                               e->id, e->busy / 10, e->busy % 10);
+            if (e->softirq && kv_len < KV_BUFFER_SIZE) {
+                kv_len += snprintf(kv_string + kv_len, KV_BUFFER_SIZE - kv_len, ":%u.%u",
+                                   e->softirq / 10, e->softirq % 10);
+            }
+        }
+        for (int b = 0; b < PERCPU_HIST_BUCKETS && kv_len < KV_BUFFER_SIZE; b++) {
+            kv_len += snprintf(kv_string + kv_len, KV_BUFFER_SIZE - kv_len, b ? ",%u" : "&percpu_hist=%u", pc->hist[b]);
+        }
+    }
+
+    /* 扩展字段：全部块设备 */
+    const BlockDevStats *disks = &sample->disks;
+    if (disks->count > 0 && kv_len >= 0 && kv_len < KV_BUFFER_SIZE) {
+        kv_len += snprintf(kv_string + kv_len, KV_BUFFER_SIZE - kv_len, "&disks=");
+        for (int d = 0; d < disks->count && kv_len < KV_BUFFER_SIZE; d++) {
+            kv_len += snprintf(kv_string + kv_len, KV_BUFFER_SIZE - kv_len, d ? ",%s" : "%s", disks->dev[d].name);
+            for (int f = 0; f < disks->fields && kv_len < KV_BUFFER_SIZE; f++) {
+                kv_len += snprintf(kv_string + kv_len, KV_BUFFER_SIZE - kv_len, ":%llu", disks->dev[d].v[f]);
+            }
+        }
+    }
+
+    /* 扩展字段：每个网络接口 */
+    const NetIfStats *ifs = &sample->interfaces;
+    if (ifs->count > 0 && kv_len >= 0 && kv_len < KV_BUFFER_SIZE) {
+        kv_len += snprintf(kv_string + kv_len, KV_BUFFER_SIZE - kv_len, "&ifaces=");
+        for (int i = 0; i < ifs->count && kv_len < KV_BUFFER_SIZE; i++) {
+            char name[IF_NAMESIZE * 3];
+            url_encode(ifs->iface[i].name, name, sizeof(name));
+            kv_len += snprintf(kv_string + kv_len, KV_BUFFER_SIZE - kv_len, i ? ",%s" : "%s", name);
+            for (int f = 0; f < NETIF_FIELDS && kv_len < KV_BUFFER_SIZE; f++) {
+                kv_len += snprintf(kv_string + kv_len, KV_BUFFER_SIZE - kv_len, ":%llu", ifs->iface[i].v[f]);
+            }
+        }
+    }
+
+    /* 扩展字段：进程排行 */
+    const ProcTopStats *top = &sample->top;
+    if (top->interval_ms > 0 && kv_len >= 0 && kv_len < KV_BUFFER_SIZE) {
+        static const char *const top_names[PROC_TOP_DIMS] = {"top_cpu", "top_rss", "top_io"};
+        kv_len += snprintf(kv_string + kv_len, KV_BUFFER_SIZE - kv_len, "&top=%u,%u", top->interval_ms, top->processes);
+        for (int dim = 0; dim < PROC_TOP_DIMS && kv_len < KV_BUFFER_SIZE; dim++) {
+            kv_len += snprintf(kv_string + kv_len, KV_BUFFER_SIZE - kv_len, "&%s=", top_names[dim]);
+            for (int i = 0; i < top->count[dim] && kv_len < KV_BUFFER_SIZE; i++) {
+                const ProcTopEntry *e = &top->top[dim][i];
+                char comm[16 * 12];
+                kv_encode_name(e->comm, comm, sizeof(comm));
+                kv_len += snprintf(kv_string + kv_len, KV_BUFFER_SIZE - kv_len, "%s%d:%s:%.1f:%llu:%llu:%llu",
+                                   i ? "," : "", e->pid, comm, e->cpu_pct, e->rss_kb, e->read_bytes, e->write_bytes);
+            }
+        }
+    }
+
+    /* 扩展字段：进程事件速率 */
+    const ProcEventStats *pe = &sample->proc_events;
+    if (pe->interval_ms > 0 && kv_len >= 0 && kv_len < KV_BUFFER_SIZE) {
+        kv_len += snprintf(kv_string + kv_len, KV_BUFFER_SIZE - kv_len, "&proc_events=%u,%u,%.2f,%.2f,%.2f",
+                           pe->interval_ms, pe->flags, pe->forks_ps, pe->execs_ps, pe->exits_ps);
+    }
+
+    /* 扩展字段：主循环调度统计 */
+    const LoopStats *ls = &sample->loop;
+    if (kv_len >= 0 && kv_len < KV_BUFFER_SIZE) {
+        kv_len += snprintf(kv_string + kv_len, KV_BUFFER_SIZE - kv_len, "&loop=%u,%d,%u",
+                           ls->missed_ticks, ls->lag_ms, ls->busy_ms);
+    }
+
+    /* 扩展字段：上报队列统计 */
+    const QueueStats *qs = &sample->queue;
+    if (qs->capacity > 0 && kv_len >= 0 && kv_len < KV_BUFFER_SIZE) {
+        kv_len += snprintf(kv_string + kv_len, KV_BUFFER_SIZE - kv_len, "&queue=%u,%u,%u,%u,%u,%u", qs->depth,
+                           qs->capacity, qs->drops, qs->sent, qs->latency_avg_ms, qs->latency_max_ms);
+    }
+
+    /* 扩展字段：上报重试状态 */
+    const UploadStats *us = &sample->upload;
+    if (qs->capacity > 0 && kv_len >= 0 && kv_len < KV_BUFFER_SIZE) {
+        kv_len += snprintf(kv_string + kv_len, KV_BUFFER_SIZE - kv_len, "&upload=%s,%u,%u,%u,%u,%d",
+                           retry_state_names[us->state], us->failures, us->retry_in_ms,
+                           us->skipped, us->trips, us->last_status);
+    }
+
+    /* 扩展字段：压力阻塞信息 */
+    const PsiStats *ps = &sample->psi;
+    if (ps->present && kv_len >= 0 && kv_len < KV_BUFFER_SIZE) {
+        static const char *const psi_names[PSI_RESOURCES] = {"cpu", "memory", "io"};
+        kv_len += snprintf(kv_string + kv_len, KV_BUFFER_SIZE - kv_len, "&psi=");
+        for (int r = 0, first = 1; r < PSI_RESOURCES && kv_len < KV_BUFFER_SIZE; r++) {
+            if (!(ps->present & (1u << r))) {
+                continue;
+            }
+            kv_len += snprintf(kv_string + kv_len, KV_BUFFER_SIZE - kv_len, "%s%s:%.2f:%.2f:%llu:%.2f:%.2f:%llu",
+                               first ? "" : ",", psi_names[r], ps->some[r].avg10, ps->some[r].avg60, ps->some[r].total_us,
+                               ps->full[r].avg10, ps->full[r].avg60, ps->full[r].total_us);
+            first = 0;
+        }
+        if ((ps->fired || ps->flags) && kv_len < KV_BUFFER_SIZE) {
+            kv_len += snprintf(kv_string + kv_len, KV_BUFFER_SIZE - kv_len, "&psi_event=%u", ps->flags);
+            for (int bit = 0; bit < PSI_RESOURCES * 2 && kv_len < KV_BUFFER_SIZE; bit++) {
+                if (ps->fired & (1u << bit)) {
+                    kv_len += snprintf(kv_string + kv_len, KV_BUFFER_SIZE - kv_len, ",%s_%s",
+                                       psi_names[bit / 2], (bit & 1) ? "full" : "some");
+                }
+            }
+        }
+    }
+
+    /* 扩展字段：cgroup 排行 */
+    const CgroupStats *cgs = &sample->cgroups;
+    if (cgs->interval_ms > 0 && kv_len >= 0 && kv_len < KV_BUFFER_SIZE) {
+        static const char *const cg_names[CGROUP_TOP_DIMS] = {"cg_cpu", "cg_mem"};
+        kv_len += snprintf(kv_string + kv_len, KV_BUFFER_SIZE - kv_len, "&cgroups=%u,%u", cgs->interval_ms, cgs->cgroups);
+        for (int dim = 0; dim < CGROUP_TOP_DIMS && kv_len < KV_BUFFER_SIZE; dim++) {
+            kv_len += snprintf(kv_string + kv_len, KV_BUFFER_SIZE - kv_len, "&%s=", cg_names[dim]);
+            for (int i = 0; i < cgs->count[dim] && kv_len < KV_BUFFER_SIZE; i++) {
+                const CgroupEntry *e = &cgs->top[dim][i];
+                char encoded[CGROUP_PATH_MAX * 12];
+                kv_encode_name(e->path, encoded, sizeof(encoded));
+                kv_len += snprintf(kv_string + kv_len, KV_BUFFER_SIZE - kv_len,
+                                   "%s%s:%.1f:%.1f:%llu:%llu:%llu:%u:%llu:%llu:%.2f:%.2f:%.2f",
+                                   i ? "," : "", encoded, e->cpu_pct, e->throttled_pct, e->throttled_usec, e->mem_kb,
+                                   e->mem_max_kb, e->oom_kills, e->read_bytes, e->write_bytes,
+                                   e->psi_some[PSI_CPU], e->psi_some[PSI_MEMORY], e->psi_some[PSI_IO]);
+            }
+        }
+    }
+
+    /* 扩展字段：全部文件系统 */
+    const FsStats *fss = &sample->filesystems;
+    if (fss->count > 0 && kv_len >= 0 && kv_len < KV_BUFFER_SIZE) {
+        kv_len += snprintf(kv_string + kv_len, KV_BUFFER_SIZE - kv_len, "&fs=");
+        for (int i = 0; i < fss->count && kv_len < KV_BUFFER_SIZE; i++) {
+            const FsUsage *fs = &fss->fs[i];
+            char encoded[FS_PATH_MAX * 12];
+            kv_encode_name(fs->mount_point, encoded, sizeof(encoded));
+            kv_len += snprintf(kv_string + kv_len, KV_BUFFER_SIZE - kv_len, "%s%s:%s:%u:%llu:%llu:%llu:%llu:%llu",
+                               i ? "," : "", encoded, fs->fstype, fs->flags, fs->total_kb, fs->free_kb,
+                               fs->avail_kb, fs->inodes_total, fs->inodes_free);
+        }
+    }
+
+    /* 扩展字段：高频采样汇总 */
+    const SubStats *hf = &sample->hf;
+    if (hf->count > 0 && kv_len >= 0 && kv_len < KV_BUFFER_SIZE) {
+        kv_len += snprintf(kv_string + kv_len, KV_BUFFER_SIZE - kv_len, "&hf_n=%d&hf_stats=", hf->count);
+        for (int g = 0; g < SUB_GAUGE_COUNT * SUB_STAT_COUNT && kv_len < KV_BUFFER_SIZE; g++) {
+            kv_len += snprintf(kv_string + kv_len, KV_BUFFER_SIZE - kv_len, g ? ",%.2lf" : "%.2lf",
+                               hf->stats[g / SUB_STAT_COUNT][g % SUB_STAT_COUNT]);
+        }
+        if (kv_len < KV_BUFFER_SIZE) {
+            kv_len += snprintf(kv_string + kv_len, KV_BUFFER_SIZE - kv_len, "&hf_rate_max=");
+        }
+        for (int r = 0; r < SUB_RATE_COUNT && kv_len < KV_BUFFER_SIZE; r++) {
+            kv_len += snprintf(kv_string + kv_len, KV_BUFFER_SIZE - kv_len, r ? ",%.2lf" : "%.2lf", hf->rate_max[r]);
+        }
+    }
+
+    if (kv_len < 0 || kv_len >= KV_BUFFER_SIZE) {
+        fprintf(stderr, "Error: Key-value string too long\n");
+        free(kv_string);
+        return NULL;
+    }
+
+    return kv_string;
+}
+
+/* ============================================================================
+ * 样本记录
+ *
+ * Sample 按各可选块的容量上限定长，只用作采集和格式化时的工作结构。上报队列、批次和本地缓存
+ * 保存的是紧凑记录：块以外的字段原样复制，每个可选块只保存块头和实际使用的前 count 项。
+ * 记录的最大长度在启动时按启用的功能和本机规模计算，未启用的功能不占空间。
+ * ============================================================================ */
+
+/**
+ * @brief 可变长度的块描述
+ *
+ * 块头（条目数组之前的部分，含 uint16_t 条目数）原样保存；多维块按行保存，每行 count[d] 项。
+ */
+typedef struct
+{
+    size_t offset;          /**< 块在 Sample 中的偏移 */
+    size_t size;            /**< 块大小 */
+    size_t header;          /**< 条目数组在块内的偏移（块头大小） */
+    size_t count_off;       /**< uint16_t 条目数数组在块内的偏移 */
+    int dims;               /**< 行数 */
+    int capacity;           /**< 每行容量 */
+    size_t entry;           /**< 条目大小 */
+    int (*limit)(void);     /**< 当前配置下每行最多的条目数，0 表示未启用 */
+} SampleSection;
+
+/**
+ * @brief 每接口统计的条目上限（接口可能增减，按容量预留）
+ */
+static int interfaces_limit(void)
+{
+    return link_table.filter[0] ? NETIF_MAX : 0;
+}
+
+/**
+ * @brief 全部块设备的条目上限（设备可能热插拔，按容量预留）
+ */
+static int disks_limit(void)
+{
+    return disk_filter_enabled() ? DISK_MAX : 0;
+}
+
+/**
+ * @brief 文件系统容量的条目上限（挂载表可能变化，按容量预留）
+ */
+static int filesystems_limit(void)
+{
+    return fs_table.enabled ? FS_MAX : 0;
+}
+
+/**
+ * @brief 进程排行每个维度的条目上限：--top 指定的进程数
+ */
+static int proc_top_limit(void)
+{
+    return proc_top.top_n;
+}
+
+/**
+ * @brief cgroup 排行每个维度的条目上限：--cgroup-top 指定的 cgroup 数
+ */
+static int cgroups_limit(void)
+{
+    return cgroups.max_depth > 0 ? cgroups.top_k : 0;
+}
+
+/**
+ * @brief 每 CPU 统计的条目上限：本机可能的 CPU 数
+ */
+static int percpu_limit(void)
+{
+    if (percpu.mode == PERCPU_OFF)
+    {
+        return 0;
+    }
+    int n = get_nprocs_conf();
+    return n > 0 && n < PERCPU_MAX ? n : PERCPU_MAX;
+}
+
+/** 可变长度的块，按在 Sample 中的偏移排序 */
+static const SampleSection sample_sections[] = {
+    {offsetof(Sample, interfaces), sizeof(NetIfStats), offsetof(NetIfStats, iface), offsetof(NetIfStats, count),
+     1, NETIF_MAX, sizeof(NetIfCounters), interfaces_limit},
+    {offsetof(Sample, disks), sizeof(BlockDevStats), offsetof(BlockDevStats, dev), offsetof(BlockDevStats, count),
+     1, DISK_MAX, sizeof(BlockDev), disks_limit},
+    {offsetof(Sample, filesystems), sizeof(FsStats), offsetof(FsStats, fs), offsetof(FsStats, count),
+     1, FS_MAX, sizeof(FsUsage), filesystems_limit},
+    {offsetof(Sample, top), sizeof(ProcTopStats), offsetof(ProcTopStats, top), offsetof(ProcTopStats, count),
+     PROC_TOP_DIMS, PROC_TOP_MAX, sizeof(ProcTopEntry), proc_top_limit},
+    {offsetof(Sample, cgroups), sizeof(CgroupStats), offsetof(CgroupStats, top), offsetof(CgroupStats, count),
+     CGROUP_TOP_DIMS, CGROUP_TOP_MAX, sizeof(CgroupEntry), cgroups_limit},
+    {offsetof(Sample, percpu), sizeof(PerCpuStats), offsetof(PerCpuStats, cpu), offsetof(PerCpuStats, count),
+     1, PERCPU_MAX, sizeof(PerCpuEntry), percpu_limit},
+};
+
+#define SAMPLE_SECTIONS     (sizeof(sample_sections) / sizeof(sample_sections[0]))
+
+/**
+ * @brief 紧凑记录的编码参数
+ */
+static struct
+{
+    int limit[SAMPLE_SECTIONS];     /**< 各块每行最多保存的条目数 */
+    size_t record_max;              /**< 记录最大长度（含长度前缀，按 8 字节对齐） */
+} sample_codec;
+
+/**
+ * @brief 按当前配置计算各块的条目上限和记录最大长度，必须在创建队列、批次和本地缓存之前调用
+ *
+ * @param all 非 0 时按全部容量计算（自检和基准测试）
+ */
+void sample_codec_init(int all)
+{
+    size_t size = sizeof(uint32_t) + sizeof(Sample);
+    for (size_t i = 0; i < SAMPLE_SECTIONS; i++)
+    {
+        const SampleSection *sec = &sample_sections[i];
+        sample_codec.limit[i] = all ? sec->capacity : sec->limit();
+        size -= sec->size - sec->header;
+        size += (size_t)sec->dims * (size_t)sample_codec.limit[i] * sec->entry;
+    }
+    sample_codec.record_max = (size + 7) & ~(size_t)7;
+}
+
+/**
+ * @brief 把样本编码为紧凑记录
+ *
+ * 记录以 uint32_t 长度开头；条目数超过上限的行只保存前若干项，记录中的条目数随之截断。
+ *
+ * @param sample 样本
+ * @param out 输出缓冲区，至少 sample_codec.record_max 字节
+ * @return 记录长度
+ */
+size_t sample_pack(const Sample *sample, unsigned char *out)
+{
+    const unsigned char *src = (const unsigned char *)sample;
+    size_t pos = 0;
+    size_t n = sizeof(uint32_t);
+    for (size_t i = 0; i < SAMPLE_SECTIONS; i++)
+    {
+        const SampleSection *sec = &sample_sections[i];
+        memcpy(out + n, src + pos, sec->offset + sec->header - pos);
+        n += sec->offset + sec->header - pos;
+        pos = sec->offset + sec->size;
+
+        unsigned char *counts = out + n - sec->header + sec->count_off;
+        for (int d = 0; d < sec->dims; d++)
+        {
+            uint16_t count;
+            memcpy(&count, counts + d * sizeof(count), sizeof(count));
+            if (count > sample_codec.limit[i])
+            {
+                count = (uint16_t)sample_codec.limit[i];
+                memcpy(counts + d * sizeof(count), &count, sizeof(count));
+            }
+            size_t bytes = count * sec->entry;
+            memcpy(out + n, src + sec->offset + sec->header + (size_t)d * sec->capacity * sec->entry, bytes);
+            n += bytes;
+        }
+    }
+    memcpy(out + n, src + pos, sizeof(Sample) - pos);
+    n += sizeof(Sample) - pos;
+    uint32_t len = (uint32_t)n;
+    memcpy(out, &len, sizeof(len));
+    return n;
+}
+
+/**
+ * @brief 紧凑记录的长度
+ */
+static inline size_t sample_record_len(const unsigned char *record)
+{
+    uint32_t len;
+    memcpy(&len, record, sizeof(len));
+    return len;
+}
+
+/**
+ * @brief 把紧凑记录还原为样本，未保存的条目清零
+ *
+ * @param record 记录
+ * @param sample 输出参数
+ * @return 成功返回 0，记录长度或条目数不一致返回 -1
+ */
+int sample_unpack(const unsigned char *record, Sample *sample)
+{
+    unsigned char *dst = (unsigned char *)sample;
+    size_t len = sample_record_len(record);
+    size_t pos = 0;
+    size_t n = sizeof(uint32_t);
+    for (size_t i = 0; i < SAMPLE_SECTIONS; i++)
+    {
+        const SampleSection *sec = &sample_sections[i];
+        if (n + sec->offset + sec->header - pos > len)
+        {
+            return -1;
+        }
+        memcpy(dst + pos, record + n, sec->offset + sec->header - pos);
+        n += sec->offset + sec->header - pos;
+        pos = sec->offset + sec->size;
+        memset(dst + sec->offset + sec->header, 0, sec->size - sec->header);
+
+        const unsigned char *counts = dst + sec->offset + sec->count_off;
+        for (int d = 0; d < sec->dims; d++)
+        {
+            uint16_t count;
+            memcpy(&count, counts + d * sizeof(count), sizeof(count));
+            size_t bytes = count * sec->entry;
+            if (count > sec->capacity || n + bytes > len)
+            {
+                return -1;
+            }
+            memcpy(dst + sec->offset + sec->header + (size_t)d * sec->capacity * sec->entry, record + n, bytes);
+            n += bytes;
+        }
+    }
+    if (n + sizeof(Sample) - pos != len)
+    {
+        return -1;
+    }
+    memcpy(dst + pos, record + n, sizeof(Sample) - pos);
+    return 0;
+}
+
+/**
+ * @brief 第 i 个记录（记录数组的步长为 sample_codec.record_max）
+ */
+static inline unsigned char *sample_record(const unsigned char *records, int i)
+{
+    return (unsigned char *)records + (size_t)i * sample_codec.record_max;
+}
+
+/**
+ * @brief 把样本数组编码为记录数组（自检和基准测试）
+ *
+ * @return 成功返回记录数组（需调用者 free），内存不足返回 NULL
+ */
+static unsigned char *sample_pack_all(const Sample *samples, int count)
+{
+    unsigned char *records = malloc((size_t)count * sample_codec.record_max);
+    if (!records)
+    {
+        perror("malloc");
+        return NULL;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        sample_pack(&samples[i], sample_record(records, i));
+    }
+    return records;
+}
+
+/* ============================================================================
+ * 二进制差分编码
+ * ============================================================================ */
+
+#define BIN_SCHEMA_VERSION          1       /**< 字段表版本 */
+#define BIN_FLAG_KEYFRAME           0x01    /**< 关键帧：各字段相对 0 编码 */
+#define BIN_FLAG_IDENTITY           0x02    /**< 携带 machine_id 和 hostname */
+#define BIN_FLAG_HANDLE             0x04    /**< 携带会话句柄 */
+#define BIN_FIELD_COUNT             (33 + TCP_STATE_COUNT)  /**< 字段数 */
+#define BIN_BITMAP_SIZE             ((BIN_FIELD_COUNT + 7) / 8)
+#define BIN_FRAME_MAX               (3 + BIN_BITMAP_SIZE + 10 + 2 + 32 + 2 + 255 + BIN_FIELD_COUNT * 10)
+#define BIN_DEFAULT_KEYFRAME        60      /**< 默认每多少帧发送一个关键帧 */
+#define BIN_CONTENT_TYPE            "application/x-kunlun-bin"
+
+/**
+ * @brief 二进制编码器状态
+ *
+ * 保存上一帧的字段值，之后的帧只写变化字段的差值。
+ */
+static struct
+{
+    int enabled;                        /**< 是否使用二进制格式 */
+    int keyframe_interval;              /**< 关键帧间隔（帧） */
+    int since_keyframe;                 /**< 距上一个关键帧的帧数 */
+    int force_keyframe;                 /**< 下一帧必须是关键帧（上报失败后置位） */
+    uint64_t prev[BIN_FIELD_COUNT];     /**< 上一帧的字段值 */
+} bin_encoder = {.keyframe_interval = BIN_DEFAULT_KEYFRAME, .force_keyframe = 1};
+
+/**
+ * @brief 解码器状态（每个上报流一个）
+ */
+typedef struct
+{
+    int have_base;                      /**< 是否已收到关键帧 */
+    uint64_t values[BIN_FIELD_COUNT];   /**< 上一帧的字段值 */
+} BinDecoder;
+
+/**
+ * @brief 解码结果
+ */
+typedef struct
+{
+    int keyframe;                       /**< 是否为关键帧 */
+    unsigned long handle;               /**< 会话句柄，0 表示未携带 */
+    char machine_id[33];                /**< 机器 ID（未携带时为空串） */
+    char hostname[256];                 /**< 主机名（未携带时为空串） */
+    uint64_t values[BIN_FIELD_COUNT];   /**< 字段值，顺序与 values= 相同，之后为 tcp_states */
+} BinFrame;
+
+/**
+ * @brief 非负浮点数按 0.01 定点化（四舍五入）
+ */
+static inline uint64_t bin_fixed2(double v)
+{
+    return v > 0 ? (uint64_t)(v * 100 + 0.5) : 0;
+}
+
+/**
+ * @brief 将样本展开为字段数组
+ *
+ * 顺序与 values= 的前 33 个数字相同，之后为 tcp_states；浮点字段（负载、内存）按 0.01 定点化，与文本格式精度一致。
+ */
+static void sample_to_fields(const Sample *sample, uint64_t *fields)
+{
+    const CpuInfo *cpu = &sample->cpuinfo;
+    const DiskStats *disk = &sample->diskstats;
+    int n = 0;
+    fields[n++] = (uint64_t)sample->timestamp;
+    fields[n++] = (uint64_t)(long)sample->uptime.uptime_s;
+    fields[n++] = bin_fixed2(sample->loadavg.load_1min);
+    fields[n++] = bin_fixed2(sample->loadavg.load_5min);
+    fields[n++] = bin_fixed2(sample->loadavg.load_15min);
+    fields[n++] = (uint64_t)sample->loadavg.running_tasks;
+    fields[n++] = (uint64_t)sample->loadavg.total_tasks;
+    fields[n++] = cpu->cpu_user;
+    fields[n++] = cpu->cpu_system;
+    fields[n++] = cpu->cpu_nice;
+    fields[n++] = cpu->cpu_idle;
+    fields[n++] = cpu->cpu_iowait;
+    fields[n++] = cpu->cpu_irq;
+    fields[n++] = cpu->cpu_softirq;
+    fields[n++] = cpu->cpu_steal;
+    fields[n++] = bin_fixed2(sample->meminfo.mem_total_mib);
+    fields[n++] = bin_fixed2(sample->meminfo.mem_free_mib);
+    fields[n++] = bin_fixed2(sample->meminfo.mem_used_mib);
+    fields[n++] = bin_fixed2(sample->meminfo.mem_buff_cache_mib);
+    fields[n++] = (uint64_t)sample->netinfo.tcp_connections;
+    fields[n++] = (uint64_t)sample->netinfo.udp_connections;
+    fields[n++] = sample->netinfo.default_interface_net_rx_bytes;
+    fields[n++] = sample->netinfo.default_interface_net_tx_bytes;
+    fields[n++] = (uint64_t)sample->sysinfo.cpu_num_cores;
+    fields[n++] = sample->sysinfo.root_disk_total_kb;
+    fields[n++] = sample->sysinfo.root_disk_avail_kb;
+    fields[n++] = disk->reads_completed;
+    fields[n++] = disk->writes_completed;
+    fields[n++] = disk->reading_ms;
+    fields[n++] = disk->writing_ms;
+    fields[n++] = disk->iotime_ms;
+    fields[n++] = disk->ios_in_progress;
+    fields[n++] = disk->weighted_io_time;
+    for (int i = 0; i < TCP_STATE_COUNT; i++)
+    {
+        fields[n++] = (uint64_t)sample->netinfo.tcp_states[i];
+    }
+}
+
+/**
+ * @brief 写入无符号 LEB128 变长整数
+ *
+ * @return 写入的字节数（最多 10）
+ */
+static size_t bin_put_varint(unsigned char *out, uint64_t v)
+{
+    size_t n = 0;
+    while (v >= 0x80)
+    {
+        out[n++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = (unsigned char)v;
+    return n;
+}
+
+/**
+ * @brief 读取无符号 LEB128 变长整数
+ *
+ * @return 成功返回消耗的字节数，数据不完整或超过 64 位返回 0
+ */
+static size_t bin_get_varint(const unsigned char *p, size_t len, uint64_t *v)
+{
+    uint64_t result = 0;
+    for (size_t i = 0; i < len && i < 10; i++)
+    {
+        result |= (uint64_t)(p[i] & 0x7f) << (7 * i);
+        if (!(p[i] & 0x80))
+        {
+            *v = result;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief 写入长度前缀的字符串
+ */
+static size_t bin_put_string(unsigned char *out, const char *s, size_t max)
+{
+    size_t len = strnlen(s, max);
+    size_t n = bin_put_varint(out, len);
+    memcpy(out + n, s, len);
+    return n + len;
+}
+
+/**
+ * @brief 编码一帧
+ *
+ * 帧格式：版本（1 字节）、标志（1 字节）、字段数（1 字节）、字段存在位图（按字段数向上取整到字节），
+ * 之后依次为句柄（varint，BIN_FLAG_HANDLE）、machine_id 和 hostname（varint 长度 + 字节，BIN_FLAG_IDENTITY），
+ * 最后是位图中置位字段的差值（zigzag varint）。差值为 0 的字段不出现在位图中。
+ * 关键帧以 0 为基准，即直接写字段值。
+ *
+ * @param prev 上一帧字段值，NULL 表示关键帧
+ * @param sample 样本
+ * @param handle 会话句柄，0 表示携带完整身份
+ * @param out 输出缓冲区，至少 BIN_FRAME_MAX 字节
+ * @param fields 输出参数，本帧的字段值（作为下一帧的 prev）
+ * @return 帧长度
+ */
+static size_t bin_encode_frame(const uint64_t *prev, const Sample *sample, unsigned long handle,
+                               unsigned char *out, uint64_t *fields)
+{
+    sample_to_fields(sample, fields);
+
+    size_t n = 0;
+    out[n++] = BIN_SCHEMA_VERSION;
+    out[n++] = (prev ? 0 : BIN_FLAG_KEYFRAME) | (handle ? BIN_FLAG_HANDLE : BIN_FLAG_IDENTITY);
+    out[n++] = BIN_FIELD_COUNT;
+    unsigned char *bitmap = out + n;
+    memset(bitmap, 0, BIN_BITMAP_SIZE);
+    n += BIN_BITMAP_SIZE;
+
+    if (handle)
+    {
+        n += bin_put_varint(out + n, handle);
+    }
+    else
+    {
+        n += bin_put_string(out + n, sample->sysinfo.machine_id, 32);
+        n += bin_put_string(out + n, sample->sysinfo.hostname, 255);
+    }
+
+    for (int i = 0; i < BIN_FIELD_COUNT; i++)
+    {
+        /* 无符号减法自然处理计数器回绕和重置，再按有符号差值做 zigzag */
+        int64_t delta = (int64_t)(fields[i] - (prev ? prev[i] : 0));
+        if (delta != 0)
+        {
+            bitmap[i / 8] |= (unsigned char)(1u << (i % 8));
+            n += bin_put_varint(out + n, ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+        }
+    }
+    return n;
+}
+
+/**
+ * @brief 解码一帧
+ *
+ * 字段数多于本版本时，多出的字段被解析后丢弃；少于本版本时缺少的字段沿用上一帧的值。
+ *
+ * @param dec 解码器状态
+ * @param buf 输入数据
+ * @param len 输入长度
+ * @param frame 输出参数，解码结果
+ * @return 成功返回消耗的字节数，格式错误或缺少关键帧返回 -1
+ */
+int bin_decode_frame(BinDecoder *dec, const unsigned char *buf, size_t len, BinFrame *frame)
+{
+    memset(frame, 0, sizeof(*frame));
+    if (len < 3 || buf[0] != BIN_SCHEMA_VERSION)
+    {
+        return -1;
+    }
+    int flags = buf[1];
+    int field_count = buf[2];
+    size_t bitmap_size = ((size_t)field_count + 7) / 8;
+    const unsigned char *bitmap = buf + 3;
+    size_t n = 3 + bitmap_size;
+    if (n > len)
+    {
+        return -1;
+    }
+
+    frame->keyframe = (flags & BIN_FLAG_KEYFRAME) != 0;
+    if (!frame->keyframe && !dec->have_base)
+    {
+        return -1;
+    }
+
+    uint64_t v;
+    size_t used;
+    if (flags & BIN_FLAG_HANDLE)
+    {
+        if ((used = bin_get_varint(buf + n, len - n, &v)) == 0)
+        {
+            return -1;
+        }
+        frame->handle = (unsigned long)v;
+        n += used;
+    }
+    if (flags & BIN_FLAG_IDENTITY)
+    {
+        char *dst[2] = {frame->machine_id, frame->hostname};
+        size_t cap[2] = {sizeof(frame->machine_id), sizeof(frame->hostname)};
+        for (int i = 0; i < 2; i++)
+        {
+            if ((used = bin_get_varint(buf + n, len - n, &v)) == 0 || v >= cap[i] || v > len - n - used)
+            {
+                return -1;
+            }
+            n += used;
+            memcpy(dst[i], buf + n, (size_t)v);
+            dst[i][v] = '\0';
+            n += (size_t)v;
+        }
+    }
+
+    for (int i = 0; i < field_count; i++)
+    {
+        uint64_t base = frame->keyframe || i >= BIN_FIELD_COUNT ? 0 : dec->values[i];
+        uint64_t value = base;
+        if (bitmap[i / 8] & (1u << (i % 8)))
+        {
+            if ((used = bin_get_varint(buf + n, len - n, &v)) == 0)
+            {
+                return -1;
+            }
+            n += used;
+            value = base + ((v >> 1) ^ (0 - (v & 1)));
+        }
+        if (i < BIN_FIELD_COUNT)
+        {
+            frame->values[i] = value;
+        }
+    }
+    for (int i = field_count; i < BIN_FIELD_COUNT; i++)
+    {
+        frame->values[i] = frame->keyframe ? 0 : dec->values[i];
+    }
+
+    memcpy(dec->values, frame->values, sizeof(dec->values));
+    dec->have_base = 1;
+    return (int)n;
+}
+
+/**
+ * @brief 用编码器状态把一组样本编码为请求体
+ *
+ * 第一帧在以下情况为关键帧：上次上报失败、距上一个关键帧已达间隔、当前没有可复用的连接（即将重连）。
+ *
+ * @param records 样本记录数组（见 sample_pack），无法还原的记录被跳过
+ * @param count 记录数
+ * @param handle 会话句柄
+ * @param keyframe 非 0 时第一帧强制为关键帧
+ * @param len 输出参数，请求体长度
+ * @return 成功返回请求体（需调用者 free），失败返回 NULL
+ */
+unsigned char *bin_encode_samples(const unsigned char *records, int count, unsigned long handle, int keyframe, size_t *len)
+{
+    unsigned char *body = malloc((size_t)count * BIN_FRAME_MAX);
+    Sample *sample = malloc(sizeof(Sample));
+    if (!body || !sample)
+    {
+        perror("malloc");
+        free(body);
+        free(sample);
+        return NULL;
+    }
+
+    size_t n = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (sample_unpack(sample_record(records, i), sample) != 0)
+        {
+            fprintf(stderr, "Skipping a malformed sample record\n");
+            continue;
+        }
+        int key = bin_encoder.force_keyframe || bin_encoder.since_keyframe >= bin_encoder.keyframe_interval ||
+                  (i == 0 && keyframe);
+        uint64_t fields[BIN_FIELD_COUNT];
+        n += bin_encode_frame(key ? NULL : bin_encoder.prev, sample, handle, body + n, fields);
+        memcpy(bin_encoder.prev, fields, sizeof(fields));
+        bin_encoder.since_keyframe = key ? 1 : bin_encoder.since_keyframe + 1;
+        bin_encoder.force_keyframe = 0;
+    }
+    free(sample);
+    *len = n;
+    return body;
+}
+
+/**
+ * @brief 估算样本以差分帧编码后的大小
+ *
+ * @param prev 前一个样本的字段值，NULL 表示按关键帧估算
+ * @param sample 样本
+ * @param handle 会话句柄
+ * @param fields 输出参数，本样本的字段值（作为下一次估算的 prev）
+ */
+size_t bin_frame_size(const uint64_t *prev, const Sample *sample, unsigned long handle, uint64_t *fields)
+{
+    unsigned char frame[BIN_FRAME_MAX];
+    return bin_encode_frame(prev, sample, handle, frame, fields);
+}
+
+/* ============================================================================
+ * 压缩
+ * ============================================================================ */
+
+#define GZIP_HASH_BITS      14          /**< LZ77 哈希表大小上限（2^n 项），小输入按长度缩小 */
+#define GZIP_WINDOW         32768       /**< deflate 最大回溯距离 */
+#define GZIP_MAX_CHAIN      32          /**< 每个位置最多比较的候选数 */
+#define GZIP_MIN_MATCH      3
+#define GZIP_MAX_MATCH      258
+#define GZIP_TOO_FAR        4096        /**< 超过该距离的最短匹配不划算 */
+#define GZIP_NICE_MATCH     32          /**< 找到该长度的匹配后不再继续查找 */
+
+/**
+ * @brief 上报请求体压缩方式
+ */
+typedef enum
+{
+    COMPRESS_NONE,      /**< 不压缩 */
+    COMPRESS_GZIP       /**< gzip（Content-Encoding: gzip） */
+} CompressMode;
+
+static CompressMode compress_mode = COMPRESS_NONE;
+
+/** deflate 长度码 257..285 的基准长度和附加位数 */
+static const uint16_t deflate_len_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t deflate_len_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+
+/** deflate 距离码 0..29 的基准距离和附加位数 */
+static const uint16_t deflate_dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t deflate_dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+/**
+ * @brief 按 LSB 优先顺序写入比特流
+ */
+typedef struct
+{
+    unsigned char *out;     /**< 输出缓冲区 */
+    size_t len;             /**< 已写入的完整字节数 */
+    uint64_t bits;          /**< 尚未写出的比特 */
+    int count;              /**< bits 中的比特数 */
+} BitWriter;
+
+static inline void bits_put(BitWriter *w, uint32_t value, int n)
+{
+    w->bits |= (uint64_t)value << w->count;
+    w->count += n;
+    while (w->count >= 8)
+    {
+        w->out[w->len++] = (unsigned char)w->bits;
+        w->bits >>= 8;
+        w->count -= 8;
+    }
+}
+
+/**
+ * @brief 写入 Huffman 码（码字按 MSB 优先定义，需要反转后写入）
+ */
+static inline void bits_put_code(BitWriter *w, uint32_t code, int n)
+{
+    uint32_t rev = 0;
+    for (int i = 0; i < n; i++)
+    {
+        rev = (rev << 1) | ((code >> i) & 1);
+    }
+    bits_put(w, rev, n);
+}
+
+/**
+ * @brief 按固定 Huffman 表写入字面量/长度符号（RFC 1951 3.2.6）
+ *
+ * 码字首次使用时按写入顺序反转后缓存。
+ */
+static void deflate_put_symbol(BitWriter *w, int sym)
+{
+    static uint16_t codes[288];
+    static uint8_t lengths[288];
+    if (lengths[0] == 0)
+    {
+        for (int i = 0; i < 288; i++)
+        {
+            uint32_t code;
+            int n;
+            if (i < 144)
+            {
+                code = 0x30 + i, n = 8;
+            }
+            else if (i < 256)
+            {
+                code = 0x190 + i - 144, n = 9;
+            }
+            else if (i < 280)
+            {
+                code = i - 256, n = 7;
+            }
+            else
+            {
+                code = 0xc0 + i - 280, n = 8;
+            }
+            uint32_t rev = 0;
+            for (int k = 0; k < n; k++)
+            {
+                rev = (rev << 1) | ((code >> k) & 1);
+            }
+            codes[i] = (uint16_t)rev;
+            lengths[i] = (uint8_t)n;
+        }
+    }
+    bits_put(w, codes[sym], lengths[sym]);
+}
+
+/**
+ * @brief 写入一个 (长度, 距离) 匹配
+ */
+static void deflate_put_match(BitWriter *w, int length, int distance)
+{
+    int lc = 28;
+    while (deflate_len_base[lc] > length)
+    {
+        lc--;
+    }
+    deflate_put_symbol(w, 257 + lc);
+    bits_put(w, (uint32_t)(length - deflate_len_base[lc]), deflate_len_extra[lc]);
+
+    int dc = 29;
+    while (deflate_dist_base[dc] > distance)
+    {
+        dc--;
+    }
+    bits_put_code(w, (uint32_t)dc, 5);
+    bits_put(w, (uint32_t)(distance - deflate_dist_base[dc]), deflate_dist_extra[dc]);
+}
+
+/**
+ * @brief 计算 CRC-32（IEEE 802.3，gzip 尾部校验）
+ */
+static uint32_t crc32_update(uint32_t crc, const unsigned char *p, size_t len)
+{
+    static uint32_t table[256];
+    if (table[1] == 0)
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+            {
+                c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+    }
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++)
+    {
+        crc = table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+/**
+ * @brief gzip 压缩
+ *
+ * 单个固定 Huffman 表的 deflate 块，LZ77 使用 3 字节哈希链贪心匹配。
+ * 上报数据的压缩收益主要来自批次内各行重复的字段前缀、身份和相近的数值，
+ * 固定表省去了动态表的构造和传输，对几 KB 的请求体比动态表更合适。
+ *
+ * @param data 输入数据
+ * @param len 输入长度
+ * @param out_len 输出参数，压缩后长度
+ * @return 成功返回压缩数据（需调用者 free），失败返回 NULL
+ */
+unsigned char *gzip_compress(const void *data, size_t len, size_t *out_len)
+{
+    const unsigned char *in = data;
+    /* 固定表下字面量最长 9 比特、匹配每字节不超过 8 比特，再加上头尾和块结束符 */
+    unsigned char *out = malloc(len + len / 8 + 32);
+    int hash_bits = 8;
+    while (hash_bits < GZIP_HASH_BITS && ((size_t)1 << hash_bits) < len)
+    {
+        hash_bits++;
+    }
+    int32_t *head = malloc(sizeof(int32_t) << hash_bits);
+    int32_t *prev = malloc(sizeof(int32_t) * (len ? len : 1));
+    if (!out || !head || !prev)
+    {
+        perror("malloc");
+        free(out);
+        free(head);
+        free(prev);
+        return NULL;
+    }
+    memset(head, 0xff, sizeof(int32_t) << hash_bits);
+
+    static const unsigned char gzip_header[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3};
+    memcpy(out, gzip_header, sizeof(gzip_header));
+    BitWriter w = {.out = out, .len = sizeof(gzip_header)};
+    bits_put(&w, 1, 1);     /* BFINAL */
+    bits_put(&w, 1, 2);     /* BTYPE = 01，固定 Huffman */
+
+    size_t pos = 0;
+    while (pos < len)
+    {
+        int best_len = 0;
+        size_t best_dist = 0;
+        if (pos + GZIP_MIN_MATCH <= len)
+        {
+            uint32_t h = ((uint32_t)in[pos] << 16 | (uint32_t)in[pos + 1] << 8 | in[pos + 2]) * 2654435761u;
+            h >>= 32 - hash_bits;
+            size_t max_len = len - pos < GZIP_MAX_MATCH ? len - pos : GZIP_MAX_MATCH;
+            int32_t cand = head[h];
+            for (int chain = 0; cand >= 0 && pos - (size_t)cand <= GZIP_WINDOW && chain < GZIP_MAX_CHAIN; chain++)
+            {
+                const unsigned char *a = in + cand;
+                const unsigned char *b = in + pos;
+                if (a[best_len] == b[best_len])
+                {
+                    size_t l = 0;
+                    while (l < max_len && a[l] == b[l])
+                    {
+                        l++;
+                    }
+                    if ((int)l > best_len)
+                    {
+                        best_len = (int)l;
+                        best_dist = pos - (size_t)cand;
+                        if (l == max_len || l >= GZIP_NICE_MATCH)
+                        {
+                            break;
+                        }
+                    }
+                }
+                cand = prev[cand];
+            }
+            prev[pos] = head[h];
+            head[h] = (int32_t)pos;
+        }
+
+        /* 远距离的 3 字节匹配编码后比 3 个字面量还长 */
+        if (best_len >= GZIP_MIN_MATCH && !(best_len == GZIP_MIN_MATCH && best_dist > GZIP_TOO_FAR))
+        {
+            deflate_put_match(&w, best_len, (int)best_dist);
+            /* 匹配覆盖的位置也加入哈希链，供之后的匹配引用 */
+            for (size_t end = pos + (size_t)best_len, p = pos + 1; p < end && p + GZIP_MIN_MATCH <= len; p++)
+            {
+                uint32_t h = ((uint32_t)in[p] << 16 | (uint32_t)in[p + 1] << 8 | in[p + 2]) * 2654435761u;
+                h >>= 32 - hash_bits;
+                prev[p] = head[h];
+                head[h] = (int32_t)p;
+            }
+            pos += (size_t)best_len;
+        }
+        else
+        {
+            deflate_put_symbol(&w, in[pos]);
+            pos++;
+        }
+    }
+    deflate_put_symbol(&w, 256);
+    bits_put(&w, 0, 7);     /* 补齐到字节边界 */
+    free(head);
+    free(prev);
+
+    uint32_t crc = crc32_update(0, in, len);
+    for (int i = 0; i < 4; i++)
+    {
+        out[w.len++] = (unsigned char)(crc >> (8 * i));
+    }
+    for (int i = 0; i < 4; i++)
+    {
+        out[w.len++] = (unsigned char)((uint32_t)len >> (8 * i));
+    }
+    *out_len = w.len;
+    return out;
+}
+
+/* ============================================================================
+ * 样本上报
+ * ============================================================================ */
+
+/**
+ * @brief 按文本格式生成一组样本的请求体
+ *
+ * 单个样本的请求体与 metrics_to_kv 相同（application/x-www-form-urlencoded）；
+ * 多个样本时每个样本占一行，行内格式与单个样本相同，行间以 \n 分隔（application/x-kunlun-batch）。
+ * 格式化失败的样本无法通过重试恢复，直接跳过；内存不足则整批失败，由调用者写入本地缓存。
+ *
+ * @param records 样本记录数组（见 sample_pack）
+ * @param count 记录数
+ * @param handle 会话句柄
+ * @param len 输出参数，请求体长度
+ * @param lines 输出参数，请求体包含的样本数，0 表示没有可发送的样本
+ * @return 成功返回请求体（需调用者 free），内存不足返回 NULL
+ */
+static char *text_encode_samples(const unsigned char *records, int count, unsigned long handle, size_t *len, int *lines)
+{
+    Sample *sample = malloc(sizeof(Sample));
+    if (!sample)
+    {
+        perror("malloc");
+        return NULL;
+    }
+    char *body = NULL;
+    size_t body_len = 0;
+    size_t body_cap = 0;
+    *lines = 0;
+    for (int i = 0; i < count; i++)
+    {
+        char *kv_data = sample_unpack(sample_record(records, i), sample) == 0 ? metrics_to_kv(sample, handle) : NULL;
+        if (!kv_data)
+        {
+            fprintf(stderr, "Failed to convert metrics to key-value pairs\n");
+            continue;
+        }
+        size_t kv_len = strlen(kv_data);
+        if (body_len + kv_len + 2 > body_cap)
+        {
+            size_t new_cap = body_cap ? body_cap * 2 : 4096;
+            while (new_cap < body_len + kv_len + 2)
+            {
+                new_cap *= 2;
+            }
+            char *new_body = realloc(body, new_cap);
+            if (!new_body)
+            {
+                perror("realloc");
+                free(kv_data);
+                free(body);
+                free(sample);
+                return NULL;
+            }
+            body = new_body;
+            body_cap = new_cap;
+        }
+        if ((*lines)++ > 0)
+        {
+            body[body_len++] = '\n';
+        }
+        memcpy(body + body_len, kv_data, kv_len + 1);
+        body_len += kv_len;
+        free(kv_data);
+    }
+    free(sample);
+    if (*lines == 0)
+    {
+        free(body);
+        body = strdup("");
+    }
+    *len = body_len;
+    return body;
+}
+
+/**
+ * @brief 编码并上报一组样本
+ *
+ * 默认使用文本格式（见 text_encode_samples）；启用二进制格式时请求体为连续的二进制帧（application/x-kunlun-bin）。
+ * 启用压缩时请求体经 gzip 压缩并带 Content-Encoding: gzip。
+ *
+ * 网络错误、5xx、408/409/429 和编码时内存不足视为可重试；其余 4xx 表示服务端拒绝该请求，重试无意义，视为已处理。
+ * 结果交给 retry_record 更新退避和熔断状态。
+ *
+ * @param client HTTP 客户端
+ * @param session 会话
+ * @param records 样本记录数组（见 sample_pack），按采集时间排序
+ * @param count 记录数
+ * @return 已送达（或无需重试）返回 0，需要重试返回 -1
+ */
+int report_samples(HttpClient *client, Session *session, const unsigned char *records, int count)
+{
+    /* 补发的样本可能来自改名之前，注册时使用实时样本的身份 */
+    if (!session->have_live)
+    {
+        Sample *last = malloc(sizeof(Sample));
+        if (!last)
+        {
+            perror("malloc");
+            return -1;
+        }
+        if (sample_unpack(sample_record(records, count - 1), last) == 0)
+        {
+            session->live = last->sysinfo;
+        }
+        free(last);
+    }
+    unsigned long handle = session_handle(client, session, &session->live);
+
+    char *body;
+    size_t body_len;
+    const char *content_type;
+    if (bin_encoder.enabled)
+    {
+        /* 即将重连时先发关键帧，接收端可能不是上一条连接的那一个 */
+        if (client->fd >= 0 && !http_conn_alive(client->fd))
+        {
+            http_close(client);
+        }
+        body = (char *)bin_encode_samples(records, count, handle, client->fd < 0, &body_len);
+        content_type = BIN_CONTENT_TYPE;
+    }
+    else
+    {
+        int lines;
+        body = text_encode_samples(records, count, handle, &body_len, &lines);
+        content_type = lines > 1 ? HTTP_CONTENT_TYPE_BATCH : HTTP_CONTENT_TYPE_FORM;
+        if (body && lines == 0)
+        {
+            /* 没有一个样本能格式化，重试也无法恢复 */
+            free(body);
+            return 0;
+        }
+    }
+    if (!body)
+    {
+        /* 内存不足：整批交给调用者写入本地缓存 */
+        return -1;
+    }
+
+    /* 压缩后没有变小（如单个二进制帧）时按原样发送 */
+    const char *content_encoding = NULL;
+    if (compress_mode == COMPRESS_GZIP)
+    {
+        size_t gz_len;
+        unsigned char *gz = gzip_compress(body, body_len, &gz_len);
+        if (gz && gz_len < body_len)
+        {
+            free(body);
+            body = (char *)gz;
+            body_len = gz_len;
+            content_encoding = "gzip";
+        }
+        else
+        {
+            free(gz);
+        }
+    }
+
+    HttpResponse resp;
+    int ret = send_post_request(client, content_type, content_encoding, body, body_len, &resp);
+    free(body);
+    session_check_response(session, &resp);
+    if (ret != 0)
+    {
+        /* 服务端没有收到这些帧，之后的差分失去基准 */
+        bin_encoder.force_keyframe = 1;
+        fprintf(stderr, "Failed to send data\n");
+        if (resp.status >= 400 && resp.status < 500 &&
+            resp.status != 408 && resp.status != 409 && resp.status != 429)
+        {
+            ret = 0;
+        }
+    }
+    retry_record(ret == 0, &resp, monotonic_ns());
+    return ret;
+}
+
+/* ============================================================================
+ * 本地缓存（spool）
+ * ============================================================================ */
+
+#define SPOOL_MAGIC             0x504c534bu     /**< 文件魔数 "KSLP" */
+#define SPOOL_VERSION           2               /**< 文件格式版本 */
+#define SPOOL_HEADER_SIZE       4096            /**< 文件头占用大小（记录区按页对齐） */
+#define SPOOL_DEFAULT_SIZE_MB   4               /**< 默认缓存文件大小（MiB） */
+#define SPOOL_DEFAULT_REPLAY    6               /**< 默认每周期最多补发的样本数 */
+#define SPOOL_SYNC_RECORDS      6               /**< 累计多少次修改后落盘一次 */
+#define SPOOL_SYNC_INTERVAL_MS  60000           /**< 有未落盘修改时最长落盘间隔（毫秒） */
+
+/**
+ * @brief 缓存文件头
+ *
+ * head/tail 为单调递增的序号，记录位于槽位 seq % capacity。
+ */
+typedef struct
+{
+    uint32_t magic;         /**< SPOOL_MAGIC */
+    uint32_t version;       /**< SPOOL_VERSION */
+    uint32_t record_size;   /**< 槽位大小，Sample 布局或启用的功能变化时不兼容 */
+    uint32_t capacity;      /**< 槽位数 */
+    uint64_t head;          /**< 下一个写入的序号 */
+    uint64_t tail;          /**< 最早未发送的序号 */
+    uint64_t dropped;       /**< 累计丢弃的样本数 */
+} SpoolHeader;
+
+/**
+ * @brief 缓存记录头，之后紧跟样本记录（见 sample_pack），槽位大小为 spool_slot_size()
+ *
+ * 先写记录再推进 head；恢复时用序号和校验和识别写了一半的记录。
+ */
+typedef struct
+{
+    uint64_t seq;           /**< 记录序号，与槽位不符说明记录无效 */
+    uint32_t checksum;      /**< 样本记录的 FNV-1a 校验和 */
+    uint32_t reserved;      /**< 保留 */
+} SpoolRecord;
+
+/**
+ * @brief 缓存已满时的丢弃策略
+ */
+typedef enum
+{
+    SPOOL_DROP_OLDEST,      /**< 覆盖最旧的样本 */
+    SPOOL_DROP_NEWEST       /**< 丢弃新样本 */
+} SpoolDropPolicy;
+
+/**
+ * @brief 内存映射的定长环形缓存
+ *
+ * 上报失败的样本以二进制形式写入，进程重启后仍然保留，服务端恢复后按从旧到新的顺序补发。
+ */
+typedef struct
+{
+    int fd;                         /**< 缓存文件，-1 表示未启用 */
+    char *map;                      /**< 映射起始地址 */
+    size_t map_size;                /**< 映射大小 */
+    SpoolHeader *header;            /**< 文件头 */
+    unsigned char *records;         /**< 记录区 */
+    size_t slot_size;               /**< 槽位大小 */
+    SpoolDropPolicy drop_policy;    /**< 丢弃策略 */
+    unsigned dirty;                 /**< 未落盘的修改次数 */
+    uint64_t last_sync_ms;          /**< 上次落盘时间（单调时钟） */
+} Spool;
+
+/**
+ * @brief 计算样本记录校验和（FNV-1a）
+ */
+static uint32_t spool_checksum(const unsigned char *record, size_t len)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+    {
+        h = (h ^ record[i]) * 16777619u;
+    }
+    return h;
+}
+
+/**
+ * @brief 槽位大小：记录头加上当前配置下的最大样本记录
+ */
+static inline size_t spool_slot_size(void)
+{
+    return sizeof(SpoolRecord) + sample_codec.record_max;
+}
+
+/**
+ * @brief 序号 seq 所在的槽位
+ */
+static inline SpoolRecord *spool_slot(const Spool *spool, uint64_t seq)
+{
+    return (SpoolRecord *)(spool->records + (seq % spool->header->capacity) * spool->slot_size);
+}
+
+/**
+ * @brief 打开（必要时创建）缓存文件并映射到内存
+ *
+ * 已有文件的格式、记录大小或容量与当前配置不符时丢弃旧内容重新初始化；
+ * 记录大小取决于启用的功能，因此增减 --percpu 等选项后缓存会被清空。
+ *
+ * @param spool 缓存
+ * @param path 文件路径
+ * @param size_mb 文件大小上限（MiB）
+ * @param drop_policy 缓存已满时的丢弃策略
+ * @return 成功返回 0，失败返回 -1
+ */
+int spool_open(Spool *spool, const char *path, unsigned size_mb, SpoolDropPolicy drop_policy)
+{
+    memset(spool, 0, sizeof(*spool));
+    spool->fd = -1;
+    spool->drop_policy = drop_policy;
+
+    size_t slot_size = spool_slot_size();
+    size_t bytes = (size_t)size_mb * 1024 * 1024;
+    if (bytes < SPOOL_HEADER_SIZE + slot_size)
+    {
+        bytes = SPOOL_HEADER_SIZE + slot_size;
+    }
+    uint32_t capacity = (uint32_t)((bytes - SPOOL_HEADER_SIZE) / slot_size);
+    size_t map_size = SPOOL_HEADER_SIZE + (size_t)capacity * slot_size;
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0)
+    {
+        perror(path);
+        return -1;
+    }
+
+    struct stat st;
+    SpoolHeader existing;
+    int valid = fstat(fd, &st) == 0 && (size_t)st.st_size == map_size &&
+                pread(fd, &existing, sizeof(existing), 0) == (ssize_t)sizeof(existing) &&
+                existing.magic == SPOOL_MAGIC && existing.version == SPOOL_VERSION &&
+                existing.record_size == slot_size && existing.capacity == capacity &&
+                existing.head >= existing.tail && existing.head - existing.tail <= capacity;
+
+    if (!valid)
+    {
+        if (st.st_size > 0)
+        {
+            fprintf(stderr, "Spool %s has an incompatible layout, reinitializing\n", path);
+        }
+        /* 预先分配磁盘空间，避免写入映射时因磁盘已满触发 SIGBUS */
+        if (ftruncate(fd, 0) != 0 || ftruncate(fd, map_size) != 0)
+        {
+            perror(path);
+            close(fd);
+            return -1;
+        }
+        /* posix_fallocate 通过返回值报告错误，不设置 errno */
+        int err = posix_fallocate(fd, 0, map_size);
+        if (err != 0 && err != EOPNOTSUPP && err != EINVAL)
+        {
+            fprintf(stderr, "%s: %s\n", path, strerror(err));
+            close(fd);
+            return -1;
+        }
+    }
+
+    char *map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        perror("mmap");
+        close(fd);
+        return -1;
+    }
+
+    spool->fd = fd;
+    spool->map = map;
+    spool->map_size = map_size;
+    spool->header = (SpoolHeader *)map;
+    spool->records = (unsigned char *)map + SPOOL_HEADER_SIZE;
+    spool->slot_size = slot_size;
+    spool->last_sync_ms = monotonic_ms();
+
+    if (!valid)
+    {
+        SpoolHeader *header = spool->header;
+        memset(header, 0, sizeof(*header));
+        header->version = SPOOL_VERSION;
+        header->record_size = (uint32_t)slot_size;
+        header->capacity = capacity;
+        header->magic = SPOOL_MAGIC;
+        msync(map, SPOOL_HEADER_SIZE, MS_SYNC);
+    }
+    else if (existing.head > existing.tail)
+    {
+        fprintf(stderr, "Spool %s: %llu samples pending\n", path,
+                (unsigned long long)(existing.head - existing.tail));
+    }
+    return 0;
+}
+
+/**
+ * @brief 缓存是否启用
+ */
+static inline int spool_enabled(const Spool *spool)
+{
+    return spool->fd >= 0;
+}
+
+/**
+ * @brief 待补发的样本数
+ */
+static inline uint64_t spool_pending(const Spool *spool)
+{
+    return spool_enabled(spool) ? spool->header->head - spool->header->tail : 0;
+}
+
+/**
+ * @brief 按批次将修改落盘
+ *
+ * @param spool 缓存
+ * @param force 非 0 时只要有未落盘修改就立即落盘
+ */
+void spool_sync(Spool *spool, int force)
+{
+    if (!spool_enabled(spool) || spool->dirty == 0)
+    {
+        return;
+    }
+    uint64_t now = monotonic_ms();
+    if (force || spool->dirty >= SPOOL_SYNC_RECORDS || now - spool->last_sync_ms >= SPOOL_SYNC_INTERVAL_MS)
+    {
+        if (msync(spool->map, spool->map_size, MS_SYNC) != 0)
+        {
+            perror("msync");
+        }
+        spool->dirty = 0;
+        spool->last_sync_ms = now;
+    }
+}
+
+/**
+ * @brief 追加一个样本，缓存已满时按丢弃策略处理
+ *
+ * @param spool 缓存
+ * @param record 样本记录（见 sample_pack）
+ * @return 成功写入返回 0，按 SPOOL_DROP_NEWEST 策略丢弃返回 -1
+ */
+int spool_append(Spool *spool, const unsigned char *record)
+{
+    SpoolHeader *header = spool->header;
+    if (header->head - header->tail >= header->capacity)
+    {
+        header->dropped++;
+        if (spool->drop_policy == SPOOL_DROP_NEWEST)
+        {
+            spool->dirty++;
+            return -1;
+        }
+        header->tail++;
+    }
+
+    SpoolRecord *slot = spool_slot(spool, header->head);
+    size_t len = sample_record_len(record);
+    slot->seq = header->head;
+    memcpy(slot + 1, record, len);
+    slot->checksum = spool_checksum(record, len);
+    /* 记录写完后再推进 head */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    header->head++;
+    spool->dirty++;
+    spool_sync(spool, 0);
+    return 0;
+}
+
+/**
+ * @brief 从最早的待补发样本开始复制最多 max 个样本记录（不出队），跳过校验失败的记录
+ *
+ * @param spool 缓存
+ * @param out 输出参数，样本记录数组（步长 sample_codec.record_max）
+ * @param max 最多复制的样本数
+ * @param end 输出参数，最后检查的记录之后的序号，传给 spool_consume
+ * @return 复制的样本数
+ */
+int spool_read(const Spool *spool, unsigned char *out, int max, uint64_t *end)
+{
+    const SpoolHeader *header = spool->header;
+    uint64_t seq = header->tail;
+    int count = 0;
+    for (; seq < header->head && count < max; seq++)
+    {
+        const SpoolRecord *slot = spool_slot(spool, seq);
+        const unsigned char *record = (const unsigned char *)(slot + 1);
+        size_t len = sample_record_len(record);
+        if (slot->seq == seq && len <= sample_codec.record_max && slot->checksum == spool_checksum(record, len))
+        {
+            memcpy(sample_record(out, count++), record, len);
+        }
+    }
+    *end = seq;
+    return count;
+}
+
+/**
+ * @brief 样本已送达后出队，其间跳过的无效记录计入丢弃数
+ *
+ * @param spool 缓存
+ * @param end spool_read 返回的序号
+ * @param count spool_read 复制的样本数
+ */
+void spool_consume(Spool *spool, uint64_t end, int count)
+{
+    SpoolHeader *header = spool->header;
+    header->dropped += end - header->tail - (uint64_t)count;
+    header->tail = end;
+    spool->dirty++;
+}
+
+/**
+ * @brief 按从旧到新的顺序补发缓存中的样本，每次最多 max_records 个
+ *
+ * 样本在服务端确认后才出队，补发途中进程退出不会丢失样本。
+ *
+ * @param spool 缓存
+ * @param client HTTP 客户端
+ * @param session 会话
+ * @param max_records 本次最多补发的样本数（限制追赶速度）
+ * @param per_request 每个请求最多携带的样本数
+ * @return 补发成功的样本数
+ */
+int spool_replay(Spool *spool, HttpClient *client, Session *session, int max_records, int per_request)
+{
+    unsigned char *chunk = malloc((size_t)per_request * sample_codec.record_max);
+    if (!chunk)
+    {
+        perror("malloc");
+        return 0;
+    }
+
+    int sent = 0;
+    while (sent < max_records)
+    {
+        int want = max_records - sent < per_request ? max_records - sent : per_request;
+        uint64_t end;
+        int count = spool_read(spool, chunk, want, &end);
+        if (end == spool->header->tail)
+        {
+            break;
+        }
+        if (count > 0 && report_samples(client, session, chunk, count) != 0)
+        {
+            break;
+        }
+        spool_consume(spool, end, count);
+        sent += count;
+    }
+    free(chunk);
+    spool_sync(spool, 0);
+    return sent;
+}
+
+/**
+ * @brief 落盘并关闭缓存
+ */
+void spool_close(Spool *spool)
+{
+    if (!spool_enabled(spool))
+    {
+        return;
+    }
+    spool_sync(spool, 1);
+    munmap(spool->map, spool->map_size);
+    close(spool->fd);
+    spool->fd = -1;
+}
+
+/* ============================================================================
+ * 批量上报
+ * ============================================================================ */
+
+#define BATCH_MAX_SAMPLES       360             /**< 每批样本数上限（1 小时） */
+#define BATCH_DEFAULT_BYTES     (64 * 1024)     /**< 默认每批请求体大小上限 */
+
+/**
+ * @brief 待上报的样本批次
+ *
+ * 每个采集周期只把样本加入批次；样本数、累计时长或请求体大小任一达到上限时一次性上报。
+ */
+typedef struct
+{
+    int max_samples;        /**< 样本数上限，1 表示每个样本单独上报 */
+    int max_age_s;          /**< 最早样本的最长等待时间（秒），0 表示不限 */
+    size_t max_bytes;       /**< 请求体大小上限（字节） */
+    unsigned char *records; /**< 样本记录数组（见 sample_pack），容量为 max_samples */
+    int count;              /**< 当前样本数 */
+    size_t bytes;           /**< 当前请求体大小（按加入时的格式估算） */
+    uint64_t last_fields[BIN_FIELD_COUNT];  /**< 最后加入的样本的二进制字段值，用于估算下一帧 */
+    uint64_t first_ms;      /**< 最早样本加入的时间（单调时钟） */
+} Batch;
+
+/**
+ * @brief 初始化批次
+ *
+ * @param batch 批次
+ * @param max_samples 样本数上限
+ * @param max_age_s 最早样本的最长等待时间（秒），0 表示不限
+ * @param max_bytes 请求体大小上限（字节）
+ * @return 成功返回 0，失败返回 -1
+ */
+int batch_init(Batch *batch, int max_samples, int max_age_s, size_t max_bytes)
+{
+    memset(batch, 0, sizeof(*batch));
+    batch->max_samples = max_samples;
+    batch->max_age_s = max_age_s;
+    batch->max_bytes = max_bytes;
+    batch->records = malloc((size_t)max_samples * sample_codec.record_max);
+    if (!batch->records)
+    {
+        perror("malloc");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 将样本加入批次
+ *
+ * @param batch 批次
+ * @param record 样本记录（见 sample_pack）
+ * @param sample 还原后的样本，用于估算格式化后的大小
+ * @param session 会话
+ */
+void batch_add(Batch *batch, const unsigned char *record, const Sample *sample, const Session *session)
+{
+    if (batch->count == 0)
+    {
+        batch->first_ms = monotonic_ms();
+    }
+    memcpy(sample_record(batch->records, batch->count++), record, sample_record_len(record));
+
+    if (bin_encoder.enabled)
+    {
+        uint64_t fields[BIN_FIELD_COUNT];
+        batch->bytes += bin_frame_size(batch->count > 1 ? batch->last_fields : NULL, sample, session->handle, fields);
+        memcpy(batch->last_fields, fields, sizeof(fields));
+        return;
+    }
+    char *kv_data = metrics_to_kv(sample, session->handle);
+    if (kv_data)
+    {
+        batch->bytes += strlen(kv_data) + 1;
+        free(kv_data);
+    }
+}
+
+/**
+ * @brief 批次是否应当上报
+ */
+int batch_due(const Batch *batch)
+{
+    if (batch->count == 0)
+    {
+        return 0;
+    }
+    return batch->count >= batch->max_samples || batch->bytes >= batch->max_bytes ||
+           (batch->max_age_s > 0 && monotonic_ms() - batch->first_ms >= (uint64_t)batch->max_age_s * 1000);
+}
+
+/**
+ * @brief 把批次中的前 count 个样本写入本地缓存（不清空批次）
+ *
+ * @param batch 批次
+ * @param spool 本地缓存（未启用时样本被丢弃）
+ * @param count 样本数
+ */
+void batch_spool(const Batch *batch, Spool *spool, int count)
+{
+    int dropped = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (!spool_enabled(spool) || spool_append(spool, sample_record(batch->records, i)) != 0)
+        {
+            dropped++;
+        }
+    }
+    if (dropped > 0)
+    {
+        fprintf(stderr, "%d samples dropped\n", dropped);
+    }
+}
+
+/**
+ * @brief 上报批次中的全部样本并清空批次；失败时样本写入本地缓存
+ *
+ * @param batch 批次
+ * @param client HTTP 客户端
+ * @param session 会话
+ * @param spool 本地缓存（未启用时失败的样本被丢弃）
+ * @return 上报成功返回 0，失败返回 -1
+ */
+int batch_flush(Batch *batch, HttpClient *client, Session *session, Spool *spool)
+{
+    int ret = batch->count > 0 ? report_samples(client, session, batch->records, batch->count) : 0;
+    if (ret != 0)
+    {
+        batch_spool(batch, spool, batch->count);
+    }
+    batch->count = 0;
+    batch->bytes = 0;
+    return ret;
+}
+
+/* ============================================================================
+ * 上报线程
+ *
+ * 采集（主线程）与上报（上报线程）之间是一个有界的单生产者单消费者无锁环形队列，槽位是定长的样本记录。
+ * 主线程只做入队和一次非阻塞的 eventfd 写，不在任何与服务器相关的 I/O 上阻塞；批次、会话、
+ * 本地缓存和 HTTP 连接全部归上报线程所有。队列满时丢弃新样本并计数。
+ * ============================================================================ */
+
+#define QUEUE_DEFAULT_SLOTS     32      /**< 默认队列容量（样本数） */
+#define QUEUE_MAX_SLOTS         1024    /**< 队列容量上限 */
+#define CACHE_LINE_SIZE         64      /**< 缓存行大小 */
+
+/**
+ * @brief 队列槽位
+ */
+typedef struct
+{
+    uint64_t enqueue_ns;                /**< 入队时间（单调时钟） */
+    uint64_t not_before_ns;             /**< 最早上报时间（单调时钟，周期边界加本机相位偏移） */
+    int urgent;                         /**< 是否立即上报（PSI 带外样本） */
+    unsigned char record[];             /**< 样本记录（见 sample_pack），最长 sample_codec.record_max */
+} QueueSlot;
+
+/**
+ * @brief 单生产者单消费者环形队列
+ *
+ * head 只由生产者写，tail 只由消费者写，各自与本方缓存的对方下标放在独立的缓存行上，避免伪共享。
+ * 生产者写完槽位后以 release 发布 head，消费者以 acquire 读取 head 后才访问槽位；释放槽位方向相反。
+ */
+typedef struct
+{
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t head;    /**< 下一个写入位置（生产者） */
+    uint32_t tail_cache;                                /**< 生产者缓存的 tail，满时才重新读取 */
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t tail;    /**< 下一个读取位置（消费者） */
+    uint32_t head_cache;                                /**< 消费者缓存的 head，空时才重新读取 */
+    _Alignas(CACHE_LINE_SIZE) uint32_t mask;            /**< 容量 - 1（容量为 2 的幂） */
+    size_t stride;                                      /**< 槽位大小 */
+    unsigned char *slots;                               /**< 槽位数组 */
+} SampleQueue;
+
+/**
+ * @brief 第 i 个槽位
+ */
+static inline QueueSlot *queue_slot(const SampleQueue *q, uint32_t i)
+{
+    return (QueueSlot *)(q->slots + (size_t)(i & q->mask) * q->stride);
+}
+
+/**
+ * @brief 初始化队列，容量向上取整到 2 的幂
+ *
+ * @return 成功返回 0，内存不足返回 -1
+ */
+static int queue_init(SampleQueue *q, uint32_t slots)
+{
+    uint32_t cap = 1;
+    while (cap < slots)
+    {
+        cap <<= 1;
+    }
+    q->stride = sizeof(QueueSlot) + sample_codec.record_max;
+    q->slots = calloc(cap, q->stride);
+    if (!q->slots)
+    {
+        perror("calloc queue");
+        return -1;
+    }
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    q->tail_cache = q->head_cache = 0;
+    q->mask = cap - 1;
+    return 0;
+}
+
+/**
+ * @brief 生产者：把样本编码为记录写入队尾
+ *
+ * @return 成功返回 0，队列满返回 -1
+ */
+static int queue_push(SampleQueue *q, const Sample *sample, int urgent, uint64_t not_before_ns)
+{
+    uint32_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    if (head - q->tail_cache > q->mask)
+    {
+        q->tail_cache = atomic_load_explicit(&q->tail, memory_order_acquire);
+        if (head - q->tail_cache > q->mask)
+        {
+            return -1;
+        }
+    }
+    QueueSlot *slot = queue_slot(q, head);
+    slot->enqueue_ns = monotonic_ns();
+    slot->not_before_ns = not_before_ns;
+    slot->urgent = urgent;
+    sample_pack(sample, slot->record);
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+    return 0;
+}
+
+/**
+ * @brief 消费者：取队首槽位（不出队），用完后调用 queue_release
+ *
+ * @return 队首槽位，队列空返回 NULL
+ */
+static QueueSlot *queue_peek(SampleQueue *q)
+{
+    uint32_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    if (tail == q->head_cache)
+    {
+        q->head_cache = atomic_load_explicit(&q->head, memory_order_acquire);
+        if (tail == q->head_cache)
+        {
+            return NULL;
+        }
+    }
+    return queue_slot(q, tail);
+}
+
+/**
+ * @brief 消费者：释放 queue_peek 返回的槽位
+ */
+static void queue_release(SampleQueue *q)
+{
+    uint32_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+}
+
+/**
+ * @brief 队列中的样本数（任一方调用均可，结果是瞬时值）
+ */
+static uint32_t queue_depth(SampleQueue *q)
+{
+    return atomic_load_explicit(&q->head, memory_order_acquire) - atomic_load_explicit(&q->tail, memory_order_acquire);
+}
+
+/**
+ * @brief 上报线程状态
+ */
+static struct
+{
+    SampleQueue queue;                  /**< 样本队列 */
+    int wake_fd;                        /**< eventfd：入队后唤醒上报线程 */
+    pthread_t thread;                   /**< 上报线程 */
+    atomic_int stop;                    /**< 主线程请求退出 */
+    atomic_int reload;                  /**< 主线程请求重建连接（SIGHUP） */
+    atomic_int urgent;                  /**< 队列中有带外样本：跳过相位偏移，立即上报已入队的全部样本 */
+    uint64_t spread_offset_ns;          /**< 本机上报相位偏移（纳秒），0 表示在周期边界立即上报 */
+    uint32_t drops;                     /**< 上一个样本以来因队列满丢弃的样本数（仅主线程访问） */
+    atomic_uint sent;                   /**< 上一个样本以来成功上报的样本数 */
+    atomic_ullong latency_sum_ms;       /**< 这些样本的入队到上报完成耗时之和（毫秒） */
+    atomic_uint latency_max_ms;         /**< 这些样本的最大入队到上报完成耗时（毫秒） */
+
+    /* 以下仅由上报线程访问 */
+    HttpClient *client;                 /**< HTTP 客户端 */
+    Session *session;                   /**< 会话 */
+    Spool *spool;                       /**< 本地缓存 */
+    Batch *batch;                       /**< 批次 */
+    Sample sample;                      /**< 从队列取出并还原的样本 */
+    int replay_max;                     /**< 每次上报成功后最多补发的积压样本数 */
+    uint64_t batch_enqueue_min_ns;      /**< 批次中最早的入队时间 */
+    uint64_t batch_enqueue_sum_ns;      /**< 批次中各样本入队时间之和 */
+    uint64_t batch_enqueue_last_ns;     /**< 批次中最后一个样本的入队时间 */
+} uploader = {.wake_fd = -1};
+
+/**
+ * @brief 由机器标识计算稳定的上报相位偏移
+ *
+ * FNV-1a 之后做一次 32 位终混（murmur3 fmix32），使相近的标识也均匀分布在窗口内。
+ *
+ * @param machine_id 机器标识（空串时调用者应改用主机名）
+ * @param window_ms 分散窗口（毫秒）
+ * @return [0, window_ms) 内的偏移（毫秒）
+ */
+static uint32_t spread_offset_ms(const char *machine_id, uint32_t window_ms)
+{
+    uint32_t h = kp_hash(machine_id, strlen(machine_id));
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return window_ms ? h % window_ms : 0;
+}
+
+/**
+ * @brief 设置本机的上报相位偏移，必须在 uploader_start 之前调用
+ *
+ * @param machine_id 机器标识，为空时使用主机名
+ * @param window_ms 分散窗口（毫秒），0 表示不分散
+ */
+void uploader_set_spread(const char *machine_id, uint32_t window_ms)
+{
+    char host[256] = "";
+    if (!*machine_id)
+    {
+        gethostname(host, sizeof(host) - 1);
+        machine_id = host;
+    }
+    uint32_t offset = spread_offset_ms(machine_id, window_ms);
+    uploader.spread_offset_ns = offset * 1000000ULL;
+    if (window_ms > 0)
+    {
+        fprintf(stderr, "Upload phase offset: %u ms (spread window %u ms)\n", offset, window_ms);
+    }
+}
+
+/**
+ * @brief 上报批次，成功时累计入队到上报完成的耗时，并按限速补发积压样本
+ *
+ * 退避或熔断期间不上报，批次直接写入本地缓存；熔断后的探测只发送最新的一个样本，其余写入本地缓存。
+ */
+static void uploader_flush(void)
+{
+    Batch *batch = uploader.batch;
+    RetryState mode = retry_allow(monotonic_ns());
+    if (mode != RETRY_OK && mode != RETRY_PROBE)
+    {
+        atomic_fetch_add(&retry_policy.skipped, (unsigned)batch->count);
+        batch_spool(batch, uploader.spool, batch->count);
+        batch->count = 0;
+        batch->bytes = 0;
+        return;
+    }
+    if (mode == RETRY_PROBE && batch->count > 1)
+    {
+        batch_spool(batch, uploader.spool, batch->count - 1);
+        const unsigned char *last = sample_record(batch->records, batch->count - 1);
+        memcpy(batch->records, last, sample_record_len(last));
+        batch->count = 1;
+        uploader.batch_enqueue_min_ns = uploader.batch_enqueue_sum_ns = uploader.batch_enqueue_last_ns;
+    }
+    int count = batch->count;
+    if (batch_flush(batch, uploader.client, uploader.session, uploader.spool) != 0)
+    {
+        return;
+    }
+    uint64_t now = monotonic_ns();
+    uint32_t max_ms = (uint32_t)((now - uploader.batch_enqueue_min_ns) / 1000000);
+    atomic_fetch_add(&uploader.sent, (unsigned)count);
+    atomic_fetch_add(&uploader.latency_sum_ms, (now * count - uploader.batch_enqueue_sum_ns) / 1000000);
+    unsigned prev = atomic_load(&uploader.latency_max_ms);
+    while (max_ms > prev && !atomic_compare_exchange_weak(&uploader.latency_max_ms, &prev, max_ms))
+    {
+    }
+    if (spool_pending(uploader.spool) > 0)
+    {
+        spool_replay(uploader.spool, uploader.client, uploader.session, uploader.replay_max, batch->max_samples);
+    }
+}
+
+/**
+ * @brief 上报线程：等待唤醒或批次超时，把队列中的样本加入批次并在到期时上报
+ */
+static void *uploader_main(void *arg)
+{
+    (void)arg;
+    Batch *batch = uploader.batch;
+    uint64_t hold_until_ns = 0;
+    for (;;)
+    {
+        int timeout_ms = -1;
+        if (batch->count > 0 && batch->max_age_s > 0)
+        {
+            uint64_t due = batch->first_ms + (uint64_t)batch->max_age_s * 1000, now = monotonic_ms();
+            timeout_ms = due > now ? (int)(due - now) : 0;
+        }
+        if (hold_until_ns > 0)
+        {
+            uint64_t now = monotonic_ns();
+            int hold_ms = hold_until_ns > now ? (int)((hold_until_ns - now + 999999) / 1000000) : 0;
+            timeout_ms = timeout_ms < 0 || hold_ms < timeout_ms ? hold_ms : timeout_ms;
+        }
+        struct pollfd pfd = {.fd = uploader.wake_fd, .events = POLLIN};
+        if (poll(&pfd, 1, timeout_ms) > 0)
+        {
+            uint64_t value;
+            if (read(uploader.wake_fd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+            {
+                perror("read eventfd");
+            }
+        }
+        if (atomic_exchange(&uploader.reload, 0))
+        {
+            http_close(uploader.client);
+            uploader.client->addr_expire_ms = 0;
+        }
+
+        /* 先读退出标志再取样本：主线程在置位之前入队的样本此时一定可见 */
+        int stopping = atomic_load(&uploader.stop);
+        int urgent_pending = atomic_exchange(&uploader.urgent, 0);
+        QueueSlot *slot;
+        hold_until_ns = 0;
+        while ((slot = queue_peek(&uploader.queue)) != NULL)
+        {
+            /* 相位偏移：样本时间戳仍是周期边界，只推迟交给批次（进而上报）的时刻 */
+            if (!stopping && !urgent_pending && slot->not_before_ns > monotonic_ns())
+            {
+                hold_until_ns = slot->not_before_ns;
+                break;
+            }
+            if (batch->count == 0)
+            {
+                uploader.batch_enqueue_min_ns = slot->enqueue_ns;
+                uploader.batch_enqueue_sum_ns = 0;
+            }
+            uploader.batch_enqueue_sum_ns += slot->enqueue_ns;
+            uploader.batch_enqueue_last_ns = slot->enqueue_ns;
+            int urgent = slot->urgent;
+            if (sample_unpack(slot->record, &uploader.sample) == 0)
+            {
+                uploader.session->live = uploader.sample.sysinfo;
+                uploader.session->have_live = 1;
+                batch_add(batch, slot->record, &uploader.sample, uploader.session);
+            }
+            queue_release(&uploader.queue);
+            if (urgent || batch_due(batch))
+            {
+                uploader_flush();
+            }
+        }
+        if (batch_due(batch))
+        {
+            uploader_flush();
+        }
+        if (stopping)
+        {
+            if (batch->count > 0)
+            {
+                uploader_flush();
+            }
+            return NULL;
+        }
+    }
+}
+
+/**
+ * @brief 创建队列并启动上报线程；之后客户端、会话、本地缓存和批次只能由上报线程访问
+ *
+ * @return 成功返回 0，失败返回 -1
+ */
+int uploader_start(HttpClient *client, Session *session, Spool *spool, Batch *batch, int replay_max, int slots)
+{
+    uploader.client = client;
+    uploader.session = session;
+    uploader.spool = spool;
+    uploader.batch = batch;
+    uploader.replay_max = replay_max;
+    if (queue_init(&uploader.queue, (uint32_t)slots) != 0)
+    {
+        return -1;
+    }
+    uploader.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (uploader.wake_fd < 0)
+    {
+        perror("eventfd");
+        return -1;
+    }
+    int err = pthread_create(&uploader.thread, NULL, uploader_main, NULL);
+    if (err != 0)
+    {
+        fprintf(stderr, "pthread_create uploader: %s\n", strerror(err));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 主线程：样本入队并唤醒上报线程，队列满时丢弃并计数
+ *
+ * @param sample 样本
+ * @param urgent 是否要求立即上报（不等待相位偏移）
+ * @param boundary_mono_ns 样本所属周期边界的单调时钟时间，上报推迟到该时间加本机相位偏移
+ */
+void uploader_enqueue(const Sample *sample, int urgent, uint64_t boundary_mono_ns)
+{
+    uint64_t not_before_ns = urgent ? 0 : boundary_mono_ns + uploader.spread_offset_ns;
+    if (urgent)
+    {
+        atomic_store(&uploader.urgent, 1);
+    }
+    if (queue_push(&uploader.queue, sample, urgent, not_before_ns) != 0)
+    {
+        uploader.drops++;
+        fprintf(stderr, "Upload queue full (%u samples), sample dropped\n", uploader.queue.mask + 1);
+        return;
+    }
+    uint64_t one = 1;
+    if (write(uploader.wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+    {
+        perror("write eventfd");
+    }
+}
+
+/**
+ * @brief 主线程：取出并清零上一个样本以来的队列统计
+ *
+ * @param stats 输出参数
+ */
+void uploader_take_stats(QueueStats *stats)
+{
+    stats->depth = queue_depth(&uploader.queue);
+    stats->capacity = uploader.queue.mask + 1;
+    stats->drops = uploader.drops;
+    uploader.drops = 0;
+    uint32_t sent = atomic_exchange(&uploader.sent, 0);
+    unsigned long long sum = atomic_exchange(&uploader.latency_sum_ms, 0);
+    stats->sent = sent;
+    stats->latency_avg_ms = sent ? (uint32_t)(sum / sent) : 0;
+    stats->latency_max_ms = atomic_exchange(&uploader.latency_max_ms, 0);
+}
+
+/**
+ * @brief 主线程：请求上报线程关闭连接并丢弃 DNS 缓存（SIGHUP）
+ */
+void uploader_reload(void)
+{
+    atomic_store(&uploader.reload, 1);
+    uint64_t one = 1;
+    if (write(uploader.wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+    {
+        perror("write eventfd");
+    }
+}
+
+/**
+ * @brief 主线程：请求上报线程上报剩余样本后退出，并等待其结束
+ */
+void uploader_stop(void)
+{
+    atomic_store(&uploader.stop, 1);
+    uint64_t one = 1;
+    if (write(uploader.wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+    {
+        perror("write eventfd");
+    }
+    pthread_join(uploader.thread, NULL);
+}
+
+/* ============================================================================
+ * 基准测试
+ * ============================================================================ */
+
+#define BENCH_ITERATIONS    200000  /**< 每项基准测试的迭代次数 */
+
+/** 代表性的 /proc/meminfo 内容 */
+static const char bench_meminfo[] =
+    "MemTotal:       16333852 kB\n"
+    "MemFree:         1276340 kB\n"
+    "MemAvailable:   11204472 kB\n"
+    "Buffers:          712456 kB\n"
+    "Cached:          9077296 kB\n"
+    "SwapCached:         2148 kB\n"
+    "Active:          6913140 kB\n"
+    "Inactive:        6719344 kB\n"
+    "Active(anon):    3627952 kB\n"
+    "Inactive(anon):   397200 kB\n"
+    "Active(file):    3285188 kB\n"
+    "Inactive(file):  6322144 kB\n"
+    "Unevictable:       32124 kB\n"
+    "Mlocked:           32124 kB\n"
+    "SwapTotal:       2097148 kB\n"
+    "SwapFree:        2061564 kB\n"
+    "Dirty:               932 kB\n"
+    "Writeback:             0 kB\n"
+    "AnonPages:       3874860 kB\n"
+    "Mapped:          1093580 kB\n"
+    "Shmem:            173600 kB\n"
+    "KReclaimable:     814212 kB\n"
+    "Slab:            1154328 kB\n"
+    "SReclaimable:     814212 kB\n"
+    "SUnreclaim:       340116 kB\n"
+    "KernelStack:       20256 kB\n"
+    "PageTables:        48172 kB\n"
+    "NFS_Unstable:          0 kB\n"
+    "Bounce:                0 kB\n"
+    "WritebackTmp:          0 kB\n"
+    "CommitLimit:    10264072 kB\n"
+    "Committed_AS:   11539476 kB\n"
+    "VmallocTotal:   34359738367 kB\n"
+    "VmallocUsed:       68572 kB\n"
+    "VmallocChunk:          0 kB\n"
+    "Percpu:            10368 kB\n"
+    "HardwareCorrupted:     0 kB\n"
+    "AnonHugePages:    129024 kB\n"
+    "ShmemHugePages:        0 kB\n"
+    "ShmemPmdMapped:        0 kB\n"
+    "FileHugePages:         0 kB\n"
+    "FilePmdMapped:         0 kB\n"
+    "HugePages_Total:       0\n"
+    "HugePages_Free:        0\n"
+    "HugePages_Rsvd:        0\n"
+    "HugePages_Surp:        0\n"
+    "Hugepagesize:       2048 kB\n"
+    "Hugetlb:               0 kB\n"
+    "DirectMap4k:      543540 kB\n"
+    "DirectMap2M:    14002176 kB\n"
+    "DirectMap1G:     2097152 kB\n";
+
+/** 代表性的 /proc/diskstats 内容（目标设备位于末尾） */
+static const char bench_diskstats[] =
+    "   7       0 loop0 52 0 2090 25 0 0 0 0 0 52 25 0 0 0 0 0 0\n"
+    "   7       1 loop1 493 0 9470 112 0 0 0 0 0 400 112 0 0 0 0 0 0\n"
+    "   7       2 loop2 1106 0 26526 277 0 0 0 0 0 744 277 0 0 0 0 0 0\n"
+    "   7       3 loop3 56 0 2168 11 0 0 0 0 0 48 11 0 0 0 0 0 0\n"
+    "   7       4 loop4 8 0 16 0 0 0 0 0 0 4 0 0 0 0 0 0 0\n"
+    "   7       5 loop5 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0\n"
+    "   7       6 loop6 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0\n"
+    "   7       7 loop7 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0\n"
+    "   8       0 sda 231573 61421 17326454 92834 1936291 2031468 61238048 4129736 0 1672040 4339482 0 0 0 0 153622 116911\n"
+    "   8       1 sda1 430 1190 14882 96 2 0 2 0 0 104 96 0 0 0 0 0 0\n"
+    "   8       2 sda2 231058 60231 17307596 92723 1936289 2031468 61238046 4129735 0 1671968 4222458 0 0 0 0 0 0\n"
+    " 259       0 nvme0n1 8802914 2184 1034421418 1844361 36112297 21876204 2231580144 41732113 0 21307144 43836937 0 0 0 0 2184431 260462\n"
+    " 259       1 nvme0n1p1 342 0 16432 56 1 0 1 0 0 72 56 0 0 0 0 0 0\n"
+    " 259       2 nvme0n1p2 8802500 2184 1034400594 1844292 36112296 21876204 2231580143 41732112 0 21307096 43576405 0 0 0 0 0 0\n"
+    " 253       0 dm-0 8801813 0 1034387226 2171536 58035384 0 2231580144 124628420 0 21307700 126799956 0 0 0 0 0 0\n";
+
+/** 代表性的 /proc/stat 首行 */
+static const char bench_stat[] =
+    "cpu  2255483 4142 769524 87344210 42418 0 26431 5813 0 0\n"
+    "cpu0 280317 499 95641 10917614 5224 0 10732 729 0 0\n"
+    "cpu1 282493 528 96405 10919104 5367 0 3268 725 0 0\n";
+
+/**
+ * @brief 原实现：fscanf 逐项读取 /proc/meminfo
+ */
+static int bench_meminfo_scanf(const char *buf, void *out)
+{
+    MemInfo *meminfo = out;
+    FILE *fp = fmemopen((void *)buf, strlen(buf), "r");
+    if (!fp)
+        return -1;
+
+    char key[32];
+    unsigned long long value;
+    meminfo->mem_total_mib = 0;
+    meminfo->mem_free_mib = 0;
+    meminfo->mem_buff_cache_mib = 0;
+    while (fscanf(fp, "%31s %llu kB", key, &value) == 2)
+    {
+        if (strcmp(key, "MemTotal:") == 0)
+            meminfo->mem_total_mib = value / 1024.0;
+        else if (strcmp(key, "MemFree:") == 0)
+            meminfo->mem_free_mib = value / 1024.0;
+        else if (strcmp(key, "Buffers:") == 0 || strcmp(key, "Cached:") == 0)
+            meminfo->mem_buff_cache_mib += value / 1024.0;
+    }
+    fclose(fp);
+    meminfo->mem_used_mib = meminfo->mem_total_mib - meminfo->mem_free_mib;
+    return 0;
+}
+
+/**
+ * @brief 新实现：单次遍历解析 /proc/meminfo
+ */
+static int bench_meminfo_kp(const char *buf, void *out)
+{
+    return parse_mem_info(buf, out);
+}
+
+/**
+ * @brief 原实现：fgets + 14 项 sscanf 查找 /proc/diskstats 中的设备
+ */
+static int bench_diskstats_scanf(const char *buf, void *out)
+{
+    DiskStats *stats = out;
+    FILE *fp = fmemopen((void *)buf, strlen(buf), "r");
+    if (!fp)
+        return -1;
+
+    char line[1024];
+    while (fgets(line, sizeof(line), fp))
+    {
+        int major, minor;
+        char name[256];
+        int fields_read = sscanf(line, "%d %d %255s %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu",
+                                 &major, &minor, name,
+                                 &stats->reads_completed, &stats->read_merges, &stats->read_sectors, &stats->reading_ms,
+                                 &stats->writes_completed, &stats->write_merges, &stats->write_sectors, &stats->writing_ms,
+                                 &stats->ios_in_progress, &stats->iotime_ms, &stats->weighted_io_time);
+        if (fields_read >= 11 && strcmp(name, "dm-0") == 0)
+        {
+            fclose(fp);
+            return 0;
+        }
+    }
+    fclose(fp);
+    return -1;
+}
+
+/**
+ * @brief 新实现：单次遍历查找 /proc/diskstats 中的设备
+ */
+static int bench_diskstats_kp(const char *buf, void *out)
+{
+    return parse_diskstats_device(buf, 253, 0, out);
+}
+
+/**
+ * @brief 原实现：sscanf 解析 /proc/stat 首行
+ */
+static int bench_stat_scanf(const char *buf, void *out)
+{
+    CpuInfo *cpuinfo = out;
+    char cpu_label[4];
+    if (sscanf(buf, "%3s %llu %llu %llu %llu %llu %llu %llu %llu",
+               cpu_label, &cpuinfo->cpu_user, &cpuinfo->cpu_nice, &cpuinfo->cpu_system,
+               &cpuinfo->cpu_idle, &cpuinfo->cpu_iowait, &cpuinfo->cpu_irq,
+               &cpuinfo->cpu_softirq, &cpuinfo->cpu_steal) != 9 ||
+        strcmp(cpu_label, "cpu") != 0)
+        return -1;
+    return 0;
+}
+
+/**
+ * @brief 新实现：解析 /proc/stat 首行
+ */
+static int bench_stat_kp(const char *buf, void *out)
+{
+    return parse_cpu_info(buf, out);
+}
+
+/**
+ * @brief 重复运行解析函数并返回每次调用的平均耗时（纳秒）
+ */
+static double bench_run(int (*fn)(const char *, void *), const char *buf, void *out)
+{
+    uint64_t start = monotonic_ns();
+    for (int i = 0; i < BENCH_ITERATIONS; i++)
+    {
+        if (fn(buf, out) != 0)
+        {
+            return -1;
+        }
+    }
+    return (double)(monotonic_ns() - start) / BENCH_ITERATIONS;
+}
+
+/**
+ * @brief 基准测试和自检用伪随机数（xorshift64）
+ */
+static uint64_t synth_rand(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+/**
+ * @brief 生成接近真实主机的样本序列：计数器按典型速率增长，瞬时值小幅波动
+ */
+static void bench_next_sample(Sample *s, uint64_t *rng)
+{
+    s->timestamp += 10;
+    s->uptime.uptime_s += 10;
+    s->loadavg.load_1min = (double)(50 + synth_rand(rng) % 100) / 100;
+    s->loadavg.load_5min = (double)(60 + synth_rand(rng) % 20) / 100;
+    s->loadavg.load_15min = 0.70;
+    s->loadavg.running_tasks = 1 + (int)(synth_rand(rng) % 3);
+    s->loadavg.total_tasks = 150 + (int)(synth_rand(rng) % 4);
+    s->cpuinfo.cpu_user += 100 + synth_rand(rng) % 200;
+    s->cpuinfo.cpu_system += 30 + synth_rand(rng) % 60;
+    s->cpuinfo.cpu_nice += synth_rand(rng) % 2;
+    s->cpuinfo.cpu_idle += 7000 + synth_rand(rng) % 500;
+    s->cpuinfo.cpu_iowait += synth_rand(rng) % 20;
+    s->cpuinfo.cpu_irq += synth_rand(rng) % 3;
+    s->cpuinfo.cpu_softirq += synth_rand(rng) % 10;
+    s->meminfo.mem_free_mib = 1024.00 + (double)(synth_rand(rng) % 2000) / 100;
+    s->meminfo.mem_used_mib = s->meminfo.mem_total_mib - s->meminfo.mem_free_mib - s->meminfo.mem_buff_cache_mib;
+    s->netinfo.tcp_connections = 10 + (int)(synth_rand(rng) % 3);
+    s->netinfo.udp_connections = 5;
+    s->netinfo.tcp_states[0] = s->netinfo.tcp_connections - 2;
+    s->netinfo.tcp_states[9] = 2;
+    s->netinfo.default_interface_net_rx_bytes += 100000 + synth_rand(rng) % 50000;
+    s->netinfo.default_interface_net_tx_bytes += 50000 + synth_rand(rng) % 20000;
+    s->sysinfo.root_disk_avail_kb -= synth_rand(rng) % 16;
+    s->diskstats.reads_completed += synth_rand(rng) % 10;
+    s->diskstats.writes_completed += 20 + synth_rand(rng) % 20;
+    s->diskstats.reading_ms += synth_rand(rng) % 20;
+    s->diskstats.writing_ms += 30 + synth_rand(rng) % 40;
+    s->diskstats.iotime_ms += 40 + synth_rand(rng) % 40;
+    s->diskstats.weighted_io_time += 60 + synth_rand(rng) % 80;
+}
+
+/**
+ * @brief 初始化基准测试样本
+ */
+static void bench_init_sample(Sample *s)
+{
+    memset(s, 0, sizeof(*s));
+    s->timestamp = 1712345678;
+    s->uptime.uptime_s = 123456;
+    s->cpuinfo.cpu_user = 1000000;
+    s->cpuinfo.cpu_system = 500000;
+    s->cpuinfo.cpu_idle = 8000000;
+    s->meminfo.mem_total_mib = 8192.00;
+    s->meminfo.mem_buff_cache_mib = 2048.00;
+    s->netinfo.default_interface_net_rx_bytes = 1234567890;
+    s->netinfo.default_interface_net_tx_bytes = 987654321;
+    s->sysinfo.cpu_num_cores = 8;
+    s->sysinfo.root_disk_total_kb = 104857600;
+    s->sysinfo.root_disk_avail_kb = 52428800;
+    s->diskstats.reads_completed = 10000;
+    s->diskstats.writes_completed = 5000;
+    strcpy(s->sysinfo.machine_id, "abc123def456abc123def456abc123de");
+    strcpy(s->sysinfo.hostname, "myserver");
+}
+
+/**
+ * @brief 压缩基准测试：对不同批次大小和编码的请求体测量压缩率和耗时
+ *
+ * @return 成功返回 0，失败返回 -1
+ */
+static int bench_compression(void)
+{
+    enum { STREAM = 360 };
+    static const struct
+    {
+        const char *name;
+        int binary;
+        int batch;
+        unsigned long handle;
+    } cases[] = {
+        {"text x1", 0, 1, 0},
+        {"text x6", 0, 6, 0},
+        {"text x30", 0, 30, 0},
+        {"text x180", 0, 180, 0},
+        {"text x30 session", 0, 30, 42},
+        {"binary x1", 1, 1, 0},
+        {"binary x30", 1, 30, 0},
+        {"binary x180", 1, 180, 0},
+    };
+
+    Sample *samples = malloc(STREAM * sizeof(Sample));
+    if (!samples)
+    {
+        perror("malloc");
+        return -1;
+    }
+    uint64_t rng = 0x2545f4914f6cdd1dull;
+    Sample s;
+    bench_init_sample(&s);
+    for (int i = 0; i < STREAM; i++)
+    {
+        bench_next_sample(&s, &rng);
+        samples[i] = s;
+    }
+    unsigned char *records = sample_pack_all(samples, STREAM);
+    free(samples);
+    if (!records)
+    {
+        return -1;
+    }
+
+    int saved_interval = bin_encoder.keyframe_interval;
+    bin_encoder.keyframe_interval = BIN_DEFAULT_KEYFRAME;
+    int ret = 0;
+    printf("\n%-18s %10s %10s %7s %10s %9s\n", "gzip body", "raw B/smp", "gz B/smp", "ratio", "us/req", "MB/s");
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++)
+    {
+        size_t raw_total = 0, gz_total = 0;
+        uint64_t ns_total = 0;
+        int requests = 0;
+        bin_encoder.force_keyframe = 1;
+        for (int i = 0; i + cases[c].batch <= STREAM; i += cases[c].batch)
+        {
+            size_t len;
+            char *body;
+            if (cases[c].binary)
+            {
+                body = (char *)bin_encode_samples(sample_record(records, i), cases[c].batch, cases[c].handle, 0, &len);
+            }
+            else
+            {
+                int lines;
+                body = text_encode_samples(sample_record(records, i), cases[c].batch, cases[c].handle, &len, &lines);
+            }
+            if (!body)
+            {
+                ret = -1;
+                break;
+            }
+
+            size_t gz_len = 0;
+            unsigned char *gz = NULL;
+            uint64_t start = monotonic_ns();
+            for (int k = 0; k < 20; k++)
+            {
+                free(gz);
+                gz = gzip_compress(body, len, &gz_len);
+            }
+            ns_total += (monotonic_ns() - start) / 20;
+            raw_total += len;
+            gz_total += gz_len;
+            requests++;
+            free(gz);
+            free(body);
+        }
+        if (ret != 0 || requests == 0)
+        {
+            printf("%-18s FAILED\n", cases[c].name);
+            ret = -1;
+            continue;
+        }
+        int sampled = requests * cases[c].batch;
+        printf("%-18s %10.1f %10.1f %6.2fx %10.2f %9.1f\n", cases[c].name,
+               (double)raw_total / sampled, (double)gz_total / sampled, (double)raw_total / gz_total,
+               (double)ns_total / requests / 1000, (double)raw_total * 1000 / (double)ns_total);
+    }
+    bin_encoder.keyframe_interval = saved_interval;
+    bin_encoder.force_keyframe = 1;
+    free(records);
+    return ret;
+}
+
+/**
+ * @brief 高频采样开销：在本机 /proc 上反复采集采样点，换算为各频率下的 CPU 占用
+ *
+ * @return 成功返回 0
+ */
+static int bench_subsample(void)
+{
+    enum { ROUNDS = 5000 };
+    SubPoint point;
+    struct rusage before, after;
+    getrusage(RUSAGE_SELF, &before);
+    uint64_t start = monotonic_ns();
+    for (int i = 0; i < ROUNDS; i++)
+    {
+        sub_point_read(&point);
+    }
+    double wall_us = (double)(monotonic_ns() - start) / 1000 / ROUNDS;
+    getrusage(RUSAGE_SELF, &after);
+    double cpu_us = ((after.ru_utime.tv_sec - before.ru_utime.tv_sec) * 1e6 +
+                     (after.ru_utime.tv_usec - before.ru_utime.tv_usec) +
+                     (after.ru_stime.tv_sec - before.ru_stime.tv_sec) * 1e6 +
+                     (after.ru_stime.tv_usec - before.ru_stime.tv_usec)) / ROUNDS;
+
+    printf("\n%-18s %10s %10s %12s %12s\n", "subsample point", "wall us", "cpu us", "CPU% @1Hz", "CPU% @10Hz");
+    printf("%-18s %10.1f %10.1f %12.4f %12.4f\n", "stat+load+mem+disk", wall_us, cpu_us, cpu_us / 1e4, cpu_us * 10 / 1e4);
+    return 0;
+}
+
+/**
+ * @brief 每 CPU 差值计算基准：PERCPU_MAX 个核心一次完整计算的耗时
+ *
+ * @return 成功返回 0
+ */
+static int bench_percpu(void)
+{
+    enum { ROUNDS = 20000 };
+    static uint32_t ticks[2][PERCPU_MODES][PERCPU_MAX];
+    static float busy[PERCPU_MAX], softirq[PERCPU_MAX];
+    uint64_t rng = 0x9e3779b97f4a7c15ull;
+    for (int k = 0; k < PERCPU_MODES; k++)
+    {
+        for (int i = 0; i < PERCPU_MAX; i++)
+        {
+            ticks[0][k][i] = (uint32_t)synth_rand(&rng);
+            ticks[1][k][i] = ticks[0][k][i] + (uint32_t)(synth_rand(&rng) % 1000);
+        }
+    }
+    uint64_t start = monotonic_ns();
+    for (int r = 0; r < ROUNDS; r++)
+    {
+        percpu_delta_kernel(PERCPU_MAX, (const uint32_t (*)[PERCPU_MAX])ticks[(r & 1) ^ 1],
+                            (const uint32_t (*)[PERCPU_MAX])ticks[r & 1], busy, softirq);
+    }
+    double ns = (double)(monotonic_ns() - start) / ROUNDS;
+    printf("\n%-18s %10s %10s\n", "percpu delta", "ns/pass", "ns/cpu");
+    printf("%-18d %10.1f %10.2f\n", PERCPU_MAX, ns, ns / PERCPU_MAX);
+    return 0;
+}
+
+/**
+ * @brief 进程排行基准：本机一次完整遍历的耗时（首次建基线，之后为稳态）
+ *
+ * @return 成功返回 0，遍历失败返回 -1
+ */
+static int bench_proc_top(void)
+{
+    enum { ROUNDS = 20 };
+    static ProcTopStats stats;
+    int saved_top = proc_top.top_n;
+    proc_top.top_n = PROC_TOP_MAX;
+
+    uint64_t start = monotonic_ns();
+    int ret = get_top_processes(&stats);
+    double first_us = (double)(monotonic_ns() - start) / 1000;
+    start = monotonic_ns();
+    for (int i = 0; i < ROUNDS && ret == 0; i++)
+    {
+        ret = get_top_processes(&stats);
+    }
+    double steady_us = (double)(monotonic_ns() - start) / 1000 / ROUNDS;
+    proc_top.top_n = saved_top;
+    if (ret != 0)
+    {
+        return -1;
+    }
+
+    printf("\n%-18s %10s %12s %12s %12s\n", "process walk", "processes", "first us", "steady us", "us/process");
+    printf("%-18s %10u %12.1f %12.1f %12.2f\n", "/proc", stats.processes, first_us, steady_us,
+           stats.processes ? steady_us / stats.processes : 0);
+    return 0;
+}
+
+/**
+ * @brief 运行 /proc 解析器基准测试：原 scanf 实现与手写解析器对比
+ *
+ * @return 成功返回 0，任一解析失败或结果不一致返回 -1
+ */
+int run_benchmarks(void)
+{
+    static const struct
+    {
+        const char *name;
+        const char *input;
+        int (*old_fn)(const char *, void *);
+        int (*new_fn)(const char *, void *);
+        size_t out_size;
+    } cases[] = {
+        {"meminfo", bench_meminfo, bench_meminfo_scanf, bench_meminfo_kp, sizeof(MemInfo)},
+        {"diskstats", bench_diskstats, bench_diskstats_scanf, bench_diskstats_kp, sizeof(DiskStats)},
+        {"stat", bench_stat, bench_stat_scanf, bench_stat_kp, sizeof(CpuInfo)},
+    };
+    int ret = 0;
+    sample_codec_init(1);
+
+    printf("%-12s %14s %14s %9s\n", "parser", "scanf ns/op", "kp ns/op", "speedup");
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        union
+        {
+            MemInfo mem;
+            DiskStats disk;
+            CpuInfo cpu;
+        } old_out, new_out;
+        memset(&old_out, 0, sizeof(old_out));
+        memset(&new_out, 0, sizeof(new_out));
+
+        double old_ns = bench_run(cases[i].old_fn, cases[i].input, &old_out);
+        double new_ns = bench_run(cases[i].new_fn, cases[i].input, &new_out);
+        if (old_ns < 0 || new_ns < 0 || memcmp(&old_out, &new_out, cases[i].out_size) != 0)
+        {
+            printf("%-12s FAILED (parse error or result mismatch)\n", cases[i].name);
+            ret = -1;
+            continue;
+        }
+        printf("%-12s %14.1f %14.1f %8.1fx\n", cases[i].name, old_ns, new_ns, old_ns / new_ns);
+    }
+
+    if (bench_compression() != 0)
+    {
+        ret = -1;
+    }
+    if (bench_subsample() != 0)
+    {
+        ret = -1;
+    }
+    if (bench_percpu() != 0)
+    {
+        ret = -1;
+    }
+    if (bench_proc_top() != 0)
+    {
+        ret = -1;
+    }
+    return ret;
+}
+
+/* ============================================================================
+ * 自检
+ * ============================================================================ */
+
+/**
+ * @brief 生成下一个自检样本：计数器小幅递增，间或出现计数器重置、回绕和大幅跳变
+ */
+static void selftest_next_sample(Sample *s, uint64_t *rng, int i)
+{
+    s->timestamp += 10;
+    s->uptime.uptime_s += 10;
+    s->loadavg.load_1min = (double)(synth_rand(rng) % 1600) / 100;
+    s->loadavg.load_5min = (double)(synth_rand(rng) % 1600) / 100;
+    s->loadavg.running_tasks = (int)(synth_rand(rng) % 8);
+    s->loadavg.total_tasks += (int)(synth_rand(rng) % 5) - 2;
+    s->cpuinfo.cpu_user += synth_rand(rng) % 1000;
+    s->cpuinfo.cpu_system += synth_rand(rng) % 300;
+    s->cpuinfo.cpu_idle += synth_rand(rng) % 4000;
+    s->meminfo.mem_free_mib = (double)(synth_rand(rng) % 800000) / 100;
+    s->meminfo.mem_used_mib = s->meminfo.mem_total_mib - s->meminfo.mem_free_mib;
+    s->netinfo.tcp_connections = (int)(synth_rand(rng) % 500);
+    s->netinfo.tcp_states[0] = s->netinfo.tcp_connections;
+    s->netinfo.default_interface_net_rx_bytes += synth_rand(rng) % 100000000;
+    s->netinfo.default_interface_net_tx_bytes += synth_rand(rng) % 1000;
+    s->diskstats.reads_completed += synth_rand(rng) % 50;
+    s->diskstats.weighted_io_time += synth_rand(rng) % 2000;
+
+    if (i % 97 == 0)
+    {
+        s->cpuinfo.cpu_user = synth_rand(rng) % 100;     /* 计数器重置 */
+    }
+    if (i % 131 == 0)
+    {
+        s->netinfo.default_interface_net_rx_bytes = UINT64_MAX - synth_rand(rng) % 1000;  /* 即将回绕 */
+    }
+    if (i % 211 == 0)
+    {
+        s->sysinfo.root_disk_avail_kb = synth_rand(rng);  /* 任意 64 位跳变 */
+    }
+}
+
+/**
+ * @brief 二进制编码往返自检：编码随机样本序列后逐帧解码，核对字段、身份和句柄
+ *
+ * @return 通过返回 0，失败返回 -1
+ */
+static int selftest_binary(void)
+{
+    enum { SAMPLES = 2000, CHUNK_MAX = 20 };
+    Sample *samples = calloc(SAMPLES, sizeof(Sample));
+    if (!samples)
+    {
+        perror("calloc");
+        return -1;
+    }
+
+    uint64_t rng = 0x9e3779b97f4a7c15ull;
+    Sample s;
+    memset(&s, 0, sizeof(s));
+    s.timestamp = 1712345678;
+    s.meminfo.mem_total_mib = 8192.25;
+    s.sysinfo.cpu_num_cores = 8;
+    s.sysinfo.root_disk_total_kb = 104857600;
+    strcpy(s.sysinfo.machine_id, "abc123def456abc123def456abc123de");
+    strcpy(s.sysinfo.hostname, "selftest-host");
+    for (int i = 0; i < SAMPLES; i++)
+    {
+        selftest_next_sample(&s, &rng, i);
+        samples[i] = s;
+    }
+    unsigned char *records = sample_pack_all(samples, SAMPLES);
+    if (!records)
+    {
+        free(samples);
+        return -1;
+    }
+
+    int saved_interval = bin_encoder.keyframe_interval;
+    bin_encoder.keyframe_interval = 7;
+    bin_encoder.force_keyframe = 1;
+
+    BinDecoder dec;
+    memset(&dec, 0, sizeof(dec));
+    size_t text_bytes = 0, key_bytes = 0, delta_bytes = 0;
+    int keyframes = 0, failures = 0;
+    for (int i = 0; i < SAMPLES && failures == 0;)
+    {
+        int count = 1 + (int)(synth_rand(&rng) % CHUNK_MAX);
+        if (count > SAMPLES - i)
+        {
+            count = SAMPLES - i;
+        }
+        unsigned long handle = (i / 100) % 2 ? 42 : 0;
+        size_t len;
+        unsigned char *body = bin_encode_samples(sample_record(records, i), count, handle, synth_rand(&rng) % 10 == 0, &len);
+        if (!body)
+        {
+            failures++;
+            break;
+        }
+
+        size_t pos = 0;
+        for (int j = 0; j < count; j++, i++)
+        {
+            BinFrame frame;
+            int used = bin_decode_frame(&dec, body + pos, len - pos, &frame);
+            uint64_t expect[BIN_FIELD_COUNT];
+            sample_to_fields(&samples[i], expect);
+            if (used <= 0 || memcmp(frame.values, expect, sizeof(expect)) != 0 || frame.handle != handle ||
+                (!handle && (strcmp(frame.machine_id, samples[i].sysinfo.machine_id) != 0 ||
+                             strcmp(frame.hostname, samples[i].sysinfo.hostname) != 0)))
+            {
+                printf("binary: frame %d mismatch\n", i);
+                failures++;
+                break;
+            }
+
+            /* 截断的帧必须被拒绝，且不能修改解码器状态 */
+            if (i % 50 == 0)
+            {
+                for (int cut = 0; cut < used; cut++)
+                {
+                    BinDecoder copy = dec;
+                    BinFrame tmp;
+                    if (bin_decode_frame(&copy, body + pos, (size_t)cut, &tmp) >= 0)
+                    {
+                        printf("binary: truncated frame %d accepted at %d/%d bytes\n", i, cut, used);
+                        failures++;
+                        break;
+                    }
+                }
+            }
+
+            if (frame.keyframe)
+            {
+                keyframes++;
+                key_bytes += (size_t)used;
+            }
+            else
+            {
+                delta_bytes += (size_t)used;
+            }
+            char *kv_data = metrics_to_kv(&samples[i], handle);
+            text_bytes += kv_data ? strlen(kv_data) : 0;
+            free(kv_data);
+            pos += (size_t)used;
+        }
+        if (failures == 0 && pos != len)
+        {
+            printf("binary: %zu trailing bytes\n", len - pos);
+            failures++;
+        }
+        free(body);
+    }
+
+    BinDecoder fresh;
+    BinFrame frame;
+    memset(&fresh, 0, sizeof(fresh));
+    unsigned char delta_only[] = {BIN_SCHEMA_VERSION, BIN_FLAG_HANDLE, 0, 1};
+    if (bin_decode_frame(&fresh, delta_only, sizeof(delta_only), &frame) >= 0)
+    {
+        printf("binary: delta frame accepted without keyframe\n");
+        failures++;
+    }
+
+    /* 负载和内存按 0.01 定点化：对照字面值，而不是用 sample_to_fields 计算期望值 */
+    Sample fixed = samples[0];
+    fixed.loadavg.load_1min = 1.23;
+    fixed.loadavg.load_5min = 0.5;
+    fixed.loadavg.load_15min = 0;
+    fixed.meminfo.mem_total_mib = 8192.25;
+    fixed.meminfo.mem_free_mib = 512.5;
+    fixed.meminfo.mem_used_mib = 7000;
+    fixed.meminfo.mem_buff_cache_mib = 0.004;
+    static const uint64_t fixed_expect[][2] = {
+        {2, 123}, {3, 50}, {4, 0}, {15, 819225}, {16, 51250}, {17, 700000}, {18, 0},
+    };
+    size_t fixed_len;
+    sample_pack(&fixed, records);
+    unsigned char *fixed_body = bin_encode_samples(records, 1, 0, 1, &fixed_len);
+    memset(&fresh, 0, sizeof(fresh));
+    if (!fixed_body || bin_decode_frame(&fresh, fixed_body, fixed_len, &frame) <= 0)
+    {
+        printf("binary: fixed-point frame not decoded\n");
+        failures++;
+    }
+    else
+    {
+        for (size_t i = 0; i < sizeof(fixed_expect) / sizeof(fixed_expect[0]); i++)
+        {
+            if (frame.values[fixed_expect[i][0]] != fixed_expect[i][1])
+            {
+                printf("binary: field %llu decoded as %llu, expected %llu\n",
+                       (unsigned long long)fixed_expect[i][0], (unsigned long long)frame.values[fixed_expect[i][0]],
+                       (unsigned long long)fixed_expect[i][1]);
+                failures++;
+            }
+        }
+    }
+    free(fixed_body);
+
+    bin_encoder.keyframe_interval = saved_interval;
+    bin_encoder.force_keyframe = 1;
+    free(records);
+    free(samples);
+
+    if (failures > 0)
+    {
+        printf("binary round trip: FAILED\n");
+        return -1;
+    }
+    printf("binary round trip: %d frames OK (%d keyframes)\n", SAMPLES, keyframes);
+    printf("  text      %6.1f bytes/sample\n", (double)text_bytes / SAMPLES);
+    printf("  keyframe  %6.1f bytes/frame\n", keyframes ? (double)key_bytes / keyframes : 0.0);
+    printf("  delta     %6.1f bytes/frame\n", SAMPLES > keyframes ? (double)delta_bytes / (SAMPLES - keyframes) : 0.0);
+    return 0;
+}
+
+/**
+ * @brief 自检用的比特流读取器（LSB 优先）
+ */
+typedef struct
+{
+    const unsigned char *in;    /**< 输入数据 */
+    size_t len;                 /**< 输入长度 */
+    size_t pos;                 /**< 下一个读取的字节 */
+    uint32_t bits;              /**< 尚未消耗的比特 */
+    int count;                  /**< bits 中的比特数 */
+} BitReader;
+
+static int bits_get(BitReader *r, int n, uint32_t *value)
+{
+    while (r->count < n)
+    {
+        if (r->pos >= r->len)
+        {
+            return -1;
+        }
+        r->bits |= (uint32_t)r->in[r->pos++] << r->count;
+        r->count += 8;
+    }
+    *value = r->bits & ((1u << n) - 1);
+    r->bits >>= n;
+    r->count -= n;
+    return 0;
+}
+
+/**
+ * @brief 按固定 Huffman 表解码一个字面量/长度符号
+ *
+ * @return 符号值，数据不完整返回 -1
+ */
+static int inflate_fixed_symbol(BitReader *r)
+{
+    uint32_t code = 0, bit;
+    for (int n = 1; n <= 9; n++)
+    {
+        if (bits_get(r, 1, &bit) != 0)
+        {
+            return -1;
+        }
+        code = (code << 1) | bit;
+        if (n == 7 && code <= 0x17)
+        {
+            return 256 + (int)code;
+        }
+        if (n == 8 && code >= 0x30 && code <= 0xbf)
+        {
+            return (int)code - 0x30;
+        }
+        if (n == 8 && code >= 0xc0 && code <= 0xc7)
+        {
+            return 280 + (int)code - 0xc0;
+        }
+    }
+    return code >= 0x190 ? 144 + (int)code - 0x190 : -1;
+}
+
+/**
+ * @brief 解压 gzip_compress 的输出（只支持存储块和固定 Huffman 块），并校验 CRC 和长度
+ *
+ * @return 成功返回解压数据（需调用者 free），失败返回 NULL
+ */
+static unsigned char *selftest_gunzip(const unsigned char *gz, size_t len, size_t *out_len)
+{
+    if (len < 18 || gz[0] != 0x1f || gz[1] != 0x8b || gz[2] != 8 || gz[3] != 0)
+    {
+        return NULL;
+    }
+    const unsigned char *trailer = gz + len - 8;
+    uint32_t crc = 0, size = 0;
+    for (int i = 3; i >= 0; i--)
+    {
+        crc = crc << 8 | trailer[i];
+        size = size << 8 | trailer[4 + i];
+    }
+    unsigned char *out = malloc(size ? size : 1);
+    if (!out)
+    {
+        return NULL;
+    }
+
+    BitReader r = {.in = gz + 10, .len = len - 18};
+    size_t n = 0;
+    uint32_t bfinal = 0, btype, v;
+    while (!bfinal)
+    {
+        if (bits_get(&r, 1, &bfinal) != 0 || bits_get(&r, 2, &btype) != 0 || btype == 2 || btype == 3)
+        {
+            goto fail;
+        }
+        if (btype == 0)
+        {
+            r.bits = 0;
+            r.count = 0;
+            if (r.pos + 4 > r.len)
+            {
+                goto fail;
+            }
+            size_t stored = r.in[r.pos] | (size_t)r.in[r.pos + 1] << 8;
+            r.pos += 4;
+            if (r.pos + stored > r.len || n + stored > size)
+            {
+                goto fail;
+            }
+            memcpy(out + n, r.in + r.pos, stored);
+            r.pos += stored;
+            n += stored;
+            continue;
+        }
+        for (;;)
+        {
+            int sym = inflate_fixed_symbol(&r);
+            if (sym < 0 || sym > 285)
+            {
+                goto fail;
+            }
+            if (sym < 256)
+            {
+                if (n >= size)
+                {
+                    goto fail;
+                }
+                out[n++] = (unsigned char)sym;
+                continue;
+            }
+            if (sym == 256)
+            {
+                break;
+            }
+            int lc = sym - 257;
+            if (bits_get(&r, deflate_len_extra[lc], &v) != 0)
+            {
+                goto fail;
+            }
+            size_t length = deflate_len_base[lc] + v;
+            uint32_t dc = 0, bit;
+            for (int i = 0; i < 5; i++)
+            {
+                if (bits_get(&r, 1, &bit) != 0)
+                {
+                    goto fail;
+                }
+                dc = (dc << 1) | bit;
+            }
+            if (dc >= 30 || bits_get(&r, deflate_dist_extra[dc], &v) != 0)
+            {
+                goto fail;
+            }
+            size_t distance = deflate_dist_base[dc] + v;
+            if (distance > n || n + length > size)
+            {
+                goto fail;
+            }
+            for (size_t i = 0; i < length; i++, n++)
+            {
+                out[n] = out[n - distance];
+            }
+        }
+    }
+    if (n != size || crc32_update(0, out, n) != crc)
+    {
+        goto fail;
+    }
+    *out_len = n;
+    return out;
+
+fail:
+    free(out);
+    return NULL;
+}
+
+/**
+ * @brief gzip 往返自检：压缩各种输入后解压并逐字节比较
+ *
+ * @return 通过返回 0，失败返回 -1
+ */
+static int selftest_gzip(void)
+{
+    enum { MAX_LEN = 100000 };
+    unsigned char *input = malloc(MAX_LEN);
+    if (!input)
+    {
+        perror("malloc");
+        return -1;
+    }
+
+    uint64_t rng = 0x853c49e6748fea9bull;
+    static const size_t lengths[] = {0, 1, 2, 3, 4, 257, 258, 259, 1000, 32767, 32768, 32769, 65536, MAX_LEN};
+    int failures = 0, cases = 0;
+    for (int kind = 0; kind < 4; kind++)
+    {
+        for (size_t li = 0; li < sizeof(lengths) / sizeof(lengths[0]); li++)
+        {
+            size_t len = lengths[li];
+            for (size_t i = 0; i < len; i++)
+            {
+                switch (kind)
+                {
+                case 0:     /* 随机字节（不可压缩） */
+                    input[i] = (unsigned char)synth_rand(&rng);
+                    break;
+                case 1:     /* 单一字节（最长匹配） */
+                    input[i] = 'a';
+                    break;
+                case 2:     /* 小字母表（大量短匹配和远距离匹配） */
+                    input[i] = (unsigned char)('0' + synth_rand(&rng) % 4);
+                    break;
+                default:    /* 周期性文本 */
+                    input[i] = (unsigned char)("values=1712345678,123456,0.50,"[i % 30]);
+                    break;
+                }
+            }
+
+            size_t gz_len, out_len;
+            unsigned char *gz = gzip_compress(input, len, &gz_len);
+            unsigned char *out = gz ? selftest_gunzip(gz, gz_len, &out_len) : NULL;
+            if (!out || out_len != len || memcmp(out, input, len) != 0 || gz_len > len + len / 8 + 32)
+            {
+                printf("gzip: kind %d length %zu mismatch\n", kind, len);
+                failures++;
+            }
+            free(gz);
+            free(out);
+            cases++;
+        }
+    }
+    free(input);
+
+    if (failures > 0)
+    {
+        printf("gzip round trip: FAILED\n");
+        return -1;
+    }
+    printf("gzip round trip: %d inputs OK\n", cases);
+    return 0;
+}
+
+/**
+ * @brief 速率计算自检：正常增长、32 位回绕、计数器重置和 iowait 回退
+ *
+ * @return 通过返回 0，失败返回 -1
+ */
+static int selftest_rates(void)
+{
+    int failures = 0;
+    Sample a, b;
+    memset(&a, 0, sizeof(a));
+    a.mono_ns = 1000000000ull;
+    a.cpuinfo.cpu_user = 1000;
+    a.cpuinfo.cpu_idle = 9000;
+    a.cpuinfo.cpu_iowait = 500;
+    a.diskstats.reads_completed = 100;
+    a.diskstats.reading_ms = 1000;
+    a.diskstats.iotime_ms = 5000;
+    a.netinfo.default_interface_net_rx_bytes = UINT32_MAX - 999;    /* 32 位计数器即将回绕 */
+    a.netinfo.default_interface_net_tx_bytes = 5000000000ull;
+
+    b = a;
+    b.mono_ns += 10000000000ull;
+    b.cpuinfo.cpu_user += 250;
+    b.cpuinfo.cpu_idle += 750;
+    b.cpuinfo.cpu_iowait -= 3;                                      /* 单项小幅回退 */
+    b.diskstats.reads_completed += 200;
+    b.diskstats.reading_ms += 400;
+    b.diskstats.iotime_ms += 2500;
+    b.netinfo.default_interface_net_rx_bytes = 9000;                /* 回绕后增长 10000 字节 */
+    b.netinfo.default_interface_net_tx_bytes = 1000;                /* 64 位值变小：重置 */
+
+    memset(&rate_state, 0, sizeof(rate_state));
+    compute_rates(&a);
+    compute_rates(&b);
+    const Rates *r = &b.rates;
+    struct
+    {
+        const char *name;
+        double got, want;
+    } checks[] = {
+        {"interval_ms", (double)r->interval_ms, 10000},
+        {"cpu_user_pct", r->cpu_user_pct, 25},
+        {"cpu_busy_pct", r->cpu_busy_pct, 25},
+        {"cpu_iowait_pct", r->cpu_iowait_pct, 0},
+        {"disk_reads_ps", r->disk_reads_ps, 20},
+        {"disk_r_await_ms", r->disk_r_await_ms, 2},
+        {"disk_util_pct", r->disk_util_pct, 25},
+        {"net_rx_bps", r->net_rx_bps, 1000},
+        {"net_tx_bps", r->net_tx_bps, 0},
+        {"flags", r->flags, RATE_FLAG_WRAP | RATE_FLAG_NET_RESET},
+    };
+    for (size_t i = 0; i < sizeof(checks) / sizeof(checks[0]); i++)
+    {
+        if (fabs(checks[i].got - checks[i].want) > 1e-6)
+        {
+            printf("rates: %s = %.4f, want %.4f\n", checks[i].name, checks[i].got, checks[i].want);
+            failures++;
+        }
+    }
+    memset(&rate_state, 0, sizeof(rate_state));
+
+    if (failures > 0)
+    {
+        printf("rates: FAILED\n");
+        return -1;
+    }
+    printf("rates: OK\n");
+    return 0;
+}
+
+/**
+ * @brief 每 CPU 统计自检：两次 /proc/stat 快照的占比、32 位回绕、top-K 顺序和直方图
+ *
+ * @return 通过返回 0，失败返回 -1
+ */
+static int selftest_percpu(void)
+{
+    static const char stat_a[] =
+        "cpu  0 0 0 0 0 0 0 0 0 0\n"
+        "cpu0 100 0 100 800 0 0 0 0 0 0\n"
+        "cpu1 100 0 100 800 0 0 0 0 0 0\n"
+        "cpu2 100 0 100 800 0 0 0 0 0 0\n"
+        "cpu3 4294967290 0 0 800 0 0 0 0 0 0\n"
+        "intr 0\n";
+    static const char stat_b[] =
+        "cpu  0 0 0 0 0 0 0 0 0 0\n"
+        "cpu0 150 0 100 850 0 0 0 0 0 0\n"            /* 50% */
+        "cpu1 190 0 100 800 0 0 10 0 0 0\n"           /* 100%，软中断 10% */
+        "cpu2 100 0 100 900 0 0 0 0 0 0\n"            /* 0% */
+        "cpu3 14 0 0 880 0 0 0 0 0 0\n"               /* user 回绕后增长 20：20% */
+        "intr 0\n";
+    static const uint16_t want_busy[] = {500, 1000, 0, 200};
+    static const uint16_t want_hist[PERCPU_HIST_BUCKETS] = {1, 0, 1, 0, 0, 1, 0, 0, 0, 1};
+    int failures = 0;
+    PerCpuStats stats;
+    PerCpuMode saved_mode = percpu.mode;
+
+    percpu.mode = PERCPU_FULL;
+    percpu.count[0] = percpu.count[1] = 0;
+    if (percpu_parse(stat_a, 1) != 4 || percpu_parse(stat_b, 1) != 4)
+    {
+        printf("percpu: cpu count mismatch\n");
+        failures++;
+    }
+    percpu_compute(&stats);
+    if (stats.count != 4)
+    {
+        printf("percpu: count = %u, want 4\n", stats.count);
+        failures++;
+    }
+    for (int i = 0; i < stats.count && i < 4; i++)
+    {
+        if (stats.cpu[i].id != i || stats.cpu[i].busy != want_busy[i])
+        {
+            printf("percpu: cpu%u busy = %u, want %u\n", stats.cpu[i].id, stats.cpu[i].busy, want_busy[i]);
+            failures++;
+        }
+    }
+    if (stats.cpu[1].softirq != 100)
+    {
+        printf("percpu: cpu1 softirq = %u, want 100\n", stats.cpu[1].softirq);
+        failures++;
+    }
+    if (memcmp(stats.hist, want_hist, sizeof(want_hist)) != 0)
+    {
+        printf("percpu: histogram mismatch\n");
+        failures++;
+    }
+    int top[PERCPU_MAX];
+    if (percpu_top(&stats, 3, top) != 3 || top[0] != 1 || top[1] != 0 || top[2] != 3)
+    {
+        printf("percpu: top-3 order mismatch\n");
+        failures++;
+    }
+
+    percpu.count[0] = percpu.count[1] = 0;
+    percpu.mode = saved_mode;
+    if (failures > 0)
+    {
+        printf("percpu: FAILED\n");
+        return -1;
+    }
+    printf("percpu: OK\n");
+    return 0;
+}
+
+/**
+ * @brief 块设备索引自检：过滤规则、根设备、按位置取值、设备增减时重建
+ *
+ * @return 通过返回 0，失败返回 -1
+ */
+static int selftest_diskstats(void)
+{
+    static const char stats_a[] =
+        "   7       0 loop0 1 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0\n"
+        " 259       0 nvme0n1 10 1 80 5 20 2 160 9 0 12 14 3 0 24 1 7 2\n"
+        " 259       1 nvme1n1 30 0 240 6 40 0 320 8 1 13 15 0 0 0 0 0 0\n"
+        " 253       0 dm-0 50 0 400 7 60 0 480 9 0 14 16 0 0 0 0 0 0\n";
+    static const char stats_b[] =
+        "   7       0 loop0 1 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0\n"
+        " 259       0 nvme0n1 11 1 88 5 21 2 168 9 0 12 14 3 0 24 1 8 2\n"
+        " 259       1 nvme1n1 31 0 248 6 41 0 328 8 1 13 15 0 0 0 0 0 0\n"
+        " 259       2 nvme2n1 70 0 560 1 80 0 640 2 0 3 4 0 0 0 0 0 0\n"
+        " 253       0 dm-0 51 0 408 7 61 0 488 9 0 14 16 0 0 0 0 0 0\n";
+    static const char stats_old[] =
+        " 259       0 nvme0n1 12 1 96 5 22 2 176 9 0 12 14\n"
+        " 253       0 dm-0 52 0 416 7 62 0 496 9 0 14 16\n";
+    char saved_filter[sizeof(disk_index.filter)];
+    int failures = 0;
+    DiskStats root;
+    static BlockDevStats devs;
+
+    memcpy(saved_filter, disk_index.filter, sizeof(saved_filter));
+    /* 设备号是虚构的，不能查询本机 sysfs（本机的 259:1 可能是某个分区） */
+    disk_index.sysfs_root = "/nonexistent";
+    set_disk_filter("nvme*,loop*,!nvme1n1");
+    unsigned long rebuilds = disk_index.rebuilds;
+    if (diskstats_scan(stats_a, 253, 0, &root, &devs) != 0 || root.reads_completed != 50 ||
+        devs.count != 1 || devs.fields != DISK_FIELDS || strcmp(devs.dev[0].name, "nvme0n1") != 0 ||
+        devs.dev[0].v[0] != 10 || devs.dev[0].v[16] != 2)
+    {
+        printf("diskstats: filtered scan mismatch\n");
+        failures++;
+    }
+    if (diskstats_scan(stats_a, 253, 0, &root, &devs) != 0 || disk_index.rebuilds != rebuilds + 1)
+    {
+        printf("diskstats: index rebuilt without device change\n");
+        failures++;
+    }
+    if (diskstats_scan(stats_b, 253, 0, &root, &devs) != 0 || disk_index.rebuilds != rebuilds + 2 ||
+        devs.count != 2 || strcmp(devs.dev[1].name, "nvme2n1") != 0 || devs.dev[1].v[0] != 70 ||
+        root.reads_completed != 51)
+    {
+        printf("diskstats: new device not picked up\n");
+        failures++;
+    }
+
+    set_disk_filter("loop0,dm-*");
+    if (diskstats_scan(stats_old, 253, 0, &root, &devs) != 0 || devs.count != 1 || devs.fields != 11 ||
+        strcmp(devs.dev[0].name, "dm-0") != 0 || root.reads_completed != 52)
+    {
+        printf("diskstats: pre-4.18 layout mismatch\n");
+        failures++;
+    }
+    if (diskstats_scan(stats_a, 253, 0, &root, &devs) != 0 || devs.count != 2 ||
+        strcmp(devs.dev[0].name, "loop0") != 0)
+    {
+        printf("diskstats: explicit device name not selected\n");
+        failures++;
+    }
+    if (diskstats_scan(stats_a, 8, 0, &root, NULL) == 0)
+    {
+        printf("diskstats: missing root device not reported\n");
+        failures++;
+    }
+
+    disk_index.sysfs_root = NULL;
+    memcpy(disk_index.filter, saved_filter, sizeof(saved_filter));
+    disk_index.built = 0;
+    if (failures > 0)
+    {
+        printf("diskstats: FAILED\n");
+        return -1;
+    }
+    printf("diskstats: OK\n");
+    return 0;
+}
+
+/**
+ * @brief 网络接口自检：过滤规则和 rtnetlink 计数器到 /proc/net/dev 列的换算
+ *
+ * @return 通过返回 0，失败返回 -1
+ */
+static int selftest_interfaces(void)
+{
+    static const struct
+    {
+        const char *filter;
+        const char *name;
+        int want;
+    } cases[] = {
+        {"all", "eth0", 1}, {"all", "lo", 0}, {"all", "veth12ab", 0}, {"eth*,lo", "lo", 1},
+        {"*,!bond0", "bond0", 0}, {"bond0,!bond*", "bond0", 0}, {"eth[01]", "eth2", 0}, {"eth[01]", "eth1", 1},
+    };
+    char saved_filter[sizeof(link_table.filter)];
+    int failures = 0;
+
+    memcpy(saved_filter, link_table.filter, sizeof(saved_filter));
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        set_interface_filter(cases[i].filter);
+        if (link_selected(cases[i].name) != cases[i].want)
+        {
+            printf("interfaces: %s with \"%s\" selected = %d, want %d\n", cases[i].name, cases[i].filter,
+                   !cases[i].want, cases[i].want);
+            failures++;
+        }
+    }
+    memcpy(link_table.filter, saved_filter, sizeof(saved_filter));
+
+    struct rtnl_link_stats64 st;
+    memset(&st, 0, sizeof(st));
+    st.rx_bytes = 1000;
+    st.rx_dropped = 3;
+    st.rx_missed_errors = 4;
+    st.rx_crc_errors = 5;
+    st.rx_frame_errors = 6;
+    st.multicast = 7;
+    st.tx_fifo_errors = 8;
+    st.tx_carrier_errors = 9;
+    st.tx_aborted_errors = 10;
+    unsigned long long v[NETIF_FIELDS];
+    link_stats_to_procfs(&st, v);
+    if (v[0] != 1000 || v[3] != 7 || v[5] != 11 || v[7] != 7 || v[12] != 8 || v[14] != 19)
+    {
+        printf("interfaces: counter mapping mismatch\n");
+        failures++;
+    }
+
+    if (failures > 0)
+    {
+        printf("interfaces: FAILED\n");
+        return -1;
+    }
+    printf("interfaces: OK\n");
+    return 0;
+}
+
+/**
+ * @brief 进程排行自检：stat 解析、有界堆选出的前 N 名、进程表删除后查找仍然正确
+ *
+ * @return 通过返回 0，失败返回 -1
+ */
+static int selftest_proc_top(void)
+{
+    static const char stat_line[] =
+        "4242 (we ird) (name) S 1 4242 4242 0 -1 4194560 500 0 0 0 1234 567 0 0 20 0 3 0 987654 "
+        "1000000 2048 18446744073709551615 1 1 0 0 0 0 0 0 0 0 0 0 17 3 0 0 0 0 0\n";
+    int failures = 0;
+    char comm[16];
+    unsigned long long cpu_ticks, start_time, rss_pages;
+    if (proc_parse_stat(stat_line, comm, &cpu_ticks, &start_time, &rss_pages) != 0 ||
+        strcmp(comm, "we ird) (name") != 0 || cpu_ticks != 1801 || start_time != 987654 || rss_pages != 2048)
+    {
+        printf("proc_top: stat parse mismatch\n");
+        failures++;
+    }
+
+    /* 有界堆与完整排序的结果一致 */
+    enum { N = 5000, K = PROC_TOP_MAX };
+    static double keys[N];
+    ProcTopCandidate heap[K], c;
+    ProcTopEntry out[K];
+    int heap_n = 0;
+    uint64_t rng = 12345;
+    memset(&c, 0, sizeof(c));
+    for (int i = 0; i < N; i++)
+    {
+        keys[i] = (double)(synth_rand(&rng) % 100000);
+        c.key = keys[i];
+        c.entry.pid = i;
+        proc_heap_offer(heap, &heap_n, K, &c);
+    }
+    int n = proc_heap_drain(heap, heap_n, out);
+    for (int i = 0; i < n; i++)
+    {
+        int rank = 0;
+        for (int j = 0; j < N; j++)
+        {
+            rank += keys[j] > keys[out[i].pid];
+        }
+        if (rank > i || (i > 0 && keys[out[i].pid] > keys[out[i - 1].pid]))
+        {
+            printf("proc_top: heap order mismatch at %d\n", i);
+            failures++;
+            break;
+        }
+    }
+
+    /* 进程表：插入、删除一半后剩余进程都能找到 */
+    ProcEntry *saved_table = proc_top.table;
+    uint32_t saved_cap = proc_top.cap, saved_count = proc_top.count, saved_gen = proc_top.gen;
+    proc_top.table = NULL;
+    proc_top.cap = proc_top.count = 0;
+    proc_top.gen = 1;
+    if (proc_table_grow() != 0)
+    {
+        return -1;
+    }
+    for (int32_t pid = 1; pid <= 3000; pid++)
+    {
+        ProcEntry *e = proc_table_insert(pid * 7);
+        if (!e)
+        {
+            return -1;
+        }
+        e->gen = (pid % 2) ? 2 : 1;
+    }
+    proc_top.gen = 2;
+    proc_table_sweep();
+    for (int32_t pid = 1; pid <= 3000; pid++)
+    {
+        ProcEntry *e = proc_table_slot(pid * 7);
+        if ((e->pid == pid * 7) != (pid % 2))
+        {
+            printf("proc_top: table lookup mismatch for pid %d\n", pid * 7);
+            failures++;
+            break;
+        }
+    }
+    if (proc_top.count != 1500)
+    {
+        printf("proc_top: table count = %u, want 1500\n", proc_top.count);
+        failures++;
+    }
+    free(proc_top.table);
+    proc_top.table = saved_table;
+    proc_top.cap = saved_cap;
+    proc_top.count = saved_count;
+    proc_top.gen = saved_gen;
+
+    if (failures > 0)
+    {
+        printf("proc_top: FAILED\n");
+        return -1;
+    }
+    printf("proc_top: OK\n");
+    return 0;
+}
+
+/**
+ * @brief 进程事件自检：通过 socketpair 送入构造的 connector 消息，检查计数和进程表增删
+ *
+ * @return 通过返回 0，失败返回 -1
+ */
+static int selftest_proc_events(void)
+{
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0, sv) != 0)
+    {
+        perror("socketpair");
+        return -1;
+    }
+    /* fork(1000)、线程 fork(1001)、exec、线程退出、进程退出(1000) 和进程 2000 的 fork */
+    static const struct
+    {
+        uint32_t what;
+        int32_t a, b;
+    } events[] = {
+        {PROC_EVENT_FORK, 1000, 1000}, {PROC_EVENT_FORK, 1001, 1000}, {PROC_EVENT_EXEC, 1000, 1000},
+        {PROC_EVENT_EXIT, 1001, 1000}, {PROC_EVENT_EXIT, 1000, 1000}, {PROC_EVENT_FORK, 2000, 2000},
+    };
+    struct
+    {
+        struct nlmsghdr nlh;
+        struct cn_msg cn;
+        struct proc_event ev;
+    } __attribute__((packed)) msg[6];
+    memset(msg, 0, sizeof(msg));
+    for (size_t i = 0; i < sizeof(events) / sizeof(events[0]); i++)
+    {
+        msg[i].nlh.nlmsg_len = NLMSG_LENGTH(sizeof(msg[i].cn) + sizeof(msg[i].ev));
+        msg[i].nlh.nlmsg_type = NLMSG_DONE;
+        msg[i].cn.id.idx = CN_IDX_PROC;
+        msg[i].cn.id.val = CN_VAL_PROC;
+        msg[i].cn.len = sizeof(msg[i].ev);
+        msg[i].ev.what = events[i].what;
+        if (events[i].what == PROC_EVENT_FORK)
+        {
+            msg[i].ev.event_data.fork.child_pid = events[i].a;
+            msg[i].ev.event_data.fork.child_tgid = events[i].b;
+        }
+        else if (events[i].what == PROC_EVENT_EXIT)
+        {
+            msg[i].ev.event_data.exit.process_pid = events[i].a;
+            msg[i].ev.event_data.exit.process_tgid = events[i].b;
+        }
+        else
+        {
+            msg[i].ev.event_data.exec.process_pid = events[i].a;
+            msg[i].ev.event_data.exec.process_tgid = events[i].b;
+        }
+    }
+    /* 前两条消息放在同一个数据报中，检查多消息解析 */
+    send(sv[1], msg, 2 * sizeof(msg[0]), 0);
+    for (int i = 2; i < 6; i++)
+    {
+        send(sv[1], &msg[i], sizeof(msg[i]), 0);
+    }
+
+    int failures = 0;
+    ProcEntry *saved_table = proc_top.table;
+    uint32_t saved_cap = proc_top.cap, saved_count = proc_top.count;
+    int saved_tracked = proc_top.tracked, saved_fd = proc_events.fd;
+    char *saved_buf = proc_events.buf;
+    proc_top.table = NULL;
+    proc_top.cap = proc_top.count = 0;
+    proc_top.tracked = 1;
+    proc_events.fd = sv[0];
+    proc_events.buf = malloc(PROC_EVENTS_BUF);
+    proc_events.forks = proc_events.execs = proc_events.exits = 0;
+    if (!proc_events.buf || proc_table_grow() != 0)
+    {
+        return -1;
+    }
+    proc_events_drain();
+    if (proc_events.forks != 2 || proc_events.execs != 1 || proc_events.exits != 1)
+    {
+        printf("proc_events: forks=%llu execs=%llu exits=%llu, want 2/1/1\n",
+               (unsigned long long)proc_events.forks, (unsigned long long)proc_events.execs,
+               (unsigned long long)proc_events.exits);
+        failures++;
+    }
+    if (proc_top.count != 1 || proc_table_slot(2000)->pid != 2000 || proc_table_slot(1000)->pid != 0)
+    {
+        printf("proc_events: table holds %u processes, want only 2000\n", proc_top.count);
+        failures++;
+    }
+
+    close(sv[0]);
+    close(sv[1]);
+    free(proc_events.buf);
+    free(proc_top.table);
+    proc_events.buf = saved_buf;
+    proc_events.fd = saved_fd;
+    proc_events.forks = proc_events.execs = proc_events.exits = 0;
+    proc_top.table = saved_table;
+    proc_top.cap = saved_cap;
+    proc_top.count = saved_count;
+    proc_top.tracked = saved_tracked;
+
+    if (failures > 0)
+    {
+        printf("proc_events: FAILED\n");
+        return -1;
+    }
+    printf("proc_events: OK\n");
+    return 0;
+}
+
+/**
+ * @brief cgroup 自检：cpu.stat/io.stat 解析、前 K 名插入
+ *
+ * @return 通过返回 0，失败返回 -1
+ */
+static int selftest_cgroups(void)
+{
+    static const char cpu_stat[] =
+        "usage_usec 123456\nuser_usec 100000\nsystem_usec 23456\nnr_periods 200\nnr_throttled 50\n"
+        "throttled_usec 98765\nnr_bursts 0\n";
+    static const char io_stat[] =
+        "8:0 rbytes=4096 wbytes=8192 rios=1 wios=2 dbytes=0 dios=0\n"
+        "253:1 rbytes=100 wbytes=200 rios=3 wios=4 dbytes=0 dios=0\n";
+    int failures = 0;
+    unsigned long long usage = 0, throttled = 0, throttled_usec = 0, missing = 7, r, w;
+    if (cgroup_keyed_value(cpu_stat, "usage_usec", &usage) != 0 || usage != 123456 ||
+        cgroup_keyed_value(cpu_stat, "nr_throttled", &throttled) != 0 || throttled != 50 ||
+        cgroup_keyed_value(cpu_stat, "throttled_usec", &throttled_usec) != 0 || throttled_usec != 98765 ||
+        cgroup_keyed_value(cpu_stat, "usage", &missing) == 0 || missing != 7)
+    {
+        printf("cgroups: cpu.stat parse mismatch\n");
+        failures++;
+    }
+    cgroup_parse_io(io_stat, &r, &w);
+    if (r != 4196 || w != 8392)
+    {
+        printf("cgroups: io.stat sums %llu/%llu, want 4196/8392\n", r, w);
+        failures++;
+    }
+
+    /* 前 K 名：乱序插入后保持降序，只保留最大的 K 个 */
+    static CgroupEntry list[CGROUP_TOP_MAX], item;
+    double keys[CGROUP_TOP_MAX];
+    uint16_t n = 0;
+    static const double input[] = {5, 1, 9, 3, 7, 9, 2, 8};
+    for (size_t i = 0; i < sizeof(input) / sizeof(input[0]); i++)
+    {
+        item.cpu_pct = (float)input[i];
+        cgroup_top_offer(list, keys, &n, 4, input[i], &item);
+    }
+    if (n != 4 || list[0].cpu_pct != 9 || list[1].cpu_pct != 9 || list[2].cpu_pct != 8 || list[3].cpu_pct != 7)
+    {
+        printf("cgroups: top-k order mismatch\n");
+        failures++;
+    }
+
+    if (failures > 0)
+    {
+        printf("cgroups: FAILED\n");
+        return -1;
+    }
+    printf("cgroups: OK\n");
+    return 0;
+}
+
+/**
+ * @brief PSI 自检：压力文件解析、触发器参数解析
+ *
+ * @return 通过返回 0，失败返回 -1
+ */
+static int selftest_psi(void)
+{
+    static const char both[] = "some avg10=1.50 avg60=0.25 avg300=0.00 total=123456\n"
+                               "full avg10=0.75 avg60=0.00 avg300=0.00 total=789\n";
+    static const char some_only[] = "some avg10=12.34 avg60=5.00 avg300=1.00 total=42\n";
+    int failures = 0;
+    PsiLine some, full;
+    if (psi_parse(both, &some, &full) != 0 || fabsf(some.avg10 - 1.5f) > 1e-4f || fabsf(some.avg60 - 0.25f) > 1e-4f ||
+        some.total_us != 123456 || fabsf(full.avg10 - 0.75f) > 1e-4f || full.total_us != 789)
+    {
+        printf("psi: parse mismatch\n");
+        failures++;
+    }
+    if (psi_parse(some_only, &some, &full) != 0 || fabsf(some.avg10 - 12.34f) > 1e-4f || some.total_us != 42 ||
+        full.total_us != 0 || psi_parse("", &some, &full) == 0)
+    {
+        printf("psi: some-only parse mismatch\n");
+        failures++;
+    }
+
+    int saved_count = psi.trigger_count, saved_enabled = psi.enabled;
+    if (psi_add_trigger("memory:full:100000:2000000") != 0 ||
+        psi.triggers[psi.trigger_count - 1].resource != PSI_MEMORY || !psi.triggers[psi.trigger_count - 1].full ||
+        strcmp(psi.triggers[psi.trigger_count - 1].spec, "full 100000 2000000") != 0 ||
+        psi_add_trigger("cpu:half:1:2") == 0 || psi_add_trigger("disk:some:1:2") == 0 ||
+        psi_add_trigger("io:some:3000000:2000000") == 0)
+    {
+        printf("psi: trigger parse mismatch\n");
+        failures++;
+    }
+    psi.trigger_count = saved_count;
+    psi.enabled = saved_enabled;
+
+    if (failures > 0)
+    {
+        printf("psi: FAILED\n");
+        return -1;
+    }
+    printf("psi: OK\n");
+    return 0;
+}
+
+/** 队列自检中传递的样本数 */
+#define SELFTEST_QUEUE_ITEMS    5000
+
+/**
+ * @brief 队列自检的消费者线程：按序取出样本，检查序号连续
+ */
+static void *selftest_queue_consumer(void *arg)
+{
+    SampleQueue *q = arg;
+    static Sample sample;
+    long errors = 0;
+    for (uint32_t expected = 0; expected < SELFTEST_QUEUE_ITEMS;)
+    {
+        QueueSlot *slot = queue_peek(q);
+        if (!slot)
+        {
+            sched_yield();
+            continue;
+        }
+        errors += sample_unpack(slot->record, &sample) != 0 || sample.timestamp != (time_t)expected ||
+                  sample.mono_ns != expected * 3ULL;
+        queue_release(q);
+        expected++;
+    }
+    return (void *)errors;
+}
+
+/**
+ * @brief 单生产者单消费者队列自检：小容量队列上两个线程并发传递样本，检查顺序、满队列和空队列
+ *
+ * @return 通过返回 0，失败返回 -1
+ */
+static int selftest_queue(void)
+{
+    SampleQueue q;
+    int failures = 0;
+    static Sample sample;
+    if (queue_init(&q, 3) != 0)
+    {
+        return -1;
+    }
+    if (q.mask != 3 || queue_peek(&q) != NULL)
+    {
+        printf("queue: bad initial state\n");
+        failures++;
+    }
+    for (int i = 0; i < 4; i++)
+    {
+        failures += queue_push(&q, &sample, 0, 0) != 0;
+    }
+    if (queue_push(&q, &sample, 0, 0) == 0 || queue_depth(&q) != 4)
+    {
+        printf("queue: full queue accepted a sample\n");
+        failures++;
+    }
+    while (queue_peek(&q))
+    {
+        queue_release(&q);
+    }
+
+    pthread_t consumer;
+    if (pthread_create(&consumer, NULL, selftest_queue_consumer, &q) != 0)
+    {
+        return -1;
+    }
+    for (uint32_t i = 0; i < SELFTEST_QUEUE_ITEMS;)
+    {
+        sample.timestamp = (time_t)i;
+        sample.mono_ns = i * 3ULL;
+        if (queue_push(&q, &sample, 0, 0) == 0)
+        {
+            i++;
+        }
+        else
+        {
+            sched_yield();
+        }
+    }
+    void *errors;
+    pthread_join(consumer, &errors);
+    if (errors != NULL || queue_depth(&q) != 0)
+    {
+        printf("queue: %ld samples out of order or corrupted\n", (long)errors);
+        failures++;
+    }
+    free(q.slots);
+
+    if (failures > 0)
+    {
+        printf("queue: FAILED\n");
+        return -1;
+    }
+    printf("queue: OK\n");
+    return 0;
+}
+
+/**
+ * @brief 样本记录自检：编码后还原与原样本一致，记录只包含实际使用的条目，超出上限的条目被截断，
+ *        条目数与长度不一致的记录被拒绝；记录经本地缓存写入和读出后不变
+ *
+ * @return 通过返回 0，失败返回 -1
+ */
+static int selftest_sample_record(void)
+{
+    static Sample sample, back;
+    static unsigned char record[sizeof(uint32_t) + sizeof(Sample) + 8];
+    int failures = 0;
+    /* 每 CPU 统计是 Sample 的最后一个字段，也是最后一个块 */
+    const size_t pc = SAMPLE_SECTIONS - 1;
+    int saved_limit = sample_codec.limit[pc];
+
+    memset(&sample, 0, sizeof(sample));
+    sample.timestamp = 1712345678;
+    strcpy(sample.sysinfo.hostname, "selftest-host");
+    sample.percpu.count = 3;
+    for (int i = 0; i < 3; i++)
+    {
+        sample.percpu.cpu[i] = (PerCpuEntry){(uint16_t)i, (uint16_t)(100 * i), (uint16_t)i};
+    }
+    sample.disks.count = 2;
+    sample.disks.fields = DISK_FIELDS;
+    strcpy(sample.disks.dev[0].name, "sda");
+    strcpy(sample.disks.dev[1].name, "nvme0n1");
+    sample.disks.dev[1].v[DISK_FIELDS - 1] = 42;
+    sample.filesystems.count = 1;
+    strcpy(sample.filesystems.fs[0].mount_point, "/");
+    sample.filesystems.fs[0].avail_kb = 1024;
+    sample.interfaces.count = 1;
+    strcpy(sample.interfaces.iface[0].name, "eth0");
+    sample.interfaces.iface[0].v[0] = 1;
+    sample.top.count[PROC_TOP_RSS] = 2;
+    sample.top.top[PROC_TOP_RSS][1].pid = 7;
+    sample.top.count[PROC_TOP_IO] = 1;
+    sample.top.top[PROC_TOP_IO][0].pid = 9;
+    sample.cgroups.count[CGROUP_TOP_MEM] = 1;
+    strcpy(sample.cgroups.top[CGROUP_TOP_MEM][0].path, "system.slice");
+
+    size_t empty = sizeof(uint32_t) + sizeof(Sample);
+    for (size_t i = 0; i < SAMPLE_SECTIONS; i++)
+    {
+        empty -= sample_sections[i].size - sample_sections[i].header;
+    }
+    size_t used = empty + sizeof(NetIfCounters) + 2 * sizeof(BlockDev) + sizeof(FsUsage) + 3 * sizeof(ProcTopEntry) +
+                  sizeof(CgroupEntry);
+    size_t len = sample_pack(&sample, record);
+    if (len != used + 3 * sizeof(PerCpuEntry) || sample_record_len(record) != len)
+    {
+        printf("sample_record: length %zu, want %zu\n", len, used + 3 * sizeof(PerCpuEntry));
+        failures++;
+    }
+    memset(&back, 0xff, sizeof(back));
+    if (sample_unpack(record, &back) != 0 || memcmp(&back, &sample, sizeof(sample)) != 0)
+    {
+        printf("sample_record: round trip mismatch\n");
+        failures++;
+    }
+
+    /* 长度与条目数不一致 */
+    uint32_t bad_len = (uint32_t)len - 1;
+    memcpy(record, &bad_len, sizeof(bad_len));
+    if (sample_unpack(record, &back) == 0)
+    {
+        printf("sample_record: inconsistent record accepted\n");
+        failures++;
+    }
+
+    sample_codec.limit[pc] = 2;
+    len = sample_pack(&sample, record);
+    if (len != used + 2 * sizeof(PerCpuEntry) || sample_unpack(record, &back) != 0 || back.percpu.count != 2 ||
+        back.percpu.cpu[1].busy != 100 || back.percpu.cpu[2].busy != 0)
+    {
+        printf("sample_record: entries over the limit not truncated\n");
+        failures++;
+    }
+    sample_codec.limit[pc] = saved_limit;
+
+    char path[] = "/tmp/kunlun-selftest-XXXXXX";
+    int fd = mkstemp(path);
+    Spool spool;
+    if (fd < 0 || spool_open(&spool, path, 1, SPOOL_DROP_OLDEST) != 0)
+    {
+        printf("sample_record: cannot open spool\n");
+        failures++;
+    }
+    else
+    {
+        unsigned char *out = malloc(2 * sample_codec.record_max);
+        uint64_t end;
+        sample_pack(&sample, record);
+        spool_append(&spool, record);
+        sample.timestamp++;
+        memset(&sample.percpu, 0, sizeof(sample.percpu));
+        sample_pack(&sample, record);
+        spool_append(&spool, record);
+        if (!out || spool_read(&spool, out, 2, &end) != 2 || end != 2 ||
+            sample_unpack(sample_record(out, 1), &back) != 0 || memcmp(&back, &sample, sizeof(sample)) != 0 ||
+            sample_unpack(sample_record(out, 0), &back) != 0 || back.percpu.count != 3)
+        {
+            printf("sample_record: spool round trip mismatch\n");
+            failures++;
+        }
+        free(out);
+        spool_close(&spool);
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+        unlink(path);
+    }
+
+    if (failures > 0)
+    {
+        printf("sample_record: FAILED\n");
+        return -1;
+    }
+    printf("sample_record: OK\n");
+    return 0;
+}
+
+/**
+ * @brief 上报相位偏移自检：同一标识结果稳定，一批随机标识在窗口内均匀分布
+ *
+ * @return 通过返回 0，失败返回 -1
+ */
+static int selftest_spread(void)
+{
+    enum { HOSTS = 20000, BUCKETS = 10 };
+    int failures = 0, counts[BUCKETS] = {0};
+    const char *id = "67e3d13727e94486a0cd8c0d55eeb41b";
+    if (spread_offset_ms(id, 10000) != spread_offset_ms(id, 10000) || spread_offset_ms(id, 0) != 0)
+    {
+        printf("spread: offset not stable\n");
+        failures++;
+    }
+    uint64_t rng = 777;
+    for (int i = 0; i < HOSTS; i++)
+    {
+        char machine_id[33];
+        snprintf(machine_id, sizeof(machine_id), "%016llx%016llx",
+                 (unsigned long long)synth_rand(&rng), (unsigned long long)synth_rand(&rng));
+        uint32_t offset = spread_offset_ms(machine_id, 10000);
+        if (offset >= 10000)
+        {
+            failures++;
+            break;
+        }
+        counts[offset / 1000]++;
+    }
+    for (int b = 0; b < BUCKETS; b++)
+    {
+        /* 期望每个桶 2000 个，允许 ±10% */
+        if (counts[b] < HOSTS / BUCKETS * 9 / 10 || counts[b] > HOSTS / BUCKETS * 11 / 10)
+        {
+            printf("spread: bucket %d has %d of %d hosts\n", b, counts[b], HOSTS);
+            failures++;
+        }
+    }
+
+    if (failures > 0)
+    {
+        printf("spread: FAILED\n");
+        return -1;
     }
-    if (read_cpu_info(cpuinfo) != 0)
+    printf("spread: OK\n");
+    return 0;
+}
+
+/**
+ * @brief 上报重试策略自检：退避抖动范围、熔断与探测、Retry-After、恢复
+ *
+ * @return 通过返回 0，失败返回 -1
+ */
+static int selftest_retry(void)
+{
+    int failures = 0;
+    const uint64_t ms = 1000000, t0 = 1000 * ms;
+
+    /* 抖动覆盖整个区间：第 3 次失败上限 40 秒，熔断后第 8 次上限 300 秒 */
+    uint64_t lo = UINT64_MAX, hi = 0, open_lo = UINT64_MAX, open_hi = 0;
+    for (int i = 0; i < 10000; i++)
     {
-        fprintf(stderr, "Failed to read cpu info\n");
+        uint64_t d = retry_delay_ms(3, 0), o = retry_delay_ms(8, 1);
+        lo = d < lo ? d : lo;
+        hi = d > hi ? d : hi;
+        open_lo = o < open_lo ? o : open_lo;
+        open_hi = o > open_hi ? o : open_hi;
     }
-    if (read_mem_info(meminfo) != 0)
+    if (lo > 1000 || hi < 39000 || hi > 40000 || open_lo < RETRY_MAX_MS / 2 || open_hi > RETRY_MAX_MS)
     {
-        fprintf(stderr, "Failed to read mem info\n");
+        printf("retry: jitter range [%llu, %llu], open [%llu, %llu]\n", (unsigned long long)lo,
+               (unsigned long long)hi, (unsigned long long)open_lo, (unsigned long long)open_hi);
+        failures++;
     }
-    if (read_net_info(netinfo) != 0)
+
+    /* 连续失败：退避期间不上报，到达阈值后熔断，到期后探测 */
+    HttpResponse down = {.status = 0, .retry_after_s = -1};
+    uint64_t now = t0;
+    for (int i = 1; i <= BREAKER_THRESHOLD; i++)
     {
-        fprintf(stderr, "Failed to read net info\n");
+        uint64_t next = atomic_load(&retry_policy.next_attempt_ns);
+        now = next > now ? next : now;
+        retry_record(0, &down, now);
+        RetryState want = i < BREAKER_THRESHOLD ? RETRY_BACKOFF : RETRY_OPEN;
+        if (atomic_load(&retry_policy.state) != (int)want || retry_allow(now) == RETRY_OK)
+        {
+            printf("retry: state %d after %d failures\n", atomic_load(&retry_policy.state), i);
+            failures++;
+        }
     }
-    if (get_machine_id(sysinfo->machine_id, sizeof(sysinfo->machine_id)) != 0)
+    UploadStats stats;
+    retry_take_stats(&stats);
+    if (stats.trips != 1)
     {
-        fprintf(stderr, "Failed to get machine id\n");
+        printf("retry: %u trips\n", stats.trips);
+        failures++;
     }
-    if (get_hostname(sysinfo->hostname, sizeof(sysinfo->hostname)) != 0)
+    now = atomic_load(&retry_policy.next_attempt_ns);
+    if (retry_allow(now) != RETRY_PROBE)
     {
-        fprintf(stderr, "Failed to get hostname\n");
+        printf("retry: no probe after open interval\n");
+        failures++;
     }
-    if (get_root_diskstats(diskstats) != 0){
-        fprintf(stderr, "Failed to get diskstats\n");
+
+    /* 探测失败且服务端要求 600 秒后重试：保持熔断，至少等待 600 秒，不重复计熔断次数 */
+    HttpResponse busy = {.status = 503, .retry_after_s = 600};
+    retry_record(0, &busy, now);
+    if (atomic_load(&retry_policy.state) != RETRY_OPEN ||
+        atomic_load(&retry_policy.next_attempt_ns) < now + 600000 * ms || atomic_load(&retry_policy.trips) != 0)
+    {
+        printf("retry: Retry-After not honoured while open\n");
+        failures++;
     }
 
-    sysinfo->cpu_num_cores = sysconf(_SC_NPROCESSORS_ONLN);
-    if (get_disk_space_kb("/", &sysinfo->root_disk_total_kb, &sysinfo->root_disk_avail_kb) != 0)
+    /* 探测成功：恢复正常 */
+    now = atomic_load(&retry_policy.next_attempt_ns);
+    HttpResponse ok = {.status = 200, .retry_after_s = -1};
+    if (retry_allow(now) != RETRY_PROBE)
     {
-        fprintf(stderr, "Failed to get disk space\n");
+        failures++;
     }
-    if (get_default_interface_traffic(&netinfo->default_interface_net_rx_bytes, &netinfo->default_interface_net_tx_bytes) != 0)
+    retry_record(1, &ok, now);
+    if (retry_allow(now) != RETRY_OK || atomic_load(&retry_policy.failures) != 0)
     {
-        fprintf(stderr, "Failed to get net traffic\n");
+        printf("retry: not recovered after successful probe\n");
+        failures++;
+    }
+
+    /* 退避中的 429 同样采信 Retry-After */
+    HttpResponse limited = {.status = 429, .retry_after_s = 120};
+    retry_record(0, &limited, now);
+    if (atomic_load(&retry_policy.next_attempt_ns) < now + 120000 * ms)
+    {
+        printf("retry: Retry-After not honoured on 429\n");
+        failures++;
+    }
+    retry_record(1, &ok, now);
+    retry_take_stats(&stats);
+
+    if (failures > 0)
+    {
+        printf("retry: FAILED\n");
+        return -1;
     }
+    printf("retry: OK\n");
+    return 0;
 }
 
 /**
- * @brief 将指标转换为 values=v1,v2,v3,... 格式的字符串
- *
- * 输出字段顺序（共 35 个字段）：
- * timestamp, uptime_s, load_1min, load_5min, load_15min, running_tasks, total_tasks,
- * cpu_user, cpu_system, cpu_nice, cpu_idle, cpu_iowait, cpu_irq, cpu_softirq, cpu_steal,
- * mem_total_mib, mem_free_mib, mem_used_mib, mem_buff_cache_mib,
- * tcp_connections, udp_connections, net_rx_bytes, net_tx_bytes, cpu_num_cores,
- * root_disk_total_kb, root_disk_avail_kb,
- * disk_reads_completed, disk_writes_completed, disk_reading_ms, disk_writing_ms,
- * disk_iotime_ms, disk_ios_in_progress, disk_weighted_io_time,
- * machine_id, hostname
+ * @brief 文件系统容量自检：挂载点反转义、伪文件系统识别、工作线程中的 statvfs
  *
- * @param timestamp 时间戳
- * @param uptime 运行时间
- * @param loadavg 负载信息
- * @param cpuinfo CPU 信息
- * @param meminfo 内存信息
- * @param netinfo 网络信息
- * @param sysinfo 系统信息
- * @param diskstats 磁盘统计
- * @return 成功返回格式化字符串（需调用者 free），失败返回 NULL
+ * @return 通过返回 0，失败返回 -1
  */
-char *metrics_to_kv(int timestamp, Uptime *uptime, LoadAvg *loadavg, CpuInfo *cpuinfo, MemInfo *meminfo, NetInfo *netinfo, SystemInfo *sysinfo, DiskStats *diskstats) {
-    char *kv_string = malloc(8192);
-    if (!kv_string) {
-        perror("malloc");
-        return NULL;
+static int selftest_filesystems(void)
+{
+    static const char escaped[] = "/mnt/data\\040disk\\134x\\0";
+    int failures = 0;
+    char path[FS_PATH_MAX];
+    if (mountinfo_unescape(escaped, strlen(escaped), path, sizeof(path)) != 0 ||
+        strcmp(path, "/mnt/data disk\\x\\0") != 0)
+    {
+        printf("filesystems: unescape mismatch: %s\n", path);
+        failures++;
     }
-
-    char values_buffer[8192];
-    int values_len = 0;
-
-    values_len += snprintf(values_buffer + values_len, sizeof(values_buffer) - values_len,
-                           "%ld,%ld,%.2lf,%.2lf,%.2lf,%d,%d,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%.2lf,%.2lf,%.2lf,%.2lf,%d,%d,%lu,%lu,%d,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%s,%s",
-                           timestamp,(long)uptime->uptime_s,
-                           loadavg->load_1min, loadavg->load_5min, loadavg->load_15min,
-                           loadavg->running_tasks, loadavg->total_tasks,
-                           cpuinfo->cpu_user, cpuinfo->cpu_system, cpuinfo->cpu_nice,
-                           cpuinfo->cpu_idle, cpuinfo->cpu_iowait, cpuinfo->cpu_irq,
-                           cpuinfo->cpu_softirq, cpuinfo->cpu_steal,
-                           meminfo->mem_total_mib, meminfo->mem_free_mib, meminfo->mem_used_mib,
-                           meminfo->mem_buff_cache_mib,
-                           netinfo->tcp_connections, netinfo->udp_connections,
-                           netinfo->default_interface_net_rx_bytes, netinfo->default_interface_net_tx_bytes,
-                           sysinfo->cpu_num_cores,
-                           sysinfo->root_disk_total_kb, sysinfo->root_disk_avail_kb,
-                           diskstats->reads_completed, diskstats->writes_completed, diskstats->reading_ms, diskstats->writing_ms,
-                           diskstats->iotime_ms, diskstats->ios_in_progress, diskstats->weighted_io_time,
-                           sysinfo->machine_id, sysinfo->hostname);
-
-    if (values_len < 0 || values_len >= sizeof(values_buffer)) {
-        fprintf(stderr, "Error: Values string too long\n");
-        free(kv_string);
-        return NULL;
+    if (mountinfo_unescape(escaped, strlen(escaped), path, 8) == 0)
+    {
+        printf("filesystems: unescape overflow not detected\n");
+        failures++;
+    }
+    if (!fs_is_pseudo("cgroup2", 7) || fs_is_pseudo("cgroup2fs", 9) || fs_is_pseudo("xfs", 3))
+    {
+        printf("filesystems: pseudo filesystem check mismatch\n");
+        failures++;
+    }
+    struct statvfs direct, timed;
+    if (statvfs("/", &direct) != 0 || fs_statvfs_timed("/", &timed) != 0 || direct.f_blocks != timed.f_blocks)
+    {
+        printf("filesystems: statvfs through worker mismatch\n");
+        failures++;
     }
 
-    int kv_len = snprintf(kv_string, 8192, "values=%s", values_buffer);
-
-    if (kv_len < 0 || kv_len >= 8192) {
-        fprintf(stderr, "Error: Key-value string too long\n");
-        free(kv_string);
-        return NULL;
+    if (failures > 0)
+    {
+        printf("filesystems: FAILED\n");
+        return -1;
     }
+    printf("filesystems: OK\n");
+    return 0;
+}
 
-    return kv_string;
+/**
+ * @brief 运行全部自检
+ *
+ * @return 全部通过返回 0，否则返回 -1
+ */
+int run_selftest(void)
+{
+    int ret = 0;
+    sample_codec_init(1);
+    if (selftest_binary() != 0)
+    {
+        ret = -1;
+    }
+    if (selftest_gzip() != 0)
+    {
+        ret = -1;
+    }
+    if (selftest_rates() != 0)
+    {
+        ret = -1;
+    }
+    if (selftest_percpu() != 0)
+    {
+        ret = -1;
+    }
+    if (selftest_diskstats() != 0)
+    {
+        ret = -1;
+    }
+    if (selftest_interfaces() != 0)
+    {
+        ret = -1;
+    }
+    if (selftest_filesystems() != 0)
+    {
+        ret = -1;
+    }
+    if (selftest_proc_top() != 0)
+    {
+        ret = -1;
+    }
+    if (selftest_proc_events() != 0)
+    {
+        ret = -1;
+    }
+    if (selftest_cgroups() != 0)
+    {
+        ret = -1;
+    }
+    if (selftest_psi() != 0)
+    {
+        ret = -1;
+    }
+    if (selftest_queue() != 0)
+    {
+        ret = -1;
+    }
+    if (selftest_sample_record() != 0)
+    {
+        ret = -1;
+    }
+    if (selftest_spread() != 0)
+    {
+        ret = -1;
+    }
+    if (selftest_retry() != 0)
+    {
+        ret = -1;
+    }
+    return ret;
 }
 
 /* ============================================================================
  * 主函数
  * ============================================================================ */
 
+/**
+ * @brief 输出用法说明
+ *
+ * @param prog 程序名
+ */
+static void print_usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s -u <url> [options]\n"
+            "  -u, --url <url>     report endpoint (required)\n"
+            "  -v, --verbose       print per-source read cost after each collection\n"
+            "      --tcp-states <list>\n"
+            "                      TCP states to count, e.g. established,time_wait (default: all)\n"
+            "      --session       register static host identity once and report with a handle\n"
+            "      --spool <path>  keep unsent samples in a memory-mapped file and replay them later\n"
+            "      --spool-size <MiB>\n"
+            "                      spool file size cap (default: 4)\n"
+            "      --spool-drop oldest|newest\n"
+            "                      what to drop when the spool is full (default: oldest)\n"
+            "      --spool-replay <n>\n"
+            "                      max backlog samples replayed per tick (default: 6)\n"
+            "      --upload-spread auto|<ms>\n"
+            "                      delay each upload by a stable per-host offset within this window after the\n"
+            "                      10 s boundary, derived from machine-id; auto = 10000 (default: 0, off)\n"
+            "      --queue <n>     samples buffered between the collector and the uploader thread (default: 32)\n"
+            "      --format text|binary\n"
+            "                      upload encoding (default: text)\n"
+            "      --keyframe-interval <n>\n"
+            "                      binary format: send a full keyframe every n frames (default: 60)\n"
+            "      --subsample <hz>\n"
+            "                      sample cpu/load/memory/disk between reports, send min/max/mean/last (default: 0, off)\n"
+            "      --disks <globs>\n"
+            "                      report I/O counters of every matching block device, e.g. all or nvme*,!nvme0n1\n"
+            "      --interfaces <globs>\n"
+            "                      report bytes/packets/errs/drop/fifo/multicast per interface, e.g. all or eth*,bond0\n"
+            "      --top <n>       report the n processes using the most CPU, memory and disk I/O (default: 0, off)\n"
+            "      --cgroups <depth>\n"
+            "                      report the busiest cgroup v2 groups down to this depth (default: 0, off)\n"
+            "      --cgroup-top <k>\n"
+            "                      cgroups to send per dimension, cpu and memory (default: 5)\n"
+            "      --psi           report /proc/pressure cpu/memory/io (and cgroup pressure with --cgroups)\n"
+            "      --psi-trigger <resource>:some|full:<stall_us>:<window_us>\n"
+            "                      send a sample immediately when the kernel PSI trigger fires,\n"
+            "                      e.g. cpu:some:150000:1000000 (repeatable, implies --psi)\n"
+            "      --proc-events   count fork/exec/exit via the kernel proc connector; with --top, track processes\n"
+            "                      from events instead of walking /proc every cycle (needs CAP_NET_ADMIN)\n"
+            "      --filesystems   report block and inode usage of every real mounted filesystem\n"
+            "      --statvfs-timeout <ms>\n"
+            "                      give up on a filesystem whose statvfs takes longer (default: 1000)\n"
+            "      --percpu off|full|top\n"
+            "                      report per-CPU busy/softirq share (default: off)\n"
+            "      --percpu-top <k>\n"
+            "                      with --percpu top: number of hottest CPUs to send (default: 8)\n"
+            "      --compress none|gzip\n"
+            "                      compress upload bodies (default: none)\n"
+            "      --batch <n>     send up to n samples per request (default: 1)\n"
+            "      --batch-interval <seconds>\n"
+            "                      send a partial batch once its oldest sample is this old (default: 0, off)\n"
+            "      --batch-bytes <bytes>\n"
+            "                      send a batch once its body reaches this size (default: 65536)\n"
+            "      --bench         run parser and compression benchmarks and exit\n"
+            "      --selftest      run encoder/decoder self-tests and exit\n",
+            prog);
+}
+
 /**
  * @brief 程序入口
  *
- * 用法：./kunlun -u <url>
+ * 用法：./kunlun -u <url> [options]，选项见 print_usage()。
  *
  * 每 10 秒采集一次系统指标，并通过 HTTP POST 上报到指定 URL。
  *
@@ -787,10 +11613,88 @@ char *metrics_to_kv(int timestamp, Uptime *uptime, LoadAvg *loadavg, CpuInfo *cp
 int main(int argc, char *argv[])
 {
     char url[256] = "";
+    char spool_path[256] = "";
+    unsigned spool_size_mb = SPOOL_DEFAULT_SIZE_MB;
+    SpoolDropPolicy spool_drop = SPOOL_DROP_OLDEST;
+    int spool_replay_max = SPOOL_DEFAULT_REPLAY;
+    int queue_slots = QUEUE_DEFAULT_SLOTS;
+    uint32_t upload_spread_ms = 0;
+    int batch_samples = 1;
+    int batch_interval_s = 0;
+    size_t batch_bytes = BATCH_DEFAULT_BYTES;
+    int verbose = 0;
+    Session session = {0};
     int opt;
 
+    enum
+    {
+        OPT_BENCH = 256,
+        OPT_TCP_STATES,
+        OPT_SESSION,
+        OPT_SPOOL,
+        OPT_SPOOL_SIZE,
+        OPT_SPOOL_DROP,
+        OPT_SPOOL_REPLAY,
+        OPT_QUEUE,
+        OPT_UPLOAD_SPREAD,
+        OPT_BATCH,
+        OPT_BATCH_INTERVAL,
+        OPT_BATCH_BYTES,
+        OPT_SELFTEST,
+        OPT_FORMAT,
+        OPT_KEYFRAME_INTERVAL,
+        OPT_COMPRESS,
+        OPT_SUBSAMPLE,
+        OPT_PERCPU,
+        OPT_PERCPU_TOP,
+        OPT_DISKS,
+        OPT_FILESYSTEMS,
+        OPT_INTERFACES,
+        OPT_TOP,
+        OPT_PROC_EVENTS,
+        OPT_CGROUPS,
+        OPT_PSI,
+        OPT_PSI_TRIGGER,
+        OPT_CGROUP_TOP,
+        OPT_STATVFS_TIMEOUT,
+    };
+    static const struct option long_options[] = {
+        {"url", required_argument, NULL, 'u'},
+        {"verbose", no_argument, NULL, 'v'},
+        {"bench", no_argument, NULL, OPT_BENCH},
+        {"selftest", no_argument, NULL, OPT_SELFTEST},
+        {"format", required_argument, NULL, OPT_FORMAT},
+        {"compress", required_argument, NULL, OPT_COMPRESS},
+        {"subsample", required_argument, NULL, OPT_SUBSAMPLE},
+        {"percpu", required_argument, NULL, OPT_PERCPU},
+        {"percpu-top", required_argument, NULL, OPT_PERCPU_TOP},
+        {"disks", required_argument, NULL, OPT_DISKS},
+        {"filesystems", no_argument, NULL, OPT_FILESYSTEMS},
+        {"interfaces", required_argument, NULL, OPT_INTERFACES},
+        {"top", required_argument, NULL, OPT_TOP},
+        {"proc-events", no_argument, NULL, OPT_PROC_EVENTS},
+        {"cgroups", required_argument, NULL, OPT_CGROUPS},
+        {"psi", no_argument, NULL, OPT_PSI},
+        {"psi-trigger", required_argument, NULL, OPT_PSI_TRIGGER},
+        {"cgroup-top", required_argument, NULL, OPT_CGROUP_TOP},
+        {"statvfs-timeout", required_argument, NULL, OPT_STATVFS_TIMEOUT},
+        {"keyframe-interval", required_argument, NULL, OPT_KEYFRAME_INTERVAL},
+        {"tcp-states", required_argument, NULL, OPT_TCP_STATES},
+        {"session", no_argument, NULL, OPT_SESSION},
+        {"spool", required_argument, NULL, OPT_SPOOL},
+        {"spool-size", required_argument, NULL, OPT_SPOOL_SIZE},
+        {"spool-drop", required_argument, NULL, OPT_SPOOL_DROP},
+        {"spool-replay", required_argument, NULL, OPT_SPOOL_REPLAY},
+        {"queue", required_argument, NULL, OPT_QUEUE},
+        {"upload-spread", required_argument, NULL, OPT_UPLOAD_SPREAD},
+        {"batch", required_argument, NULL, OPT_BATCH},
+        {"batch-interval", required_argument, NULL, OPT_BATCH_INTERVAL},
+        {"batch-bytes", required_argument, NULL, OPT_BATCH_BYTES},
+        {NULL, 0, NULL, 0},
+    };
+
     /* 解析命令行参数 */
-    while ((opt = getopt(argc, argv, "u:")) != -1)
+    while ((opt = getopt_long(argc, argv, "u:v", long_options, NULL)) != -1)
     {
         switch (opt)
         {
@@ -798,8 +11702,245 @@ int main(int argc, char *argv[])
             strncpy(url, optarg, sizeof(url) - 1);
             url[sizeof(url) - 1] = '\0';
             break;
+        case 'v':
+            verbose = 1;
+            break;
+        case OPT_BENCH:
+            return run_benchmarks() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+        case OPT_SELFTEST:
+            return run_selftest() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+        case OPT_FORMAT:
+            if (strcmp(optarg, "text") == 0)
+            {
+                bin_encoder.enabled = 0;
+            }
+            else if (strcmp(optarg, "binary") == 0)
+            {
+                bin_encoder.enabled = 1;
+            }
+            else
+            {
+                fprintf(stderr, "Error: invalid --format: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case OPT_COMPRESS:
+            if (strcmp(optarg, "none") == 0)
+            {
+                compress_mode = COMPRESS_NONE;
+            }
+            else if (strcmp(optarg, "gzip") == 0)
+            {
+                compress_mode = COMPRESS_GZIP;
+            }
+            else
+            {
+                fprintf(stderr, "Error: invalid --compress: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case OPT_SUBSAMPLE:
+            sub_sampler.hz = atoi(optarg);
+            if (sub_sampler.hz < 0 || sub_sampler.hz > SUB_MAX_HZ)
+            {
+                fprintf(stderr, "Error: --subsample must be between 0 and %d\n", SUB_MAX_HZ);
+                return EXIT_FAILURE;
+            }
+            break;
+        case OPT_PERCPU:
+            if (strcmp(optarg, "off") == 0)
+            {
+                percpu.mode = PERCPU_OFF;
+            }
+            else if (strcmp(optarg, "full") == 0)
+            {
+                percpu.mode = PERCPU_FULL;
+            }
+            else if (strcmp(optarg, "top") == 0)
+            {
+                percpu.mode = PERCPU_TOP;
+            }
+            else
+            {
+                fprintf(stderr, "Error: invalid --percpu: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case OPT_PERCPU_TOP:
+            percpu.top = atoi(optarg);
+            if (percpu.top <= 0 || percpu.top > PERCPU_MAX)
+            {
+                fprintf(stderr, "Error: --percpu-top must be between 1 and %d\n", PERCPU_MAX);
+                return EXIT_FAILURE;
+            }
+            break;
+        case OPT_DISKS:
+            if (set_disk_filter(optarg) != 0)
+            {
+                fprintf(stderr, "Error: invalid --disks: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case OPT_INTERFACES:
+            if (set_interface_filter(optarg) != 0)
+            {
+                fprintf(stderr, "Error: invalid --interfaces: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case OPT_TOP:
+            proc_top.top_n = atoi(optarg);
+            if (proc_top.top_n < 0 || proc_top.top_n > PROC_TOP_MAX)
+            {
+                fprintf(stderr, "Error: --top must be between 0 and %d\n", PROC_TOP_MAX);
+                return EXIT_FAILURE;
+            }
+            break;
+        case OPT_PROC_EVENTS:
+            proc_events.enabled = 1;
+            break;
+        case OPT_PSI:
+            psi.enabled = 1;
+            break;
+        case OPT_PSI_TRIGGER:
+            if (psi_add_trigger(optarg) != 0)
+            {
+                fprintf(stderr, "Error: invalid --psi-trigger %s (at most %d of cpu|memory|io:some|full:stall_us:window_us)\n",
+                        optarg, PSI_TRIGGER_MAX);
+                return EXIT_FAILURE;
+            }
+            break;
+        case OPT_CGROUPS:
+            cgroups.max_depth = atoi(optarg);
+            if (cgroups.max_depth < 0 || cgroups.max_depth > CGROUP_DEPTH_MAX)
+            {
+                fprintf(stderr, "Error: --cgroups must be between 0 and %d\n", CGROUP_DEPTH_MAX);
+                return EXIT_FAILURE;
+            }
+            break;
+        case OPT_CGROUP_TOP:
+            cgroups.top_k = atoi(optarg);
+            if (cgroups.top_k < 1 || cgroups.top_k > CGROUP_TOP_MAX)
+            {
+                fprintf(stderr, "Error: --cgroup-top must be between 1 and %d\n", CGROUP_TOP_MAX);
+                return EXIT_FAILURE;
+            }
+            break;
+        case OPT_FILESYSTEMS:
+            fs_table.enabled = 1;
+            break;
+        case OPT_STATVFS_TIMEOUT:
+            fs_table.timeout_ms = atoi(optarg);
+            if (fs_table.timeout_ms <= 0)
+            {
+                fprintf(stderr, "Error: invalid --statvfs-timeout: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case OPT_KEYFRAME_INTERVAL:
+            bin_encoder.keyframe_interval = atoi(optarg);
+            if (bin_encoder.keyframe_interval <= 0)
+            {
+                fprintf(stderr, "Error: invalid --keyframe-interval: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case OPT_TCP_STATES:
+        {
+            uint32_t mask;
+            if (parse_tcp_state_mask(optarg, &mask) != 0)
+            {
+                fprintf(stderr, "Error: invalid --tcp-states: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            set_tcp_state_mask(mask);
+            break;
+        }
+        case OPT_SESSION:
+            session.enabled = 1;
+            break;
+        case OPT_SPOOL:
+            strncpy(spool_path, optarg, sizeof(spool_path) - 1);
+            spool_path[sizeof(spool_path) - 1] = '\0';
+            break;
+        case OPT_SPOOL_SIZE:
+            spool_size_mb = (unsigned)atoi(optarg);
+            if (spool_size_mb == 0)
+            {
+                fprintf(stderr, "Error: invalid --spool-size: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case OPT_SPOOL_DROP:
+            if (strcmp(optarg, "oldest") == 0)
+            {
+                spool_drop = SPOOL_DROP_OLDEST;
+            }
+            else if (strcmp(optarg, "newest") == 0)
+            {
+                spool_drop = SPOOL_DROP_NEWEST;
+            }
+            else
+            {
+                fprintf(stderr, "Error: invalid --spool-drop: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case OPT_UPLOAD_SPREAD:
+            if (strcmp(optarg, "auto") == 0)
+            {
+                upload_spread_ms = LOOP_INTERVAL_S * 1000;
+                break;
+            }
+            upload_spread_ms = (uint32_t)atoi(optarg);
+            if (atoi(optarg) < 0 || upload_spread_ms > LOOP_INTERVAL_S * 1000)
+            {
+                fprintf(stderr, "Error: --upload-spread must be auto or between 0 and %d ms\n", LOOP_INTERVAL_S * 1000);
+                return EXIT_FAILURE;
+            }
+            break;
+        case OPT_QUEUE:
+            queue_slots = atoi(optarg);
+            if (queue_slots < 1 || queue_slots > QUEUE_MAX_SLOTS)
+            {
+                fprintf(stderr, "Error: --queue must be between 1 and %d\n", QUEUE_MAX_SLOTS);
+                return EXIT_FAILURE;
+            }
+            break;
+        case OPT_SPOOL_REPLAY:
+            spool_replay_max = atoi(optarg);
+            if (spool_replay_max <= 0)
+            {
+                fprintf(stderr, "Error: invalid --spool-replay: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case OPT_BATCH:
+            batch_samples = atoi(optarg);
+            if (batch_samples <= 0 || batch_samples > BATCH_MAX_SAMPLES)
+            {
+                fprintf(stderr, "Error: --batch must be between 1 and %d\n", BATCH_MAX_SAMPLES);
+                return EXIT_FAILURE;
+            }
+            break;
+        case OPT_BATCH_INTERVAL:
+            batch_interval_s = atoi(optarg);
+            if (batch_interval_s < 0)
+            {
+                fprintf(stderr, "Error: invalid --batch-interval: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case OPT_BATCH_BYTES:
+            batch_bytes = strtoul(optarg, NULL, 10);
+            if (batch_bytes == 0)
+            {
+                fprintf(stderr, "Error: invalid --batch-bytes: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
         default:
-            fprintf(stderr, "Usage: %s -u <url>\n", argv[0]);
+            print_usage(argv[0]);
             return EXIT_FAILURE;
         }
     }
@@ -808,45 +11949,100 @@ int main(int argc, char *argv[])
     if (strlen(url) == 0)
     {
         fprintf(stderr, "Error: -u <url> is required.\n");
-        fprintf(stderr, "Usage: %s -u <url>\n", argv[0]);
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    /* 初始化上报客户端 */
+    HttpClient client;
+    if (http_client_init(&client, url) != 0)
+    {
         return EXIT_FAILURE;
     }
+    if (!client.native)
+    {
+        fprintf(stderr, "Using curl for %s\n", url);
+    }
 
-    /* 定义存储指标的变量 */
-    Uptime uptime;
-    LoadAvg loadavg;
-    CpuInfo cpuinfo;
-    MemInfo meminfo;
-    NetInfo netinfo;
-    SystemInfo sysinfo;
-    DiskStats diskstats;
+    /* 队列、批次和本地缓存的记录大小取决于启用的功能 */
+    sample_codec_init(0);
 
-    /* 主循环：每 10 秒采集并上报一次 */
-    while (1)
+    /* 打开本地缓存 */
+    Spool spool = {.fd = -1};
+    if (*spool_path && spool_open(&spool, spool_path, spool_size_mb, spool_drop) != 0)
     {
-        /* 计算到下一个整 10 秒的等待时间 */
-        time_t now = time(NULL);
-        int seconds_to_wait = 10 - (now % 10);
-        sleep(seconds_to_wait);
+        return EXIT_FAILURE;
+    }
 
-        /* 采集指标 */
-        time_t timestamp = time(NULL);
-        collect_metrics(&uptime, &loadavg, &cpuinfo, &meminfo, &netinfo, &sysinfo, &diskstats);
+    Batch batch;
+    if (batch_init(&batch, batch_samples, batch_interval_s, batch_bytes) != 0)
+    {
+        return EXIT_FAILURE;
+    }
 
-        /* 格式化并上报 */
-        char *kv_data = metrics_to_kv(timestamp, &uptime, &loadavg, &cpuinfo, &meminfo, &netinfo, &sysinfo, &diskstats);
-        if (!kv_data)
+    /* 样本跨周期复用，静态身份只读取一次 */
+    Sample sample;
+    memset(&sample, 0, sizeof(sample));
+    if (get_machine_id(sample.sysinfo.machine_id, sizeof(sample.sysinfo.machine_id)) != 0)
+    {
+        fprintf(stderr, "Failed to get machine id\n");
+    }
+
+    uploader_set_spread(sample.sysinfo.machine_id, upload_spread_ms);
+    if (event_loop_init() != 0 ||
+        uploader_start(&client, &session, &spool, &batch, spool_replay_max, queue_slots) != 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    /* 主循环：每 10 秒采集并上报一次 */
+    uint32_t busy_ms = 0;
+    for (;;)
+    {
+        /* 等待到下一个整 10 秒（启用高频采样时期间持续采样）；PSI 触发器触发时立即采集带外样本 */
+        int event = event_loop_wait();
+        if (event == LOOP_STOP)
         {
-            fprintf(stderr, "Failed to convert metrics to key-value pairs\n");
+            break;
+        }
+        if (event == LOOP_RELOAD)
+        {
+            event_loop_reload();
+            uploader_reload();
             continue;
         }
+        int oob = event == LOOP_PSI;
+        uint64_t start_ns = monotonic_ns();
 
-        int ret = send_post_request(url, kv_data);
-        if (ret != 0)
+        /* 采集指标 */
+        sample.timestamp = oob ? time(NULL) : event_loop.boundary;
+        sample.mono_ns = monotonic_ns();
+        collect_metrics(&sample);
+        compute_rates(&sample);
+        percpu_compute(&sample.percpu);
+        sub_finish(&sample);
+        sample.psi.flags = oob ? PSI_FLAG_OOB : 0;
+        loop_take_stats(&sample.loop, busy_ms);
+        uploader_take_stats(&sample.queue);
+        retry_take_stats(&sample.upload);
+        if (sample.loop.missed_ticks > 0)
         {
-            fprintf(stderr, "Failed to send data (curl returned %d)\n", ret);
+            fprintf(stderr, "Missed %u tick(s): previous cycle took %u ms\n", sample.loop.missed_ticks, busy_ms);
         }
-        free(kv_data);
+        if (verbose)
+        {
+            proc_sources_report(stderr);
+            sub_report(stderr, &sample.hf);
+        }
+
+        /* 交给上报线程：加入批次，达到上限时上报；失败则写入缓存，成功则按限速补发积压样本 */
+        uploader_enqueue(&sample, oob, event_loop.boundary_mono_ns);
+        busy_ms = (uint32_t)((monotonic_ns() - start_ns) / 1000000);
     }
+
+    /* 退出前由上报线程上报队列和批次中剩余的样本，失败时写入本地缓存 */
+    fprintf(stderr, "Shutting down\n");
+    uploader_stop();
+    spool_close(&spool);
     return 0;
 }